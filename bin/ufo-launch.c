@@ -485,6 +485,27 @@ progress_update (gpointer user)
     g_print ("\33[2K\r%i items processed ...", ++n);
 }
 
+static UfoBaseSchedulerReport report = UFO_BASE_SCHEDULER_REPORT_NONE;
+
+static gboolean
+parse_report (const gchar *option_name,
+              const gchar *value,
+              gpointer data,
+              GError **error)
+{
+    if (value == NULL || !g_strcmp0 (value, "text"))
+        report = UFO_BASE_SCHEDULER_REPORT_TEXT;
+    else if (!g_strcmp0 (value, "json"))
+        report = UFO_BASE_SCHEDULER_REPORT_JSON;
+    else {
+        g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                     "Unknown report format `%s'", value);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 int
 main(int argc, char* argv[])
 {
@@ -507,11 +528,19 @@ main(int argc, char* argv[])
     static gboolean version = FALSE;
     static gboolean timestamps = FALSE;
     static gchar *dump = NULL;
+    static gchar *scheduler = NULL;
+    static gchar *metrics = NULL;
+    static gint kernel_samples = 0;
 
     static GOptionEntry entries[] = {
         { "trace",   't', 0, G_OPTION_ARG_NONE, &trace, "enable tracing", NULL },
         { "dump",    'd', 0, G_OPTION_ARG_STRING, &dump, "Dump to JSON file", NULL },
         { "timestamps",0, 0, G_OPTION_ARG_NONE, &timestamps, "generate timestamps", NULL },
+        { "scheduler", 's', 0, G_OPTION_ARG_STRING, &scheduler, "selecting a scheduler", "dynamic|fixed|pool" },
+        { "metrics", 'm', 0, G_OPTION_ARG_STRING, &metrics, "write live metrics to FILE", "FILE" },
+        { "sample-kernels", 0, 0, G_OPTION_ARG_INT, &kernel_samples, "measure every N-th call of a kernel", "N" },
+        { "report",  'r', G_OPTION_FLAG_OPTIONAL_ARG, G_OPTION_ARG_CALLBACK, (gpointer) parse_report,
+          "print a bottleneck report", "text|json" },
         { "quiet",   'q', 0, G_OPTION_ARG_NONE, &quiet, "be quiet", NULL },
         { "quieter",   0, 0, G_OPTION_ARG_NONE, &quieter, "be quieter", NULL },
         { "version",   0, 0, G_OPTION_ARG_NONE, &version, "Show version information", NULL },
@@ -535,6 +564,19 @@ main(int argc, char* argv[])
         return 0;
     }
 
+    if (scheduler != NULL &&
+        g_ascii_strcasecmp (scheduler, "dynamic") &&
+        g_ascii_strcasecmp (scheduler, "fixed") &&
+        g_ascii_strcasecmp (scheduler, "pool")) {
+        g_printerr ("Error parsing options: unknown scheduler `%s', use dynamic, fixed or pool\n", scheduler);
+        return 1;
+    }
+
+    if (kernel_samples < 0) {
+        g_printerr ("Error parsing options: --sample-kernels must not be negative\n");
+        return 1;
+    }
+
     quiet = quiet || quieter;
 
     pm = ufo_plugin_manager_new ();
@@ -568,11 +610,18 @@ main(int argc, char* argv[])
         g_signal_connect (leaf, "processed", G_CALLBACK (progress_update), NULL);
     }
 
-    sched = ufo_scheduler_new ();
+    if (scheduler != NULL && !g_ascii_strcasecmp (scheduler, "fixed"))
+        sched = ufo_fixed_scheduler_new ();
+    else if (scheduler != NULL && !g_ascii_strcasecmp (scheduler, "pool"))
+        sched = ufo_pool_scheduler_new ();
+    else
+        sched = ufo_scheduler_new ();
 
     g_object_set (sched,
                   "enable-tracing", trace,
                   "timestamps", timestamps,
+                  "metrics-file", metrics,
+                  "kernel-sample-rate", (guint) kernel_samples,
                   NULL);
 
     if (!dump)
@@ -593,6 +642,14 @@ main(int argc, char* argv[])
         g_print ("Finished in %3.5fs\n", run_time);
     }
 
+    if (report != UFO_BASE_SCHEDULER_REPORT_NONE && !dump) {
+        gchar *text;
+
+        text = ufo_base_scheduler_get_report (sched, report);
+        g_print ("%s", text);
+        g_free (text);
+    }
+
     if (resources) {
         g_object_unref (resources);
     }
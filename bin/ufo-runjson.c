@@ -29,11 +29,24 @@ typedef struct {
     gchar *scheduler;
     gboolean trace;
     gboolean timestamps;
+    gboolean ordered;
     gboolean version;
     gboolean quiet;
     gboolean quieter;
+    UfoBaseSchedulerReport report;
 } Options;
 
+static Options options = {
+    .scheduler = NULL,
+    .trace = FALSE,
+    .timestamps = FALSE,
+    .ordered = FALSE,
+    .version = FALSE,
+    .quiet = FALSE,
+    .quieter = FALSE,
+    .report = UFO_BASE_SCHEDULER_REPORT_NONE,
+};
+
 static void
 handle_error (const gchar *prefix, GError *error, UfoGraph *graph)
 {
@@ -96,6 +109,11 @@ execute_json (const gchar *filename,
     }
     */
 
+    if ((NULL != options->scheduler) && (0 == g_ascii_strcasecmp (options->scheduler, "pool"))) {
+        g_debug ("INFO: run-json: using pool-scheduler");
+        scheduler = ufo_pool_scheduler_new ();
+    }
+
     if ((NULL != options->scheduler) && (0 == g_ascii_strcasecmp (options->scheduler, "dynamic"))) {
         g_debug ("INFO: run-json: using dynamic scheduler");
         scheduler = ufo_scheduler_new ();
@@ -109,6 +127,7 @@ execute_json (const gchar *filename,
     g_object_set (scheduler,
                   "enable-tracing", options->trace,
                   "timestamps", options->timestamps,
+                  "ordered", options->ordered,
                   NULL);
 
     ufo_base_scheduler_run (scheduler, task_graph, &error);
@@ -124,6 +143,14 @@ execute_json (const gchar *filename,
         g_print ("Finished in %3.5fs\n", run_time);
     }
 
+    if (options->report != UFO_BASE_SCHEDULER_REPORT_NONE) {
+        gchar *report;
+
+        report = ufo_base_scheduler_get_report (scheduler, options->report);
+        g_print ("%s", report);
+        g_free (report);
+    }
+
     g_list_free (leaves);
 
     g_object_unref (task_graph);
@@ -134,25 +161,38 @@ execute_json (const gchar *filename,
         g_object_unref (resources);
 }
 
+static gboolean
+parse_report (const gchar *option_name,
+              const gchar *value,
+              gpointer data,
+              GError **error)
+{
+    if (value == NULL || !g_strcmp0 (value, "text"))
+        options.report = UFO_BASE_SCHEDULER_REPORT_TEXT;
+    else if (!g_strcmp0 (value, "json"))
+        options.report = UFO_BASE_SCHEDULER_REPORT_JSON;
+    else {
+        g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                     "Unknown report format `%s'", value);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 int main(int argc, char *argv[])
 {
     GOptionContext *context;
     GError *error = NULL;
 
-    static Options options = {
-        .scheduler = NULL,
-        .trace = FALSE,
-        .timestamps = FALSE,
-        .version = FALSE,
-        .quiet = FALSE,
-        .quieter = FALSE,
-    };
-
     GOptionEntry entries[] = {
         { "trace",     't', 0, G_OPTION_ARG_NONE, &options.trace, "enable tracing", NULL },
         { "scheduler", 's', 0, G_OPTION_ARG_STRING, &options.scheduler, "selecting a scheduler",
-          "dynamic|fixed"},
+          "dynamic|fixed|pool"},
         { "timestamps",  0, 0, G_OPTION_ARG_NONE, &options.timestamps, "enable timestamps", NULL },
+        { "ordered",     0, 0, G_OPTION_ARG_NONE, &options.ordered, "keep frame order where expanded branches join", NULL },
+        { "report",    'r', G_OPTION_FLAG_OPTIONAL_ARG, G_OPTION_ARG_CALLBACK, (gpointer) parse_report,
+          "print a bottleneck report", "text|json" },
         { "quiet",     'q', 0, G_OPTION_ARG_NONE, &options.quiet, "be quiet", NULL },
         { "quieter",     0, 0, G_OPTION_ARG_NONE, &options.quieter, "be quieter", NULL },
         { "version",   'v', 0, G_OPTION_ARG_NONE, &options.version, "Show version information", NULL },
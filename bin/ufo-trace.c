@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2011-2015 Karlsruhe Institute of Technology
+ *
+ * This file is part of ufo-trace.
+ *
+ * ufo-trace is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ufo-trace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with ufo-trace.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "ufo/ufo.h"
+
+
+static gchar *output = NULL;
+static gboolean version = FALSE;
+
+
+static gchar *
+get_output_name (const gchar *input)
+{
+    if (g_str_has_suffix (input, ".ufotrace")) {
+        gchar *base;
+        gchar *result;
+
+        base = g_strndup (input, strlen (input) - strlen (".ufotrace"));
+        result = g_strdup_printf ("%s.json", base);
+        g_free (base);
+        return result;
+    }
+
+    return g_strdup_printf ("%s.json", input);
+}
+
+int
+main(int argc, char* argv[])
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    gchar *filename;
+
+    static GOptionEntry entries[] = {
+        { "output",  'o', 0, G_OPTION_ARG_STRING, &output, "Output file name", "FILE" },
+        { "version",   0, 0, G_OPTION_ARG_NONE, &version, "Show version information", NULL },
+        { NULL }
+    };
+
+#if !(GLIB_CHECK_VERSION (2, 36, 0))
+    g_type_init ();
+#endif
+
+    context = g_option_context_new ("FILE.ufotrace ...");
+    g_option_context_add_main_entries (context, entries, NULL);
+
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("Error parsing options: %s\n", error->message);
+        return 1;
+    }
+
+    if (version) {
+        g_print ("%s version " UFO_VERSION "\n", argv[0]);
+        return 0;
+    }
+
+    if (argc < 2) {
+        g_printerr ("%s", g_option_context_get_help (context, TRUE, NULL));
+        return 1;
+    }
+
+    if (output != NULL && argc > 2) {
+        g_printerr ("Error: --output can only be used with a single trace\n");
+        return 1;
+    }
+
+    for (gint i = 1; i < argc; i++) {
+        filename = output != NULL ? g_strdup (output) : get_output_name (argv[i]);
+
+        if (!ufo_trace_convert_to_json (argv[i], filename, &error)) {
+            g_printerr ("Error: %s\n", error->message);
+            g_error_free (error);
+            g_free (filename);
+            return 1;
+        }
+
+        g_free (filename);
+    }
+
+    g_option_context_free (context);
+    return 0;
+}
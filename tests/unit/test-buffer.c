@@ -110,6 +110,419 @@ test_convert_16_from_data (Fixture *fixture,
         g_assert (host_data[i] == ((gfloat) fixture->data16[i]));
 }
 
+static const UfoBufferDepth all_depths[] = {
+    UFO_BUFFER_DEPTH_8U,
+    UFO_BUFFER_DEPTH_16U,
+    UFO_BUFFER_DEPTH_16S,
+    UFO_BUFFER_DEPTH_32S,
+    UFO_BUFFER_DEPTH_32U,
+};
+
+static gsize
+depth_size (UfoBufferDepth depth)
+{
+    if (depth == UFO_BUFFER_DEPTH_8U)
+        return 1;
+
+    if (depth == UFO_BUFFER_DEPTH_16U || depth == UFO_BUFFER_DEPTH_16S)
+        return 2;
+
+    return 4;
+}
+
+static gfloat
+reference_value (const guint8 *data, UfoBufferDepth depth, gsize i)
+{
+    switch (depth) {
+        case UFO_BUFFER_DEPTH_8U:
+            return (gfloat) data[i];
+        case UFO_BUFFER_DEPTH_16U:
+            return (gfloat) ((const guint16 *) data)[i];
+        case UFO_BUFFER_DEPTH_16S:
+            return (gfloat) ((const gint16 *) data)[i];
+        case UFO_BUFFER_DEPTH_32S:
+            return (gfloat) ((const gint32 *) data)[i];
+        default:
+            return (gfloat) ((const guint32 *) data)[i];
+    }
+}
+
+static void
+test_convert_large (void)
+{
+    /* Odd size exercises the vector tails and is large enough for threads */
+    UfoRequisition requisition = {
+        .n_dims = 1,
+        .dims[0] = (1 << 20) + 13,
+    };
+
+    UfoBuffer *buffer;
+    guint8 *data;
+    gsize n_pixels;
+
+    n_pixels = requisition.dims[0];
+    buffer = ufo_buffer_new (&requisition, NULL);
+    data = g_malloc (n_pixels * 4);
+
+    for (gsize i = 0; i < n_pixels * 4; i++)
+        data[i] = (guint8) g_random_int ();
+
+    for (guint d = 0; d < G_N_ELEMENTS (all_depths); d++) {
+        UfoBufferDepth depth = all_depths[d];
+        gfloat *host_data;
+
+        ufo_buffer_convert_from_data (buffer, data, depth);
+        host_data = ufo_buffer_get_host_array (buffer, NULL);
+
+        for (gsize i = 0; i < n_pixels; i++)
+            g_assert (host_data[i] == reference_value (data, depth, i));
+
+        g_memmove (host_data, data, n_pixels * depth_size (depth));
+        ufo_buffer_convert (buffer, depth);
+        host_data = ufo_buffer_get_host_array (buffer, NULL);
+
+        for (gsize i = 0; i < n_pixels; i++)
+            g_assert (host_data[i] == reference_value (data, depth, i));
+    }
+
+    g_free (data);
+    g_object_unref (buffer);
+}
+
+static void
+test_convert_throughput (void)
+{
+    UfoRequisition requisition = {
+        .n_dims = 2,
+        .dims[0] = 2048,
+        .dims[1] = 2048,
+    };
+
+    UfoBuffer *buffer;
+    GTimer *timer;
+    guint8 *data;
+    gsize n_pixels;
+    const guint n_runs = 50;
+
+    if (!g_test_perf ())
+        return;
+
+    n_pixels = requisition.dims[0] * requisition.dims[1];
+    buffer = ufo_buffer_new (&requisition, NULL);
+    data = g_malloc0 (n_pixels * 4);
+    timer = g_timer_new ();
+
+    for (guint d = 0; d < G_N_ELEMENTS (all_depths); d++) {
+        UfoBufferDepth depth = all_depths[d];
+        gdouble elapsed;
+        gsize bytes;
+
+        /* Warm up pages and the thread pool */
+        ufo_buffer_convert_from_data (buffer, data, depth);
+        g_timer_start (timer);
+
+        for (guint i = 0; i < n_runs; i++)
+            ufo_buffer_convert_from_data (buffer, data, depth);
+
+        elapsed = g_timer_elapsed (timer, NULL);
+        bytes = n_runs * n_pixels * (depth_size (depth) + sizeof (gfloat));
+        g_test_maximized_result (bytes / elapsed / 1e9,
+                                 "depth %u from data: %.2f GB/s", depth, bytes / elapsed / 1e9);
+
+        g_timer_start (timer);
+
+        for (guint i = 0; i < n_runs; i++)
+            ufo_buffer_convert (buffer, depth);
+
+        elapsed = g_timer_elapsed (timer, NULL);
+        g_test_maximized_result (bytes / elapsed / 1e9,
+                                 "depth %u in place: %.2f GB/s", depth, bytes / elapsed / 1e9);
+    }
+
+    g_timer_destroy (timer);
+    g_free (data);
+    g_object_unref (buffer);
+}
+
+static void
+test_convert_to (Fixture *fixture,
+                 gconstpointer unused)
+{
+    static const gfloat values[8] = { -10.0f, 0.0f, 0.5f, 1.5f, 2.5f, 100.0f, 300.0f, NAN };
+    gfloat *host_data;
+    gfloat copy[8];
+    guint8 data8[8];
+    guint16 data16[8];
+    gint16 data16s[8];
+
+    host_data = ufo_buffer_get_host_array (fixture->buffer, NULL);
+    memcpy (host_data, values, sizeof (values));
+
+    /* Identity scale: saturation, ties to even and NaN at the low end */
+    ufo_buffer_convert_to (fixture->buffer, UFO_BUFFER_DEPTH_8U, 0.0f, 255.0f, data8);
+    g_assert_cmpuint (data8[0], ==, 0);
+    g_assert_cmpuint (data8[1], ==, 0);
+    g_assert_cmpuint (data8[2], ==, 0);
+    g_assert_cmpuint (data8[3], ==, 2);
+    g_assert_cmpuint (data8[4], ==, 2);
+    g_assert_cmpuint (data8[5], ==, 100);
+    g_assert_cmpuint (data8[6], ==, 255);
+    g_assert_cmpuint (data8[7], ==, 0);
+
+    /* Auto range ignores NaN and maps the extremes to the full range */
+    ufo_buffer_convert_to (fixture->buffer, UFO_BUFFER_DEPTH_16U, 0.0f, 0.0f, data16);
+    g_assert_cmpuint (data16[0], ==, 0);
+    g_assert_cmpuint (data16[6], ==, 65535);
+
+    for (guint i = 1; i < 6; i++)
+        g_assert_cmpuint (data16[i], <=, data16[i + 1]);
+
+    ufo_buffer_convert_to (fixture->buffer, UFO_BUFFER_DEPTH_16S, -1.0f, 1.0f, data16s);
+    g_assert_cmpint (data16s[0], ==, -32768);
+    g_assert_cmpint (data16s[1], ==, 0);
+    g_assert_cmpint (data16s[6], ==, 32767);
+
+    ufo_buffer_convert_to (fixture->buffer, UFO_BUFFER_DEPTH_32F, 0.0f, 0.0f, copy);
+    g_assert (memcmp (copy, values, sizeof (values)) == 0);
+}
+
+static void
+test_convert_to_large (void)
+{
+    UfoRequisition requisition = {
+        .n_dims = 1,
+        .dims[0] = (1 << 20) + 13,
+    };
+
+    UfoBuffer *buffer;
+    gfloat *host_data;
+    guint16 *data16;
+    gsize n_pixels;
+
+    n_pixels = requisition.dims[0];
+    buffer = ufo_buffer_new (&requisition, NULL);
+    host_data = ufo_buffer_get_host_array (buffer, NULL);
+    data16 = g_malloc (n_pixels * sizeof (guint16));
+
+    for (gsize i = 0; i < n_pixels; i++)
+        host_data[i] = (gfloat) (i % 65536) - 1000.0f;
+
+    ufo_buffer_convert_to (buffer, UFO_BUFFER_DEPTH_16U, -1000.0f, 64535.0f, data16);
+
+    for (gsize i = 0; i < n_pixels; i++)
+        g_assert_cmpuint (data16[i], ==, i % 65536);
+
+    g_free (data16);
+    g_object_unref (buffer);
+}
+
+static void
+test_storage_depth (Fixture *fixture,
+                    gconstpointer unused)
+{
+    gpointer raw;
+    gfloat *host_data;
+
+    ufo_buffer_set_storage_depth (fixture->buffer, UFO_BUFFER_DEPTH_16U);
+    g_assert_cmpuint (ufo_buffer_get_size (fixture->buffer), ==, fixture->n_data * sizeof (guint16));
+
+    raw = ufo_buffer_get_raw_host_array (fixture->buffer, NULL);
+    memcpy (raw, fixture->data16, fixture->n_data * sizeof (guint16));
+
+    host_data = ufo_buffer_get_host_array (fixture->buffer, NULL);
+    g_assert_cmpint (ufo_buffer_get_storage_depth (fixture->buffer), ==, UFO_BUFFER_DEPTH_32F);
+    g_assert_cmpuint (ufo_buffer_get_size (fixture->buffer), ==, fixture->n_data * sizeof (gfloat));
+
+    for (guint i = 0; i < fixture->n_data; i++)
+        g_assert (host_data[i] == ((gfloat) fixture->data16[i]));
+
+    /* Narrow data fits into the float allocation */
+    ufo_buffer_set_storage_depth (fixture->buffer, UFO_BUFFER_DEPTH_8U);
+    raw = ufo_buffer_get_raw_host_array (fixture->buffer, NULL);
+    g_assert (raw == (gpointer) host_data);
+    memcpy (raw, fixture->data8, fixture->n_data);
+
+    host_data = ufo_buffer_get_host_array (fixture->buffer, NULL);
+
+    for (guint i = 0; i < fixture->n_data; i++)
+        g_assert (host_data[i] == ((gfloat) fixture->data8[i]));
+}
+
+static void
+test_storage_depth_half (Fixture *fixture,
+                         gconstpointer unused)
+{
+    static const guint16 halves[8] = { 0x3c00, 0xc000, 0x7bff, 0x0001, 0x7c00, 0x0000, 0x8000, 0x3555 };
+    gfloat *host_data;
+
+    ufo_buffer_set_storage_depth (fixture->buffer, UFO_BUFFER_DEPTH_16F);
+    memcpy (ufo_buffer_get_raw_host_array (fixture->buffer, NULL), halves, sizeof (halves));
+    host_data = ufo_buffer_get_host_array (fixture->buffer, NULL);
+
+    g_assert_cmpfloat (host_data[0], ==, 1.0f);
+    g_assert_cmpfloat (host_data[1], ==, -2.0f);
+    g_assert_cmpfloat (host_data[2], ==, 65504.0f);
+    g_assert_cmpfloat (host_data[3], ==, ldexpf (1.0f, -24));
+    g_assert (isinf (host_data[4]) && host_data[4] > 0.0f);
+    g_assert_cmpfloat (host_data[5], ==, 0.0f);
+    g_assert (host_data[6] == 0.0f && signbit (host_data[6]));
+    g_assert_cmpfloat (fabsf (host_data[7] - 1.0f / 3.0f), <, 1e-3f);
+}
+
+static void
+test_statistics (Fixture *fixture,
+                 gconstpointer unused)
+{
+    static const gfloat values[8] = { 2.0f, 4.0f, NAN, 4.0f, 4.0f, 5.0f, 5.0f, 7.0f };
+    UfoBufferStatistics stats;
+
+    /* 8 values with NaN ignored, the remaining seven have a mean of 31/7 */
+    memcpy (ufo_buffer_get_host_array (fixture->buffer, NULL), values, sizeof (values));
+    ufo_buffer_get_statistics (fixture->buffer, NULL, &stats);
+
+    g_assert_cmpuint (stats.n_values, ==, 7);
+    g_assert_cmpfloat (stats.min, ==, 2.0f);
+    g_assert_cmpfloat (stats.max, ==, 7.0f);
+    g_assert_cmpfloat (fabs (stats.sum - 31.0), <, 1e-9);
+    g_assert_cmpfloat (fabs (stats.mean - 31.0 / 7.0), <, 1e-9);
+    g_assert_cmpfloat (fabs (stats.variance - (151.0 / 7.0 - (31.0 / 7.0) * (31.0 / 7.0))), <, 1e-9);
+
+    g_assert_cmpfloat (ufo_buffer_min (fixture->buffer, NULL), ==, 2.0f);
+    g_assert_cmpfloat (ufo_buffer_max (fixture->buffer, NULL), ==, 7.0f);
+}
+
+static void
+test_statistics_large (void)
+{
+    UfoRequisition requisition = {
+        .n_dims = 1,
+        .dims[0] = (1 << 20) + 13,
+    };
+
+    UfoBuffer *buffer;
+    UfoBufferStatistics stats;
+    gfloat *host_data;
+    gdouble sum = 0.0;
+    gdouble sum_sq = 0.0;
+    gdouble mean;
+    gsize n_pixels;
+
+    n_pixels = requisition.dims[0];
+    buffer = ufo_buffer_new (&requisition, NULL);
+    host_data = ufo_buffer_get_host_array (buffer, NULL);
+
+    /* A large offset makes naive single-precision accumulation fail */
+    for (gsize i = 0; i < n_pixels; i++) {
+        host_data[i] = 10000.0f + (gfloat) ((i * 7919) % 1000) / 100.0f;
+        sum += host_data[i];
+    }
+
+    mean = sum / n_pixels;
+
+    for (gsize i = 0; i < n_pixels; i++)
+        sum_sq += (host_data[i] - mean) * (host_data[i] - mean);
+
+    ufo_buffer_get_statistics (buffer, NULL, &stats);
+
+    g_assert_cmpuint (stats.n_values, ==, n_pixels);
+    g_assert_cmpfloat (stats.min, ==, 10000.0f);
+    g_assert_cmpfloat (stats.max, ==, 10000.0f + 9.99f);
+    g_assert_cmpfloat (fabs (stats.mean - mean), <, 1e-6);
+    g_assert_cmpfloat (fabs (stats.sum - sum) / sum, <, 1e-9);
+    g_assert_cmpfloat (fabs (stats.variance - sum_sq / n_pixels), <, 1e-3);
+
+    g_object_unref (buffer);
+}
+
+static void
+test_histogram (Fixture *fixture,
+                gconstpointer unused)
+{
+    static const gfloat values[8] = { 0.0f, 0.5f, 1.0f, NAN, 2.5f, 3.9f, 4.0f, 5.0f };
+    guint32 bins[4];
+
+    memcpy (ufo_buffer_get_host_array (fixture->buffer, NULL), values, sizeof (values));
+
+    /* The upper edge is part of the last bin, 5.0 is outside */
+    ufo_buffer_get_histogram (fixture->buffer, NULL, 0.0f, 4.0f, 4, bins);
+    g_assert_cmpuint (bins[0], ==, 2);
+    g_assert_cmpuint (bins[1], ==, 1);
+    g_assert_cmpuint (bins[2], ==, 1);
+    g_assert_cmpuint (bins[3], ==, 2);
+
+    /* Equal bounds span the range of the data */
+    ufo_buffer_get_histogram (fixture->buffer, NULL, 0.0f, 0.0f, 2, bins);
+    g_assert_cmpuint (bins[0], ==, 3);
+    g_assert_cmpuint (bins[1], ==, 4);
+}
+
+static void
+test_expression (Fixture *fixture,
+                 gconstpointer unused)
+{
+    static const gchar *names[] = { "a", "dark", "flat", NULL };
+    UfoRequisition requisition;
+    UfoBuffer *args[3];
+    UfoBuffer *small;
+    gfloat *a, *dark, *flat, *out;
+    GError *error = NULL;
+
+    ufo_buffer_get_requisition (fixture->buffer, &requisition);
+    args[0] = ufo_buffer_new (&requisition, NULL);
+    args[1] = ufo_buffer_new (&requisition, NULL);
+    args[2] = ufo_buffer_new (&requisition, NULL);
+
+    a = ufo_buffer_get_host_array (args[0], NULL);
+    dark = ufo_buffer_get_host_array (args[1], NULL);
+    flat = ufo_buffer_get_host_array (args[2], NULL);
+
+    for (guint i = 0; i < fixture->n_data; i++) {
+        a[i] = (gfloat) i;
+        dark[i] = 1.0f;
+        flat[i] = 3.0f + i;
+    }
+
+    g_assert (ufo_op_expression ("(a - dark) / (flat - dark) * 2", names, args,
+                                 fixture->buffer, NULL, NULL, &error) == NULL);
+    g_assert_no_error (error);
+    out = ufo_buffer_get_host_array (fixture->buffer, NULL);
+
+    for (guint i = 0; i < fixture->n_data; i++)
+        g_assert_cmpfloat (fabs (out[i] - (a[i] - dark[i]) / (flat[i] - dark[i]) * 2.0f), <, 1e-6);
+
+    /* The output may be one of the inputs */
+    ufo_op_expression ("max(a * a - 2 * a, -sqrt(dark))", names, args, args[0], NULL, NULL, &error);
+    g_assert_no_error (error);
+
+    for (guint i = 0; i < fixture->n_data; i++)
+        g_assert_cmpfloat (a[i], ==, MAX ((gfloat) i * i - 2.0f * i, -1.0f));
+
+    ufo_op_expression ("a + unknown", names, args, fixture->buffer, NULL, NULL, &error);
+    g_assert_error (error, UFO_OP_ERROR, UFO_OP_ERROR_EXPRESSION);
+    g_clear_error (&error);
+
+    /* Narrow storage has as many elements as the float output */
+    ufo_buffer_set_storage_depth (args[1], UFO_BUFFER_DEPTH_8U);
+    memcpy (ufo_buffer_get_raw_host_array (args[1], NULL), fixture->data8, fixture->n_data);
+    ufo_op_expression ("dark * 2", names, args, fixture->buffer, NULL, NULL, &error);
+    g_assert_no_error (error);
+    out = ufo_buffer_get_host_array (fixture->buffer, NULL);
+
+    for (guint i = 0; i < fixture->n_data; i++)
+        g_assert_cmpfloat (out[i], ==, 2.0f * fixture->data8[i]);
+
+    requisition.dims[0] = 4;
+    small = ufo_buffer_new (&requisition, NULL);
+    ufo_op_expression ("a", names, args, small, NULL, NULL, &error);
+    g_assert_error (error, UFO_OP_ERROR, UFO_OP_ERROR_SIZE);
+    g_clear_error (&error);
+
+    g_object_unref (small);
+    g_object_unref (args[0]);
+    g_object_unref (args[1]);
+    g_object_unref (args[2]);
+}
+
 static void
 test_insert_metadata (Fixture *fixture,
                       gconstpointer unused)
@@ -129,6 +542,10 @@ test_insert_metadata (Fixture *fixture,
     g_assert (other != NULL);
     g_assert (g_value_get_int (other) == -123);
 
+    /* Looking up unknown names must not intern them */
+    g_assert (ufo_buffer_get_metadata (fixture->buffer, "test-metadata-never-set") == NULL);
+    g_assert (g_quark_try_string ("test-metadata-never-set") == 0);
+
     /* Overwrite data */
     g_value_unset (&value);
     g_value_init (&value, G_TYPE_FLOAT);
@@ -167,6 +584,41 @@ test_copy_metadata (Fixture *fixture,
     g_object_unref (copy);
 }
 
+static void
+test_copy_metadata_on_write (Fixture *fixture,
+                             gconstpointer unused)
+{
+    GValue value = {0};
+    UfoBuffer *copy;
+    UfoBuffer *other;
+
+    copy = ufo_buffer_dup (fixture->buffer);
+    other = ufo_buffer_dup (fixture->buffer);
+
+    g_value_init (&value, G_TYPE_INT);
+    g_value_set_int (&value, 1);
+    ufo_buffer_set_metadata (fixture->buffer, "foo", &value);
+    ufo_buffer_set_metadata (other, "bar", &value);
+
+    /* Shared until modified */
+    ufo_buffer_copy_metadata (fixture->buffer, copy);
+    g_assert (ufo_buffer_get_metadata (copy, "foo") == ufo_buffer_get_metadata (fixture->buffer, "foo"));
+
+    g_value_set_int (&value, 2);
+    ufo_buffer_set_metadata (copy, "foo", &value);
+    g_assert_cmpint (g_value_get_int (ufo_buffer_get_metadata (copy, "foo")), ==, 2);
+    g_assert_cmpint (g_value_get_int (ufo_buffer_get_metadata (fixture->buffer, "foo")), ==, 1);
+
+    /* Merging keeps keys that are not in the source */
+    ufo_buffer_copy_metadata (fixture->buffer, other);
+    g_assert_cmpint (g_value_get_int (ufo_buffer_get_metadata (other, "foo")), ==, 1);
+    g_assert (ufo_buffer_get_metadata (other, "bar") != NULL);
+    g_assert (ufo_buffer_get_metadata (fixture->buffer, "bar") == NULL);
+
+    g_object_unref (copy);
+    g_object_unref (other);
+}
+
 static void
 test_location (Fixture *fixture,
                gconstpointer unused)
@@ -176,6 +628,261 @@ test_location (Fixture *fixture,
     g_assert (ufo_buffer_get_location (fixture->buffer) == UFO_BUFFER_LOCATION_HOST);
 }
 
+static void
+test_pool_reuse (Fixture *fixture,
+                 gconstpointer unused)
+{
+    UfoBufferPool *pool;
+    UfoBufferPoolStatistics stats;
+    UfoBuffer *first;
+    UfoBuffer *second;
+    UfoRequisition requisition;
+
+    UfoRequisition transposed = {
+        .n_dims = 2,
+        .dims[0] = 2,
+        .dims[1] = 4,
+    };
+
+    pool = ufo_buffer_pool_new ();
+    ufo_buffer_get_requisition (fixture->buffer, &requisition);
+
+    first = ufo_buffer_pool_acquire (pool, &requisition, NULL, UFO_BUFFER_LOCATION_INVALID);
+    ufo_buffer_get_host_array (first, NULL);
+    ufo_buffer_pool_release (pool, first);
+
+    /* Same number of bytes, so the idle buffer must be re-used */
+    second = ufo_buffer_pool_acquire (pool, &transposed, NULL, UFO_BUFFER_LOCATION_DEVICE);
+    g_assert (first == second);
+    g_assert (ufo_buffer_cmp_dimensions (second, &transposed) == 0);
+    ufo_buffer_get_requisition (second, &requisition);
+    g_assert_cmpuint (requisition.n_dims, ==, 2);
+
+    ufo_buffer_pool_get_statistics (pool, &stats);
+    g_assert_cmpuint (stats.n_hits, ==, 1);
+    g_assert_cmpuint (stats.n_misses, ==, 1);
+    g_assert_cmpuint (stats.n_idle, ==, 0);
+
+    ufo_buffer_pool_release (pool, second);
+    g_object_unref (pool);
+}
+
+static void
+test_pool_reset (Fixture *fixture,
+                 gconstpointer unused)
+{
+    UfoBufferPool *pool;
+    UfoBuffer *buffer;
+    UfoRequisition requisition;
+    GValue value = G_VALUE_INIT;
+
+    pool = ufo_buffer_pool_new ();
+    ufo_buffer_get_requisition (fixture->buffer, &requisition);
+
+    buffer = ufo_buffer_pool_acquire (pool, &requisition, NULL, UFO_BUFFER_LOCATION_INVALID);
+    g_value_init (&value, G_TYPE_INT);
+    g_value_set_int (&value, 42);
+    ufo_buffer_set_metadata (buffer, "frame", &value);
+    ufo_buffer_set_layout (buffer, UFO_BUFFER_LAYOUT_COMPLEX_INTERLEAVED);
+    ufo_buffer_set_pinned (buffer, TRUE);
+    ufo_buffer_pool_release (pool, buffer);
+
+    /* A recycled buffer must not carry anything over from its last frame */
+    buffer = ufo_buffer_pool_acquire (pool, &requisition, NULL, UFO_BUFFER_LOCATION_INVALID);
+    g_assert (ufo_buffer_get_metadata (buffer, "frame") == NULL);
+    g_assert (ufo_buffer_get_metadata_keys (buffer) == NULL);
+    g_assert_cmpint (ufo_buffer_get_layout (buffer), ==, UFO_BUFFER_LAYOUT_REAL);
+
+    ufo_buffer_pool_release (pool, buffer);
+    g_value_unset (&value);
+    g_object_unref (pool);
+}
+
+static void
+test_pool_watermark (Fixture *fixture,
+                     gconstpointer unused)
+{
+    UfoBufferPool *pool;
+    UfoBufferPoolStatistics stats;
+    UfoBuffer *buffers[4];
+    UfoRequisition requisition;
+
+    pool = ufo_buffer_pool_new ();
+    ufo_buffer_get_requisition (fixture->buffer, &requisition);
+
+    g_object_set (pool,
+                  "high-watermark", (guint64) (3 * ufo_buffer_get_size (fixture->buffer)),
+                  "low-watermark", (guint64) (ufo_buffer_get_size (fixture->buffer)),
+                  NULL);
+
+    for (guint i = 0; i < 4; i++)
+        buffers[i] = ufo_buffer_pool_acquire (pool, &requisition, NULL, UFO_BUFFER_LOCATION_INVALID);
+
+    for (guint i = 0; i < 4; i++)
+        ufo_buffer_pool_release (pool, buffers[i]);
+
+    ufo_buffer_pool_get_statistics (pool, &stats);
+    g_assert_cmpuint (stats.n_misses, ==, 4);
+    g_assert_cmpuint (stats.n_releases, ==, 4);
+    g_assert_cmpuint (stats.n_evictions, ==, 3);
+    g_assert_cmpuint (stats.n_idle, ==, 1);
+    g_assert_cmpuint (stats.idle_bytes, ==, ufo_buffer_get_size (fixture->buffer));
+    g_assert_cmpuint (stats.peak_idle_bytes, ==, 4 * ufo_buffer_get_size (fixture->buffer));
+
+    g_object_unref (pool);
+}
+
+static void
+test_share (Fixture *fixture,
+            gconstpointer unused)
+{
+    gfloat *host_data;
+
+    host_data = ufo_buffer_get_host_array (fixture->buffer, NULL);
+    host_data[0] = 42.0f;
+
+    g_assert (!ufo_buffer_is_shared (fixture->buffer));
+    ufo_buffer_share (fixture->buffer, 3);
+    g_assert (ufo_buffer_is_shared (fixture->buffer));
+
+    host_data = ufo_buffer_get_host_array (fixture->buffer, NULL);
+    g_assert (host_data[0] == 42.0f);
+
+    g_assert (!ufo_buffer_release_shared (fixture->buffer));
+    g_assert (!ufo_buffer_release_shared (fixture->buffer));
+    g_assert (ufo_buffer_release_shared (fixture->buffer));
+    g_assert (!ufo_buffer_is_shared (fixture->buffer));
+}
+
+static void
+test_share_broadcast (Fixture *fixture,
+                      gconstpointer unused)
+{
+    UfoGroup *group;
+    UfoTask *targets[3];
+    UfoBuffer *inputs[3];
+    UfoBuffer *output;
+    UfoRequisition requisition;
+    GList *list = NULL;
+
+    ufo_buffer_get_requisition (fixture->buffer, &requisition);
+
+    for (guint i = 0; i < 3; i++) {
+        targets[i] = UFO_TASK (ufo_dummy_task_new ());
+        list = g_list_append (list, targets[i]);
+    }
+
+    group = ufo_group_new (list, NULL, UFO_SEND_BROADCAST);
+
+    /* Targets that did not declare read-only inputs get a copy each */
+    output = ufo_group_pop_output_buffer (group, &requisition);
+    ufo_group_push_output_buffer (group, output);
+
+    for (guint i = 0; i < 3; i++)
+        inputs[i] = ufo_group_pop_input_buffer (group, targets[i]);
+
+    g_assert (inputs[0] == output);
+    g_assert (inputs[1] != output && inputs[2] != output);
+    g_assert (!ufo_buffer_is_shared (output));
+
+    for (guint i = 0; i < 3; i++)
+        ufo_group_push_input_buffer (group, targets[i], inputs[i]);
+
+    ufo_group_set_writable (group, targets[0], FALSE);
+    ufo_group_set_writable (group, targets[1], FALSE);
+
+    output = ufo_group_pop_output_buffer (group, &requisition);
+    ufo_buffer_get_host_array (output, NULL)[0] = 42.0f;
+    ufo_group_push_output_buffer (group, output);
+
+    for (guint i = 0; i < 3; i++)
+        inputs[i] = ufo_group_pop_input_buffer (group, targets[i]);
+
+    /* Readers see the same buffer, the writer gets its own copy */
+    g_assert (inputs[0] == output);
+    g_assert (inputs[1] == output);
+    g_assert (inputs[2] != output);
+    g_assert (ufo_buffer_is_shared (output));
+    g_assert (ufo_buffer_get_host_array (inputs[2], NULL)[0] == 42.0f);
+
+    for (guint i = 0; i < 3; i++)
+        ufo_group_push_input_buffer (group, targets[i], inputs[i]);
+
+    g_assert (!ufo_buffer_is_shared (output));
+
+    g_object_unref (group);
+    g_list_free (list);
+
+    for (guint i = 0; i < 3; i++)
+        g_object_unref (targets[i]);
+}
+
+static void
+test_pinned_fallback (Fixture *fixture,
+                      gconstpointer unused)
+{
+    gfloat *host_data;
+
+    /* Without an OpenCL context, pinned memory falls back to regular memory */
+    ufo_buffer_set_pinned (fixture->buffer, TRUE);
+    host_data = ufo_buffer_get_host_array (fixture->buffer, NULL);
+    g_assert (host_data != NULL);
+    g_assert (!ufo_buffer_is_pinned (fixture->buffer));
+
+    host_data[7] = 1.0f;
+    g_assert (ufo_buffer_get_host_array (fixture->buffer, NULL)[7] == 1.0f);
+}
+
+static void
+test_swap_foreign_data (Fixture *fixture,
+                        gconstpointer unused)
+{
+    static gfloat data[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    UfoRequisition requisition;
+    UfoBuffer *foreign;
+    gfloat *host_data;
+
+    ufo_buffer_get_requisition (fixture->buffer, &requisition);
+    foreign = ufo_buffer_new_with_data (&requisition, data, NULL);
+    host_data = ufo_buffer_get_host_array (fixture->buffer, NULL);
+    host_data[0] = -1.0f;
+
+    /* The static array moves to fixture->buffer, which must not free it */
+    ufo_buffer_swap_data (foreign, fixture->buffer);
+    g_assert (ufo_buffer_get_host_array (fixture->buffer, NULL) == data);
+    g_assert (ufo_buffer_get_host_array (foreign, NULL)[0] == -1.0f);
+
+    g_object_unref (foreign);
+}
+
+static void
+test_group_try_pop (Fixture *fixture,
+                    gconstpointer unused)
+{
+    UfoGroup *group;
+    UfoTask *target;
+    UfoBuffer *output;
+    UfoRequisition requisition;
+    GList *list;
+
+    ufo_buffer_get_requisition (fixture->buffer, &requisition);
+    target = UFO_TASK (ufo_dummy_task_new ());
+    list = g_list_append (NULL, target);
+    group = ufo_group_new (list, NULL, UFO_SEND_SCATTER);
+
+    g_assert (ufo_group_try_pop_input_buffer (group, target) == NULL);
+
+    output = ufo_group_pop_output_buffer (group, &requisition);
+    ufo_group_push_output_buffer (group, output);
+    g_assert (ufo_group_try_pop_input_buffer (group, target) == output);
+    g_assert (ufo_group_try_pop_input_buffer (group, target) == NULL);
+    ufo_group_push_input_buffer (group, target, output);
+
+    g_object_unref (group);
+    g_list_free (list);
+    g_object_unref (target);
+}
+
 void
 test_add_buffer (void)
 {
@@ -195,6 +902,42 @@ test_add_buffer (void)
                 Fixture, NULL,
                 setup, test_convert_16_from_data, teardown);
 
+    g_test_add_func ("/no-opencl/buffer/convert/large",
+                     test_convert_large);
+
+    g_test_add_func ("/no-opencl/buffer/convert/throughput",
+                     test_convert_throughput);
+
+    g_test_add ("/no-opencl/buffer/convert-to/host",
+                Fixture, NULL,
+                setup, test_convert_to, teardown);
+
+    g_test_add_func ("/no-opencl/buffer/convert-to/large",
+                     test_convert_to_large);
+
+    g_test_add ("/no-opencl/buffer/storage-depth",
+                Fixture, NULL,
+                setup, test_storage_depth, teardown);
+
+    g_test_add ("/no-opencl/buffer/storage-depth/half",
+                Fixture, NULL,
+                setup, test_storage_depth_half, teardown);
+
+    g_test_add ("/no-opencl/buffer/statistics",
+                Fixture, NULL,
+                setup, test_statistics, teardown);
+
+    g_test_add_func ("/no-opencl/buffer/statistics/large",
+                     test_statistics_large);
+
+    g_test_add ("/no-opencl/buffer/histogram",
+                Fixture, NULL,
+                setup, test_histogram, teardown);
+
+    g_test_add ("/no-opencl/buffer/expression",
+                Fixture, NULL,
+                setup, test_expression, teardown);
+
     g_test_add ("/no-opencl/buffer/metadata/insert",
                 Fixture, NULL,
                 setup, test_insert_metadata, teardown);
@@ -203,7 +946,43 @@ test_add_buffer (void)
                 Fixture, NULL,
                 setup, test_copy_metadata, teardown);
 
+    g_test_add ("/no-opencl/buffer/metadata/copy-on-write",
+                Fixture, NULL,
+                setup, test_copy_metadata_on_write, teardown);
+
     g_test_add ("/no-opencl/buffer/location",
                 Fixture, NULL,
                 setup, test_location, teardown);
+
+    g_test_add ("/no-opencl/buffer/share",
+                Fixture, NULL,
+                setup, test_share, teardown);
+
+    g_test_add ("/no-opencl/buffer/share/broadcast",
+                Fixture, NULL,
+                setup, test_share_broadcast, teardown);
+
+    g_test_add ("/no-opencl/buffer/pinned/fallback",
+                Fixture, NULL,
+                setup, test_pinned_fallback, teardown);
+
+    g_test_add ("/no-opencl/buffer/swap/foreign-data",
+                Fixture, NULL,
+                setup, test_swap_foreign_data, teardown);
+
+    g_test_add ("/no-opencl/buffer/group/try-pop",
+                Fixture, NULL,
+                setup, test_group_try_pop, teardown);
+
+    g_test_add ("/no-opencl/buffer/pool/reuse",
+                Fixture, NULL,
+                setup, test_pool_reuse, teardown);
+
+    g_test_add ("/no-opencl/buffer/pool/reset",
+                Fixture, NULL,
+                setup, test_pool_reset, teardown);
+
+    g_test_add ("/no-opencl/buffer/pool/watermark",
+                Fixture, NULL,
+                setup, test_pool_watermark, teardown);
 }
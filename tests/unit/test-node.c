@@ -17,6 +17,8 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+#include <glib/gstdio.h>
 #include <ufo/ufo.h>
 #include "test-suite.h"
 
@@ -55,6 +57,290 @@ test_copy (void)
     g_object_unref (copy);
 }
 
+static void
+test_queue_depth (void)
+{
+    UfoTaskGraph *graph;
+    UfoNode *source;
+    UfoNode *sink;
+    UfoNode *copy;
+    GError *error = NULL;
+
+    graph = UFO_TASK_GRAPH (ufo_task_graph_new ());
+    source = ufo_dummy_task_new ();
+    sink = ufo_dummy_task_new ();
+
+    g_assert_cmpuint (ufo_task_node_get_queue_depth (UFO_TASK_NODE (sink), 0), ==, 0);
+
+    ufo_task_graph_connect_nodes_with_depth (graph, UFO_TASK_NODE (source), UFO_TASK_NODE (sink), 1, 8);
+    g_assert_cmpuint (ufo_task_node_get_queue_depth (UFO_TASK_NODE (sink), 0), ==, 0);
+    g_assert_cmpuint (ufo_task_node_get_queue_depth (UFO_TASK_NODE (sink), 1), ==, 8);
+
+    ufo_task_node_set_queue_depth (UFO_TASK_NODE (sink), 0, 100000);
+    g_assert_cmpuint (ufo_task_node_get_queue_depth (UFO_TASK_NODE (sink), 0), ==, UFO_TWO_WAY_QUEUE_MAX_CAPACITY);
+
+    copy = ufo_node_copy (sink, &error);
+    g_assert_no_error (error);
+    g_assert_cmpuint (ufo_task_node_get_queue_depth (UFO_TASK_NODE (copy), 1), ==, 8);
+
+    g_object_unref (copy);
+    g_object_unref (graph);
+    g_object_unref (source);
+    g_object_unref (sink);
+}
+
+static void
+test_in_group_order (void)
+{
+    UfoNode *node;
+    UfoNode *copy;
+    UfoGroup *groups[3];
+    guint replicas;
+    GError *error = NULL;
+
+    node = ufo_dummy_task_new ();
+
+    for (guint i = 0; i < 3; i++) {
+        groups[i] = ufo_group_new (NULL, NULL, UFO_SEND_SCATTER);
+        ufo_task_node_add_in_group (UFO_TASK_NODE (node), 0, groups[i]);
+    }
+
+    /* Groups are visited in the order they were added */
+    for (guint i = 0; i < 6; i++) {
+        g_assert (ufo_task_node_get_current_in_group (UFO_TASK_NODE (node), 0) == groups[i % 3]);
+        ufo_task_node_switch_in_group (UFO_TASK_NODE (node), 0);
+    }
+
+    g_object_set (node, "replicas", 4, NULL);
+    copy = ufo_node_copy (node, &error);
+    g_assert_no_error (error);
+    g_object_get (copy, "replicas", &replicas, NULL);
+    g_assert_cmpuint (replicas, ==, 4);
+
+    g_object_unref (copy);
+    g_object_unref (node);
+
+    for (guint i = 0; i < 3; i++)
+        g_object_unref (groups[i]);
+}
+
+static guint
+expand_with_replicas (UfoNode *task, guint replicas)
+{
+    UfoTaskGraph *graph;
+    UfoNode *source;
+    UfoNode *sink;
+    guint n_nodes;
+
+    graph = UFO_TASK_GRAPH (ufo_task_graph_new ());
+    source = ufo_dummy_task_new ();
+    sink = ufo_dummy_task_new ();
+    ufo_task_node_set_send_pattern (UFO_TASK_NODE (source), UFO_SEND_SCATTER);
+    g_object_set (task, "replicas", replicas, NULL);
+
+    ufo_task_graph_connect_nodes (graph, UFO_TASK (source), UFO_TASK (task));
+    ufo_task_graph_connect_nodes (graph, UFO_TASK (task), UFO_TASK (sink));
+    ufo_task_graph_expand (graph, NULL, 1);
+    n_nodes = ufo_graph_get_num_nodes (UFO_GRAPH (graph));
+
+    /* Each copy gets the single input and output of the original */
+    g_assert_cmpuint (ufo_graph_get_num_successors (UFO_GRAPH (graph), source), ==, n_nodes - 2);
+    g_assert_cmpuint (ufo_graph_get_num_predecessors (UFO_GRAPH (graph), sink), ==, n_nodes - 2);
+
+    g_object_unref (graph);
+    g_object_unref (source);
+    g_object_unref (sink);
+
+    return n_nodes;
+}
+
+static void
+test_replicate (void)
+{
+    UfoNode *task;
+
+    /* Stateless tasks take all cores unless told otherwise */
+    task = ufo_copy_task_new ();
+    g_assert (ufo_task_get_mode (UFO_TASK (task)) & UFO_TASK_MODE_STATELESS);
+    g_assert_cmpuint (expand_with_replicas (task, 0), ==, 2 + MAX (1, g_get_num_processors ()));
+    g_object_unref (task);
+
+    task = ufo_copy_task_new ();
+    g_assert_cmpuint (expand_with_replicas (task, 1), ==, 3);
+    g_object_unref (task);
+
+    task = ufo_copy_task_new ();
+    g_assert_cmpuint (expand_with_replicas (task, 4), ==, 6);
+    g_object_unref (task);
+
+    /* Tasks without exactly one input are never replicated */
+    task = ufo_dummy_task_new ();
+    g_assert_cmpuint (expand_with_replicas (task, 4), ==, 3);
+    g_object_unref (task);
+}
+
+static void
+test_setup_tasks (void)
+{
+    UfoBaseScheduler *scheduler;
+    UfoNode *node;
+    GList *tasks;
+    GList *it;
+    gdouble setup_time;
+    GError *error = NULL;
+
+    scheduler = ufo_scheduler_new ();
+    g_object_set (scheduler, "parallel-setup", TRUE, NULL);
+    node = ufo_dummy_task_new ();
+    tasks = g_list_append (NULL, node);
+
+    for (guint i = 0; i < 7; i++) {
+        tasks = g_list_append (tasks, ufo_node_copy (node, &error));
+        g_assert_no_error (error);
+    }
+
+    g_assert (ufo_base_scheduler_setup_tasks (scheduler, tasks, NULL, &error));
+    g_assert_no_error (error);
+
+    g_object_get (scheduler, "setup-time", &setup_time, NULL);
+    g_assert_cmpfloat (setup_time, >, 0.0);
+
+    for (it = tasks; it != NULL; it = g_list_next (it)) {
+        UfoProfiler *profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (it->data));
+
+        g_assert_cmpfloat (ufo_profiler_elapsed (profiler, UFO_PROFILER_TIMER_SETUP), <=, setup_time);
+    }
+
+    g_list_free_full (tasks, g_object_unref);
+    g_object_unref (scheduler);
+}
+
+static void
+test_counters (void)
+{
+    UfoTaskNode *node;
+    guint64 n_frames;
+    guint64 n_bytes;
+    guint64 wait_time;
+    guint n_queued;
+
+    node = UFO_TASK_NODE (ufo_dummy_task_new ());
+
+    ufo_task_node_add_to_counter (node, UFO_TASK_NODE_COUNTER_FRAMES_OUT, 2);
+    ufo_task_node_add_to_counter (node, UFO_TASK_NODE_COUNTER_FRAMES_OUT, 3);
+    g_assert_cmpuint (ufo_task_node_get_counter (node, UFO_TASK_NODE_COUNTER_FRAMES_OUT), ==, 5);
+
+    ufo_task_node_account_input (node, 1, 1024, 10, 4);
+    ufo_task_node_account_input (node, 1, 1024, 20, 2);
+    ufo_task_node_get_input_counters (node, 1, &n_frames, &n_bytes, &wait_time, &n_queued);
+    g_assert_cmpuint (n_frames, ==, 2);
+    g_assert_cmpuint (n_bytes, ==, 2048);
+    g_assert_cmpuint (wait_time, ==, 30);
+    g_assert_cmpuint (n_queued, ==, 2);
+    g_assert_cmpuint (ufo_task_node_get_counter (node, UFO_TASK_NODE_COUNTER_BYTES_IN), ==, 2048);
+    g_assert_cmpuint (ufo_task_node_get_counter (node, UFO_TASK_NODE_COUNTER_FETCH_TIME), ==, 30);
+
+    ufo_task_node_setup (node);
+    g_assert_cmpuint (ufo_task_node_get_counter (node, UFO_TASK_NODE_COUNTER_FRAMES_OUT), ==, 0);
+    ufo_task_node_get_input_counters (node, 1, &n_frames, &n_bytes, &wait_time, &n_queued);
+    g_assert_cmpuint (n_frames, ==, 0);
+
+    g_object_unref (node);
+}
+
+static void
+test_metrics_file (void)
+{
+    UfoBaseScheduler *scheduler;
+    UfoNode *node;
+    GList *tasks;
+    GError *error = NULL;
+    gchar *tmpdir;
+    gchar *filename;
+    gchar *contents = NULL;
+
+    tmpdir = g_dir_make_tmp ("ufo-metrics-XXXXXX", NULL);
+    filename = g_build_filename (tmpdir, "ufo.prom", NULL);
+
+    scheduler = ufo_scheduler_new ();
+    g_object_set (scheduler, "metrics-file", filename, "metrics-interval", 0.01, NULL);
+
+    node = ufo_dummy_task_new ();
+    tasks = g_list_append (NULL, node);
+    g_assert (ufo_base_scheduler_setup_tasks (scheduler, tasks, NULL, &error));
+    g_assert_no_error (error);
+
+    ufo_task_node_add_to_counter (UFO_TASK_NODE (node), UFO_TASK_NODE_COUNTER_FRAMES_OUT, 42);
+    ufo_task_node_add_to_counter (UFO_TASK_NODE (node), UFO_TASK_NODE_COUNTER_PROCESS_TIME, 1500000);
+
+    /* Snapshots are written while the scheduler is alive */
+    for (guint i = 0; i < 500 && !g_file_test (filename, G_FILE_TEST_EXISTS); i++)
+        g_usleep (1000);
+
+    g_assert (g_file_test (filename, G_FILE_TEST_EXISTS));
+
+    /* The final snapshot is written when the scheduler stops watching */
+    g_object_unref (scheduler);
+    g_assert (g_file_get_contents (filename, &contents, NULL, &error));
+    g_assert_no_error (error);
+
+    g_assert (strstr (contents, "# TYPE ufo_task_frames_out_total counter\n") != NULL);
+    g_assert (strstr (contents, "ufo_task_frames_out_total{task=\"[dummy]\",node=\"0\"} 42\n") != NULL);
+    g_assert (strstr (contents, "ufo_task_process_seconds_total{task=\"[dummy]\",node=\"0\"} 1.5\n") != NULL);
+
+    g_remove (filename);
+    g_rmdir (tmpdir);
+    g_free (contents);
+    g_free (filename);
+    g_free (tmpdir);
+    g_list_free_full (tasks, g_object_unref);
+}
+
+static void
+test_report (void)
+{
+    UfoBaseScheduler *scheduler;
+    UfoNode *nodes[2];
+    GList *tasks = NULL;
+    JsonParser *parser;
+    JsonObject *root;
+    GError *error = NULL;
+    gchar *report;
+
+    scheduler = ufo_scheduler_new ();
+
+    for (guint i = 0; i < 2; i++) {
+        nodes[i] = ufo_dummy_task_new ();
+        tasks = g_list_append (tasks, nodes[i]);
+    }
+
+    g_assert (ufo_base_scheduler_setup_tasks (scheduler, tasks, NULL, &error));
+    g_assert_no_error (error);
+
+    ufo_task_node_add_to_counter (UFO_TASK_NODE (nodes[0]), UFO_TASK_NODE_COUNTER_PROCESS_TIME, 10);
+    ufo_task_node_add_to_counter (UFO_TASK_NODE (nodes[1]), UFO_TASK_NODE_COUNTER_PROCESS_TIME, 20);
+    ufo_task_node_add_to_counter (UFO_TASK_NODE (nodes[1]), UFO_TASK_NODE_COUNTER_FRAMES_OUT, 7);
+
+    report = ufo_base_scheduler_get_report (scheduler, UFO_BASE_SCHEDULER_REPORT_TEXT);
+    g_assert (strstr (report, "Limited by [dummy] (1)") != NULL);
+    g_free (report);
+
+    report = ufo_base_scheduler_get_report (scheduler, UFO_BASE_SCHEDULER_REPORT_JSON);
+    parser = json_parser_new ();
+    json_parser_load_from_data (parser, report, -1, &error);
+    g_assert_no_error (error);
+
+    root = json_node_get_object (json_parser_get_root (parser));
+    g_assert_cmpint (json_object_get_int_member (root, "bottleneck"), ==, 1);
+    g_assert_cmpint (json_object_get_int_member (root, "frames"), ==, 7);
+    g_assert_cmpuint (json_array_get_length (json_object_get_array_member (root, "tasks")), ==, 2);
+
+    g_object_unref (parser);
+    g_free (report);
+    g_list_free_full (tasks, g_object_unref);
+    g_object_unref (scheduler);
+}
+
 void
 test_add_node (void)
 {
@@ -63,4 +349,25 @@ test_add_node (void)
 
     g_test_add_func ("/no-opencl/node/copy",
                      test_copy);
+
+    g_test_add_func ("/no-opencl/node/queue-depth",
+                     test_queue_depth);
+
+    g_test_add_func ("/no-opencl/node/in-group-order",
+                     test_in_group_order);
+
+    g_test_add_func ("/no-opencl/node/replicate",
+                     test_replicate);
+
+    g_test_add_func ("/no-opencl/node/setup-tasks",
+                     test_setup_tasks);
+
+    g_test_add_func ("/no-opencl/node/counters",
+                     test_counters);
+
+    g_test_add_func ("/no-opencl/node/metrics-file",
+                     test_metrics_file);
+
+    g_test_add_func ("/no-opencl/node/report",
+                     test_report);
 }
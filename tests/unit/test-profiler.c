@@ -62,10 +62,107 @@ test_timer_elapsed (Fixture *fixture, gconstpointer data)
                                     UFO_PROFILER_TIMER_IO) >= 0.001);
 }
 
+typedef struct {
+    UfoTraceWriter *writer;
+    guint index;
+} TraceData;
+
+static gpointer
+emit_trace_events (TraceData *data)
+{
+    UfoProfiler *profiler;
+    gchar *track;
+
+    profiler = ufo_profiler_new ();
+    track = g_strdup_printf ("track-%u", data->index);
+    ufo_profiler_enable_tracing (profiler, TRUE);
+    ufo_profiler_set_trace_writers (profiler, data->writer, NULL, track);
+
+    for (guint i = 0; i < 500; i++) {
+        ufo_profiler_trace_event (profiler, UFO_TRACE_EVENT_PROCESS | UFO_TRACE_EVENT_BEGIN);
+        ufo_profiler_trace_event (profiler, UFO_TRACE_EVENT_PROCESS | UFO_TRACE_EVENT_END);
+    }
+
+    ufo_profiler_set_trace_writers (profiler, NULL, NULL, NULL);
+    g_object_unref (profiler);
+    g_free (track);
+    return NULL;
+}
+
+static void
+test_trace_stream (void)
+{
+    UfoTraceWriter *writer;
+    JsonParser *parser;
+    JsonObject *root;
+    JsonArray *events;
+    GThread *threads[4];
+    TraceData data[4];
+    GError *error = NULL;
+    gchar *tmpdir;
+    gchar *input;
+    gchar *output;
+    guint n_begin = 0;
+    guint n_end = 0;
+
+    tmpdir = g_dir_make_tmp ("ufo-trace-XXXXXX", NULL);
+    input = g_build_filename (tmpdir, "trace.ufotrace", NULL);
+    output = g_build_filename (tmpdir, "trace.json", NULL);
+
+    writer = ufo_trace_writer_new (input, &error);
+    g_assert_no_error (error);
+
+    for (guint i = 0; i < 4; i++) {
+        data[i].writer = writer;
+        data[i].index = i;
+        threads[i] = g_thread_new (NULL, (GThreadFunc) emit_trace_events, &data[i]);
+    }
+
+    for (guint i = 0; i < 4; i++)
+        g_thread_join (threads[i]);
+
+    g_assert_cmpuint (ufo_trace_writer_get_n_dropped (writer), ==, 0);
+    ufo_trace_writer_free (writer);
+
+    g_assert (ufo_trace_convert_to_json (input, output, &error));
+    g_assert_no_error (error);
+
+    parser = json_parser_new ();
+    json_parser_load_from_file (parser, output, &error);
+    g_assert_no_error (error);
+
+    root = json_node_get_object (json_parser_get_root (parser));
+    events = json_object_get_array_member (root, "traceEvents");
+
+    for (guint i = 0; i < json_array_get_length (events); i++) {
+        JsonObject *event = json_array_get_object_element (events, i);
+        const gchar *phase = json_object_get_string_member (event, "ph");
+
+        g_assert_cmpstr (json_object_get_string_member (event, "name"), ==, "process");
+        n_begin += g_strcmp0 (phase, "B") == 0;
+        n_end += g_strcmp0 (phase, "E") == 0;
+    }
+
+    g_assert_cmpuint (n_begin, ==, 4 * 500);
+    g_assert_cmpuint (n_end, ==, 4 * 500);
+    g_assert_cmpint (json_object_get_int_member (json_object_get_object_member (root, "otherData"),
+                                                 "droppedEvents"), ==, 0);
+
+    g_object_unref (parser);
+    g_remove (output);
+    g_remove (input);
+    g_rmdir (tmpdir);
+    g_free (output);
+    g_free (input);
+    g_free (tmpdir);
+}
 
 void
 test_add_profiler (void)
 {
+    g_test_add_func ("/no-opencl/trace/stream",
+                     test_trace_stream);
+
     g_test_add ("/no-opencl/timer/elapsed",
                 Fixture,
                 NULL,
@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2011-2013 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ufo/ufo.h>
+#include "test-suite.h"
+
+#define N_ITEMS         4
+#define N_ITERATIONS    200000
+
+typedef struct {
+    UfoTwoWayQueue *queue;
+    gint items[N_ITEMS];
+} Fixture;
+
+typedef struct {
+    GAsyncQueue *producer_queue;
+    GAsyncQueue *consumer_queue;
+} AsyncQueuePair;
+
+static void
+setup (Fixture *fixture, gconstpointer data)
+{
+    fixture->queue = ufo_two_way_queue_new (NULL);
+
+    for (guint i = 0; i < N_ITEMS; i++)
+        ufo_two_way_queue_insert (fixture->queue, &fixture->items[i]);
+}
+
+static void
+teardown (Fixture *fixture, gconstpointer data)
+{
+    ufo_two_way_queue_free (fixture->queue);
+}
+
+static void
+test_insert (Fixture *fixture, gconstpointer data)
+{
+    GList *inserted;
+    GList *it;
+    guint i = 0;
+
+    g_assert_cmpuint (ufo_two_way_queue_get_capacity (fixture->queue), ==, N_ITEMS);
+
+    inserted = ufo_two_way_queue_get_inserted (fixture->queue);
+    g_assert_cmpuint (g_list_length (inserted), ==, N_ITEMS);
+
+    for (it = inserted; it != NULL; it = g_list_next (it))
+        g_assert (it->data == &fixture->items[i++]);
+}
+
+static void
+test_order (Fixture *fixture, gconstpointer data)
+{
+    gpointer items[N_ITEMS];
+
+    for (guint i = 0; i < N_ITEMS; i++) {
+        items[i] = ufo_two_way_queue_producer_pop (fixture->queue);
+        g_assert (items[i] == &fixture->items[i]);
+    }
+
+    for (guint i = 0; i < N_ITEMS; i++)
+        ufo_two_way_queue_producer_push (fixture->queue, items[i]);
+
+    for (guint i = 0; i < N_ITEMS; i++)
+        g_assert (ufo_two_way_queue_consumer_pop (fixture->queue) == &fixture->items[i]);
+}
+
+static void
+test_full (Fixture *fixture, gconstpointer data)
+{
+    gint items[UFO_TWO_WAY_QUEUE_MAX_CAPACITY - N_ITEMS + 1];
+
+    for (guint i = 0; i < UFO_TWO_WAY_QUEUE_MAX_CAPACITY - N_ITEMS; i++)
+        ufo_two_way_queue_insert (fixture->queue, &items[i]);
+
+    g_assert_cmpuint (ufo_two_way_queue_get_capacity (fixture->queue), ==, UFO_TWO_WAY_QUEUE_MAX_CAPACITY);
+    g_assert_cmpuint (g_list_length (ufo_two_way_queue_get_inserted (fixture->queue)), ==, UFO_TWO_WAY_QUEUE_MAX_CAPACITY);
+
+    /* One more item is a programming error that must not go unnoticed */
+    if (g_test_subprocess ()) {
+        ufo_two_way_queue_insert (fixture->queue, &items[UFO_TWO_WAY_QUEUE_MAX_CAPACITY - N_ITEMS]);
+        return;
+    }
+
+    g_test_trap_subprocess (NULL, 0, 0);
+    g_test_trap_assert_failed ();
+    g_test_trap_assert_stderr ("*Cannot insert*");
+}
+
+static gpointer
+produce (UfoTwoWayQueue *queue)
+{
+    for (guint i = 0; i < N_ITERATIONS; i++) {
+        gint *item;
+
+        item = ufo_two_way_queue_producer_pop (queue);
+        *item = i;
+        ufo_two_way_queue_producer_push (queue, item);
+    }
+
+    return NULL;
+}
+
+static void
+test_threaded (Fixture *fixture, gconstpointer data)
+{
+    GThread *thread;
+
+    thread = g_thread_new (NULL, (GThreadFunc) produce, fixture->queue);
+
+    for (guint i = 0; i < N_ITERATIONS; i++) {
+        gint *item;
+
+        item = ufo_two_way_queue_consumer_pop (fixture->queue);
+        g_assert_cmpint (*item, ==, i);
+        ufo_two_way_queue_consumer_push (fixture->queue, item);
+    }
+
+    g_thread_join (thread);
+}
+
+static gpointer
+produce_async (AsyncQueuePair *pair)
+{
+    for (guint i = 0; i < N_ITERATIONS; i++) {
+        gint *item;
+
+        item = g_async_queue_pop (pair->producer_queue);
+        *item = i;
+        g_async_queue_push (pair->consumer_queue, item);
+    }
+
+    return NULL;
+}
+
+static void
+test_benchmark (Fixture *fixture, gconstpointer data)
+{
+    AsyncQueuePair pair;
+    GThread *thread;
+    GTimer *timer;
+    gdouble ring_time;
+    gdouble async_time;
+
+    if (!g_test_perf ())
+        return;
+
+    timer = g_timer_new ();
+    test_threaded (fixture, data);
+    ring_time = g_timer_elapsed (timer, NULL);
+
+    pair.producer_queue = g_async_queue_new ();
+    pair.consumer_queue = g_async_queue_new ();
+
+    for (guint i = 0; i < N_ITEMS; i++)
+        g_async_queue_push (pair.producer_queue, &fixture->items[i]);
+
+    g_timer_start (timer);
+    thread = g_thread_new (NULL, (GThreadFunc) produce_async, &pair);
+
+    for (guint i = 0; i < N_ITERATIONS; i++)
+        g_async_queue_push (pair.producer_queue, g_async_queue_pop (pair.consumer_queue));
+
+    g_thread_join (thread);
+    async_time = g_timer_elapsed (timer, NULL);
+
+    g_test_minimized_result (ring_time, "UfoTwoWayQueue: %.0f items/s", N_ITERATIONS / ring_time);
+    g_test_message ("GAsyncQueue: %.0f items/s", N_ITERATIONS / async_time);
+
+    g_async_queue_unref (pair.producer_queue);
+    g_async_queue_unref (pair.consumer_queue);
+    g_timer_destroy (timer);
+}
+
+void
+test_add_queue (void)
+{
+    g_test_add ("/no-opencl/queue/insert",
+                Fixture, NULL,
+                setup, test_insert, teardown);
+
+    g_test_add ("/no-opencl/queue/order",
+                Fixture, NULL,
+                setup, test_order, teardown);
+
+    g_test_add ("/no-opencl/queue/full",
+                Fixture, NULL,
+                setup, test_full, teardown);
+
+    g_test_add ("/no-opencl/queue/threaded",
+                Fixture, NULL,
+                setup, test_threaded, teardown);
+
+    g_test_add ("/no-opencl/queue/benchmark",
+                Fixture, NULL,
+                setup, test_benchmark, teardown);
+}
@@ -0,0 +1,636 @@
+/*
+ * Copyright (C) 2011-2013 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <glib/gstdio.h>
+#include <ufo/ufo.h>
+#include "test-suite.h"
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#define N_BENCHMARK_KERNELS     64
+#define N_CONCURRENT_REQUESTS   4
+#define N_TUNED_CALLS           256
+#define N_SAMPLED_CALLS         40
+#define SAMPLE_RATE             4
+
+typedef struct {
+    gchar *cache_dir;
+} Fixture;
+
+static const gchar *fill_source =
+    "__kernel void fill (global float *out) { out[get_global_id (0)] = 1.0f; }";
+
+static void
+setup (Fixture *fixture, gconstpointer data)
+{
+    fixture->cache_dir = g_dir_make_tmp ("ufo-kernel-cache-XXXXXX", NULL);
+    g_assert (fixture->cache_dir != NULL);
+    g_setenv ("UFO_KERNEL_CACHE_DIR", fixture->cache_dir, TRUE);
+}
+
+static GList *
+get_entries (Fixture *fixture)
+{
+    GDir *dir;
+    GList *entries = NULL;
+    const gchar *name;
+
+    dir = g_dir_open (fixture->cache_dir, 0, NULL);
+
+    while ((name = g_dir_read_name (dir)) != NULL)
+        entries = g_list_append (entries, g_build_filename (fixture->cache_dir, name, NULL));
+
+    g_dir_close (dir);
+    return entries;
+}
+
+static void
+clear_entries (Fixture *fixture)
+{
+    GList *entries;
+    GList *it;
+
+    entries = get_entries (fixture);
+
+    for (it = entries; it != NULL; it = g_list_next (it))
+        g_unlink ((gchar *) it->data);
+
+    g_list_free_full (entries, g_free);
+}
+
+static void
+teardown (Fixture *fixture, gconstpointer data)
+{
+    clear_entries (fixture);
+    g_rmdir (fixture->cache_dir);
+    g_unsetenv ("UFO_KERNEL_CACHE_DIR");
+    g_free (fixture->cache_dir);
+}
+
+static UfoResources *
+create_resources (void)
+{
+    UfoResources *resources;
+    GError *error = NULL;
+
+    resources = ufo_resources_new (&error);
+
+    if (error != NULL) {
+        g_test_skip (error->message);
+        g_error_free (error);
+        return NULL;
+    }
+
+    return resources;
+}
+
+static gdouble
+time_startup (const gchar *source)
+{
+    UfoResources *resources;
+    GTimer *timer;
+    GError *error = NULL;
+    gdouble elapsed;
+
+    timer = g_timer_new ();
+    resources = create_resources ();
+
+    if (resources == NULL) {
+        g_timer_destroy (timer);
+        return -1.0;
+    }
+
+    g_assert (ufo_resources_get_kernel_from_source (resources, source, NULL, NULL, &error) != NULL);
+    g_assert_no_error (error);
+    elapsed = g_timer_elapsed (timer, NULL);
+
+    g_object_unref (resources);
+    g_timer_destroy (timer);
+    return elapsed;
+}
+
+static void
+test_kernel_cache (Fixture *fixture, gconstpointer data)
+{
+    GList *entries;
+    GList *it;
+    guint n_entries;
+
+    if (time_startup (fill_source) < 0.0)
+        return;
+
+    entries = get_entries (fixture);
+    n_entries = g_list_length (entries);
+    g_assert_cmpuint (n_entries, >, 0);
+    g_list_free_full (entries, g_free);
+
+    /* Loading from the cache must not add entries */
+    time_startup (fill_source);
+    entries = get_entries (fixture);
+    g_assert_cmpuint (g_list_length (entries), ==, n_entries);
+
+    /* Damaged entries are replaced by a fresh build */
+    for (it = entries; it != NULL; it = g_list_next (it))
+        g_file_set_contents ((gchar *) it->data, "garbage", -1, NULL);
+
+    time_startup (fill_source);
+
+    for (it = entries; it != NULL; it = g_list_next (it)) {
+        gchar *contents;
+
+        g_assert (g_file_get_contents ((gchar *) it->data, &contents, NULL, NULL));
+        g_assert (g_str_has_prefix (contents, "UFOCLBIN"));
+        g_free (contents);
+    }
+
+    g_list_free_full (entries, g_free);
+}
+
+typedef struct {
+    UfoResources *resources;
+    const gchar *source;
+} BuildRequest;
+
+static gpointer
+request_kernel (BuildRequest *request)
+{
+    GError *error = NULL;
+    gpointer kernel;
+
+    kernel = ufo_resources_get_kernel_from_source (request->resources, request->source, NULL, NULL, &error);
+    g_assert_no_error (error);
+    return kernel;
+}
+
+static void
+test_concurrent_builds (Fixture *fixture, gconstpointer data)
+{
+    static const gchar *sources[] = {
+        "__kernel void a (global float *x) { x[get_global_id (0)] += 1.0f; }",
+        "__kernel void b (global float *x) { x[get_global_id (0)] *= 2.0f; }",
+    };
+
+    BuildRequest requests[N_CONCURRENT_REQUESTS];
+    GThread *threads[N_CONCURRENT_REQUESTS];
+    UfoResources *resources;
+
+    resources = create_resources ();
+
+    if (resources == NULL)
+        return;
+
+    /* Every source is requested twice to exercise waiting for a build */
+    for (guint i = 0; i < N_CONCURRENT_REQUESTS; i++) {
+        requests[i].resources = resources;
+        requests[i].source = sources[i % G_N_ELEMENTS (sources)];
+        threads[i] = g_thread_new (NULL, (GThreadFunc) request_kernel, &requests[i]);
+    }
+
+    for (guint i = 0; i < N_CONCURRENT_REQUESTS; i++)
+        g_assert (g_thread_join (threads[i]) != NULL);
+
+    g_object_unref (resources);
+}
+
+typedef struct {
+    UfoResources *resources;
+    const gchar *filename;
+} KernelRequest;
+
+static gpointer
+request_thread_kernel (KernelRequest *request)
+{
+    GError *error = NULL;
+    gpointer kernel;
+
+    kernel = ufo_resources_get_thread_kernel (request->resources, request->filename, "fill", &error);
+    g_assert_no_error (error);
+    return kernel;
+}
+
+static void
+test_thread_kernels (Fixture *fixture, gconstpointer data)
+{
+    UfoResources *resources;
+    KernelRequest request;
+    GThread *thread;
+    gpointer kernel;
+    gchar *filename;
+
+    resources = create_resources ();
+
+    if (resources == NULL)
+        return;
+
+    filename = g_build_filename (fixture->cache_dir, "fill.cl", NULL);
+    g_assert (g_file_set_contents (filename, fill_source, -1, NULL));
+
+    request.resources = resources;
+    request.filename = filename;
+    kernel = request_thread_kernel (&request);
+    g_assert (kernel != NULL);
+    g_assert (request_thread_kernel (&request) == kernel);
+
+    /* Another thread must not receive the same kernel object */
+    thread = g_thread_new (NULL, (GThreadFunc) request_thread_kernel, &request);
+    g_assert (g_thread_join (thread) != kernel);
+
+    /* Nor another resources object on the same thread */
+    request.resources = create_resources ();
+    g_assert (request_thread_kernel (&request) != kernel);
+    g_object_unref (request.resources);
+
+    g_object_unref (resources);
+    g_free (filename);
+}
+
+static void
+test_work_size_tuning (Fixture *fixture, gconstpointer data)
+{
+    UfoResources *resources;
+    UfoProfiler *profiler;
+    GList *queues;
+    GError *error = NULL;
+    gpointer queue;
+    gpointer kernel;
+    cl_mem d_data;
+    cl_int errcode;
+    gchar *filename;
+    gchar *contents;
+    gfloat *host_data;
+    gsize size = 4096;
+
+    resources = create_resources ();
+
+    if (resources == NULL)
+        return;
+
+    queues = ufo_resources_get_cmd_queues (resources);
+    queue = queues->data;
+    kernel = ufo_resources_get_kernel_from_source (resources,
+        "__kernel void tune_increment (global float *x) { x[get_global_id (0)] += 1.0f; }",
+        NULL, NULL, &error);
+    g_assert_no_error (error);
+
+    host_data = g_new0 (gfloat, size);
+    d_data = clCreateBuffer (ufo_resources_get_context (resources), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                             size * sizeof (gfloat), host_data, &errcode);
+    g_assert (errcode == CL_SUCCESS);
+    g_assert (clSetKernelArg (kernel, 0, sizeof (cl_mem), &d_data) == CL_SUCCESS);
+
+    /* Tuning must not run the kernel more often than requested */
+    profiler = ufo_profiler_new ();
+
+    for (guint i = 0; i < N_TUNED_CALLS; i++) {
+        ufo_profiler_call (profiler, queue, kernel, 1, &size, NULL);
+
+        if (i == N_TUNED_CALLS / 2)
+            clFinish (queue);
+    }
+
+    g_assert (clEnqueueReadBuffer (queue, d_data, CL_TRUE, 0, size * sizeof (gfloat), host_data,
+                                   0, NULL, NULL) == CL_SUCCESS);
+
+    for (gsize i = 0; i < size; i++)
+        g_assert_cmpfloat (host_data[i], ==, (gfloat) N_TUNED_CALLS);
+
+    /* The result is remembered for the next process */
+    filename = g_build_filename (fixture->cache_dir, "work-sizes.ini", NULL);
+    g_assert (g_file_get_contents (filename, &contents, NULL, NULL));
+    g_assert (strstr (contents, "tune_increment/1/4096=") != NULL);
+
+    g_free (contents);
+    g_free (filename);
+    g_free (host_data);
+    clReleaseMemObject (d_data);
+    g_object_unref (profiler);
+    g_list_free (queues);
+    g_object_unref (resources);
+}
+
+typedef struct {
+    guint   n_kernels;
+    guint64 n_launches;
+    guint64 n_samples;
+    gdouble total;
+    gdouble p50;
+    gdouble p99;
+} KernelStats;
+
+static void
+record_kernel_stats (const gchar *kernel,
+                     guint64 n_launches,
+                     guint64 n_samples,
+                     gdouble total,
+                     gdouble p50,
+                     gdouble p99,
+                     KernelStats *stats)
+{
+    g_assert_cmpstr (kernel, ==, "sample_increment");
+    stats->n_kernels++;
+    stats->n_launches = n_launches;
+    stats->n_samples = n_samples;
+    stats->total = total;
+    stats->p50 = p50;
+    stats->p99 = p99;
+}
+
+static void
+test_kernel_sampling (Fixture *fixture, gconstpointer data)
+{
+    UfoResources *resources;
+    UfoProfiler *profiler;
+    UfoProfiler *other;
+    KernelStats stats = { 0, };
+    GList *queues;
+    GError *error = NULL;
+    gpointer queue;
+    gpointer kernel;
+    cl_kernel copy;
+    cl_program program;
+    cl_mem d_data;
+    cl_int errcode;
+    gfloat *host_data;
+    gsize size = 4096;
+
+    resources = create_resources ();
+
+    if (resources == NULL)
+        return;
+
+    queues = ufo_resources_get_cmd_queues (resources);
+    queue = queues->data;
+    kernel = ufo_resources_get_kernel_from_source (resources,
+        "__kernel void sample_increment (global float *x) { x[get_global_id (0)] += 1.0f; }",
+        NULL, NULL, &error);
+    g_assert_no_error (error);
+
+    host_data = g_new0 (gfloat, size);
+    d_data = clCreateBuffer (ufo_resources_get_context (resources), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                             size * sizeof (gfloat), host_data, &errcode);
+    g_assert (errcode == CL_SUCCESS);
+    g_assert (clSetKernelArg (kernel, 0, sizeof (cl_mem), &d_data) == CL_SUCCESS);
+
+    /* A second kernel object of the same function, as handed out per thread */
+    g_assert (clGetKernelInfo (kernel, CL_KERNEL_PROGRAM, sizeof (cl_program), &program, NULL) == CL_SUCCESS);
+    copy = clCreateKernel (program, "sample_increment", &errcode);
+    g_assert (errcode == CL_SUCCESS);
+    g_assert (clSetKernelArg (copy, 0, sizeof (cl_mem), &d_data) == CL_SUCCESS);
+
+    /* Both profilers share the sampler thread */
+    profiler = ufo_profiler_new ();
+    other = ufo_profiler_new ();
+    ufo_profiler_set_sample_rate (profiler, SAMPLE_RATE);
+    ufo_profiler_set_sample_rate (other, SAMPLE_RATE);
+
+    for (guint i = 0; i < N_SAMPLED_CALLS; i++) {
+        gpointer current = i % 2 ? kernel : (gpointer) copy;
+
+        if (i % 3 == 0)
+            ufo_profiler_call_blocking (profiler, queue, current, 1, &size, NULL);
+        else
+            ufo_profiler_call (profiler, queue, current, 1, &size, NULL);
+    }
+
+    /* Stopping collects the outstanding samples */
+    ufo_profiler_set_sample_rate (other, 0);
+    ufo_profiler_set_sample_rate (profiler, 0);
+    ufo_profiler_foreach_kernel_stats (profiler, (UfoProfilerKernelFunc) record_kernel_stats, &stats);
+
+    g_assert_cmpuint (stats.n_kernels, ==, 1);
+    g_assert_cmpuint (stats.n_launches, ==, N_SAMPLED_CALLS);
+    g_assert_cmpuint (stats.n_samples, ==, N_SAMPLED_CALLS / SAMPLE_RATE);
+    g_assert_cmpfloat (stats.p50, >, 0.0);
+    g_assert_cmpfloat (stats.p50, <=, stats.p99);
+    g_assert_cmpfloat (stats.total, >=, stats.p50);
+
+    g_assert (clEnqueueReadBuffer (queue, d_data, CL_TRUE, 0, size * sizeof (gfloat), host_data,
+                                   0, NULL, NULL) == CL_SUCCESS);
+
+    for (gsize i = 0; i < size; i++)
+        g_assert_cmpfloat (host_data[i], ==, (gfloat) N_SAMPLED_CALLS);
+
+    g_free (host_data);
+    clReleaseMemObject (d_data);
+    clReleaseKernel (copy);
+    g_object_unref (profiler);
+    g_object_unref (other);
+    g_list_free (queues);
+    g_object_unref (resources);
+}
+
+static void
+test_buffer_transfers (Fixture *fixture, gconstpointer data)
+{
+    UfoResources *resources;
+    UfoBuffer *buffer;
+    UfoRequisition requisition = { .n_dims = 2, .dims = { 256, 128 } };
+    GList *queues;
+    gpointer queue;
+    gfloat *host;
+    guint64 n_transfers;
+    guint64 n_bytes;
+    gdouble time;
+
+    resources = create_resources ();
+
+    if (resources == NULL)
+        return;
+
+    queues = ufo_resources_get_cmd_queues (resources);
+    queue = queues->data;
+    buffer = ufo_buffer_new (&requisition, ufo_resources_get_context (resources));
+
+    /* Up, down and up again */
+    host = ufo_buffer_get_host_array (buffer, queue);
+    host[0] = 1.0f;
+    g_assert (ufo_buffer_get_device_array (buffer, queue) != NULL);
+    host = ufo_buffer_get_host_array (buffer, queue);
+    host[0] = 2.0f;
+    g_assert (ufo_buffer_get_device_array (buffer, queue) != NULL);
+    g_assert (ufo_buffer_get_host_array (buffer, queue)[0] == 2.0f);
+
+    ufo_buffer_get_transfer_counters (buffer, UFO_BUFFER_TRANSFER_HOST_TO_DEVICE, &n_transfers, &n_bytes, &time);
+    g_assert_cmpuint (n_transfers, ==, 2);
+    g_assert_cmpuint (n_bytes, ==, 2 * ufo_buffer_get_size (buffer));
+    g_assert_cmpfloat (time, >=, 0.0);
+
+    ufo_buffer_get_transfer_counters (buffer, UFO_BUFFER_TRANSFER_DEVICE_TO_HOST, &n_transfers, &n_bytes, &time);
+    g_assert_cmpuint (n_transfers, ==, 2);
+    g_assert_cmpuint (n_bytes, ==, 2 * ufo_buffer_get_size (buffer));
+    g_assert_cmpfloat (time, >=, 0.0);
+
+    ufo_buffer_get_transfer_counters (buffer, UFO_BUFFER_TRANSFER_DEVICE_TO_DEVICE, &n_transfers, NULL, NULL);
+    g_assert_cmpuint (n_transfers, ==, 0);
+    g_object_unref (buffer);
+
+    /* Narrow data is uploaded as is and widened on the device */
+    buffer = ufo_buffer_new (&requisition, ufo_resources_get_context (resources));
+    ufo_buffer_set_storage_depth (buffer, UFO_BUFFER_DEPTH_8U);
+    memset (ufo_buffer_get_raw_host_array (buffer, queue), 1, 256 * 128);
+    g_assert (ufo_buffer_get_device_array (buffer, queue) != NULL);
+
+    ufo_buffer_get_transfer_counters (buffer, UFO_BUFFER_TRANSFER_HOST_TO_DEVICE, &n_transfers, &n_bytes, NULL);
+    g_assert_cmpuint (n_transfers, ==, 1);
+    g_assert_cmpuint (n_bytes, ==, 256 * 128);
+
+    g_object_unref (buffer);
+    g_list_free (queues);
+    g_object_unref (resources);
+}
+
+static void
+test_expression_on_device (Fixture *fixture, gconstpointer data)
+{
+    static const gchar *names[] = { "a", "b", NULL };
+    UfoResources *resources;
+    UfoRequisition requisition = { .n_dims = 2, .dims = { 64, 32 } };
+    UfoBuffer *args[2];
+    UfoBuffer *out;
+    GList *queues;
+    gpointer queue;
+    gpointer event;
+    gfloat *host;
+    guint8 *raw;
+    gsize n;
+    GError *error = NULL;
+
+    resources = create_resources ();
+
+    if (resources == NULL)
+        return;
+
+    queues = ufo_resources_get_cmd_queues (resources);
+    queue = queues->data;
+    n = requisition.dims[0] * requisition.dims[1];
+
+    args[0] = ufo_buffer_new (&requisition, ufo_resources_get_context (resources));
+    args[1] = ufo_buffer_new (&requisition, ufo_resources_get_context (resources));
+    out = ufo_buffer_new (&requisition, ufo_resources_get_context (resources));
+
+    host = ufo_buffer_get_host_array (args[0], queue);
+    ufo_buffer_set_storage_depth (args[1], UFO_BUFFER_DEPTH_8U);
+    raw = ufo_buffer_get_raw_host_array (args[1], queue);
+
+    for (gsize i = 0; i < n; i++) {
+        host[i] = (gfloat) i;
+        raw[i] = (guint8) (i % 256);
+    }
+
+    /* Operands on the host are evaluated there */
+    event = ufo_op_expression ("a + b", names, args, out, resources, queue, &error);
+    g_assert_no_error (error);
+    g_assert (event == NULL);
+    g_assert (ufo_buffer_get_location (out) == UFO_BUFFER_LOCATION_HOST);
+
+    /* Once an operand is on the device, the kernel path is taken */
+    g_assert (ufo_buffer_get_device_array (args[0], queue) != NULL);
+    event = ufo_op_expression ("a * 2 - b", names, args, out, resources, queue, &error);
+    g_assert_no_error (error);
+    g_assert (event != NULL);
+    g_assert (clWaitForEvents (1, (cl_event *) &event) == CL_SUCCESS);
+    clReleaseEvent (event);
+    g_assert (ufo_buffer_get_location (out) == UFO_BUFFER_LOCATION_DEVICE);
+
+    host = ufo_buffer_get_host_array (out, queue);
+
+    for (gsize i = 0; i < n; i++)
+        g_assert_cmpfloat (host[i], ==, 2.0f * i - (gfloat) (i % 256));
+
+    g_object_unref (args[0]);
+    g_object_unref (args[1]);
+    g_object_unref (out);
+    g_list_free (queues);
+    g_object_unref (resources);
+}
+
+static void
+test_startup_benchmark (Fixture *fixture, gconstpointer data)
+{
+    GString *source;
+    gdouble cold;
+    gdouble warm;
+
+    if (!g_test_perf ())
+        return;
+
+    source = g_string_new (NULL);
+
+    for (guint i = 0; i < N_BENCHMARK_KERNELS; i++) {
+        g_string_append_printf (source,
+            "__kernel void k%u (global float *x, const float a)\n"
+            "{\n"
+            "    const int idx = get_global_id (0);\n"
+            "    float v = x[idx];\n"
+            "    for (int j = 0; j < %u; j++) v = sin (v) * a + cos (v * %u.0f);\n"
+            "    x[idx] = v;\n"
+            "}\n", i, i + 1, i);
+    }
+
+    cold = time_startup (source->str);
+
+    if (cold >= 0.0) {
+        warm = time_startup (source->str);
+        g_test_minimized_result (warm, "Startup with cached binaries: %.3fs", warm);
+        g_test_message ("Startup with compilation: %.3fs (%.1fx)", cold, cold / warm);
+    }
+
+    g_string_free (source, TRUE);
+}
+
+void
+test_add_resources (void)
+{
+    g_test_add ("/resources/kernel-cache",
+                Fixture, NULL,
+                setup, test_kernel_cache, teardown);
+
+    g_test_add ("/resources/concurrent-builds",
+                Fixture, NULL,
+                setup, test_concurrent_builds, teardown);
+
+    g_test_add ("/resources/thread-kernels",
+                Fixture, NULL,
+                setup, test_thread_kernels, teardown);
+
+    g_test_add ("/resources/work-size-tuning",
+                Fixture, NULL,
+                setup, test_work_size_tuning, teardown);
+
+    g_test_add ("/resources/kernel-sampling",
+                Fixture, NULL,
+                setup, test_kernel_sampling, teardown);
+
+    g_test_add ("/resources/buffer-transfers",
+                Fixture, NULL,
+                setup, test_buffer_transfers, teardown);
+
+    g_test_add ("/resources/expression",
+                Fixture, NULL,
+                setup, test_expression_on_device, teardown);
+
+    g_test_add ("/resources/kernel-cache/benchmark",
+                Fixture, NULL,
+                setup, test_startup_benchmark, teardown);
+}
@@ -0,0 +1,465 @@
+/*
+ * Copyright (C) 2011-2013 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <ufo/ufo.h>
+#include "test-suite.h"
+
+#define N_FRAMES    10
+#define FRAME_SIZE  16
+
+/*
+ * A CPU task whose behaviour is chosen by its mode: generators produce frames
+ * filled with the frame number, processors pass their input on, reductors sum
+ * up the frame numbers and all of them check the order of their inputs.
+ * Sinks with a command queue only move their input to the device.
+ */
+typedef struct {
+    UfoTaskNode parent_instance;
+    UfoTaskMode mode;
+    guint n_inputs;
+    guint n_generated;
+    guint n_processed;
+    gfloat last;
+    gfloat sum;
+    gboolean in_order;
+    gboolean scribble;
+    gulong delay;
+    gpointer queue;
+} TestTask;
+
+typedef struct {
+    UfoTaskNodeClass parent_class;
+} TestTaskClass;
+
+static void test_task_interface_init (UfoTaskIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (TestTask, test_task, UFO_TYPE_TASK_NODE,
+                         G_IMPLEMENT_INTERFACE (UFO_TYPE_TASK,
+                                                test_task_interface_init))
+
+static TestTask *
+test_task_new (UfoTaskMode mode, const gchar *name)
+{
+    TestTask *task;
+
+    task = g_object_new (test_task_get_type (), NULL);
+    task->mode = mode | UFO_TASK_MODE_CPU;
+    task->n_inputs = (mode & UFO_TASK_MODE_GENERATOR) ? 0 : 1;
+    ufo_task_node_set_plugin_name (UFO_TASK_NODE (task), name);
+    return task;
+}
+
+static void
+test_task_setup (UfoTask *task,
+                 UfoResources *resources,
+                 GError **error)
+{
+}
+
+static void
+test_task_get_requisition (UfoTask *task,
+                           UfoBuffer **inputs,
+                           UfoRequisition *requisition,
+                           GError **error)
+{
+    requisition->n_dims = 1;
+    requisition->dims[0] = FRAME_SIZE;
+}
+
+static guint
+test_task_get_num_inputs (UfoTask *task)
+{
+    return ((TestTask *) task)->n_inputs;
+}
+
+static guint
+test_task_get_num_dimensions (UfoTask *task,
+                              guint input)
+{
+    return 1;
+}
+
+static UfoTaskMode
+test_task_get_mode (UfoTask *task)
+{
+    return ((TestTask *) task)->mode;
+}
+
+static gboolean
+test_task_process (UfoTask *task,
+                   UfoBuffer **inputs,
+                   UfoBuffer *output,
+                   UfoRequisition *requisition)
+{
+    TestTask *self = (TestTask *) task;
+    gfloat *data;
+
+    if (self->delay > 0)
+        g_usleep (self->delay);
+
+    if (self->queue != NULL) {
+        g_assert (ufo_buffer_get_device_array (inputs[0], self->queue) != NULL);
+        self->n_processed++;
+        return TRUE;
+    }
+
+    data = ufo_buffer_get_host_array (inputs[0], NULL);
+
+    for (guint i = 0; i < FRAME_SIZE; i++)
+        self->in_order = self->in_order && data[i] == (gfloat) self->n_processed;
+
+    self->last = data[0];
+    self->sum += data[0];
+    self->n_processed++;
+
+    if (self->scribble) {
+        for (guint i = 0; i < FRAME_SIZE; i++)
+            data[i] = -1.0f;
+    }
+
+    if (output != NULL && (self->mode & UFO_TASK_MODE_PROCESSOR))
+        ufo_buffer_copy (inputs[0], output);
+
+    return TRUE;
+}
+
+static gboolean
+test_task_generate (UfoTask *task,
+                    UfoBuffer *output,
+                    UfoRequisition *requisition)
+{
+    TestTask *self = (TestTask *) task;
+    gfloat *data;
+    gfloat value;
+
+    if (self->mode & UFO_TASK_MODE_REDUCTOR) {
+        if (self->n_generated > 0)
+            return FALSE;
+
+        value = self->sum;
+    }
+    else {
+        if (self->n_generated == N_FRAMES)
+            return FALSE;
+
+        value = (gfloat) self->n_generated;
+    }
+
+    data = ufo_buffer_get_host_array (output, NULL);
+
+    for (guint i = 0; i < FRAME_SIZE; i++)
+        data[i] = value;
+
+    self->n_generated++;
+    return TRUE;
+}
+
+static void
+test_task_interface_init (UfoTaskIface *iface)
+{
+    iface->setup = test_task_setup;
+    iface->get_num_inputs = test_task_get_num_inputs;
+    iface->get_num_dimensions = test_task_get_num_dimensions;
+    iface->get_mode = test_task_get_mode;
+    iface->get_requisition = test_task_get_requisition;
+    iface->process = test_task_process;
+    iface->generate = test_task_generate;
+}
+
+static void
+test_task_class_init (TestTaskClass *klass)
+{
+}
+
+static void
+test_task_init (TestTask *self)
+{
+    self->in_order = TRUE;
+}
+
+static void
+run_pool (UfoTaskGraph *graph, GError **error)
+{
+    UfoBaseScheduler *scheduler;
+
+    scheduler = ufo_pool_scheduler_new ();
+    g_object_set (scheduler, "num-workers", 3, NULL);
+    ufo_base_scheduler_run (scheduler, graph, error);
+    g_object_unref (scheduler);
+}
+
+static void
+test_pool_pipeline (void)
+{
+    UfoTaskGraph *graph;
+    TestTask *source;
+    TestTask *pass;
+    TestTask *sink;
+    GError *error = NULL;
+
+    graph = UFO_TASK_GRAPH (ufo_task_graph_new ());
+    source = test_task_new (UFO_TASK_MODE_GENERATOR, "source");
+    pass = test_task_new (UFO_TASK_MODE_PROCESSOR, "pass");
+    sink = test_task_new (UFO_TASK_MODE_SINK, "sink");
+
+    ufo_task_graph_connect_nodes (graph, UFO_TASK (source), UFO_TASK (pass));
+    ufo_task_graph_connect_nodes (graph, UFO_TASK (pass), UFO_TASK (sink));
+
+    run_pool (graph, &error);
+    g_assert_no_error (error);
+
+    g_assert_cmpuint (source->n_generated, ==, N_FRAMES);
+    g_assert_cmpuint (pass->n_processed, ==, N_FRAMES);
+    g_assert_cmpuint (sink->n_processed, ==, N_FRAMES);
+    g_assert (pass->in_order);
+    g_assert (sink->in_order);
+
+    g_object_unref (graph);
+    g_object_unref (source);
+    g_object_unref (pass);
+    g_object_unref (sink);
+}
+
+static void
+test_pool_broadcast (void)
+{
+    UfoTaskGraph *graph;
+    TestTask *source;
+    TestTask *readers[2];
+    TestTask *writer;
+    GError *error = NULL;
+
+    graph = UFO_TASK_GRAPH (ufo_task_graph_new ());
+    source = test_task_new (UFO_TASK_MODE_GENERATOR, "source");
+    writer = test_task_new (UFO_TASK_MODE_SINK, "writer");
+    writer->scribble = TRUE;
+
+    for (guint i = 0; i < 2; i++) {
+        readers[i] = test_task_new (UFO_TASK_MODE_SINK | UFO_TASK_MODE_READ_ONLY_INPUTS, "reader");
+        ufo_task_graph_connect_nodes (graph, UFO_TASK (source), UFO_TASK (readers[i]));
+    }
+
+    ufo_task_graph_connect_nodes (graph, UFO_TASK (source), UFO_TASK (writer));
+
+    run_pool (graph, &error);
+    g_assert_no_error (error);
+
+    /* The writer modifies its own copy, the shared buffer stays intact */
+    for (guint i = 0; i < 2; i++) {
+        g_assert_cmpuint (readers[i]->n_processed, ==, N_FRAMES);
+        g_assert (readers[i]->in_order);
+        g_object_unref (readers[i]);
+    }
+
+    g_assert_cmpuint (writer->n_processed, ==, N_FRAMES);
+    g_assert (writer->in_order);
+
+    g_object_unref (graph);
+    g_object_unref (source);
+    g_object_unref (writer);
+}
+
+static void
+test_pool_reduce (void)
+{
+    UfoTaskGraph *graph;
+    TestTask *source;
+    TestTask *reductor;
+    TestTask *sink;
+    GError *error = NULL;
+
+    graph = UFO_TASK_GRAPH (ufo_task_graph_new ());
+    source = test_task_new (UFO_TASK_MODE_GENERATOR, "source");
+    reductor = test_task_new (UFO_TASK_MODE_REDUCTOR, "sum");
+    sink = test_task_new (UFO_TASK_MODE_SINK, "sink");
+
+    ufo_task_graph_connect_nodes (graph, UFO_TASK (source), UFO_TASK (reductor));
+    ufo_task_graph_connect_nodes (graph, UFO_TASK (reductor), UFO_TASK (sink));
+
+    run_pool (graph, &error);
+    g_assert_no_error (error);
+
+    g_assert_cmpuint (reductor->n_processed, ==, N_FRAMES);
+    g_assert (reductor->in_order);
+    g_assert_cmpuint (sink->n_processed, ==, 1);
+    g_assert_cmpfloat (sink->last, ==, N_FRAMES * (N_FRAMES - 1) / 2);
+
+    g_object_unref (graph);
+    g_object_unref (source);
+    g_object_unref (reductor);
+    g_object_unref (sink);
+}
+
+static void
+test_pool_bad_port (void)
+{
+    UfoTaskGraph *graph;
+    TestTask *source;
+    TestTask *sink;
+    GError *error = NULL;
+
+    graph = UFO_TASK_GRAPH (ufo_task_graph_new ());
+    source = test_task_new (UFO_TASK_MODE_GENERATOR, "source");
+    sink = test_task_new (UFO_TASK_MODE_SINK, "sink");
+
+    /* The sink has only one input */
+    ufo_task_graph_connect_nodes_full (graph, UFO_TASK (source), UFO_TASK (sink), 1);
+
+    run_pool (graph, &error);
+    g_assert_error (error, UFO_BASE_SCHEDULER_ERROR, UFO_BASE_SCHEDULER_ERROR_SETUP);
+    g_assert_cmpuint (sink->n_processed, ==, 0);
+
+    g_error_free (error);
+    g_object_unref (graph);
+    g_object_unref (source);
+    g_object_unref (sink);
+}
+
+static void
+test_ordered_gather (void)
+{
+    UfoBaseScheduler *scheduler;
+    UfoResources *resources;
+    UfoTaskGraph *graph;
+    TestTask *source;
+    TestTask *copies[2];
+    TestTask *sink;
+    GError *error = NULL;
+
+    resources = ufo_resources_new (&error);
+
+    if (error != NULL) {
+        g_test_skip (error->message);
+        g_error_free (error);
+        return;
+    }
+
+    graph = UFO_TASK_GRAPH (ufo_task_graph_new ());
+    source = test_task_new (UFO_TASK_MODE_GENERATOR, "source");
+    sink = test_task_new (UFO_TASK_MODE_SINK, "sink");
+    ufo_task_node_set_send_pattern (UFO_TASK_NODE (source), UFO_SEND_SCATTER);
+
+    /*
+     * Frames alternate between both copies and the first one is slower, so
+     * that frames of the second one arrive early and must be held back.
+     */
+    for (guint i = 0; i < 2; i++) {
+        copies[i] = test_task_new (UFO_TASK_MODE_PROCESSOR, "pass");
+        copies[i]->delay = i == 0 ? 2000 : 0;
+        ufo_task_graph_connect_nodes (graph, UFO_TASK (source), UFO_TASK (copies[i]));
+        ufo_task_graph_connect_nodes (graph, UFO_TASK (copies[i]), UFO_TASK (sink));
+    }
+
+    scheduler = ufo_scheduler_new ();
+    ufo_base_scheduler_set_resources (scheduler, resources);
+    g_object_set (scheduler, "expand", FALSE, "ordered", TRUE, NULL);
+    ufo_base_scheduler_run (scheduler, graph, &error);
+    g_assert_no_error (error);
+
+    g_assert_cmpuint (copies[0]->n_processed, ==, N_FRAMES / 2);
+    g_assert_cmpuint (copies[1]->n_processed, ==, N_FRAMES / 2);
+    g_assert_cmpuint (sink->n_processed, ==, N_FRAMES);
+    g_assert (sink->in_order);
+
+    g_object_unref (scheduler);
+    g_object_unref (resources);
+    g_object_unref (graph);
+    g_object_unref (source);
+    g_object_unref (copies[0]);
+    g_object_unref (copies[1]);
+    g_object_unref (sink);
+}
+
+static void
+test_round_trips (void)
+{
+    UfoResources *resources;
+    UfoBuffer *buffer;
+    UfoRequisition requisition;
+    UfoProfiler *profiler;
+    TestTask *down;
+    TestTask *up;
+    GList *queues;
+    GError *error = NULL;
+    guint64 n_round_trips;
+    guint64 n_bytes;
+
+    resources = ufo_resources_new (&error);
+
+    if (error != NULL) {
+        g_test_skip (error->message);
+        g_error_free (error);
+        return;
+    }
+
+    queues = ufo_resources_get_cmd_queues (resources);
+    requisition.n_dims = 1;
+    requisition.dims[0] = FRAME_SIZE;
+    buffer = ufo_buffer_new (&requisition, ufo_resources_get_context (resources));
+    memset (ufo_buffer_get_host_array (buffer, NULL), 0, ufo_buffer_get_size (buffer));
+    g_assert (ufo_buffer_get_device_array (buffer, queues->data) != NULL);
+
+    down = test_task_new (UFO_TASK_MODE_SINK, "down");
+    up = test_task_new (UFO_TASK_MODE_SINK, "up");
+    up->queue = queues->data;
+    profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (up));
+
+    /* One task downloads, the next uploads the same data */
+    ufo_task_process (UFO_TASK (down), &buffer, NULL, &requisition);
+    ufo_task_process (UFO_TASK (up), &buffer, NULL, &requisition);
+    ufo_profiler_get_round_trips (profiler, &n_round_trips, &n_bytes);
+    g_assert_cmpuint (n_round_trips, ==, 1);
+    g_assert_cmpuint (n_bytes, ==, ufo_buffer_get_size (buffer));
+
+    /* Data changed on the host has to be uploaded */
+    down->scribble = TRUE;
+    ufo_task_process (UFO_TASK (down), &buffer, NULL, &requisition);
+    ufo_task_process (UFO_TASK (up), &buffer, NULL, &requisition);
+    ufo_profiler_get_round_trips (profiler, &n_round_trips, NULL);
+    g_assert_cmpuint (n_round_trips, ==, 1);
+
+    g_object_unref (down);
+    g_object_unref (up);
+    g_object_unref (buffer);
+    g_list_free (queues);
+    g_object_unref (resources);
+}
+
+void
+test_add_scheduler (void)
+{
+    g_test_add_func ("/no-opencl/scheduler/pool/pipeline",
+                     test_pool_pipeline);
+
+    g_test_add_func ("/no-opencl/scheduler/pool/broadcast",
+                     test_pool_broadcast);
+
+    g_test_add_func ("/no-opencl/scheduler/pool/reduce",
+                     test_pool_reduce);
+
+    g_test_add_func ("/no-opencl/scheduler/pool/bad-port",
+                     test_pool_bad_port);
+
+    g_test_add_func ("/resources/scheduler/ordered",
+                     test_ordered_gather);
+
+    g_test_add_func ("/resources/scheduler/round-trips",
+                     test_round_trips);
+}
@@ -46,6 +46,9 @@ int main(int argc, char *argv[])
     test_add_graph ();
     test_add_profiler ();
     test_add_node ();
+    test_add_queue ();
+    test_add_resources ();
+    test_add_scheduler ();
 
     g_test_run();
 
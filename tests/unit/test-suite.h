@@ -24,5 +24,8 @@ void test_add_buffer (void);
 void test_add_graph (void);
 void test_add_node (void);
 void test_add_profiler (void);
+void test_add_queue (void);
+void test_add_resources (void);
+void test_add_scheduler (void);
 
 #endif
@@ -30,8 +30,10 @@
 #endif
 
 #include "ufo-base-scheduler.h"
+#include "ufo-enums.h"
 #include "ufo-task-node.h"
 #include "ufo-task-iface.h"
+#include "ufo-two-way-queue.h"
 #include "ufo-priv.h"
 
 /**
@@ -62,15 +64,41 @@ struct _UfoBaseSchedulerPrivate {
     gboolean         trace;
     gboolean         ran;
     gboolean         timestamps;
+    gboolean         ordered;
+    gboolean         parallel_setup;
+    guint            queue_depth;
     gdouble          time;
+    gdouble          setup_time;
+    UfoTraceWriter  *trace_writer;
+    UfoTraceWriter  *opencl_writer;
+    gchar           *metrics_file;
+    gdouble          metrics_interval;
+    UfoMetrics      *metrics;
+    UfoBaseSchedulerReport report;
+    guint            kernel_sample_rate;
+    GList           *tasks;
 };
 
+typedef struct {
+    UfoResources    *resources;
+    GMutex           lock;
+    GError          *error;     /* First error, remaining tasks are skipped */
+} SetupContext;
+
 enum {
     PROP_0,
     PROP_EXPAND,
     PROP_ENABLE_TRACING,
     PROP_TIMESTAMPS,
+    PROP_QUEUE_DEPTH,
+    PROP_ORDERED,
+    PROP_PARALLEL_SETUP,
+    PROP_METRICS_FILE,
+    PROP_METRICS_INTERVAL,
+    PROP_REPORT,
+    PROP_KERNEL_SAMPLE_RATE,
     PROP_TIME,
+    PROP_SETUP_TIME,
     N_PROPERTIES,
 };
 
@@ -105,17 +133,102 @@ enable_tracing (UfoTaskGraph *graph)
     g_list_free (nodes);
 }
 
+static UfoTraceWriter *
+create_trace_writer (const gchar *prefix)
+{
+    UfoTraceWriter *writer;
+    GDateTime *now;
+    GError *error = NULL;
+    gchar *timestr;
+    gchar *filename;
+
+    now = g_date_time_new_now_local ();
+    timestr = g_date_time_format (now, "%FT%T%z");
+    filename = g_strdup_printf ("%s.%s.ufotrace", prefix, timestr);
+    writer = ufo_trace_writer_new (filename, &error);
+
+    if (writer == NULL) {
+        g_debug ("WARN %s, keeping trace in memory", error->message);
+        g_error_free (error);
+    }
+
+    g_date_time_unref (now);
+    g_free (timestr);
+    g_free (filename);
+    return writer;
+}
+
 static void
-write_tracing_data (UfoTaskGraph *graph)
+set_trace_writers (UfoTaskGraph *graph,
+                   UfoTraceWriter *trace_writer,
+                   UfoTraceWriter *opencl_writer)
 {
     GList *nodes;
+    GList *it;
 
     nodes = ufo_graph_get_nodes (UFO_GRAPH (graph));
-    ufo_write_profile_events (nodes);
-    ufo_write_opencl_events (nodes);
+
+    g_list_for (nodes, it) {
+        gchar *track;
+
+        track = g_strdup_printf ("%s-%p", G_OBJECT_TYPE_NAME (it->data), it->data);
+        ufo_profiler_set_trace_writers (ufo_task_node_get_profiler (UFO_TASK_NODE (it->data)),
+                                        trace_writer, opencl_writer, track);
+        g_free (track);
+    }
+
     g_list_free (nodes);
 }
 
+static void
+start_tracing (UfoBaseSchedulerPrivate *priv,
+               UfoTaskGraph *graph)
+{
+    enable_tracing (graph);
+    priv->trace_writer = create_trace_writer ("trace");
+    priv->opencl_writer = create_trace_writer ("opencl");
+
+    if (priv->trace_writer != NULL && priv->opencl_writer != NULL) {
+        set_trace_writers (graph, priv->trace_writer, priv->opencl_writer);
+    }
+    else {
+        g_clear_pointer (&priv->trace_writer, ufo_trace_writer_free);
+        g_clear_pointer (&priv->opencl_writer, ufo_trace_writer_free);
+    }
+}
+
+static void
+write_tracing_data (UfoBaseSchedulerPrivate *priv,
+                    UfoTaskGraph *graph)
+{
+    if (priv->trace_writer != NULL && priv->opencl_writer != NULL) {
+        /* Writes the kernel events that are still outstanding */
+        set_trace_writers (graph, NULL, NULL);
+    }
+    else {
+        GList *nodes;
+
+        nodes = ufo_graph_get_nodes (UFO_GRAPH (graph));
+        ufo_write_profile_events (nodes);
+        ufo_write_opencl_events (nodes);
+        g_list_free (nodes);
+    }
+
+    g_clear_pointer (&priv->trace_writer, ufo_trace_writer_free);
+    g_clear_pointer (&priv->opencl_writer, ufo_trace_writer_free);
+}
+
+static void
+set_sample_rate (GList *tasks,
+                 guint rate)
+{
+    GList *it;
+
+    g_list_for (tasks, it) {
+        ufo_profiler_set_sample_rate (ufo_task_node_get_profiler (UFO_TASK_NODE (it->data)), rate);
+    }
+}
+
 void
 ufo_base_scheduler_run (UfoBaseScheduler *scheduler,
                         UfoTaskGraph *graph,
@@ -134,7 +247,10 @@ ufo_base_scheduler_run (UfoBaseScheduler *scheduler,
         return;
 
     if (scheduler->priv->trace)
-        enable_tracing (graph);
+        start_tracing (scheduler->priv, graph);
+
+    g_list_free_full (scheduler->priv->tasks, g_object_unref);
+    scheduler->priv->tasks = NULL;
 
 #ifdef WITH_PYTHON
     PyEval_InitThreads();
@@ -144,8 +260,22 @@ ufo_base_scheduler_run (UfoBaseScheduler *scheduler,
     (*klass->run)(scheduler, graph, error);
     scheduler->priv->time = g_timer_elapsed (timer, NULL);
 
+    if (scheduler->priv->kernel_sample_rate > 0)
+        set_sample_rate (scheduler->priv->tasks, 0);
+
+    /* Write the final snapshot, the next run starts with fresh counters */
+    g_clear_pointer (&scheduler->priv->metrics, ufo_metrics_free);
+
+    if (scheduler->priv->report != UFO_BASE_SCHEDULER_REPORT_NONE) {
+        gchar *report;
+
+        report = ufo_base_scheduler_get_report (scheduler, scheduler->priv->report);
+        g_print ("%s", report);
+        g_free (report);
+    }
+
     if (scheduler->priv->trace)
-        write_tracing_data (graph);
+        write_tracing_data (scheduler->priv, graph);
 
     g_timer_destroy (timer);
 }
@@ -213,6 +343,458 @@ ufo_base_scheduler_set_gpu_nodes (UfoBaseScheduler *scheduler,
     scheduler->priv->gpu_nodes = g_list_copy (gpu_nodes);
 }
 
+static void
+setup_task (UfoTask *task,
+            SetupContext *context)
+{
+    UfoProfiler *profiler;
+    UfoTask *origin;
+    GError *error = NULL;
+    gboolean failed;
+
+    g_mutex_lock (&context->lock);
+    failed = context->error != NULL;
+    g_mutex_unlock (&context->lock);
+
+    if (failed)
+        return;
+
+    profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
+    origin = UFO_TASK (ufo_node_get_origin (UFO_NODE (task)));
+
+    ufo_profiler_start (profiler, UFO_PROFILER_TIMER_SETUP);
+
+    if (origin == task || !ufo_task_share_setup (task, origin, context->resources, &error)) {
+        if (error == NULL)
+            ufo_task_setup (task, context->resources, &error);
+    }
+
+    ufo_profiler_stop (profiler, UFO_PROFILER_TIMER_SETUP);
+
+    if (error != NULL) {
+        g_mutex_lock (&context->lock);
+
+        if (context->error == NULL)
+            context->error = error;
+        else
+            g_error_free (error);
+
+        g_mutex_unlock (&context->lock);
+    }
+}
+
+static void
+setup_in_pool (GList *tasks,
+               SetupContext *context,
+               gboolean parallel)
+{
+    GThreadPool *pool;
+    GList *it;
+    guint n_threads;
+
+    n_threads = MIN (g_list_length (tasks), (guint) g_get_num_processors ());
+
+    if (!parallel || n_threads < 2) {
+        g_list_for (tasks, it)
+            setup_task (UFO_TASK (it->data), context);
+
+        return;
+    }
+
+    pool = g_thread_pool_new ((GFunc) setup_task, context, n_threads, FALSE, NULL);
+
+    g_list_for (tasks, it)
+        g_thread_pool_push (pool, it->data, NULL);
+
+    g_thread_pool_free (pool, FALSE, TRUE);
+}
+
+static gint
+compare_setup_time (UfoTaskNode *a,
+                    UfoTaskNode *b)
+{
+    gdouble ta = ufo_profiler_elapsed (ufo_task_node_get_profiler (a), UFO_PROFILER_TIMER_SETUP);
+    gdouble tb = ufo_profiler_elapsed (ufo_task_node_get_profiler (b), UFO_PROFILER_TIMER_SETUP);
+
+    return ta < tb ? 1 : (ta > tb ? -1 : 0);
+}
+
+static void
+log_setup_times (GList *tasks,
+                 gdouble total)
+{
+    GList *sorted;
+    GList *it;
+
+    sorted = g_list_sort (g_list_copy (tasks), (GCompareFunc) compare_setup_time);
+    g_debug ("INFO Set up %u tasks in %3.5fs", g_list_length (tasks), total);
+
+    g_list_for (sorted, it) {
+        UfoTaskNode *node = UFO_TASK_NODE (it->data);
+        UfoNode *origin = ufo_node_get_origin (UFO_NODE (node));
+
+        g_debug ("INFO   %3.5fs  %s-%p%s",
+                 ufo_profiler_elapsed (ufo_task_node_get_profiler (node), UFO_PROFILER_TIMER_SETUP),
+                 ufo_task_node_get_plugin_name (node), (gpointer) node,
+                 origin != UFO_NODE (node) ? " (copy)" : "");
+    }
+
+    g_list_free (sorted);
+}
+
+/**
+ * ufo_base_scheduler_setup_tasks:
+ * @scheduler: A #UfoBaseScheduler
+ * @tasks: (element-type Ufo.Task): List of tasks to set up
+ * @resources: A #UfoResources object
+ * @error: Location of a #GError or %NULL
+ *
+ * Call ufo_task_setup() for all @tasks before any data is processed. If
+ * #UfoBaseScheduler:parallel-setup is enabled, tasks are set up concurrently
+ * on a thread pool. Copies made by expanding the graph are set up after their
+ * originals and may share their state, see ufo_task_share_setup(). The time
+ * spent on each task is accounted to its %UFO_PROFILER_TIMER_SETUP timer and
+ * the total is available as #UfoBaseScheduler:setup-time. If
+ * #UfoBaseScheduler:metrics-file is set, the counters of @tasks are written
+ * to it until the graph has finished. Kernel calls of @tasks are sampled
+ * according to #UfoBaseScheduler:kernel-sample-rate unless tracing is
+ * enabled.
+ *
+ * Returns: %TRUE on success, %FALSE if any task failed to set up.
+ */
+gboolean
+ufo_base_scheduler_setup_tasks (UfoBaseScheduler *scheduler,
+                                GList *tasks,
+                                UfoResources *resources,
+                                GError **error)
+{
+    UfoBaseSchedulerPrivate *priv;
+    SetupContext context;
+    GList *originals = NULL;
+    GList *copies = NULL;
+    GList *it;
+    GTimer *timer;
+
+    g_return_val_if_fail (UFO_IS_BASE_SCHEDULER (scheduler), FALSE);
+
+    priv = scheduler->priv;
+    context.resources = resources;
+    context.error = NULL;
+    g_mutex_init (&context.lock);
+
+    /* Copies whose original is not part of the list are set up on their own */
+    g_list_for (tasks, it) {
+        UfoNode *origin = ufo_node_get_origin (UFO_NODE (it->data));
+
+        if (origin != UFO_NODE (it->data) && g_list_find (tasks, origin) != NULL)
+            copies = g_list_append (copies, it->data);
+        else
+            originals = g_list_append (originals, it->data);
+    }
+
+    timer = g_timer_new ();
+
+#ifdef WITH_PYTHON
+    /* Python tasks set up from the pool need to acquire the interpreter lock */
+    if (Py_IsInitialized ()) {
+        Py_BEGIN_ALLOW_THREADS
+
+        setup_in_pool (originals, &context, priv->parallel_setup);
+        setup_in_pool (copies, &context, priv->parallel_setup);
+
+        Py_END_ALLOW_THREADS
+    }
+    else {
+        setup_in_pool (originals, &context, priv->parallel_setup);
+        setup_in_pool (copies, &context, priv->parallel_setup);
+    }
+#else
+    setup_in_pool (originals, &context, priv->parallel_setup);
+    setup_in_pool (copies, &context, priv->parallel_setup);
+#endif
+
+    priv->setup_time = g_timer_elapsed (timer, NULL);
+    log_setup_times (tasks, priv->setup_time);
+
+    g_timer_destroy (timer);
+    g_list_free (originals);
+    g_list_free (copies);
+    g_mutex_clear (&context.lock);
+
+    if (context.error != NULL) {
+        g_propagate_error (error, context.error);
+        return FALSE;
+    }
+
+    g_list_for (tasks, it) {
+        if (g_list_find (priv->tasks, it->data) == NULL)
+            priv->tasks = g_list_append (priv->tasks, g_object_ref (it->data));
+    }
+
+    /* Tracing keeps every kernel event anyway */
+    if (priv->kernel_sample_rate > 0 && !priv->trace)
+        set_sample_rate (tasks, priv->kernel_sample_rate);
+
+    if (priv->metrics_file != NULL) {
+        if (priv->metrics == NULL)
+            priv->metrics = ufo_metrics_new (priv->metrics_file, priv->metrics_interval);
+
+        ufo_metrics_watch (priv->metrics, tasks);
+    }
+
+    return TRUE;
+}
+
+typedef struct {
+    UfoTaskNode *node;
+    guint        index;
+    guint64      frames;
+    gdouble      busy;
+    gdouble      starved;
+    gdouble      blocked;
+    gdouble      setup;
+    guint64      round_trips;
+    guint64      round_trip_bytes;
+} TaskReport;
+
+static const gchar *transfer_keys[UFO_BUFFER_TRANSFER_LAST] = {
+    "host_to_device",
+    "device_to_host",
+    "device_to_device",
+    "buffer_to_image",
+    "image_to_buffer",
+};
+
+static const gchar *
+get_task_name (UfoTaskNode *node)
+{
+    const gchar *name = ufo_task_node_get_plugin_name (node);
+
+    return name != NULL ? name : G_OBJECT_TYPE_NAME (node);
+}
+
+static gdouble
+get_fraction (UfoTaskNode *node,
+              UfoTaskNodeCounter counter,
+              gdouble total)
+{
+    return MIN (ufo_task_node_get_counter (node, counter) / (gdouble) G_USEC_PER_SEC / total, 1.0);
+}
+
+static JsonObject *
+get_json_transfers (UfoTaskNode *node)
+{
+    JsonObject *transfers;
+    UfoProfiler *profiler;
+
+    transfers = json_object_new ();
+    profiler = ufo_task_node_get_profiler (node);
+
+    for (guint i = 0; i < UFO_BUFFER_TRANSFER_LAST; i++) {
+        JsonObject *transfer = json_object_new ();
+        guint64 n_transfers;
+        guint64 n_bytes;
+        gdouble time;
+
+        ufo_profiler_get_transfer_counters (profiler, i, &n_transfers, &n_bytes, &time);
+        json_object_set_int_member (transfer, "count", (gint64) n_transfers);
+        json_object_set_int_member (transfer, "bytes", (gint64) n_bytes);
+        json_object_set_double_member (transfer, "time", time);
+        json_object_set_object_member (transfers, transfer_keys[i], transfer);
+    }
+
+    return transfers;
+}
+
+static gchar *
+format_json_report (TaskReport *reports,
+                    guint n_reports,
+                    TaskReport *limit,
+                    guint64 n_frames,
+                    gdouble total)
+{
+    JsonGenerator *generator;
+    JsonNode *root;
+    JsonObject *object;
+    JsonArray *tasks;
+    gchar *result;
+
+    object = json_object_new ();
+    tasks = json_array_new ();
+
+    for (guint i = 0; i < n_reports; i++) {
+        JsonObject *task = json_object_new ();
+
+        json_object_set_string_member (task, "plugin", get_task_name (reports[i].node));
+        json_object_set_int_member (task, "node", reports[i].index);
+        json_object_set_int_member (task, "frames", (gint64) reports[i].frames);
+        json_object_set_double_member (task, "busy", reports[i].busy);
+        json_object_set_double_member (task, "starved", reports[i].starved);
+        json_object_set_double_member (task, "blocked", reports[i].blocked);
+        json_object_set_double_member (task, "setup_time", reports[i].setup);
+        json_object_set_object_member (task, "transfers", get_json_transfers (reports[i].node));
+        json_object_set_int_member (task, "round_trips", (gint64) reports[i].round_trips);
+        json_object_set_int_member (task, "round_trip_bytes", (gint64) reports[i].round_trip_bytes);
+        json_array_add_object_element (tasks, task);
+    }
+
+    json_object_set_double_member (object, "time", total);
+    json_object_set_int_member (object, "frames", (gint64) n_frames);
+    json_object_set_double_member (object, "fps", n_frames / total);
+
+    if (limit != NULL)
+        json_object_set_int_member (object, "bottleneck", limit->index);
+    else
+        json_object_set_null_member (object, "bottleneck");
+
+    json_object_set_array_member (object, "tasks", tasks);
+
+    root = json_node_new (JSON_NODE_OBJECT);
+    json_node_take_object (root, object);
+    generator = json_generator_new ();
+    json_generator_set_pretty (generator, TRUE);
+    json_generator_set_root (generator, root);
+    result = json_generator_to_data (generator, NULL);
+
+    g_object_unref (generator);
+    json_node_free (root);
+    return result;
+}
+
+static gchar *
+format_text_report (TaskReport *reports,
+                    guint n_reports,
+                    TaskReport *limit,
+                    guint64 n_frames,
+                    gdouble total)
+{
+    GString *str;
+
+    str = g_string_new (NULL);
+    g_string_append_printf (str, "%-32s %10s %8s %8s %8s %10s %10s %10s\n",
+                            "Task", "Frames", "Busy", "Starved", "Blocked", "Setup", "Upload", "Download");
+
+    for (guint i = 0; i < n_reports; i++) {
+        UfoProfiler *profiler;
+        guint64 uploaded;
+        guint64 downloaded;
+        gchar *name;
+
+        profiler = ufo_task_node_get_profiler (reports[i].node);
+        ufo_profiler_get_transfer_counters (profiler, UFO_BUFFER_TRANSFER_HOST_TO_DEVICE, NULL, &uploaded, NULL);
+        ufo_profiler_get_transfer_counters (profiler, UFO_BUFFER_TRANSFER_DEVICE_TO_HOST, NULL, &downloaded, NULL);
+
+        name = g_strdup_printf ("%s (%u)", get_task_name (reports[i].node), reports[i].index);
+        g_string_append_printf (str, "%-32s %10" G_GUINT64_FORMAT " %7.1f%% %7.1f%% %7.1f%% %9.3fs %8.1fMB %8.1fMB\n",
+                                name, reports[i].frames, 100 * reports[i].busy,
+                                100 * reports[i].starved, 100 * reports[i].blocked, reports[i].setup,
+                                uploaded / 1e6, downloaded / 1e6);
+        g_free (name);
+    }
+
+    for (guint i = 0; i < n_reports; i++) {
+        if (reports[i].round_trips > 0) {
+            g_string_append_printf (str, "Round trips in %s (%u): downloaded and uploaded the same data %"
+                                    G_GUINT64_FORMAT " times (%.1f MB)\n",
+                                    get_task_name (reports[i].node), reports[i].index,
+                                    reports[i].round_trips, reports[i].round_trip_bytes / 1e6);
+        }
+    }
+
+    if (limit != NULL) {
+        g_string_append_printf (str, "Limited by %s (%u), busy %.1f%% of %.3fs\n",
+                                get_task_name (limit->node), limit->index,
+                                100 * limit->busy, total);
+    }
+
+    g_string_append_printf (str, "Throughput %.2f frames/s\n", n_frames / total);
+    return g_string_free (str, FALSE);
+}
+
+/**
+ * ufo_base_scheduler_get_report:
+ * @scheduler: A #UfoBaseScheduler
+ * @format: Output format, must not be %UFO_BASE_SCHEDULER_REPORT_NONE
+ *
+ * Summarize where the tasks of the last run spent their time. For each task,
+ * the report lists the fraction of the run time it was busy in process or
+ * generate, starved waiting for inputs and blocked waiting for successors to
+ * release an output buffer. The busiest task limits the throughput of the
+ * graph: its predecessors are mostly blocked and its successors starved. The
+ * achieved frame rate is computed from the frames received by all sinks.
+ * Buffer transfers made by each task are listed as well and tasks that
+ * downloaded data only to upload it again are flagged, see
+ * ufo_profiler_get_round_trips().
+ *
+ * Returns: (transfer full): The report as a string.
+ */
+gchar *
+ufo_base_scheduler_get_report (UfoBaseScheduler *scheduler,
+                               UfoBaseSchedulerReport format)
+{
+    UfoBaseSchedulerPrivate *priv;
+    TaskReport *reports;
+    TaskReport *limit = NULL;
+    GList *it;
+    guint n_reports;
+    guint64 n_frames = 0;
+    guint64 n_produced = 0;
+    gboolean have_sinks = FALSE;
+    gdouble total;
+    gchar *result;
+    guint i;
+
+    g_return_val_if_fail (UFO_IS_BASE_SCHEDULER (scheduler), NULL);
+    g_return_val_if_fail (format != UFO_BASE_SCHEDULER_REPORT_NONE, NULL);
+
+    priv = scheduler->priv;
+    n_reports = g_list_length (priv->tasks);
+    reports = g_new0 (TaskReport, n_reports);
+    total = MAX (priv->time, 1e-9);
+
+    for (it = priv->tasks, i = 0; it != NULL; it = g_list_next (it), i++) {
+        UfoTaskNode *node = UFO_TASK_NODE (it->data);
+        UfoTaskMode mode;
+
+        mode = ufo_task_get_mode (UFO_TASK (node)) & UFO_TASK_MODE_TYPE_MASK;
+
+        reports[i].node = node;
+        reports[i].index = i;
+        reports[i].frames = ufo_task_node_get_counter (node, mode == UFO_TASK_MODE_GENERATOR ?
+                                                             UFO_TASK_NODE_COUNTER_FRAMES_OUT :
+                                                             UFO_TASK_NODE_COUNTER_FRAMES_IN);
+        reports[i].busy = MIN (get_fraction (node, UFO_TASK_NODE_COUNTER_PROCESS_TIME, total) +
+                               get_fraction (node, UFO_TASK_NODE_COUNTER_GENERATE_TIME, total), 1.0);
+        reports[i].starved = get_fraction (node, UFO_TASK_NODE_COUNTER_FETCH_TIME, total);
+        reports[i].blocked = get_fraction (node, UFO_TASK_NODE_COUNTER_RELEASE_TIME, total);
+        reports[i].setup = ufo_profiler_elapsed (ufo_task_node_get_profiler (node), UFO_PROFILER_TIMER_SETUP);
+        ufo_profiler_get_round_trips (ufo_task_node_get_profiler (node),
+                                      &reports[i].round_trips, &reports[i].round_trip_bytes);
+
+        if (limit == NULL || reports[i].busy > limit->busy)
+            limit = &reports[i];
+
+        if (mode == UFO_TASK_MODE_SINK) {
+            n_frames += reports[i].frames;
+            have_sinks = TRUE;
+        }
+
+        n_produced = MAX (n_produced, ufo_task_node_get_counter (node, UFO_TASK_NODE_COUNTER_FRAMES_OUT));
+    }
+
+    /* Graphs without sinks end in a processor whose outputs nobody reads */
+    if (!have_sinks)
+        n_frames = n_produced;
+
+    if (format == UFO_BASE_SCHEDULER_REPORT_JSON)
+        result = format_json_report (reports, n_reports, limit, n_frames, total);
+    else
+        result = format_text_report (reports, n_reports, limit, n_frames, total);
+
+    g_free (reports);
+    return result;
+}
+
 static void
 ufo_base_scheduler_run_real (UfoBaseScheduler *scheduler,
                              UfoTaskGraph *graph,
@@ -243,6 +825,35 @@ ufo_base_scheduler_set_property (GObject *object,
             priv->timestamps = g_value_get_boolean (value);
             break;
 
+        case PROP_QUEUE_DEPTH:
+            priv->queue_depth = g_value_get_uint (value);
+            break;
+
+        case PROP_ORDERED:
+            priv->ordered = g_value_get_boolean (value);
+            break;
+
+        case PROP_PARALLEL_SETUP:
+            priv->parallel_setup = g_value_get_boolean (value);
+            break;
+
+        case PROP_METRICS_FILE:
+            g_free (priv->metrics_file);
+            priv->metrics_file = g_value_dup_string (value);
+            break;
+
+        case PROP_METRICS_INTERVAL:
+            priv->metrics_interval = g_value_get_double (value);
+            break;
+
+        case PROP_REPORT:
+            priv->report = g_value_get_enum (value);
+            break;
+
+        case PROP_KERNEL_SAMPLE_RATE:
+            priv->kernel_sample_rate = g_value_get_uint (value);
+            break;
+
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -270,10 +881,42 @@ ufo_base_scheduler_get_property (GObject *object,
             g_value_set_boolean (value, priv->timestamps);
             break;
 
+        case PROP_QUEUE_DEPTH:
+            g_value_set_uint (value, priv->queue_depth);
+            break;
+
+        case PROP_ORDERED:
+            g_value_set_boolean (value, priv->ordered);
+            break;
+
+        case PROP_PARALLEL_SETUP:
+            g_value_set_boolean (value, priv->parallel_setup);
+            break;
+
+        case PROP_METRICS_FILE:
+            g_value_set_string (value, priv->metrics_file);
+            break;
+
+        case PROP_METRICS_INTERVAL:
+            g_value_set_double (value, priv->metrics_interval);
+            break;
+
+        case PROP_REPORT:
+            g_value_set_enum (value, priv->report);
+            break;
+
+        case PROP_KERNEL_SAMPLE_RATE:
+            g_value_set_uint (value, priv->kernel_sample_rate);
+            break;
+
         case PROP_TIME:
             g_value_set_double (value, priv->time);
             break;
 
+        case PROP_SETUP_TIME:
+            g_value_set_double (value, priv->setup_time);
+            break;
+
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -292,6 +935,10 @@ ufo_base_scheduler_dispose (GObject *object)
         priv->resources = NULL;
     }
 
+    g_clear_pointer (&priv->metrics, ufo_metrics_free);
+    g_list_free_full (priv->tasks, g_object_unref);
+    priv->tasks = NULL;
+
     G_OBJECT_CLASS (ufo_base_scheduler_parent_class)->dispose (object);
 }
 
@@ -303,6 +950,7 @@ ufo_base_scheduler_finalize (GObject *object)
     priv = UFO_BASE_SCHEDULER_GET_PRIVATE (object);
 
     g_clear_error (&priv->construct_error);
+    g_free (priv->metrics_file);
 
     G_OBJECT_CLASS (ufo_base_scheduler_parent_class)->finalize (object);
 }
@@ -374,6 +1022,84 @@ ufo_base_scheduler_class_init (UfoBaseSchedulerClass *klass)
                               FALSE,
                               G_PARAM_READWRITE);
 
+    properties[PROP_QUEUE_DEPTH] =
+        g_param_spec_uint ("queue-depth",
+                           "Default number of buffers in flight per edge",
+                           "Default number of buffers in flight per edge, 0 lets the scheduler decide",
+                           0, UFO_TWO_WAY_QUEUE_MAX_CAPACITY, 0,
+                           G_PARAM_READWRITE);
+
+    properties[PROP_ORDERED] =
+        g_param_spec_boolean ("ordered",
+                              "Keep frame order where expanded branches join",
+                              "Keep frame order where expanded branches join",
+                              FALSE,
+                              G_PARAM_READWRITE);
+
+    /**
+     * UfoBaseScheduler:parallel-setup:
+     *
+     * Set up tasks concurrently on a thread pool. Only enable this if the
+     * setup of all plugins in the graph is thread safe.
+     */
+    properties[PROP_PARALLEL_SETUP] =
+        g_param_spec_boolean ("parallel-setup",
+                              "Set up tasks concurrently",
+                              "Set up tasks concurrently",
+                              FALSE,
+                              G_PARAM_READWRITE);
+
+    /**
+     * UfoBaseScheduler:metrics-file:
+     *
+     * If set, counters of all tasks such as processed frames and bytes, time
+     * spent processing and waiting for inputs and outputs and the occupancy
+     * of all input queues are periodically written to this file in the
+     * Prometheus text format while a graph runs.
+     */
+    properties[PROP_METRICS_FILE] =
+        g_param_spec_string ("metrics-file",
+                             "File for live metrics in Prometheus text format",
+                             "File for live metrics in Prometheus text format",
+                             NULL,
+                             G_PARAM_READWRITE);
+
+    properties[PROP_METRICS_INTERVAL] =
+        g_param_spec_double ("metrics-interval",
+                             "Seconds between two metrics snapshots",
+                             "Seconds between two metrics snapshots",
+                             0.01, G_MAXDOUBLE, 1.0,
+                             G_PARAM_READWRITE);
+
+    /**
+     * UfoBaseScheduler:report:
+     *
+     * Print a report of where tasks spent their time after each run, see
+     * ufo_base_scheduler_get_report().
+     */
+    properties[PROP_REPORT] =
+        g_param_spec_enum ("report",
+                           "Print a bottleneck report after running",
+                           "Print a bottleneck report after running",
+                           UFO_TYPE_BASE_SCHEDULER_REPORT,
+                           UFO_BASE_SCHEDULER_REPORT_NONE,
+                           G_PARAM_READWRITE);
+
+    /**
+     * UfoBaseScheduler:kernel-sample-rate:
+     *
+     * Measure the run time of every n-th call of each kernel while a graph
+     * runs without tracing, see ufo_profiler_set_sample_rate(). The median
+     * and 99th percentile per kernel are part of the metrics file. 0 disables
+     * sampling.
+     */
+    properties[PROP_KERNEL_SAMPLE_RATE] =
+        g_param_spec_uint ("kernel-sample-rate",
+                           "Measure every n-th call of a kernel",
+                           "Measure every n-th call of a kernel",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READWRITE);
+
     properties[PROP_TIME] =
         g_param_spec_double ("time",
                              "Finished execution time",
@@ -381,6 +1107,13 @@ ufo_base_scheduler_class_init (UfoBaseSchedulerClass *klass)
                               0.0, G_MAXDOUBLE, 0.0,
                               G_PARAM_READABLE);
 
+    properties[PROP_SETUP_TIME] =
+        g_param_spec_double ("setup-time",
+                             "Time spent setting up tasks",
+                             "Time spent setting up tasks in seconds",
+                              0.0, G_MAXDOUBLE, 0.0,
+                              G_PARAM_READABLE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (oclass, i, properties[i]);
 
@@ -396,8 +1129,18 @@ ufo_base_scheduler_init (UfoBaseScheduler *scheduler)
     priv->expand = TRUE;
     priv->trace = FALSE;
     priv->timestamps = FALSE;
+    priv->queue_depth = 0;
+    priv->ordered = FALSE;
+    priv->parallel_setup = FALSE;
     priv->ran = FALSE;
     priv->time = 0.0;
+    priv->setup_time = 0.0;
+    priv->metrics_file = NULL;
+    priv->metrics_interval = 1.0;
+    priv->metrics = NULL;
+    priv->report = UFO_BASE_SCHEDULER_REPORT_NONE;
+    priv->kernel_sample_rate = 0;
+    priv->tasks = NULL;
     priv->gpu_nodes = NULL;
     priv->resources = NULL;
 }
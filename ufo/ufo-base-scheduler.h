@@ -46,6 +46,20 @@ typedef enum {
     UFO_BASE_SCHEDULER_ERROR_EXECUTION
 } UfoBaseSchedulerError;
 
+/**
+ * UfoBaseSchedulerReport:
+ * @UFO_BASE_SCHEDULER_REPORT_NONE: Do not print a report
+ * @UFO_BASE_SCHEDULER_REPORT_TEXT: Human-readable table
+ * @UFO_BASE_SCHEDULER_REPORT_JSON: JSON document
+ *
+ * Formats of the report created by ufo_base_scheduler_get_report().
+ */
+typedef enum {
+    UFO_BASE_SCHEDULER_REPORT_NONE,
+    UFO_BASE_SCHEDULER_REPORT_TEXT,
+    UFO_BASE_SCHEDULER_REPORT_JSON
+} UfoBaseSchedulerReport;
+
 /**
  * UfoBaseScheduler:
  *
@@ -81,6 +95,12 @@ UfoResources   *ufo_base_scheduler_get_resources    (UfoBaseScheduler   *schedul
                                                      GError            **error);
 void            ufo_base_scheduler_set_gpu_nodes    (UfoBaseScheduler   *scheduler,
                                                      GList              *gpu_nodes);
+gboolean        ufo_base_scheduler_setup_tasks      (UfoBaseScheduler   *scheduler,
+                                                     GList              *tasks,
+                                                     UfoResources       *resources,
+                                                     GError            **error);
+gchar          *ufo_base_scheduler_get_report       (UfoBaseScheduler   *scheduler,
+                                                     UfoBaseSchedulerReport format);
 GType           ufo_base_scheduler_get_type         (void);
 GQuark          ufo_base_scheduler_error_quark      (void);
 
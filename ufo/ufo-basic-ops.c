@@ -28,8 +28,23 @@
 #endif
 
 #include "ufo-basic-ops.h"
+#include "ufo-priv.h"
 
 #define OPS_FILENAME "ufo-basic-ops.cl"
+#define MIN_MAX_GROUPS 64
+
+/**
+ * UfoOpError:
+ * @UFO_OP_ERROR_EXPRESSION: Expression could not be parsed
+ * @UFO_OP_ERROR_SIZE: Buffers have different numbers of elements
+ *
+ * Errors of the basic operations.
+ */
+GQuark
+ufo_op_error_quark (void)
+{
+    return g_quark_from_static_string ("ufo-op-error-quark");
+}
 
 static cl_event
 operation (const gchar *kernel_name,
@@ -70,24 +85,21 @@ ufo_op_set (UfoBuffer *arg,
     cl_mem d_arg;
     cl_event event;
     GError *error = NULL;
-    static GMutex mutex;
 
     ufo_buffer_get_requisition (arg, &requisition);
     d_arg = ufo_buffer_get_device_image (arg, command_queue);
-    kernel = ufo_resources_get_cached_kernel (resources, OPS_FILENAME, "operation_set", &error);
+    kernel = ufo_resources_get_thread_kernel (resources, OPS_FILENAME, "operation_set", &error);
 
     if (error) {
         g_error ("%s\n", error->message);
         return NULL;
     }
 
-    g_mutex_lock (&mutex);
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof(void *), (void *) &d_arg));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 1, sizeof(gfloat), (void *) &value));
     UFO_RESOURCES_CHECK_CLERR (clEnqueueNDRangeKernel (command_queue, kernel,
                                                        requisition.n_dims, NULL, requisition.dims,
                                                        NULL, 0, NULL, &event));
-    g_mutex_unlock (&mutex);
 
     return event;
 }
@@ -112,25 +124,22 @@ ufo_op_inv (UfoBuffer *arg,
     cl_kernel kernel;
     cl_mem d_arg;
     GError *error = NULL;
-    static GMutex mutex;
 
     ufo_buffer_get_requisition (arg, &requisition);
 
     d_arg = ufo_buffer_get_device_image (arg, command_queue);
-    kernel = ufo_resources_get_cached_kernel (resources, OPS_FILENAME, "operation_inv", &error);
+    kernel = ufo_resources_get_thread_kernel (resources, OPS_FILENAME, "operation_inv", &error);
 
     if (error) {
         g_error ("%s\n", error->message);
         return NULL;
     }
 
-    g_mutex_lock (&mutex);
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg(kernel, 0, sizeof(void *), (void *) &d_arg));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg(kernel, 1, sizeof(void *), (void *) &d_arg));
     UFO_RESOURCES_CHECK_CLERR (clEnqueueNDRangeKernel(command_queue, kernel,
                                                       requisition.n_dims, NULL, requisition.dims,
                                                       NULL, 0, NULL, &event));
-    g_mutex_unlock (&mutex);
 
     return event;
 }
@@ -275,7 +284,6 @@ ufo_op_mul_rows (UfoBuffer *arg1,
     cl_event event;
     UfoRequisition arg1_requisition, arg2_requisition, out_requisition;
     GError *error = NULL;
-    static GMutex mutex;
 
     ufo_buffer_get_requisition (arg1, &arg1_requisition);
     ufo_buffer_get_requisition (arg2, &arg2_requisition);
@@ -297,14 +305,13 @@ ufo_op_mul_rows (UfoBuffer *arg1,
     cl_mem d_arg1 = ufo_buffer_get_device_image (arg1, command_queue);
     cl_mem d_arg2 = ufo_buffer_get_device_image (arg2, command_queue);
     cl_mem d_out  = ufo_buffer_get_device_image (out, command_queue);
-    cl_kernel kernel = ufo_resources_get_cached_kernel (resources, OPS_FILENAME, "op_mulRows", &error);
+    cl_kernel kernel = ufo_resources_get_thread_kernel (resources, OPS_FILENAME, "op_mulRows", &error);
 
     if (error != NULL) {
         g_error ("Error: %s\n", error->message);
         return NULL;
     }
 
-    g_mutex_lock (&mutex);
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof(void *), (void *) &d_arg1));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 1, sizeof(void *), (void *) &d_arg2));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 2, sizeof(void *), (void *) &d_out));
@@ -316,7 +323,6 @@ ufo_op_mul_rows (UfoBuffer *arg1,
     UFO_RESOURCES_CHECK_CLERR (clEnqueueNDRangeKernel (command_queue, kernel,
                                                        operation_requisition.n_dims, NULL, operation_requisition.dims,
                                                        NULL, 0, NULL, &event));
-    g_mutex_unlock (&mutex);
 
     return event;
 }
@@ -332,7 +338,6 @@ operation (const gchar *kernel_name,
     UfoRequisition arg1_requisition, arg2_requisition, out_requisition;
     cl_event event;
     GError *error = NULL;
-    static GMutex mutex;
 
     ufo_buffer_get_requisition (arg1, &arg1_requisition);
     ufo_buffer_get_requisition (arg2, &arg2_requisition);
@@ -349,22 +354,20 @@ operation (const gchar *kernel_name,
     cl_mem d_arg1 = ufo_buffer_get_device_image (arg1, command_queue);
     cl_mem d_arg2 = ufo_buffer_get_device_image (arg2, command_queue);
     cl_mem d_out = ufo_buffer_get_device_image (out, command_queue);
-    cl_kernel kernel = ufo_resources_get_cached_kernel (resources, OPS_FILENAME, kernel_name, &error);
+    cl_kernel kernel = ufo_resources_get_thread_kernel (resources, OPS_FILENAME, kernel_name, &error);
 
     if (error) {
         g_error ("%s\n", error->message);
         return NULL;
     }
 
-    g_mutex_lock (&mutex);
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof(void *), (void *) &d_arg1));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 1, sizeof(void *), (void *) &d_arg2));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 2, sizeof(void *), (void *) &d_out));
 
-    UFO_RESOURCES_CHECK_CLERR (clEnqueueNDRangeKernel (command_queue, kernel,
-                                                       arg1_requisition.n_dims, NULL, arg1_requisition.dims,
-                                                       NULL, 0, NULL, &event));
-    g_mutex_unlock (&mutex);
+    UFO_RESOURCES_CHECK_CLERR (ufo_tuner_enqueue (command_queue, kernel,
+                                                  arg1_requisition.n_dims, arg1_requisition.dims,
+                                                  (gpointer *) &event));
 
     return event;
 }
@@ -381,7 +384,6 @@ operation2 (const gchar *kernel_name,
     UfoRequisition arg1_requisition, arg2_requisition, out_requisition;
     cl_event event;
     GError *error = NULL;
-    static GMutex mutex;
 
     ufo_buffer_get_requisition (arg1, &arg1_requisition);
     ufo_buffer_get_requisition (arg2, &arg2_requisition);
@@ -398,23 +400,21 @@ operation2 (const gchar *kernel_name,
     cl_mem d_arg1 = ufo_buffer_get_device_image (arg1, command_queue);
     cl_mem d_arg2 = ufo_buffer_get_device_image (arg2, command_queue);
     cl_mem d_out = ufo_buffer_get_device_image (out, command_queue);
-    cl_kernel kernel = ufo_resources_get_cached_kernel (resources, OPS_FILENAME, kernel_name, &error);
+    cl_kernel kernel = ufo_resources_get_thread_kernel (resources, OPS_FILENAME, kernel_name, &error);
 
     if (error) {
         g_error ("%s\n", error->message);
         return NULL;
     }
 
-    g_mutex_lock (&mutex);
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg(kernel, 0, sizeof(void *), (void *) &d_arg1));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg(kernel, 1, sizeof(void *), (void *) &d_arg2));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg(kernel, 2, sizeof(gfloat), (void *) &modifier));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg(kernel, 3, sizeof(void *), (void *) &d_out));
 
-    UFO_RESOURCES_CHECK_CLERR (clEnqueueNDRangeKernel (command_queue, kernel,
-                                                       arg1_requisition.n_dims, NULL, arg1_requisition.dims,
-                                                       NULL, 0, NULL, &event));
-    g_mutex_unlock (&mutex);
+    UFO_RESOURCES_CHECK_CLERR (ufo_tuner_enqueue (command_queue, kernel,
+                                                  arg1_requisition.n_dims, arg1_requisition.dims,
+                                                  (gpointer *) &event));
 
     return event;
 }
@@ -439,7 +439,6 @@ ufo_op_gradient_magnitudes (UfoBuffer *arg,
     UfoRequisition arg_requisition;
     cl_event event;
     GError *error = NULL;
-    static GMutex mutex;
 
     ufo_buffer_get_requisition (arg, &arg_requisition);
     ufo_buffer_resize (out, &arg_requisition);
@@ -447,20 +446,18 @@ ufo_op_gradient_magnitudes (UfoBuffer *arg,
     cl_mem d_arg = ufo_buffer_get_device_image (arg, command_queue);
     cl_mem d_out = ufo_buffer_get_device_image (out, command_queue);
 
-    cl_kernel kernel = ufo_resources_get_cached_kernel (resources, OPS_FILENAME, "operation_gradient_magnitude", &error);
+    cl_kernel kernel = ufo_resources_get_thread_kernel (resources, OPS_FILENAME, "operation_gradient_magnitude", &error);
 
     if (error) {
         g_error ("%s\n", error->message);
     }
 
-    g_mutex_lock (&mutex);
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof(void *), (void *) &d_arg));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 1, sizeof(void *), (void *) &d_out));
 
     UFO_RESOURCES_CHECK_CLERR (clEnqueueNDRangeKernel (command_queue, kernel,
                                                        arg_requisition.n_dims, NULL, arg_requisition.dims,
                                                        NULL, 0, NULL, &event));
-    g_mutex_unlock (&mutex);
 
     return event;
 }
@@ -487,7 +484,6 @@ ufo_op_gradient_directions (UfoBuffer *arg,
     UfoRequisition arg_requisition;
     cl_event event;
     GError *error = NULL;
-    static GMutex mutex;
 
     ufo_buffer_get_requisition (arg, &arg_requisition);
     ufo_buffer_resize (out, &arg_requisition);
@@ -496,13 +492,12 @@ ufo_op_gradient_directions (UfoBuffer *arg,
     cl_mem d_magnitudes = ufo_buffer_get_device_image (magnitudes, command_queue);
     cl_mem d_out = ufo_buffer_get_device_image (out, command_queue);
 
-    cl_kernel kernel = ufo_resources_get_cached_kernel (resources, OPS_FILENAME, "operation_gradient_direction", &error);
+    cl_kernel kernel = ufo_resources_get_thread_kernel (resources, OPS_FILENAME, "operation_gradient_direction", &error);
 
     if (error) {
         g_error ("%s\n", error->message);
     }
 
-    g_mutex_lock (&mutex);
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof(void *), (void *) &d_arg));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 1, sizeof(void *), (void *) &d_magnitudes));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 2, sizeof(void *), (void *) &d_out));
@@ -510,7 +505,6 @@ ufo_op_gradient_directions (UfoBuffer *arg,
     UFO_RESOURCES_CHECK_CLERR (clEnqueueNDRangeKernel (command_queue, kernel,
                                                        arg_requisition.n_dims, NULL, arg_requisition.dims,
                                                        NULL, 0, NULL, &event));
-    g_mutex_unlock (&mutex);
 
     return event;
 }
@@ -633,7 +627,6 @@ ufo_op_POSC (UfoBuffer *arg,
     UfoRequisition arg_requisition;
     cl_event event;
     GError *error = NULL;
-    static GMutex mutex;
 
     ufo_buffer_get_requisition (arg, &arg_requisition);
     ufo_buffer_resize (out, &arg_requisition);
@@ -641,20 +634,18 @@ ufo_op_POSC (UfoBuffer *arg,
     cl_mem d_arg = ufo_buffer_get_device_image (arg, command_queue);
     cl_mem d_out = ufo_buffer_get_device_image (out, command_queue);
 
-    cl_kernel kernel = ufo_resources_get_cached_kernel (resources, OPS_FILENAME, "POSC", &error);
+    cl_kernel kernel = ufo_resources_get_thread_kernel (resources, OPS_FILENAME, "POSC", &error);
 
     if (error) {
         g_error ("%s\n", error->message);
     }
 
-    g_mutex_lock (&mutex);
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof(void *), (void *) &d_arg));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 1, sizeof(void *), (void *) &d_out));
 
     UFO_RESOURCES_CHECK_CLERR (clEnqueueNDRangeKernel (command_queue, kernel,
                                                        arg_requisition.n_dims, NULL, arg_requisition.dims,
                                                        NULL, 0, NULL, &event));
-    g_mutex_unlock (&mutex);
 
     return event;
 }
@@ -677,7 +668,6 @@ ufo_op_gradient_descent (UfoBuffer *arg,
     UfoRequisition arg_requisition;
     cl_event event;
     GError *error = NULL;
-    static GMutex mutex;
 
     ufo_buffer_get_requisition (arg, &arg_requisition);
     ufo_buffer_resize (out, &arg_requisition);
@@ -685,20 +675,341 @@ ufo_op_gradient_descent (UfoBuffer *arg,
     cl_mem d_arg = ufo_buffer_get_device_image (arg, command_queue);
     cl_mem d_out = ufo_buffer_get_device_image (out, command_queue);
 
-    cl_kernel kernel = ufo_resources_get_cached_kernel (resources, OPS_FILENAME, "descent_grad", &error);
+    cl_kernel kernel = ufo_resources_get_thread_kernel (resources, OPS_FILENAME, "descent_grad", &error);
 
     if (error) {
         g_error ("%s\n", error->message);
     }
 
-    g_mutex_lock (&mutex);
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg(kernel, 0, sizeof(void *), (void *) &d_arg));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg(kernel, 1, sizeof(void *), (void *) &d_out));
 
     UFO_RESOURCES_CHECK_CLERR (clEnqueueNDRangeKernel (command_queue, kernel,
                                                        arg_requisition.n_dims, NULL, arg_requisition.dims,
                                                        NULL, 0, NULL, &event));
-    g_mutex_unlock (&mutex);
 
     return event;
 }
+
+static void
+find_range_on_device (cl_mem d_arg,
+                      guint n,
+                      gfloat *min,
+                      gfloat *max,
+                      UfoResources *resources,
+                      gpointer command_queue)
+{
+    cl_kernel kernel;
+    cl_device_id device;
+    cl_event event;
+    size_t max_local_size;
+    size_t local_size = 256;
+    size_t global_size;
+    gfloat partial[2 * MIN_MAX_GROUPS];
+    cl_mem d_partial;
+    cl_int errcode;
+    GError *error = NULL;
+
+    kernel = ufo_resources_get_thread_kernel (resources, OPS_FILENAME, "operation_min_max", &error);
+
+    if (error) {
+        g_error ("%s\n", error->message);
+        return;
+    }
+
+    UFO_RESOURCES_CHECK_CLERR (clGetCommandQueueInfo (command_queue, CL_QUEUE_DEVICE, sizeof (cl_device_id), &device, NULL));
+    UFO_RESOURCES_CHECK_CLERR (clGetKernelWorkGroupInfo (kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+                                                         sizeof (size_t), &max_local_size, NULL));
+
+    /* The tree reduction needs a power of two */
+    while (local_size > max_local_size)
+        local_size /= 2;
+
+    global_size = local_size * MIN_MAX_GROUPS;
+    d_partial = clCreateBuffer (ufo_resources_get_context (resources), CL_MEM_WRITE_ONLY,
+                                sizeof (partial), NULL, &errcode);
+    UFO_RESOURCES_CHECK_CLERR (errcode);
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &d_arg));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 1, sizeof (cl_mem), &d_partial));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 2, local_size * 2 * sizeof (gfloat), NULL));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 3, sizeof (guint), &n));
+    UFO_RESOURCES_CHECK_CLERR (clEnqueueNDRangeKernel (command_queue, kernel,
+                                                       1, NULL, &global_size, &local_size,
+                                                       0, NULL, &event));
+
+    UFO_RESOURCES_CHECK_CLERR (clEnqueueReadBuffer (command_queue, d_partial, CL_TRUE, 0, sizeof (partial),
+                                                    partial, 1, &event, NULL));
+    UFO_RESOURCES_CHECK_CLERR (clReleaseEvent (event));
+    UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (d_partial));
+
+    *min = INFINITY;
+    *max = -INFINITY;
+
+    for (guint i = 0; i < MIN_MAX_GROUPS; i++) {
+        *min = MIN (*min, partial[2 * i]);
+        *max = MAX (*max, partial[2 * i + 1]);
+    }
+}
+
+/**
+ * ufo_op_convert_to:
+ * @arg: A #UfoBuffer
+ * @depth: Target bit depth
+ * @min: Value mapped to the lowest value of @depth
+ * @max: Value mapped to the highest value of @depth
+ * @dst: Memory with room for all elements of @arg in @depth
+ * @resources: #UfoResources object
+ * @command_queue: A valid cl_command_queue
+ *
+ * Convert @arg on the device like ufo_buffer_convert_to() and download only the
+ * converted data into @dst. If @min equals @max, the range is determined with
+ * a reduction on the device first. @dst must stay valid until the returned
+ * event has completed.
+ *
+ * Returns: (transfer full): Event of the download into @dst
+ */
+gpointer
+ufo_op_convert_to (UfoBuffer *arg,
+                   UfoBufferDepth depth,
+                   gfloat min,
+                   gfloat max,
+                   gpointer dst,
+                   UfoResources *resources,
+                   gpointer command_queue)
+{
+    UfoRequisition requisition;
+    cl_kernel kernel;
+    cl_mem d_arg;
+    cl_mem d_out;
+    cl_event kernel_event;
+    cl_event event;
+    cl_int errcode;
+    const gchar *kernel_name;
+    gfloat scale, range, offset;
+    gsize size;
+    size_t n = 1;
+    GError *error = NULL;
+
+    ufo_buffer_get_requisition (arg, &requisition);
+    d_arg = ufo_buffer_get_device_array (arg, command_queue);
+
+    for (guint i = 0; i < requisition.n_dims; i++)
+        n *= requisition.dims[i];
+
+    if (depth == UFO_BUFFER_DEPTH_32F) {
+        UFO_RESOURCES_CHECK_CLERR (clEnqueueReadBuffer (command_queue, d_arg, CL_FALSE, 0, n * sizeof (gfloat),
+                                                        dst, 0, NULL, &event));
+        return event;
+    }
+
+    switch (depth) {
+        case UFO_BUFFER_DEPTH_8U:
+            kernel_name = "operation_convert_to_8u";
+            size = 1;
+            range = 255.0f;
+            offset = 0.0f;
+            break;
+        case UFO_BUFFER_DEPTH_16U:
+            kernel_name = "operation_convert_to_16u";
+            size = 2;
+            range = 65535.0f;
+            offset = 0.0f;
+            break;
+        case UFO_BUFFER_DEPTH_16S:
+            kernel_name = "operation_convert_to_16s";
+            size = 2;
+            range = 65535.0f;
+            offset = -32768.0f;
+            break;
+        case UFO_BUFFER_DEPTH_32S:
+            kernel_name = "operation_convert_to_32s";
+            size = 4;
+            range = 4294967040.0f;
+            offset = -2147483648.0f;
+            break;
+        case UFO_BUFFER_DEPTH_32U:
+            kernel_name = "operation_convert_to_32u";
+            size = 4;
+            range = 4294967040.0f;
+            offset = 0.0f;
+            break;
+        default:
+            g_warning ("Cannot convert to depth %i", depth);
+            return NULL;
+    }
+
+    if (min == max)
+        find_range_on_device (d_arg, (guint) n, &min, &max, resources, command_queue);
+
+    scale = max > min ? range / (max - min) : 0.0f;
+    kernel = ufo_resources_get_thread_kernel (resources, OPS_FILENAME, kernel_name, &error);
+
+    if (error) {
+        g_error ("%s\n", error->message);
+        return NULL;
+    }
+
+    d_out = clCreateBuffer (ufo_resources_get_context (resources), CL_MEM_WRITE_ONLY, n * size, NULL, &errcode);
+    UFO_RESOURCES_CHECK_CLERR (errcode);
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &d_arg));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 1, sizeof (cl_mem), &d_out));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 2, sizeof (gfloat), &min));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 3, sizeof (gfloat), &scale));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 4, sizeof (gfloat), &range));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 5, sizeof (gfloat), &offset));
+    UFO_RESOURCES_CHECK_CLERR (clEnqueueNDRangeKernel (command_queue, kernel,
+                                                       1, NULL, &n, NULL,
+                                                       0, NULL, &kernel_event));
+
+    UFO_RESOURCES_CHECK_CLERR (clEnqueueReadBuffer (command_queue, d_out, CL_FALSE, 0, n * size,
+                                                    dst, 1, &kernel_event, &event));
+
+    /* The runtime keeps d_out alive until the download has finished */
+    UFO_RESOURCES_CHECK_CLERR (clReleaseEvent (kernel_event));
+    UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (d_out));
+
+    return event;
+}
+
+static gboolean
+is_on_device (UfoBuffer *buffer)
+{
+    UfoBufferLocation location;
+
+    location = ufo_buffer_get_location (buffer);
+    return location == UFO_BUFFER_LOCATION_DEVICE || location == UFO_BUFFER_LOCATION_DEVICE_IMAGE;
+}
+
+static gboolean
+expression_on_device (UfoBuffer **args,
+                      guint n_args,
+                      UfoBuffer *out,
+                      UfoResources *resources,
+                      gpointer command_queue)
+{
+    if (resources == NULL || command_queue == NULL)
+        return FALSE;
+
+    /* Only go to the device if at least one operand is already there */
+    for (guint i = 0; i < n_args; i++) {
+        if (is_on_device (args[i]))
+            return TRUE;
+    }
+
+    return is_on_device (out);
+}
+
+static gsize
+get_num_elements (UfoBuffer *buffer)
+{
+    UfoRequisition requisition;
+    gsize n = 1;
+
+    ufo_buffer_get_requisition (buffer, &requisition);
+
+    for (guint i = 0; i < requisition.n_dims; i++)
+        n *= requisition.dims[i];
+
+    return n;
+}
+
+/**
+ * ufo_op_expression:
+ * @expression: Arithmetic expression
+ * @names: (array zero-terminated=1): %NULL-terminated names of the variables
+ *  used in @expression
+ * @args: (array): One #UfoBuffer for each name in @names
+ * @out: A #UfoBuffer receiving the result
+ * @resources: (allow-none): #UfoResources object or %NULL
+ * @command_queue: (allow-none): A valid cl_command_queue or %NULL
+ * @error: Return location for a GError from #UfoOpError, or %NULL
+ *
+ * Evaluate an elementwise @expression such as "(a - dark) / (flat - dark)"
+ * in a single pass, instead of chaining several operations with temporary
+ * buffers. Expressions consist of numbers, the variables in @names, the
+ * operators +, -, * and /, parentheses and the functions sqrt, exp, log, abs,
+ * sin, cos, min, max and pow. @out may be one of @args.
+ *
+ * If any buffer currently lives on the device and @resources and
+ * @command_queue are given, a kernel is generated for @expression, built once
+ * and enqueued. Otherwise the expression is evaluated on the host arrays.
+ *
+ * Returns: (transfer full): Event of the kernel or %NULL if the expression was
+ *  evaluated on the host or an error occurred.
+ */
+gpointer
+ufo_op_expression (const gchar *expression,
+                   const gchar * const *names,
+                   UfoBuffer **args,
+                   UfoBuffer *out,
+                   UfoResources *resources,
+                   gpointer command_queue,
+                   GError **error)
+{
+    UfoExpr *expr;
+    guint n_args;
+    gsize n_pixels;
+    cl_event event = NULL;
+
+    g_return_val_if_fail (expression != NULL && names != NULL && UFO_IS_BUFFER (out), NULL);
+
+    expr = ufo_expr_parse (expression, names, error);
+
+    if (expr == NULL)
+        return NULL;
+
+    n_args = g_strv_length ((gchar **) names);
+    n_pixels = get_num_elements (out);
+
+    for (guint i = 0; i < n_args; i++) {
+        if (get_num_elements (args[i]) != n_pixels) {
+            g_set_error (error, UFO_OP_ERROR, UFO_OP_ERROR_SIZE,
+                         "`%s' has a different number of elements than the output", names[i]);
+            ufo_expr_free (expr);
+            return NULL;
+        }
+    }
+
+    if (expression_on_device (args, n_args, out, resources, command_queue)) {
+        cl_kernel kernel;
+        cl_mem d_mem;
+        cl_ulong n = n_pixels;
+        size_t global = n_pixels;
+        gchar *source;
+
+        source = ufo_expr_get_opencl_source (expr);
+        kernel = ufo_resources_get_thread_kernel_from_source (resources, source, "expression", error);
+        g_free (source);
+
+        if (kernel == NULL) {
+            ufo_expr_free (expr);
+            return NULL;
+        }
+
+        for (guint i = 0; i < n_args; i++) {
+            d_mem = ufo_buffer_get_device_array (args[i], command_queue);
+            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i, sizeof (cl_mem), &d_mem));
+        }
+
+        d_mem = ufo_buffer_get_device_array (out, command_queue);
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, n_args, sizeof (cl_mem), &d_mem));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, n_args + 1, sizeof (cl_ulong), &n));
+        UFO_RESOURCES_CHECK_CLERR (ufo_tuner_enqueue (command_queue, kernel, 1, &global, (gpointer *) &event));
+    }
+    else {
+        const gfloat **inputs;
+
+        inputs = g_new0 (const gfloat *, n_args);
+
+        for (guint i = 0; i < n_args; i++)
+            inputs[i] = ufo_buffer_get_host_array (args[i], command_queue);
+
+        ufo_expr_evaluate (expr, inputs, ufo_buffer_get_host_array (out, command_queue), n_pixels);
+        g_free (inputs);
+    }
+
+    ufo_expr_free (expr);
+    return event;
+}
@@ -323,4 +323,56 @@ void descent_grad (__read_only image2d_t arg_r,
 
   float value = part[0] - part[1] - part[2];
   write_imagef(out, coord_w, value);
-}
\ No newline at end of file
+}
+
+__kernel
+void operation_min_max (__global const float *in,
+                        __global float2 *partial,
+                        __local float2 *scratch,
+                        const uint n)
+{
+  const uint lid = get_local_id(0);
+  float2 range = (float2) (INFINITY, -INFINITY);
+
+  /* fmin and fmax skip NaN like the host kernels */
+  for (uint i = get_global_id(0); i < n; i += get_global_size(0)) {
+    range.x = fmin(range.x, in[i]);
+    range.y = fmax(range.y, in[i]);
+  }
+
+  scratch[lid] = range;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (uint s = get_local_size(0) / 2; s > 0; s >>= 1) {
+    if (lid < s) {
+      scratch[lid].x = fmin(scratch[lid].x, scratch[lid + s].x);
+      scratch[lid].y = fmax(scratch[lid].y, scratch[lid + s].y);
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  if (lid == 0)
+    partial[get_group_id(0)] = scratch[0];
+}
+
+#define DEFINE_CONVERT_TO(name, type) \
+__kernel \
+void operation_convert_to_##name (__global const float *in, \
+                                  __global type *out, \
+                                  const float min, \
+                                  const float scale, \
+                                  const float range, \
+                                  const float offset) \
+{ \
+  const size_t idx = get_global_id(0); \
+  const float value = fmin(fmax((in[idx] - min) * scale, 0.0f), range) + offset; \
+\
+  out[idx] = convert_##type##_sat_rte(value); \
+}
+
+DEFINE_CONVERT_TO(8u, uchar)
+DEFINE_CONVERT_TO(16u, ushort)
+DEFINE_CONVERT_TO(16s, short)
+DEFINE_CONVERT_TO(32s, int)
+DEFINE_CONVERT_TO(32u, uint)
@@ -30,6 +30,13 @@
 
 G_BEGIN_DECLS
 
+#define UFO_OP_ERROR ufo_op_error_quark ()
+
+typedef enum {
+    UFO_OP_ERROR_EXPRESSION,
+    UFO_OP_ERROR_SIZE
+} UfoOpError;
+
 gpointer ufo_op_set         (UfoBuffer      *arg,
                              gfloat           value,
                              UfoResources   *resources,
@@ -102,6 +109,21 @@ gpointer ufo_op_gradient_descent
                              UfoBuffer      *out,
                              UfoResources   *resources,
                              gpointer        command_queue);
+gpointer ufo_op_convert_to  (UfoBuffer      *arg,
+                             UfoBufferDepth  depth,
+                             gfloat          min,
+                             gfloat          max,
+                             gpointer        dst,
+                             UfoResources   *resources,
+                             gpointer        command_queue);
+gpointer ufo_op_expression  (const gchar    *expression,
+                             const gchar * const *names,
+                             UfoBuffer     **args,
+                             UfoBuffer      *out,
+                             UfoResources   *resources,
+                             gpointer        command_queue,
+                             GError        **error);
+GQuark   ufo_op_error_quark (void);
 
 G_END_DECLS
 
@@ -0,0 +1,492 @@
+/*
+ * Copyright (C) 2011-2013 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "ufo-buffer-pool.h"
+#include "ufo-priv.h"
+
+/**
+ * SECTION:ufo-buffer-pool
+ * @Short_description: Re-use buffers across groups and schedulers
+ * @Title: UfoBufferPool
+ *
+ * A #UfoBufferPool keeps idle #UfoBuffer objects keyed by their OpenCL
+ * context, size in bytes and memory location. Instead of allocating and
+ * resizing buffers themselves, groups and schedulers borrow buffers with
+ * ufo_buffer_pool_acquire() and give them back with ufo_buffer_pool_release().
+ * This avoids repeated clCreateBuffer() and malloc() calls when frame sizes
+ * change during a run.
+ *
+ * Once the idle buffers occupy more than #UfoBufferPool:high-watermark bytes,
+ * the least recently released buffers are freed until less than
+ * #UfoBufferPool:low-watermark bytes are held.
+ */
+
+G_DEFINE_TYPE (UfoBufferPool, ufo_buffer_pool, G_TYPE_OBJECT)
+
+#define UFO_BUFFER_POOL_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), UFO_TYPE_BUFFER_POOL, UfoBufferPoolPrivate))
+
+#define DEFAULT_HIGH_WATERMARK  (G_GUINT64_CONSTANT (1) << 30)
+#define DEFAULT_LOW_WATERMARK   (G_GUINT64_CONSTANT (1) << 29)
+
+typedef struct {
+    gpointer            context;
+    gsize               size;
+    UfoBufferLocation   location;
+} Key;
+
+struct _UfoBufferPoolPrivate {
+    GMutex                   lock;
+    GHashTable              *buckets;   /* Key -> GQueue of UfoBuffer */
+    GQueue                  *idle;      /* all idle buffers, oldest first */
+    GHashTable              *idle_links;    /* UfoBuffer -> link in idle */
+    guint64                  high_watermark;
+    guint64                  low_watermark;
+    UfoBufferPoolStatistics  stats;
+};
+
+enum {
+    PROP_0,
+    PROP_HIGH_WATERMARK,
+    PROP_LOW_WATERMARK,
+    N_PROPERTIES
+};
+
+static GParamSpec *properties[N_PROPERTIES] = { NULL, };
+
+static guint
+key_hash (const Key *key)
+{
+    return g_direct_hash (key->context) ^ (guint) key->size ^ ((guint) key->location << 28);
+}
+
+static gboolean
+key_equal (const Key *a, const Key *b)
+{
+    return a->context == b->context && a->size == b->size && a->location == b->location;
+}
+
+/**
+ * ufo_buffer_pool_new:
+ *
+ * Create a new, empty buffer pool. Most users want to share the process-wide
+ * pool returned by ufo_buffer_pool_get_default().
+ *
+ * Returns: (transfer full): A new #UfoBufferPool.
+ */
+UfoBufferPool *
+ufo_buffer_pool_new (void)
+{
+    return UFO_BUFFER_POOL (g_object_new (UFO_TYPE_BUFFER_POOL, NULL));
+}
+
+/**
+ * ufo_buffer_pool_get_default:
+ *
+ * Get the process-wide buffer pool.
+ *
+ * Returns: (transfer none): The default #UfoBufferPool.
+ */
+UfoBufferPool *
+ufo_buffer_pool_get_default (void)
+{
+    static gsize pool = 0;
+
+    if (g_once_init_enter (&pool))
+        g_once_init_leave (&pool, (gsize) ufo_buffer_pool_new ());
+
+    return UFO_BUFFER_POOL ((gpointer) pool);
+}
+
+static void
+forget_idle (UfoBufferPoolPrivate *priv,
+             UfoBuffer *buffer)
+{
+    g_queue_delete_link (priv->idle, g_hash_table_lookup (priv->idle_links, buffer));
+    g_hash_table_remove (priv->idle_links, buffer);
+    priv->stats.n_idle--;
+    priv->stats.idle_bytes -= ufo_buffer_get_size (buffer);
+}
+
+static void
+remove_idle (UfoBufferPoolPrivate *priv,
+             GQueue *bucket,
+             UfoBuffer *buffer)
+{
+    g_queue_remove (bucket, buffer);
+    forget_idle (priv, buffer);
+}
+
+static UfoBuffer *
+take_idle (UfoBufferPoolPrivate *priv,
+           Key *key)
+{
+    GQueue *bucket;
+    UfoBuffer *buffer;
+
+    bucket = g_hash_table_lookup (priv->buckets, key);
+
+    if (bucket == NULL || g_queue_is_empty (bucket))
+        return NULL;
+
+    /* The most recently released buffer is the most likely to be cache-hot */
+    buffer = g_queue_pop_tail (bucket);
+    forget_idle (priv, buffer);
+    return buffer;
+}
+
+/**
+ * ufo_buffer_pool_acquire:
+ * @pool: A #UfoBufferPool
+ * @requisition: Size requisition of the buffer
+ * @context: (allow-none): cl_context of the buffer
+ * @location: Preferred memory location or %UFO_BUFFER_LOCATION_INVALID if any
+ *  location will do
+ *
+ * Borrow a buffer with the given @requisition from @pool. An idle buffer with
+ * the same number of bytes is re-used if possible, otherwise a new buffer is
+ * created.
+ *
+ * Returns: (transfer full): A #UfoBuffer that should be given back with
+ * ufo_buffer_pool_release().
+ */
+UfoBuffer *
+ufo_buffer_pool_acquire (UfoBufferPool *pool,
+                         UfoRequisition *requisition,
+                         gpointer context,
+                         UfoBufferLocation location)
+{
+    UfoBufferPoolPrivate *priv;
+    UfoBuffer *buffer = NULL;
+    Key key;
+
+    g_return_val_if_fail (UFO_IS_BUFFER_POOL (pool) && requisition != NULL, NULL);
+
+    priv = pool->priv;
+    key.context = context;
+    key.size = sizeof (gfloat);
+    key.location = location;
+
+    for (guint i = 0; i < requisition->n_dims; i++)
+        key.size *= requisition->dims[i];
+
+    g_mutex_lock (&priv->lock);
+
+    if (location != UFO_BUFFER_LOCATION_INVALID)
+        buffer = take_idle (priv, &key);
+
+    for (guint i = UFO_BUFFER_LOCATION_HOST; buffer == NULL && i <= UFO_BUFFER_LOCATION_INVALID; i++) {
+        key.location = (UfoBufferLocation) i;
+        buffer = take_idle (priv, &key);
+    }
+
+    if (buffer != NULL)
+        priv->stats.n_hits++;
+    else
+        priv->stats.n_misses++;
+
+    g_mutex_unlock (&priv->lock);
+
+    if (buffer == NULL)
+        return ufo_buffer_new (requisition, context);
+
+    ufo_buffer_resize (buffer, requisition);
+    return buffer;
+}
+
+/*
+ * Take idle buffers out of the pool until it is below the low watermark. The
+ * buffers are returned so that they can be freed after the lock is dropped,
+ * finalizing a buffer waits for its transfers.
+ */
+static GList *
+evict (UfoBufferPoolPrivate *priv)
+{
+    GList *victims = NULL;
+
+    while (priv->stats.idle_bytes > priv->low_watermark && !g_queue_is_empty (priv->idle)) {
+        UfoBuffer *buffer;
+        Key key;
+
+        buffer = g_queue_peek_head (priv->idle);
+        key.context = ufo_buffer_get_context (buffer);
+        key.size = ufo_buffer_get_size (buffer);
+        key.location = ufo_buffer_get_location (buffer);
+
+        remove_idle (priv, g_hash_table_lookup (priv->buckets, &key), buffer);
+        priv->stats.n_evictions++;
+        victims = g_list_prepend (victims, buffer);
+    }
+
+    return victims;
+}
+
+/**
+ * ufo_buffer_pool_release:
+ * @pool: A #UfoBufferPool
+ * @buffer: (transfer full): A #UfoBuffer
+ *
+ * Give @buffer back to @pool so that it can be re-used by subsequent calls to
+ * ufo_buffer_pool_acquire(). The pool takes over the reference of the caller.
+ * Metadata, layout, storage depth and the pinned setting of @buffer are reset,
+ * its data is kept.
+ */
+void
+ufo_buffer_pool_release (UfoBufferPool *pool,
+                         UfoBuffer *buffer)
+{
+    UfoBufferPoolPrivate *priv;
+    GQueue *bucket;
+    GList *victims = NULL;
+    Key key;
+
+    g_return_if_fail (UFO_IS_BUFFER_POOL (pool) && UFO_IS_BUFFER (buffer));
+
+    priv = pool->priv;
+
+    /* Do not leak metadata and settings of the last frame to the next user */
+    ufo_buffer_reset (buffer);
+
+    key.context = ufo_buffer_get_context (buffer);
+    key.size = ufo_buffer_get_size (buffer);
+    key.location = ufo_buffer_get_location (buffer);
+
+    g_mutex_lock (&priv->lock);
+
+    bucket = g_hash_table_lookup (priv->buckets, &key);
+
+    if (bucket == NULL) {
+        Key *bucket_key;
+
+        bucket_key = g_new0 (Key, 1);
+        *bucket_key = key;
+        bucket = g_queue_new ();
+        g_hash_table_insert (priv->buckets, bucket_key, bucket);
+    }
+
+    g_queue_push_tail (bucket, buffer);
+    g_queue_push_tail (priv->idle, buffer);
+    g_hash_table_insert (priv->idle_links, buffer, g_queue_peek_tail_link (priv->idle));
+
+    priv->stats.n_releases++;
+    priv->stats.n_idle++;
+    priv->stats.idle_bytes += key.size;
+    priv->stats.peak_idle_bytes = MAX (priv->stats.peak_idle_bytes, priv->stats.idle_bytes);
+
+    if (priv->stats.idle_bytes > priv->high_watermark)
+        victims = evict (priv);
+
+    g_mutex_unlock (&priv->lock);
+    g_list_free_full (victims, g_object_unref);
+}
+
+/**
+ * ufo_buffer_pool_purge:
+ * @pool: A #UfoBufferPool
+ * @context: (allow-none): A cl_context
+ *
+ * Free all idle buffers that were allocated for @context. This must be called
+ * before @context is released.
+ */
+void
+ufo_buffer_pool_purge (UfoBufferPool *pool,
+                       gpointer context)
+{
+    UfoBufferPoolPrivate *priv;
+    GList *buffers;
+    GList *victims = NULL;
+    GList *it;
+
+    g_return_if_fail (UFO_IS_BUFFER_POOL (pool));
+
+    priv = pool->priv;
+    g_mutex_lock (&priv->lock);
+
+    buffers = g_list_copy (priv->idle->head);
+
+    g_list_for (buffers, it) {
+        UfoBuffer *buffer;
+        Key key;
+
+        buffer = UFO_BUFFER (it->data);
+        key.context = ufo_buffer_get_context (buffer);
+
+        if (key.context != context)
+            continue;
+
+        key.size = ufo_buffer_get_size (buffer);
+        key.location = ufo_buffer_get_location (buffer);
+        remove_idle (priv, g_hash_table_lookup (priv->buckets, &key), buffer);
+        victims = g_list_prepend (victims, buffer);
+    }
+
+    g_debug ("INFO BufferPool: hits=%" G_GUINT64_FORMAT " misses=%" G_GUINT64_FORMAT
+             " evictions=%" G_GUINT64_FORMAT " peak=%3.2f MB",
+             priv->stats.n_hits, priv->stats.n_misses, priv->stats.n_evictions,
+             priv->stats.peak_idle_bytes / 1024. / 1024.);
+
+    g_list_free (buffers);
+    g_mutex_unlock (&priv->lock);
+    g_list_free_full (victims, g_object_unref);
+}
+
+/**
+ * ufo_buffer_pool_get_statistics:
+ * @pool: A #UfoBufferPool
+ * @statistics: (out): Location to store the statistics
+ *
+ * Get a snapshot of the usage statistics of @pool.
+ */
+void
+ufo_buffer_pool_get_statistics (UfoBufferPool *pool,
+                                UfoBufferPoolStatistics *statistics)
+{
+    g_return_if_fail (UFO_IS_BUFFER_POOL (pool) && statistics != NULL);
+
+    g_mutex_lock (&pool->priv->lock);
+    *statistics = pool->priv->stats;
+    g_mutex_unlock (&pool->priv->lock);
+}
+
+static void
+ufo_buffer_pool_set_property (GObject *object,
+                              guint property_id,
+                              const GValue *value,
+                              GParamSpec *pspec)
+{
+    UfoBufferPoolPrivate *priv = UFO_BUFFER_POOL_GET_PRIVATE (object);
+    GList *victims;
+
+    switch (property_id) {
+        case PROP_HIGH_WATERMARK:
+            g_mutex_lock (&priv->lock);
+            priv->high_watermark = g_value_get_uint64 (value);
+            priv->low_watermark = MIN (priv->low_watermark, priv->high_watermark);
+            victims = evict (priv);
+            g_mutex_unlock (&priv->lock);
+            g_list_free_full (victims, g_object_unref);
+            break;
+
+        case PROP_LOW_WATERMARK:
+            g_mutex_lock (&priv->lock);
+            priv->low_watermark = MIN (g_value_get_uint64 (value), priv->high_watermark);
+            g_mutex_unlock (&priv->lock);
+            break;
+
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+            break;
+    }
+}
+
+static void
+ufo_buffer_pool_get_property (GObject *object,
+                              guint property_id,
+                              GValue *value,
+                              GParamSpec *pspec)
+{
+    UfoBufferPoolPrivate *priv = UFO_BUFFER_POOL_GET_PRIVATE (object);
+
+    switch (property_id) {
+        case PROP_HIGH_WATERMARK:
+            g_value_set_uint64 (value, priv->high_watermark);
+            break;
+
+        case PROP_LOW_WATERMARK:
+            g_value_set_uint64 (value, priv->low_watermark);
+            break;
+
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+            break;
+    }
+}
+
+static void
+ufo_buffer_pool_finalize (GObject *object)
+{
+    UfoBufferPoolPrivate *priv;
+
+    priv = UFO_BUFFER_POOL_GET_PRIVATE (object);
+
+    g_hash_table_destroy (priv->idle_links);
+    g_queue_free_full (priv->idle, g_object_unref);
+    g_hash_table_destroy (priv->buckets);
+    g_mutex_clear (&priv->lock);
+
+    G_OBJECT_CLASS (ufo_buffer_pool_parent_class)->finalize (object);
+}
+
+static void
+ufo_buffer_pool_class_init (UfoBufferPoolClass *klass)
+{
+    GObjectClass *oclass = G_OBJECT_CLASS (klass);
+
+    oclass->set_property = ufo_buffer_pool_set_property;
+    oclass->get_property = ufo_buffer_pool_get_property;
+    oclass->finalize = ufo_buffer_pool_finalize;
+
+    /**
+     * UfoBufferPool:high-watermark:
+     *
+     * Number of idle bytes above which buffers are freed.
+     */
+    properties[PROP_HIGH_WATERMARK] =
+        g_param_spec_uint64 ("high-watermark",
+                             "Idle bytes above which buffers are freed",
+                             "Idle bytes above which buffers are freed",
+                             0, G_MAXUINT64, DEFAULT_HIGH_WATERMARK,
+                             G_PARAM_READWRITE);
+
+    /**
+     * UfoBufferPool:low-watermark:
+     *
+     * Number of idle bytes that are kept once the high watermark was exceeded.
+     */
+    properties[PROP_LOW_WATERMARK] =
+        g_param_spec_uint64 ("low-watermark",
+                             "Idle bytes kept after freeing buffers",
+                             "Idle bytes kept after freeing buffers",
+                             0, G_MAXUINT64, DEFAULT_LOW_WATERMARK,
+                             G_PARAM_READWRITE);
+
+    for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
+        g_object_class_install_property (oclass, i, properties[i]);
+
+    g_type_class_add_private (klass, sizeof (UfoBufferPoolPrivate));
+}
+
+static void
+ufo_buffer_pool_init (UfoBufferPool *pool)
+{
+    UfoBufferPoolPrivate *priv;
+
+    pool->priv = priv = UFO_BUFFER_POOL_GET_PRIVATE (pool);
+    g_mutex_init (&priv->lock);
+    priv->buckets = g_hash_table_new_full ((GHashFunc) key_hash, (GEqualFunc) key_equal,
+                                           g_free, (GDestroyNotify) g_queue_free);
+    priv->idle = g_queue_new ();
+    priv->idle_links = g_hash_table_new (g_direct_hash, g_direct_equal);
+    priv->high_watermark = DEFAULT_HIGH_WATERMARK;
+    priv->low_watermark = DEFAULT_LOW_WATERMARK;
+    memset (&priv->stats, 0, sizeof (UfoBufferPoolStatistics));
+}
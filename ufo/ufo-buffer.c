@@ -19,6 +19,7 @@
 
 #include "config.h"
 
+#include <math.h>
 #include <string.h>
 
 #ifdef __APPLE__
@@ -71,8 +72,10 @@
  * @UFO_BUFFER_DEPTH_32S: 32 bit signed
  * @UFO_BUFFER_DEPTH_32U: 32 bit unsigned
  * @UFO_BUFFER_DEPTH_32F: 32 bit float
+ * @UFO_BUFFER_DEPTH_16F: 16 bit half float
  *
- * Source depth of data as used in ufo_buffer_convert().
+ * Source depth of data as used in ufo_buffer_convert() and storage depth of
+ * buffer data as set with ufo_buffer_set_storage_depth().
  */
 
 /**
@@ -95,6 +98,22 @@
  * Layout of the backed data memory.
  */
 
+/**
+ * UfoBufferTransfer:
+ * @UFO_BUFFER_TRANSFER_HOST_TO_DEVICE: Upload from host memory into a device
+ *  array or image
+ * @UFO_BUFFER_TRANSFER_DEVICE_TO_HOST: Download from a device array or image
+ *  into host memory
+ * @UFO_BUFFER_TRANSFER_DEVICE_TO_DEVICE: Copy between two device arrays or two
+ *  images
+ * @UFO_BUFFER_TRANSFER_BUFFER_TO_IMAGE: Copy from a device array into an image
+ * @UFO_BUFFER_TRANSFER_IMAGE_TO_BUFFER: Copy from an image into a device array
+ * @UFO_BUFFER_TRANSFER_LAST: Auxiliary value, do not use
+ *
+ * Directions of data transfers counted by ufo_buffer_get_transfer_counters()
+ * and ufo_profiler_get_transfer_counters().
+ */
+
 G_DEFINE_TYPE(UfoBuffer, ufo_buffer, G_TYPE_OBJECT)
 
 #define UFO_BUFFER_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), UFO_TYPE_BUFFER, UfoBufferPrivate))
@@ -106,22 +125,77 @@ enum {
     N_PROPERTIES
 };
 
+/*
+ * Metadata tables are reference counted and shared between buffers that carry
+ * the same metadata, e.g. all outputs that inherit it from their inputs. Keys
+ * are interned strings and compared by pointer. A table that is shared must
+ * not change, writers copy it first.
+ */
+typedef struct {
+    gint        ref_count;
+    GHashTable *table;
+} Metadata;
+
+typedef struct {
+    guint64     n_transfers;
+    guint64     n_bytes;
+    guint64     time;           /* in ns */
+} TransferCounters;
+
 struct _UfoBufferPrivate {
     UfoRequisition      requisition;
     gfloat             *host_array;
     gboolean            free;
+    gboolean            pinned;         /* allocate page-locked host memory */
+    cl_mem              pinned_mem;     /* backs host_array if not NULL */
+    cl_command_queue    pinned_queue;   /* queue that mapped pinned_mem */
     cl_mem              device_array;
     cl_mem              device_image;
     cl_context          context;
     cl_command_queue    last_queue;
+    UfoBufferDepth      depth;          /* storage depth of the data */
     gsize               size;           /* size of buffer in bytes */
+    gsize               host_size;      /* allocated bytes of host_array */
+    gsize               device_size;    /* allocated bytes of device_array */
     UfoBufferLocation   location;
     UfoBufferLocation   last_location;
     UfoBufferLayout     layout;
-    GHashTable         *metadata;
+    Metadata           *metadata;       /* NULL if empty */
     GList              *sub_device_arrays;
+    cl_event            pending[3];     /* last transfer into each location */
+    cl_command_queue    pending_queue[3];
+    UfoBufferTransfer   pending_transfer[3];    /* LAST if not timed */
+    UfoProfiler        *pending_profiler[3];
+    TransferCounters    transfers[UFO_BUFFER_TRANSFER_LAST];
+    gboolean            downloaded;     /* host data came from the device */
+    guint32             fingerprint;    /* of host data when downloaded */
+    gint                n_readers;      /* > 0 if shared read-only */
+    guint               valid;          /* locations with valid data while shared */
+    GMutex              lock;
 };
 
+#define LOCATION_BIT(location)  (1 << (location))
+#define REDUCE_GROUP_SIZE       256
+#define REDUCE_MAX_GROUPS       256
+
+static GHashTable *pinned_contexts = NULL;  /* cl_context with pinned default */
+G_LOCK_DEFINE_STATIC (pinned_contexts);
+
+static gboolean
+get_pinned_default (gpointer context)
+{
+    gboolean pinned;
+
+    if (context == NULL)
+        return FALSE;
+
+    G_LOCK (pinned_contexts);
+    pinned = pinned_contexts != NULL && g_hash_table_contains (pinned_contexts, context);
+    G_UNLOCK (pinned_contexts);
+
+    return pinned;
+}
+
 static void
 update_location (UfoBufferPrivate *priv,
                  UfoBufferLocation new_location)
@@ -130,6 +204,237 @@ update_location (UfoBufferPrivate *priv,
     priv->location = new_location;
 }
 
+static void
+update_last_queue (UfoBufferPrivate *priv,
+                   cl_command_queue queue)
+{
+    if (queue != NULL)
+        priv->last_queue = queue;
+}
+
+/*
+ * Transfers are enqueued without blocking. The event of the last transfer into
+ * a location is kept until the data is needed elsewhere: further commands on
+ * the same in-order queue are ordered implicitly, transfers on other queues
+ * wait for it through their event wait list and host access waits for all
+ * pending transfers because they may still read from or write to host memory.
+ */
+static guint
+get_wait_list (UfoBufferPrivate *src_priv,
+               UfoBufferLocation src_location,
+               UfoBufferPrivate *dst_priv,
+               UfoBufferLocation dst_location,
+               cl_event wait_list[2])
+{
+    guint n_events = 0;
+
+    if (src_priv->pending[src_location] != NULL)
+        wait_list[n_events++] = src_priv->pending[src_location];
+
+    if (dst_priv->pending[dst_location] != NULL &&
+        (src_priv != dst_priv || src_location != dst_location))
+        wait_list[n_events++] = dst_priv->pending[dst_location];
+
+    return n_events;
+}
+
+/*
+ * Transfers are counted when they are enqueued and attributed to the profiler
+ * of the task that is processing on the calling thread. Their duration can
+ * only be read from the event after they finished, i.e. right away for
+ * blocking transfers and otherwise when the pending event is dropped.
+ */
+static void
+add_transfer_time (UfoBufferPrivate *priv,
+                   UfoBufferTransfer transfer,
+                   UfoProfiler *profiler,
+                   cl_event event)
+{
+    cl_int status;
+    cl_ulong start;
+    cl_ulong end;
+
+    UFO_RESOURCES_CHECK_CLERR (clGetEventInfo (event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                               sizeof (cl_int), &status, NULL));
+
+    /* Still running, e.g. superseded by a transfer on the same queue */
+    if (status != CL_COMPLETE)
+        return;
+
+    if (clGetEventProfilingInfo (event, CL_PROFILING_COMMAND_START, sizeof (cl_ulong), &start, NULL) != CL_SUCCESS ||
+        clGetEventProfilingInfo (event, CL_PROFILING_COMMAND_END, sizeof (cl_ulong), &end, NULL) != CL_SUCCESS ||
+        end < start)
+        return;
+
+    __atomic_fetch_add (&priv->transfers[transfer].time, end - start, __ATOMIC_RELAXED);
+
+    if (profiler != NULL)
+        ufo_profiler_add_transfer_time (profiler, transfer, end - start);
+}
+
+static void
+set_pending (UfoBufferPrivate *priv,
+             UfoBufferLocation location,
+             cl_event event,
+             cl_command_queue queue)
+{
+    if (priv->pending[location] != NULL) {
+        if (priv->pending_transfer[location] != UFO_BUFFER_TRANSFER_LAST)
+            add_transfer_time (priv, priv->pending_transfer[location],
+                               priv->pending_profiler[location], priv->pending[location]);
+
+        UFO_RESOURCES_CHECK_CLERR (clReleaseEvent (priv->pending[location]));
+    }
+
+    if (priv->pending_profiler[location] != NULL)
+        g_object_unref (priv->pending_profiler[location]);
+
+    priv->pending[location] = event;
+    priv->pending_queue[location] = queue;
+    priv->pending_transfer[location] = UFO_BUFFER_TRANSFER_LAST;
+    priv->pending_profiler[location] = NULL;
+}
+
+/*
+ * Account a transfer of @n_bytes into @priv. If @event is the pending event of
+ * @location, it is timed when it is dropped, otherwise it must have finished.
+ */
+static void
+account_transfer (UfoBufferPrivate *priv,
+                  UfoBufferTransfer transfer,
+                  gsize n_bytes,
+                  cl_command_queue queue,
+                  cl_event event,
+                  UfoBufferLocation location)
+{
+    UfoProfiler *profiler;
+
+    __atomic_fetch_add (&priv->transfers[transfer].n_transfers, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add (&priv->transfers[transfer].n_bytes, n_bytes, __ATOMIC_RELAXED);
+
+    profiler = ufo_profiler_get_current ();
+
+    if (profiler != NULL)
+        ufo_profiler_add_transfer (profiler, transfer, n_bytes, queue, event);
+
+    if (location != UFO_BUFFER_LOCATION_INVALID && priv->pending[location] == event) {
+        priv->pending_transfer[location] = transfer;
+        priv->pending_profiler[location] = profiler != NULL ? g_object_ref (profiler) : NULL;
+    }
+    else {
+        add_transfer_time (priv, transfer, profiler, event);
+    }
+}
+
+/*
+ * Hash a sample of words spread over the host data. It is cheap compared to
+ * the transfer and tells if a task changed data it downloaded before.
+ */
+static guint32
+get_fingerprint (UfoBufferPrivate *priv)
+{
+    const guint32 *words;
+    gsize n_words;
+    gsize step;
+    guint32 hash = 2166136261u;
+
+    words = (const guint32 *) priv->host_array;
+    n_words = priv->size / sizeof (guint32);
+    step = MAX (n_words / 256, 1);
+
+    for (gsize i = 0; i < n_words; i += step)
+        hash = (hash ^ words[i]) * 16777619u;
+
+    if (n_words > 0)
+        hash = (hash ^ words[n_words - 1]) * 16777619u;
+
+    return hash;
+}
+
+static void
+note_download (UfoBufferPrivate *priv)
+{
+    priv->downloaded = TRUE;
+    priv->fingerprint = get_fingerprint (priv);
+}
+
+/*
+ * Count a round trip if the host data of @src_priv is uploaded as it was
+ * downloaded, no matter which task downloaded it.
+ */
+static void
+note_upload (UfoBufferPrivate *src_priv,
+             UfoBufferPrivate *dst_priv)
+{
+    UfoProfiler *profiler;
+
+    profiler = ufo_profiler_get_current ();
+
+    if (profiler != NULL && src_priv->downloaded &&
+        src_priv->fingerprint == get_fingerprint (src_priv))
+        ufo_profiler_add_round_trip (profiler, src_priv->size);
+
+    src_priv->downloaded = FALSE;
+    dst_priv->downloaded = FALSE;
+}
+
+static void
+wait_pending (UfoBufferPrivate *priv,
+              UfoBufferLocation location)
+{
+    if (priv->pending[location] != NULL) {
+        UFO_RESOURCES_CHECK_CLERR (clWaitForEvents (1, &priv->pending[location]));
+        set_pending (priv, location, NULL, NULL);
+    }
+}
+
+static void
+wait_all_pending (UfoBufferPrivate *priv)
+{
+    wait_pending (priv, UFO_BUFFER_LOCATION_HOST);
+    wait_pending (priv, UFO_BUFFER_LOCATION_DEVICE);
+    wait_pending (priv, UFO_BUFFER_LOCATION_DEVICE_IMAGE);
+}
+
+static void
+sync_pending (UfoBufferPrivate *priv,
+              UfoBufferLocation location,
+              cl_command_queue queue)
+{
+    if (priv->pending[location] != NULL && priv->pending_queue[location] != queue)
+        wait_pending (priv, location);
+}
+
+/*
+ * Shared buffers are read concurrently by several consumers. Accessors then
+ * serialize on the buffer lock and remember which locations already hold a
+ * valid copy, so that readers do not transfer data over each other.
+ */
+static gboolean
+lock_if_shared (UfoBufferPrivate *priv)
+{
+    if (g_atomic_int_get (&priv->n_readers) == 0)
+        return FALSE;
+
+    g_mutex_lock (&priv->lock);
+    return TRUE;
+}
+
+static gboolean
+needs_transfer (UfoBufferPrivate *priv, gboolean shared, UfoBufferLocation location)
+{
+    return !shared || !(priv->valid & LOCATION_BIT (location));
+}
+
+static void
+unlock_if_shared (UfoBufferPrivate *priv, gboolean shared, UfoBufferLocation location)
+{
+    if (shared) {
+        priv->valid |= LOCATION_BIT (location);
+        g_mutex_unlock (&priv->lock);
+    }
+}
+
 static void
 copy_requisition (UfoRequisition *src,
                   UfoRequisition *dst)
@@ -142,10 +447,26 @@ copy_requisition (UfoRequisition *src,
         dst->dims[i] = src->dims[i];
 }
 
+static gboolean
+requisition_equal (UfoRequisition *a,
+                   UfoRequisition *b)
+{
+    if (a->n_dims != b->n_dims)
+        return FALSE;
+
+    for (guint i = 0; i < a->n_dims; i++) {
+        if (a->dims[i] != b->dims[i])
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
 static gsize
-compute_required_size (UfoRequisition *requisition)
+compute_required_size (UfoRequisition *requisition,
+                       UfoBufferDepth depth)
 {
-    gsize size = sizeof (gfloat);
+    gsize size = ufo_convert_get_depth_size (depth);
 
     for (guint i = 0; i < requisition->n_dims; i++)
         size *= requisition->dims[i];
@@ -154,12 +475,92 @@ compute_required_size (UfoRequisition *requisition)
 }
 
 static void
-alloc_host_mem (UfoBufferPrivate *priv)
+free_host_mem (UfoBufferPrivate *priv)
 {
-    if (priv->host_array != NULL && priv->free)
+    /* Pending uploads may still read from the host array */
+    wait_all_pending (priv);
+
+    if (priv->pinned_mem != NULL) {
+        UFO_RESOURCES_CHECK_CLERR (clEnqueueUnmapMemObject (priv->pinned_queue, priv->pinned_mem,
+                                                            priv->host_array, 0, NULL, NULL));
+        UFO_RESOURCES_CHECK_CLERR (clFinish (priv->pinned_queue));
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->pinned_mem));
+        UFO_RESOURCES_CHECK_CLERR (clReleaseCommandQueue (priv->pinned_queue));
+        priv->pinned_mem = NULL;
+        priv->pinned_queue = NULL;
+    }
+    else if (priv->free) {
         g_free (priv->host_array);
+    }
+
+    priv->host_array = NULL;
+    priv->host_size = 0;
+}
+
+/*
+ * Page-locked memory is allocated by the OpenCL runtime as a buffer object
+ * with CL_MEM_ALLOC_HOST_PTR that stays mapped for the lifetime of the host
+ * array. Reads and writes from and to it can be DMAed directly instead of
+ * being staged through an internal pinned buffer first.
+ */
+static gboolean
+alloc_pinned_host_mem (UfoBufferPrivate *priv)
+{
+    cl_mem mem;
+    gpointer array;
+    cl_int err;
+
+    if (priv->context == NULL || priv->last_queue == NULL)
+        return FALSE;
+
+    mem = clCreateBuffer (priv->context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, priv->size, NULL, &err);
+
+    if (err != CL_SUCCESS) {
+        g_debug ("WARN Could not allocate %zu bytes of pinned memory: %s",
+                 priv->size, ufo_resources_clerr (err));
+        return FALSE;
+    }
+
+    array = clEnqueueMapBuffer (priv->last_queue, mem, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+                                0, priv->size, 0, NULL, NULL, &err);
+
+    if (err != CL_SUCCESS) {
+        g_debug ("WARN Could not map pinned memory: %s", ufo_resources_clerr (err));
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (mem));
+        return FALSE;
+    }
+
+    g_debug ("ALOC %p [size=%3.2f MB, type=pinned]", (gpointer) mem, priv->size / 1024. / 1024.);
+    memset (array, 0, priv->size);
+
+    UFO_RESOURCES_CHECK_CLERR (clRetainCommandQueue (priv->last_queue));
+    priv->pinned_mem = mem;
+    priv->pinned_queue = priv->last_queue;
+    priv->host_array = array;
+    priv->free = FALSE;
+    return TRUE;
+}
+
+static void
+alloc_host_mem (UfoBufferPrivate *priv)
+{
+    if (priv->host_array != NULL)
+        free_host_mem (priv);
+
+    priv->host_size = priv->size;
+
+    if (priv->pinned && alloc_pinned_host_mem (priv))
+        return;
 
     priv->host_array = g_malloc0 (priv->size);
+    priv->free = TRUE;
+}
+
+static void
+ensure_host_mem (UfoBufferPrivate *priv)
+{
+    if (priv->host_array == NULL || priv->host_size < priv->size)
+        alloc_host_mem (priv);
 }
 
 static void
@@ -176,6 +577,14 @@ alloc_device_array (UfoBufferPrivate *priv)
 
     UFO_RESOURCES_CHECK_CLERR (err);
     priv->device_array = mem;
+    priv->device_size = priv->size;
+}
+
+static void
+ensure_device_array (UfoBufferPrivate *priv)
+{
+    if (priv->device_array == NULL || priv->device_size < priv->size)
+        alloc_device_array (priv);
 }
 
 #if 0
@@ -261,6 +670,13 @@ alloc_device_image (UfoBufferPrivate *priv)
 }
 #endif
 
+static void
+ensure_device_image (UfoBufferPrivate *priv)
+{
+    if (priv->device_image == NULL)
+        alloc_device_image (priv);
+}
+
 /**
  * ufo_buffer_new:
  * @requisition: (in): size requisition
@@ -282,8 +698,10 @@ ufo_buffer_new (UfoRequisition *requisition,
     buffer = UFO_BUFFER (g_object_new (UFO_TYPE_BUFFER, NULL));
     priv = buffer->priv;
     priv->context = context;
+    priv->pinned = get_pinned_default (context);
 
-    priv->size = compute_required_size (requisition);
+    priv->depth = UFO_BUFFER_DEPTH_32F;
+    priv->size = compute_required_size (requisition, priv->depth);
     priv->layout = UFO_BUFFER_LAYOUT_REAL;
     copy_requisition (requisition, &priv->requisition);
 
@@ -338,6 +756,7 @@ ufo_buffer_new_with_data (UfoRequisition *requisition,
 
     priv->free = FALSE;
     priv->host_array = data;
+    priv->host_size = priv->size;
     update_location (priv, UFO_BUFFER_LOCATION_HOST);
 
     return buffer;
@@ -358,6 +777,21 @@ ufo_buffer_get_size (UfoBuffer *buffer)
     return buffer->priv->size;
 }
 
+/**
+ * ufo_buffer_get_context:
+ * @buffer: A #UfoBuffer
+ *
+ * Get the OpenCL context that @buffer uses to allocate device memory.
+ *
+ * Returns: (transfer none): The cl_context of @buffer or %NULL.
+ */
+gpointer
+ufo_buffer_get_context (UfoBuffer *buffer)
+{
+    g_return_val_if_fail (UFO_IS_BUFFER (buffer), NULL);
+    return buffer->priv->context;
+}
+
 static gsize
 get_num_elements (UfoBufferPrivate *priv)
 {
@@ -387,9 +821,12 @@ transfer_host_to_host (UfoBufferPrivate *src_priv,
                        UfoBufferPrivate *dst_priv,
                        cl_command_queue queue)
 {
+    wait_all_pending (src_priv);
+    wait_all_pending (dst_priv);
     g_memmove (dst_priv->host_array,
                src_priv->host_array,
                src_priv->size);
+    dst_priv->downloaded = FALSE;
 }
 
 static void
@@ -398,15 +835,31 @@ transfer_host_to_device (UfoBufferPrivate *src_priv,
                          cl_command_queue queue)
 {
     cl_int errcode;
+    cl_event event;
+    cl_event wait_list[2];
+    guint n_events;
+
+    n_events = get_wait_list (src_priv, UFO_BUFFER_LOCATION_HOST,
+                              dst_priv, UFO_BUFFER_LOCATION_DEVICE, wait_list);
 
     errcode = clEnqueueWriteBuffer (queue,
                                     dst_priv->device_array,
-                                    CL_TRUE,
+                                    CL_FALSE,
                                     0, src_priv->size,
                                     src_priv->host_array,
-                                    0, NULL, NULL);
+                                    n_events, n_events > 0 ? wait_list : NULL, &event);
 
     UFO_RESOURCES_CHECK_CLERR (errcode);
+    set_pending (dst_priv, UFO_BUFFER_LOCATION_DEVICE, event, queue);
+    account_transfer (dst_priv, UFO_BUFFER_TRANSFER_HOST_TO_DEVICE, src_priv->size,
+                      queue, event, UFO_BUFFER_LOCATION_DEVICE);
+    note_upload (src_priv, dst_priv);
+
+    /* The host array must not change until the upload finished */
+    if (src_priv != dst_priv) {
+        UFO_RESOURCES_CHECK_CLERR (clRetainEvent (event));
+        set_pending (src_priv, UFO_BUFFER_LOCATION_HOST, event, queue);
+    }
 }
 
 static void
@@ -416,22 +869,33 @@ transfer_host_to_image (UfoBufferPrivate *src_priv,
 {
     cl_int errcode;
     cl_event event;
+    cl_event wait_list[2];
+    guint n_events;
     size_t region[3];
     size_t origin[] = { 0, 0, 0 };
 
     set_region_from_requisition (region, &src_priv->requisition);
+    n_events = get_wait_list (src_priv, UFO_BUFFER_LOCATION_HOST,
+                              dst_priv, UFO_BUFFER_LOCATION_DEVICE_IMAGE, wait_list);
 
     errcode = clEnqueueWriteImage (queue,
                                    dst_priv->device_image,
-                                   CL_TRUE,
+                                   CL_FALSE,
                                    origin, region,
                                    0, 0,
                                    src_priv->host_array,
-                                   0, NULL, &event);
+                                   n_events, n_events > 0 ? wait_list : NULL, &event);
 
     UFO_RESOURCES_CHECK_CLERR (errcode);
-    UFO_RESOURCES_CHECK_CLERR (clWaitForEvents (1, &event));
-    UFO_RESOURCES_CHECK_CLERR (clReleaseEvent (event));
+    set_pending (dst_priv, UFO_BUFFER_LOCATION_DEVICE_IMAGE, event, queue);
+    account_transfer (dst_priv, UFO_BUFFER_TRANSFER_HOST_TO_DEVICE, src_priv->size,
+                      queue, event, UFO_BUFFER_LOCATION_DEVICE_IMAGE);
+    note_upload (src_priv, dst_priv);
+
+    if (src_priv != dst_priv) {
+        UFO_RESOURCES_CHECK_CLERR (clRetainEvent (event));
+        set_pending (src_priv, UFO_BUFFER_LOCATION_HOST, event, queue);
+    }
 }
 
 static void
@@ -440,18 +904,24 @@ transfer_device_to_device (UfoBufferPrivate *src_priv,
                            cl_command_queue queue)
 {
     cl_event event;
+    cl_event wait_list[2];
+    guint n_events;
     cl_int errcode;
 
+    n_events = get_wait_list (src_priv, UFO_BUFFER_LOCATION_DEVICE,
+                              dst_priv, UFO_BUFFER_LOCATION_DEVICE, wait_list);
+
     errcode = clEnqueueCopyBuffer (queue,
                                    src_priv->device_array,
                                    dst_priv->device_array,
                                    0, 0,
                                    src_priv->size,
-                                   0, NULL, &event);
+                                   n_events, n_events > 0 ? wait_list : NULL, &event);
 
     UFO_RESOURCES_CHECK_CLERR (errcode);
-    UFO_RESOURCES_CHECK_CLERR (clWaitForEvents (1, &event));
-    UFO_RESOURCES_CHECK_CLERR (clReleaseEvent (event));
+    set_pending (dst_priv, UFO_BUFFER_LOCATION_DEVICE, event, queue);
+    account_transfer (dst_priv, UFO_BUFFER_TRANSFER_DEVICE_TO_DEVICE, src_priv->size,
+                      queue, event, UFO_BUFFER_LOCATION_DEVICE);
 }
 
 static void
@@ -460,15 +930,32 @@ transfer_device_to_host (UfoBufferPrivate *src_priv,
                          cl_command_queue queue)
 {
     cl_int errcode;
+    cl_event event;
+    cl_event wait_list[2];
+    guint n_events;
+
+    /* Reading into host memory is only done when the host needs the data */
+    if (src_priv != dst_priv)
+        wait_all_pending (dst_priv);
+
+    n_events = get_wait_list (src_priv, UFO_BUFFER_LOCATION_DEVICE,
+                              dst_priv, UFO_BUFFER_LOCATION_HOST, wait_list);
 
     errcode = clEnqueueReadBuffer (queue,
                                    src_priv->device_array,
                                    CL_TRUE,
                                    0, src_priv->size,
                                    dst_priv->host_array,
-                                   0, NULL, NULL);
+                                   n_events, n_events > 0 ? wait_list : NULL, &event);
 
     UFO_RESOURCES_CHECK_CLERR (errcode);
+
+    if (errcode == CL_SUCCESS) {
+        account_transfer (dst_priv, UFO_BUFFER_TRANSFER_DEVICE_TO_HOST, src_priv->size,
+                          queue, event, UFO_BUFFER_LOCATION_INVALID);
+        UFO_RESOURCES_CHECK_CLERR (clReleaseEvent (event));
+        note_download (dst_priv);
+    }
 }
 
 static void
@@ -478,20 +965,26 @@ transfer_device_to_image (UfoBufferPrivate *src_priv,
 {
     cl_event event;
     cl_int errcode;
+    cl_event wait_list[2];
+    guint n_events;
     size_t region[3];
     size_t origin[] = { 0, 0, 0 };
 
     set_region_from_requisition (region, &src_priv->requisition);
 
+    n_events = get_wait_list (src_priv, UFO_BUFFER_LOCATION_DEVICE,
+                              dst_priv, UFO_BUFFER_LOCATION_DEVICE_IMAGE, wait_list);
+
     errcode = clEnqueueCopyBufferToImage (queue,
                                           src_priv->device_array,
                                           dst_priv->device_image,
                                           0, origin, region,
-                                          0, NULL, &event);
+                                          n_events, n_events > 0 ? wait_list : NULL, &event);
 
     UFO_RESOURCES_CHECK_CLERR (errcode);
-    UFO_RESOURCES_CHECK_CLERR (clWaitForEvents (1, &event));
-    UFO_RESOURCES_CHECK_CLERR (clReleaseEvent (event));
+    set_pending (dst_priv, UFO_BUFFER_LOCATION_DEVICE_IMAGE, event, queue);
+    account_transfer (dst_priv, UFO_BUFFER_TRANSFER_BUFFER_TO_IMAGE, src_priv->size,
+                      queue, event, UFO_BUFFER_LOCATION_DEVICE_IMAGE);
 }
 
 static void
@@ -501,20 +994,26 @@ transfer_image_to_image (UfoBufferPrivate *src_priv,
 {
     cl_event event;
     cl_int errcode;
+    cl_event wait_list[2];
+    guint n_events;
     size_t region[3];
     size_t origin[] = { 0, 0, 0 };
 
     set_region_from_requisition (region, &src_priv->requisition);
 
+    n_events = get_wait_list (src_priv, UFO_BUFFER_LOCATION_DEVICE_IMAGE,
+                              dst_priv, UFO_BUFFER_LOCATION_DEVICE_IMAGE, wait_list);
+
     errcode = clEnqueueCopyImage (queue,
                                   src_priv->device_image,
                                   dst_priv->device_image,
                                   origin, origin, region,
-                                  0, NULL, &event);
+                                  n_events, n_events > 0 ? wait_list : NULL, &event);
 
     UFO_RESOURCES_CHECK_CLERR (errcode);
-    UFO_RESOURCES_CHECK_CLERR (clWaitForEvents (1, &event));
-    UFO_RESOURCES_CHECK_CLERR (clReleaseEvent (event));
+    set_pending (dst_priv, UFO_BUFFER_LOCATION_DEVICE_IMAGE, event, queue);
+    account_transfer (dst_priv, UFO_BUFFER_TRANSFER_DEVICE_TO_DEVICE, src_priv->size,
+                      queue, event, UFO_BUFFER_LOCATION_DEVICE_IMAGE);
 }
 
 static void
@@ -523,10 +1022,18 @@ transfer_image_to_host (UfoBufferPrivate *src_priv,
                         cl_command_queue queue)
 {
     cl_int errcode;
+    cl_event event;
+    cl_event wait_list[2];
+    guint n_events;
     size_t region[3];
     size_t origin[] = { 0, 0, 0 };
 
+    if (src_priv != dst_priv)
+        wait_all_pending (dst_priv);
+
     set_region_from_requisition (region, &src_priv->requisition);
+    n_events = get_wait_list (src_priv, UFO_BUFFER_LOCATION_DEVICE_IMAGE,
+                              dst_priv, UFO_BUFFER_LOCATION_HOST, wait_list);
 
     errcode = clEnqueueReadImage (queue,
                                   src_priv->device_image,
@@ -534,9 +1041,16 @@ transfer_image_to_host (UfoBufferPrivate *src_priv,
                                   origin, region,
                                   0, 0,
                                   dst_priv->host_array,
-                                  0, NULL, NULL);
+                                  n_events, n_events > 0 ? wait_list : NULL, &event);
 
     UFO_RESOURCES_CHECK_CLERR (errcode);
+
+    if (errcode == CL_SUCCESS) {
+        account_transfer (dst_priv, UFO_BUFFER_TRANSFER_DEVICE_TO_HOST, src_priv->size,
+                          queue, event, UFO_BUFFER_LOCATION_INVALID);
+        UFO_RESOURCES_CHECK_CLERR (clReleaseEvent (event));
+        note_download (dst_priv);
+    }
 }
 
 static void
@@ -546,87 +1060,381 @@ transfer_image_to_device (UfoBufferPrivate *src_priv,
 {
     cl_event event;
     cl_int errcode;
+    cl_event wait_list[2];
+    guint n_events;
     size_t region[3];
     size_t origin[] = { 0, 0, 0 };
 
     set_region_from_requisition (region, &src_priv->requisition);
 
+    n_events = get_wait_list (src_priv, UFO_BUFFER_LOCATION_DEVICE_IMAGE,
+                              dst_priv, UFO_BUFFER_LOCATION_DEVICE, wait_list);
+
     errcode = clEnqueueCopyImageToBuffer (queue,
                                           src_priv->device_image,
                                           dst_priv->device_array,
                                           origin, region, 0,
-                                          0, NULL, &event);
+                                          n_events, n_events > 0 ? wait_list : NULL, &event);
 
     UFO_RESOURCES_CHECK_CLERR (errcode);
-    UFO_RESOURCES_CHECK_CLERR (clWaitForEvents (1, &event));
-    UFO_RESOURCES_CHECK_CLERR (clReleaseEvent (event));
+    set_pending (dst_priv, UFO_BUFFER_LOCATION_DEVICE, event, queue);
+    account_transfer (dst_priv, UFO_BUFFER_TRANSFER_IMAGE_TO_BUFFER, src_priv->size,
+                      queue, event, UFO_BUFFER_LOCATION_DEVICE);
 }
 
-
-/**
- * ufo_buffer_copy:
- * @src: Source #UfoBuffer
- * @dst: Destination #UfoBuffer
+/*
+ * Data may be stored in a narrower depth than the 32-bit floats tasks usually
+ * work on, e.g. raw camera frames. It stays narrow until it is accessed as
+ * floats and is then widened where it resides or, if it is needed on the
+ * device anyway, by a kernel on the device. Either way only the narrow data
+ * crosses the bus.
  *
- * Copy contents of @src to @dst. The final memory location is determined by the
- * destination buffer.
+ * Statistics of device data are reduced by a tree within each work group. The
+ * partial results of the groups are combined on the host, see
+ * reduce_on_device().
  */
-void
-ufo_buffer_copy (UfoBuffer *src, UfoBuffer *dst)
-{
-    typedef void (*TransferFunc) (UfoBufferPrivate *, UfoBufferPrivate *, cl_command_queue);
-    typedef void (*AllocFunc) (UfoBufferPrivate *priv);
+static const gchar *program_source =
+    "kernel void widen_8u (global const uchar *src, global float *dst) { size_t i = get_global_id (0); dst[i] = (float) src[i]; }\n"
+    "kernel void widen_16u (global const ushort *src, global float *dst) { size_t i = get_global_id (0); dst[i] = (float) src[i]; }\n"
+    "kernel void widen_16s (global const short *src, global float *dst) { size_t i = get_global_id (0); dst[i] = (float) src[i]; }\n"
+    "kernel void widen_32s (global const int *src, global float *dst) { size_t i = get_global_id (0); dst[i] = (float) src[i]; }\n"
+    "kernel void widen_32u (global const uint *src, global float *dst) { size_t i = get_global_id (0); dst[i] = (float) src[i]; }\n"
+    "kernel void widen_16f (global const half *src, global float *dst) { size_t i = get_global_id (0); dst[i] = vload_half (i, src); }\n"
+    "kernel void reduce_moments (global const float *src, ulong n, global float *partials,\n"
+    "                            local uint *count, local float *mean, local float *m2, local float *lo, local float *hi)\n"
+    "{\n"
+    "    size_t lid = get_local_id (0);\n"
+    "    uint c = 0;\n"
+    "    float m = 0.0f, s = 0.0f, mn = INFINITY, mx = -INFINITY;\n"
+    "    for (ulong i = get_global_id (0); i < n; i += get_global_size (0)) {\n"
+    "        float x = src[i], d;\n"
+    "        if (isnan (x)) continue;\n"
+    "        c++; d = x - m; m += d / c; s += d * (x - m);\n"
+    "        mn = fmin (mn, x); mx = fmax (mx, x);\n"
+    "    }\n"
+    "    count[lid] = c; mean[lid] = m; m2[lid] = s; lo[lid] = mn; hi[lid] = mx;\n"
+    "    barrier (CLK_LOCAL_MEM_FENCE);\n"
+    "    for (size_t stride = get_local_size (0) / 2; stride > 0; stride >>= 1) {\n"
+    "        if (lid < stride) {\n"
+    "            uint ca = count[lid], cb = count[lid + stride];\n"
+    "            if (cb > 0) {\n"
+    "                float d = mean[lid + stride] - mean[lid], f = (float) cb / (ca + cb);\n"
+    "                mean[lid] += d * f; m2[lid] += m2[lid + stride] + d * d * ca * f; count[lid] = ca + cb;\n"
+    "            }\n"
+    "            lo[lid] = fmin (lo[lid], lo[lid + stride]); hi[lid] = fmax (hi[lid], hi[lid + stride]);\n"
+    "        }\n"
+    "        barrier (CLK_LOCAL_MEM_FENCE);\n"
+    "    }\n"
+    "    if (lid == 0) {\n"
+    "        global float *p = partials + 5 * get_group_id (0);\n"
+    "        p[0] = as_float (count[0]); p[1] = mean[0]; p[2] = m2[0]; p[3] = lo[0]; p[4] = hi[0];\n"
+    "    }\n"
+    "}\n"
+    "kernel void reduce_histogram (global const float *src, ulong n, float lower, float upper, float scale, uint n_bins, global uint *bins)\n"
+    "{\n"
+    "    for (ulong i = get_global_id (0); i < n; i += get_global_size (0)) {\n"
+    "        float x = src[i];\n"
+    "        if (x >= lower && x <= upper) atomic_inc (&bins[min ((uint) ((x - lower) * scale), n_bins - 1)]);\n"
+    "    }\n"
+    "}\n";
+
+static const gchar *widen_kernels[] = {
+    [UFO_BUFFER_DEPTH_8U]  = "widen_8u",
+    [UFO_BUFFER_DEPTH_16U] = "widen_16u",
+    [UFO_BUFFER_DEPTH_16S] = "widen_16s",
+    [UFO_BUFFER_DEPTH_32S] = "widen_32s",
+    [UFO_BUFFER_DEPTH_32U] = "widen_32u",
+    [UFO_BUFFER_DEPTH_32F] = NULL,
+    [UFO_BUFFER_DEPTH_16F] = "widen_16f",
+};
 
-    UfoBufferPrivate *spriv;
-    UfoBufferPrivate *dpriv;
-    cl_command_queue queue;
+static GHashTable *programs = NULL;     /* retained cl_context → cl_program or NULL */
+G_LOCK_DEFINE_STATIC (programs);
 
-    TransferFunc transfer[3][3] = {
-        { transfer_host_to_host, transfer_host_to_device, transfer_host_to_image },
-        { transfer_device_to_host, transfer_device_to_device, transfer_device_to_image },
-        { transfer_image_to_host, transfer_image_to_device, transfer_image_to_image }
-    };
+static cl_program
+get_program (cl_context context)
+{
+    cl_program program = NULL;
+    cl_int err;
 
-    AllocFunc alloc[3] = { alloc_host_mem, alloc_device_array, alloc_device_image };
+    G_LOCK (programs);
 
-    g_return_if_fail (UFO_IS_BUFFER (src) && UFO_IS_BUFFER (dst));
+    if (programs == NULL)
+        programs = g_hash_table_new (g_direct_hash, g_direct_equal);
 
-    if (ufo_buffer_cmp_dimensions (dst, &src->priv->requisition) != 0)
-        ufo_buffer_resize (dst, &src->priv->requisition);
+    if (!g_hash_table_lookup_extended (programs, context, NULL, (gpointer *) &program)) {
+        program = clCreateProgramWithSource (context, 1, &program_source, NULL, &err);
 
-    spriv = src->priv;
-    dpriv = dst->priv;
-    queue = spriv->last_queue != NULL ? spriv->last_queue : dpriv->last_queue;
+        if (err == CL_SUCCESS) {
+            err = clBuildProgram (program, 0, NULL, NULL, NULL, NULL);
 
-    if (spriv->location == UFO_BUFFER_LOCATION_INVALID) {
-        alloc_host_mem (spriv);
-        spriv->location = UFO_BUFFER_LOCATION_HOST;
-    }
+            if (err != CL_SUCCESS) {
+                UFO_RESOURCES_CHECK_CLERR (clReleaseProgram (program));
+                program = NULL;
+            }
+        }
+        else {
+            program = NULL;
+        }
 
-    if (dpriv->location == UFO_BUFFER_LOCATION_INVALID ||
-        (!dpriv->host_array && !dpriv->device_array && !dpriv->device_image)) {
-        alloc[spriv->location](dpriv);
-        dpriv->location = spriv->location;
+        if (program == NULL)
+            g_debug ("WARN Cannot build buffer kernels: %s", ufo_resources_clerr (err));
+
+        /* Keep the context alive so that its address is not reused */
+        UFO_RESOURCES_CHECK_CLERR (clRetainContext (context));
+        g_hash_table_insert (programs, context, program);
     }
 
-    transfer[spriv->location][dpriv->location](spriv, dpriv, queue);
-    dpriv->last_queue = queue;
+    G_UNLOCK (programs);
+    return program;
 }
 
-/**
- * ufo_buffer_dup:
- * @buffer: A #UfoBuffer
- *
- * Create a new buffer with the same requisition as @buffer. Note, that this is
- * not a copy of @buffer!
- *
- * Returns: (transfer full): A #UfoBuffer with the same size as @buffer.
+/*
+ * Release the buffer kernels built for @context together with the reference
+ * on @context. Called by the owner of @context before releasing it.
  */
-UfoBuffer *
-ufo_buffer_dup (UfoBuffer *buffer)
+void
+ufo_buffer_release_programs (gpointer context)
 {
-    UfoBuffer *copy;
-    UfoRequisition requisition;
+    cl_program program = NULL;
+
+    G_LOCK (programs);
+
+    if (programs != NULL &&
+        g_hash_table_lookup_extended (programs, context, NULL, (gpointer *) &program)) {
+        g_hash_table_remove (programs, context);
+
+        if (program != NULL)
+            UFO_RESOURCES_CHECK_CLERR (clReleaseProgram (program));
+
+        UFO_RESOURCES_CHECK_CLERR (clReleaseContext (context));
+    }
+
+    G_UNLOCK (programs);
+}
+
+static void
+set_depth (UfoBufferPrivate *priv,
+           UfoBufferDepth depth)
+{
+    priv->depth = depth;
+    priv->size = compute_required_size (&priv->requisition, depth);
+}
+
+static gboolean
+widen_on_device (UfoBufferPrivate *priv)
+{
+    cl_program program;
+    cl_kernel kernel;
+    cl_command_queue queue;
+    cl_event event;
+    cl_mem src;
+    cl_int err;
+    gsize n;
+
+    queue = priv->last_queue;
+
+    if (priv->context == NULL || queue == NULL)
+        return FALSE;
+
+    program = get_program (priv->context);
+
+    if (program == NULL)
+        return FALSE;
+
+    kernel = clCreateKernel (program, widen_kernels[priv->depth], &err);
+    UFO_RESOURCES_CHECK_CLERR (err);
+    sync_pending (priv, UFO_BUFFER_LOCATION_DEVICE, queue);
+
+    if (priv->location == UFO_BUFFER_LOCATION_HOST) {
+        src = clCreateBuffer (priv->context, CL_MEM_READ_ONLY, priv->size, NULL, &err);
+        UFO_RESOURCES_CHECK_CLERR (err);
+        UFO_RESOURCES_CHECK_CLERR (clEnqueueWriteBuffer (queue, src, CL_FALSE, 0, priv->size,
+                                                         priv->host_array, 0, NULL, &event));
+
+        /* The host array must not change until the upload finished */
+        set_pending (priv, UFO_BUFFER_LOCATION_HOST, event, queue);
+        account_transfer (priv, UFO_BUFFER_TRANSFER_HOST_TO_DEVICE, priv->size,
+                          queue, event, UFO_BUFFER_LOCATION_HOST);
+        note_upload (priv, priv);
+    }
+    else {
+        /* The narrow array is only read by the kernel, the float data goes
+         * into a new or larger array */
+        src = priv->device_array;
+        priv->device_array = NULL;
+        priv->device_size = 0;
+    }
+
+    n = get_num_elements (priv);
+    set_depth (priv, UFO_BUFFER_DEPTH_32F);
+    ensure_device_array (priv);
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &src));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 1, sizeof (cl_mem), &priv->device_array));
+    UFO_RESOURCES_CHECK_CLERR (clEnqueueNDRangeKernel (queue, kernel, 1, NULL, &n, NULL, 0, NULL, &event));
+    set_pending (priv, UFO_BUFFER_LOCATION_DEVICE, event, queue);
+
+    /* Both are released once the kernel finished */
+    UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (kernel));
+    UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (src));
+
+    update_location (priv, UFO_BUFFER_LOCATION_DEVICE);
+    return TRUE;
+}
+
+static void
+widen_on_host (UfoBufferPrivate *priv)
+{
+    UfoBufferDepth depth;
+    gpointer narrow = NULL;
+    gsize n;
+    gsize size;
+
+    wait_all_pending (priv);
+    depth = priv->depth;
+    n = get_num_elements (priv);
+    size = n * sizeof (gfloat);
+
+    if (priv->host_size < size) {
+        if (priv->free && priv->pinned_mem == NULL) {
+            priv->host_array = g_realloc (priv->host_array, size);
+            priv->host_size = size;
+        }
+        else {
+            narrow = g_malloc (priv->size);
+            memcpy (narrow, priv->host_array, priv->size);
+        }
+    }
+
+    set_depth (priv, UFO_BUFFER_DEPTH_32F);
+
+    if (narrow != NULL) {
+        alloc_host_mem (priv);
+        ufo_convert_to_float (priv->host_array, narrow, depth, n);
+        g_free (narrow);
+    }
+    else {
+        ufo_convert_to_float (priv->host_array, priv->host_array, depth, n);
+    }
+}
+
+/*
+ * Make sure the data of @priv is stored as floats before it is accessed as
+ * such at @target.
+ */
+static void
+widen (UfoBufferPrivate *priv,
+       UfoBufferLocation target,
+       gboolean shared)
+{
+    if (priv->depth == UFO_BUFFER_DEPTH_32F)
+        return;
+
+    if (priv->location != UFO_BUFFER_LOCATION_HOST &&
+        priv->location != UFO_BUFFER_LOCATION_DEVICE) {
+        set_depth (priv, UFO_BUFFER_DEPTH_32F);
+        return;
+    }
+
+    if (priv->location == UFO_BUFFER_LOCATION_HOST && target == UFO_BUFFER_LOCATION_HOST)
+        widen_on_host (priv);
+    else if (!widen_on_device (priv)) {
+        if (priv->location == UFO_BUFFER_LOCATION_DEVICE) {
+            ensure_host_mem (priv);
+            transfer_device_to_host (priv, priv, priv->last_queue);
+            update_location (priv, UFO_BUFFER_LOCATION_HOST);
+        }
+
+        widen_on_host (priv);
+    }
+
+    /* Copies made for other readers hold the narrow data */
+    if (shared)
+        priv->valid = LOCATION_BIT (priv->location);
+}
+
+
+/**
+ * ufo_buffer_copy:
+ * @src: Source #UfoBuffer
+ * @dst: Destination #UfoBuffer
+ *
+ * Copy contents of @src to @dst. The final memory location is determined by the
+ * destination buffer.
+ */
+void
+ufo_buffer_copy (UfoBuffer *src, UfoBuffer *dst)
+{
+    typedef void (*TransferFunc) (UfoBufferPrivate *, UfoBufferPrivate *, cl_command_queue);
+    typedef void (*EnsureFunc) (UfoBufferPrivate *priv);
+
+    UfoBufferPrivate *spriv;
+    UfoBufferPrivate *dpriv;
+    cl_command_queue queue;
+    gboolean shared;
+
+    TransferFunc transfer[3][3] = {
+        { transfer_host_to_host, transfer_host_to_device, transfer_host_to_image },
+        { transfer_device_to_host, transfer_device_to_device, transfer_device_to_image },
+        { transfer_image_to_host, transfer_image_to_device, transfer_image_to_image }
+    };
+
+    EnsureFunc ensure[3] = { ensure_host_mem, ensure_device_array, ensure_device_image };
+
+    g_return_if_fail (UFO_IS_BUFFER (src) && UFO_IS_BUFFER (dst));
+    g_return_if_fail (!ufo_buffer_is_shared (dst));
+
+    if (ufo_buffer_cmp_dimensions (dst, &src->priv->requisition) != 0)
+        ufo_buffer_resize (dst, &src->priv->requisition);
+
+    spriv = src->priv;
+    dpriv = dst->priv;
+    shared = lock_if_shared (spriv);
+    queue = spriv->last_queue != NULL ? spriv->last_queue : dpriv->last_queue;
+
+    if (spriv->location == UFO_BUFFER_LOCATION_INVALID) {
+        alloc_host_mem (spriv);
+        spriv->location = UFO_BUFFER_LOCATION_HOST;
+    }
+
+    update_last_queue (dpriv, queue);
+
+    if (dpriv->depth != spriv->depth) {
+        wait_all_pending (dpriv);
+        set_depth (dpriv, spriv->depth);
+    }
+
+    if (dpriv->location == UFO_BUFFER_LOCATION_INVALID ||
+        (!dpriv->host_array && !dpriv->device_array && !dpriv->device_image))
+        dpriv->location = spriv->location;
+
+    /* Images only hold floats */
+    if (dpriv->location == UFO_BUFFER_LOCATION_DEVICE_IMAGE && dpriv->depth != UFO_BUFFER_DEPTH_32F)
+        dpriv->location = UFO_BUFFER_LOCATION_DEVICE;
+
+    ensure[dpriv->location](dpriv);
+    transfer[spriv->location][dpriv->location](spriv, dpriv, queue);
+    dpriv->last_queue = queue;
+
+    if (shared)
+        g_mutex_unlock (&spriv->lock);
+}
+
+/**
+ * ufo_buffer_dup:
+ * @buffer: A #UfoBuffer
+ *
+ * Create a new buffer with the same requisition as @buffer. Note, that this is
+ * not a copy of @buffer!
+ *
+ * Returns: (transfer full): A #UfoBuffer with the same size as @buffer.
+ */
+UfoBuffer *
+ufo_buffer_dup (UfoBuffer *buffer)
+{
+    UfoBuffer *copy;
+    UfoRequisition requisition;
 
     ufo_buffer_get_requisition (buffer, &requisition);
     copy = ufo_buffer_new (&requisition, buffer->priv->context);
@@ -647,13 +1455,17 @@ void
 ufo_buffer_swap_data (UfoBuffer *src,
                       UfoBuffer *dst)
 {
-    GHashTable *tmp_meta;
+    Metadata *tmp_meta;
 
-    if (src->priv->location != dst->priv->location) {
+    if (src->priv->location != dst->priv->location ||
+        src->priv->depth != dst->priv->depth) {
         ufo_buffer_copy (src, dst);
         return;
     }
 
+    wait_all_pending (src->priv);
+    wait_all_pending (dst->priv);
+
     tmp_meta = src->priv->metadata;
     src->priv->metadata = dst->priv->metadata;
     dst->priv->metadata = tmp_meta;
@@ -662,20 +1474,56 @@ ufo_buffer_swap_data (UfoBuffer *src,
         case UFO_BUFFER_LOCATION_HOST:
             {
                 gfloat *tmp;
+                gsize tmp_size;
+                cl_mem tmp_mem;
+                cl_command_queue tmp_queue;
+                gboolean tmp_free;
+                gboolean tmp_downloaded;
+                guint32 tmp_fingerprint;
 
                 tmp = src->priv->host_array;
                 src->priv->host_array = dst->priv->host_array;
                 dst->priv->host_array = tmp;
+
+                /* Whoever owns the memory now has to free it */
+                tmp_free = src->priv->free;
+                src->priv->free = dst->priv->free;
+                dst->priv->free = tmp_free;
+
+                tmp_size = src->priv->host_size;
+                src->priv->host_size = dst->priv->host_size;
+                dst->priv->host_size = tmp_size;
+
+                tmp_mem = src->priv->pinned_mem;
+                src->priv->pinned_mem = dst->priv->pinned_mem;
+                dst->priv->pinned_mem = tmp_mem;
+
+                tmp_queue = src->priv->pinned_queue;
+                src->priv->pinned_queue = dst->priv->pinned_queue;
+                dst->priv->pinned_queue = tmp_queue;
+
+                tmp_downloaded = src->priv->downloaded;
+                src->priv->downloaded = dst->priv->downloaded;
+                dst->priv->downloaded = tmp_downloaded;
+
+                tmp_fingerprint = src->priv->fingerprint;
+                src->priv->fingerprint = dst->priv->fingerprint;
+                dst->priv->fingerprint = tmp_fingerprint;
             }
             break;
 
         case UFO_BUFFER_LOCATION_DEVICE:
             {
                 cl_mem tmp;
+                gsize tmp_size;
 
                 tmp = src->priv->device_array;
                 src->priv->device_array = dst->priv->device_array;
                 dst->priv->device_array = tmp;
+
+                tmp_size = src->priv->device_size;
+                src->priv->device_size = dst->priv->device_size;
+                dst->priv->device_size = tmp_size;
             }
             break;
 
@@ -700,7 +1548,9 @@ ufo_buffer_swap_data (UfoBuffer *src,
  * @requisition: A #UfoRequisition structure
  *
  * Resize an existing buffer. If the new requisition has the same size as
- * before, resizing is a no-op.
+ * before, resizing is a no-op. If only the shape changes but the number of
+ * bytes stays the same, host and device arrays are kept and only the image
+ * object is released.
  *
  * Since: 0.2
  */
@@ -712,19 +1562,30 @@ ufo_buffer_resize (UfoBuffer *buffer,
 
     g_return_if_fail (UFO_IS_BUFFER (buffer));
 
-    if (ufo_buffer_cmp_dimensions (buffer, requisition) == 0)
+    priv = UFO_BUFFER_GET_PRIVATE (buffer);
+
+    if (requisition_equal (&priv->requisition, requisition))
         return;
 
-    priv = UFO_BUFFER_GET_PRIVATE (buffer);
+    wait_all_pending (priv);
 
-    if (priv->host_array != NULL && priv->free) {
-        g_free (priv->host_array);
-        priv->host_array = NULL;
+    if (compute_required_size (requisition, priv->depth) == priv->size) {
+        if (priv->device_image != NULL) {
+            UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->device_image));
+            priv->device_image = NULL;
+        }
+
+        copy_requisition (requisition, &priv->requisition);
+        return;
     }
 
+    if (priv->host_array != NULL)
+        free_host_mem (priv);
+
     if (priv->device_array != NULL) {
         UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->device_array));
         priv->device_array = NULL;
+        priv->device_size = 0;
     }
 
     if (priv->device_image != NULL) {
@@ -732,7 +1593,7 @@ ufo_buffer_resize (UfoBuffer *buffer,
         priv->device_image = NULL;
     }
 
-    priv->size = compute_required_size (requisition);
+    priv->size = compute_required_size (requisition, priv->depth);
     copy_requisition (requisition, &priv->requisition);
 }
 
@@ -785,14 +1646,6 @@ ufo_buffer_get_requisition (UfoBuffer *buffer,
     copy_requisition (&priv->requisition, requisition);
 }
 
-static void
-update_last_queue (UfoBufferPrivate *priv,
-                   cl_command_queue queue)
-{
-    if (queue != NULL)
-        priv->last_queue = queue;
-}
-
 /**
  * ufo_buffer_copy_host_array:
  * @buffer: A #UfoBuffer
@@ -831,48 +1684,86 @@ ufo_buffer_set_host_array (UfoBuffer *buffer, gpointer array, gboolean free_data
 
     priv = buffer->priv;
 
-    if (priv->free)
-        g_free (priv->host_array);
+    free_host_mem (priv);
 
     priv->free = free_data;
     priv->host_array = array;
+    priv->host_size = priv->size;
 
     update_location (priv, UFO_BUFFER_LOCATION_HOST);
 }
 
-/**
- * ufo_buffer_get_host_array:
- * @buffer: A #UfoBuffer.
- * @cmd_queue: (allow-none): A cl_command_queue object or %NULL.
- *
- * Returns a flat C-array containing the raw float data.
- *
- * Returns: Float array.
- */
-gfloat *
-ufo_buffer_get_host_array (UfoBuffer *buffer, gpointer cmd_queue)
+static gpointer
+get_host_array (UfoBuffer *buffer,
+                gpointer cmd_queue,
+                gboolean raw)
 {
     UfoBufferPrivate *priv;
+    gboolean shared;
 
-    g_return_val_if_fail (UFO_IS_BUFFER (buffer), NULL);
     priv = buffer->priv;
+    shared = lock_if_shared (priv);
 
     update_last_queue (priv, cmd_queue);
 
-    if (priv->host_array == NULL)
-        alloc_host_mem (priv);
+    if (!raw)
+        widen (priv, UFO_BUFFER_LOCATION_HOST, shared);
 
-    if (priv->location == UFO_BUFFER_LOCATION_DEVICE && priv->device_array)
-        transfer_device_to_host (priv, priv, priv->last_queue);
+    ensure_host_mem (priv);
 
-    if (priv->location == UFO_BUFFER_LOCATION_DEVICE_IMAGE && priv->device_image)
-        transfer_image_to_host (priv, priv, priv->last_queue);
+    if (needs_transfer (priv, shared, UFO_BUFFER_LOCATION_HOST)) {
+        if (priv->location == UFO_BUFFER_LOCATION_DEVICE && priv->device_array)
+            transfer_device_to_host (priv, priv, priv->last_queue);
 
+        if (priv->location == UFO_BUFFER_LOCATION_DEVICE_IMAGE && priv->device_image)
+            transfer_image_to_host (priv, priv, priv->last_queue);
+    }
+
+    /* The caller may modify host memory that pending uploads still read */
+    wait_all_pending (priv);
     update_location (priv, UFO_BUFFER_LOCATION_HOST);
+    unlock_if_shared (priv, shared, UFO_BUFFER_LOCATION_HOST);
 
     return priv->host_array;
 }
 
+/**
+ * ufo_buffer_get_host_array:
+ * @buffer: A #UfoBuffer.
+ * @cmd_queue: (allow-none): A cl_command_queue object or %NULL.
+ *
+ * Returns a flat C-array containing the raw float data. If the data is stored
+ * in a narrower depth, it is converted to floats first.
+ *
+ * Returns: Float array.
+ */
+gfloat *
+ufo_buffer_get_host_array (UfoBuffer *buffer, gpointer cmd_queue)
+{
+    g_return_val_if_fail (UFO_IS_BUFFER (buffer), NULL);
+    return get_host_array (buffer, cmd_queue, FALSE);
+}
+
+/**
+ * ufo_buffer_get_raw_host_array:
+ * @buffer: A #UfoBuffer.
+ * @cmd_queue: (allow-none): A cl_command_queue object or %NULL.
+ *
+ * Like ufo_buffer_get_host_array() but return the data in its storage depth
+ * as reported by ufo_buffer_get_storage_depth() without converting it. Use
+ * this to fill a buffer with narrow data or in tasks that can process it
+ * directly. Consumers of a shared buffer must either all use raw or all use
+ * float access.
+ *
+ * Returns: Host array of ufo_buffer_get_size() bytes.
+ */
+gpointer
+ufo_buffer_get_raw_host_array (UfoBuffer *buffer, gpointer cmd_queue)
+{
+    g_return_val_if_fail (UFO_IS_BUFFER (buffer), NULL);
+    return get_host_array (buffer, cmd_queue, TRUE);
+}
+
 /**
  * ufo_buffer_set_device_array:
  * @buffer: A #UfoBuffer.
@@ -904,11 +1795,47 @@ void ufo_buffer_set_device_array (UfoBuffer *buffer, gpointer array, gboolean fr
                    size, priv->size);
     }
 
+    wait_pending (priv, UFO_BUFFER_LOCATION_DEVICE);
+
     if (priv->free && priv->device_array)
          UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->device_array));
 
     priv->device_array = array;
+    priv->device_size = size;
+    update_location (priv, UFO_BUFFER_LOCATION_DEVICE);
+}
+
+static gpointer
+get_device_array (UfoBuffer *buffer,
+                  gpointer cmd_queue,
+                  gboolean raw)
+{
+    UfoBufferPrivate *priv;
+    gboolean shared;
+
+    priv = buffer->priv;
+    shared = lock_if_shared (priv);
+
+    update_last_queue (priv, cmd_queue);
+
+    if (!raw)
+        widen (priv, UFO_BUFFER_LOCATION_DEVICE, shared);
+
+    ensure_device_array (priv);
+
+    if (needs_transfer (priv, shared, UFO_BUFFER_LOCATION_DEVICE)) {
+        if (priv->location == UFO_BUFFER_LOCATION_HOST && priv->host_array)
+            transfer_host_to_device (priv, priv, priv->last_queue);
+
+        if (priv->location == UFO_BUFFER_LOCATION_DEVICE_IMAGE && priv->device_array)
+            transfer_image_to_device (priv, priv, priv->last_queue);
+    }
+
+    sync_pending (priv, UFO_BUFFER_LOCATION_DEVICE, priv->last_queue);
     update_location (priv, UFO_BUFFER_LOCATION_DEVICE);
+    unlock_if_shared (priv, shared, UFO_BUFFER_LOCATION_DEVICE);
+
+    return priv->device_array;
 }
 
 /**
@@ -918,32 +1845,34 @@ void ufo_buffer_set_device_array (UfoBuffer *buffer, gpointer array, gboolean fr
  *
  * Return the current cl_mem object of @buffer. If the data is not yet in device
  * memory, it is transfered via @cmd_queue to the object. If @cmd_queue is %NULL
- * @cmd_queue, the last used command queue is used.
+ * @cmd_queue, the last used command queue is used. If the data is stored in a
+ * narrower depth, it is converted to floats first.
  *
  * Returns: (transfer none): A cl_mem object associated with @buffer.
  */
 gpointer
 ufo_buffer_get_device_array (UfoBuffer *buffer, gpointer cmd_queue)
 {
-    UfoBufferPrivate *priv;
-
     g_return_val_if_fail (UFO_IS_BUFFER (buffer), NULL);
-    priv = buffer->priv;
-
-    update_last_queue (priv, cmd_queue);
-
-    if (priv->device_array == NULL)
-        alloc_device_array (priv);
-
-    if (priv->location == UFO_BUFFER_LOCATION_HOST && priv->host_array)
-        transfer_host_to_device (priv, priv, priv->last_queue);
-
-    if (priv->location == UFO_BUFFER_LOCATION_DEVICE_IMAGE && priv->device_array)
-        transfer_image_to_device (priv, priv, priv->last_queue);
-
-    update_location (priv, UFO_BUFFER_LOCATION_DEVICE);
+    return get_device_array (buffer, cmd_queue, FALSE);
+}
 
-    return priv->device_array;
+/**
+ * ufo_buffer_get_raw_device_array:
+ * @buffer: A #UfoBuffer.
+ * @cmd_queue: (allow-none): A cl_command_queue object or %NULL.
+ *
+ * Like ufo_buffer_get_device_array() but return the data in its storage depth
+ * without converting it, see ufo_buffer_get_raw_host_array().
+ *
+ * Returns: (transfer none): A cl_mem object of at least ufo_buffer_get_size()
+ * bytes.
+ */
+gpointer
+ufo_buffer_get_raw_device_array (UfoBuffer *buffer, gpointer cmd_queue)
+{
+    g_return_val_if_fail (UFO_IS_BUFFER (buffer), NULL);
+    return get_device_array (buffer, cmd_queue, TRUE);
 }
 
 /**
@@ -1032,6 +1961,7 @@ ufo_buffer_get_device_array_view (UfoBuffer *buffer,
     }
 
     update_last_queue (priv, cmd_queue);
+    widen (priv, UFO_BUFFER_LOCATION_DEVICE, FALSE);
 
     size = region->size[0] * region->size[1] * region->size[2] * sizeof(float);
     src_row_pitch = sizeof(float) * priv->requisition.dims[0];
@@ -1092,6 +2022,8 @@ ufo_buffer_get_device_array_view (UfoBuffer *buffer,
     if (priv->location == UFO_BUFFER_LOCATION_DEVICE_IMAGE && priv->device_array) {
         cl_event event;
 
+        sync_pending (priv, UFO_BUFFER_LOCATION_DEVICE, cmd_queue);
+
         UFO_RESOURCES_CHECK_CLERR (clEnqueueCopyBufferRect (cmd_queue,
                                                             priv->device_array, mem,
                                                             region->origin, dst_origin,
@@ -1122,22 +2054,27 @@ ufo_buffer_get_device_image (UfoBuffer *buffer,
                              gpointer cmd_queue)
 {
     UfoBufferPrivate *priv;
+    gboolean shared;
 
     g_return_val_if_fail (UFO_IS_BUFFER (buffer), NULL);
     priv = buffer->priv;
+    shared = lock_if_shared (priv);
 
     update_last_queue (priv, cmd_queue);
+    widen (priv, UFO_BUFFER_LOCATION_DEVICE_IMAGE, shared);
+    ensure_device_image (priv);
 
-    if (priv->device_image == NULL)
-        alloc_device_image (priv);
+    if (needs_transfer (priv, shared, UFO_BUFFER_LOCATION_DEVICE_IMAGE)) {
+        if (priv->location == UFO_BUFFER_LOCATION_HOST && priv->host_array)
+            transfer_host_to_image (priv, priv, priv->last_queue);
 
-    if (priv->location == UFO_BUFFER_LOCATION_HOST && priv->host_array)
-        transfer_host_to_image (priv, priv, priv->last_queue);
-
-    if (priv->location == UFO_BUFFER_LOCATION_DEVICE && priv->device_array)
-        transfer_device_to_image (priv, priv, priv->last_queue);
+        if (priv->location == UFO_BUFFER_LOCATION_DEVICE && priv->device_array)
+            transfer_device_to_image (priv, priv, priv->last_queue);
+    }
 
+    sync_pending (priv, UFO_BUFFER_LOCATION_DEVICE_IMAGE, priv->last_queue);
     update_location (priv, UFO_BUFFER_LOCATION_DEVICE_IMAGE);
+    unlock_if_shared (priv, shared, UFO_BUFFER_LOCATION_DEVICE_IMAGE);
 
     return priv->device_image;
 }
@@ -1156,23 +2093,180 @@ ufo_buffer_get_location (UfoBuffer *buffer)
 }
 
 /**
- * ufo_buffer_discard_location:
+ * ufo_buffer_share:
  * @buffer: A #UfoBuffer
+ * @n_readers: Number of consumers that read @buffer at the same time
  *
- * Discard the current and use the last location without copying to it first.
+ * Hand out @buffer read-only to @n_readers consumers instead of copying it for
+ * each of them. While shared, concurrent accesses to the host array, device
+ * array or device image are serialized and data is transferred only once per
+ * location. Consumers must neither write to nor resize @buffer and release it
+ * with ufo_buffer_release_shared().
  */
 void
-ufo_buffer_discard_location (UfoBuffer *buffer)
+ufo_buffer_share (UfoBuffer *buffer,
+                  guint n_readers)
 {
+    UfoBufferPrivate *priv;
+
     g_return_if_fail (UFO_IS_BUFFER (buffer));
-    buffer->priv->location = buffer->priv->last_location;
+    g_return_if_fail (!ufo_buffer_is_shared (buffer));
+    priv = buffer->priv;
+
+    if (n_readers == 0)
+        return;
+
+    priv->valid = priv->location != UFO_BUFFER_LOCATION_INVALID ? LOCATION_BIT (priv->location) : 0;
+    g_atomic_int_set (&priv->n_readers, (gint) n_readers);
 }
 
 /**
- * ufo_buffer_get_layout:
+ * ufo_buffer_release_shared:
  * @buffer: A #UfoBuffer
  *
- * Return current layout of @buffer.
+ * Drop one reader of a buffer shared with ufo_buffer_share().
+ *
+ * Returns: %TRUE if this was the last reader and @buffer is writable again.
+ */
+gboolean
+ufo_buffer_release_shared (UfoBuffer *buffer)
+{
+    UfoBufferPrivate *priv;
+
+    g_return_val_if_fail (UFO_IS_BUFFER (buffer), FALSE);
+    g_return_val_if_fail (ufo_buffer_is_shared (buffer), FALSE);
+    priv = buffer->priv;
+
+    if (g_atomic_int_dec_and_test (&priv->n_readers)) {
+        priv->valid = 0;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/**
+ * ufo_buffer_is_shared:
+ * @buffer: A #UfoBuffer
+ *
+ * Returns: %TRUE if @buffer is currently shared read-only between consumers.
+ */
+gboolean
+ufo_buffer_is_shared (UfoBuffer *buffer)
+{
+    g_return_val_if_fail (UFO_IS_BUFFER (buffer), FALSE);
+    return g_atomic_int_get (&buffer->priv->n_readers) > 0;
+}
+
+/**
+ * ufo_buffer_set_pinned:
+ * @buffer: A #UfoBuffer
+ * @pinned: %TRUE if host memory should be page-locked
+ *
+ * Back the host array of @buffer with page-locked memory allocated by the
+ * OpenCL runtime, so that transfers between host and device do not need to be
+ * staged. This takes effect the next time host memory is allocated, i.e. on
+ * first host access or after a resize. If no context or command queue is known
+ * at that time or the allocation fails, regular memory is used. The default for
+ * new buffers is set with the #UfoResources:pinned-host-memory property of the
+ * resources whose context the buffer uses.
+ */
+void
+ufo_buffer_set_pinned (UfoBuffer *buffer,
+                       gboolean pinned)
+{
+    g_return_if_fail (UFO_IS_BUFFER (buffer));
+    buffer->priv->pinned = pinned;
+}
+
+/**
+ * ufo_buffer_is_pinned:
+ * @buffer: A #UfoBuffer
+ *
+ * Returns: %TRUE if the host array of @buffer is currently backed by
+ * page-locked memory.
+ */
+gboolean
+ufo_buffer_is_pinned (UfoBuffer *buffer)
+{
+    g_return_val_if_fail (UFO_IS_BUFFER (buffer), FALSE);
+    return buffer->priv->pinned_mem != NULL;
+}
+
+/**
+ * ufo_buffer_get_transfer_counters:
+ * @buffer: A #UfoBuffer
+ * @transfer: Direction of the transfers
+ * @n_transfers: (out) (allow-none): Location for the number of transfers
+ * @n_bytes: (out) (allow-none): Location for the number of bytes moved
+ * @time: (out) (allow-none): Location for the device time in seconds
+ *
+ * Get the transfers in direction @transfer into @buffer over its lifetime,
+ * including those made by ufo_buffer_copy() with @buffer as destination. The
+ * time only includes transfers that have finished and were waited for or
+ * superseded by another transfer.
+ */
+void
+ufo_buffer_get_transfer_counters (UfoBuffer *buffer,
+                                  UfoBufferTransfer transfer,
+                                  guint64 *n_transfers,
+                                  guint64 *n_bytes,
+                                  gdouble *time)
+{
+    TransferCounters *counters;
+
+    g_return_if_fail (UFO_IS_BUFFER (buffer));
+    g_return_if_fail (transfer < UFO_BUFFER_TRANSFER_LAST);
+
+    counters = &buffer->priv->transfers[transfer];
+
+    if (n_transfers != NULL)
+        *n_transfers = __atomic_load_n (&counters->n_transfers, __ATOMIC_RELAXED);
+
+    if (n_bytes != NULL)
+        *n_bytes = __atomic_load_n (&counters->n_bytes, __ATOMIC_RELAXED);
+
+    if (time != NULL)
+        *time = __atomic_load_n (&counters->time, __ATOMIC_RELAXED) * 1e-9;
+}
+
+void
+ufo_buffer_set_pinned_default (gpointer context,
+                               gboolean pinned)
+{
+    G_LOCK (pinned_contexts);
+
+    if (pinned) {
+        if (pinned_contexts == NULL)
+            pinned_contexts = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+        g_hash_table_add (pinned_contexts, context);
+    }
+    else if (pinned_contexts != NULL) {
+        g_hash_table_remove (pinned_contexts, context);
+    }
+
+    G_UNLOCK (pinned_contexts);
+}
+
+/**
+ * ufo_buffer_discard_location:
+ * @buffer: A #UfoBuffer
+ *
+ * Discard the current and use the last location without copying to it first.
+ */
+void
+ufo_buffer_discard_location (UfoBuffer *buffer)
+{
+    g_return_if_fail (UFO_IS_BUFFER (buffer));
+    buffer->priv->location = buffer->priv->last_location;
+}
+
+/**
+ * ufo_buffer_get_layout:
+ * @buffer: A #UfoBuffer
+ *
+ * Return current layout of @buffer.
  */
 UfoBufferLayout
 ufo_buffer_get_layout (UfoBuffer *buffer)
@@ -1194,51 +2288,67 @@ ufo_buffer_set_layout (UfoBuffer *buffer, UfoBufferLayout layout)
     buffer->priv->layout = layout;
 }
 
-static void
-convert_data (UfoBufferPrivate *priv,
-              gconstpointer data,
-              UfoBufferDepth depth)
+/**
+ * ufo_buffer_set_storage_depth:
+ * @buffer: A #UfoBuffer
+ * @depth: Depth in which the data is stored
+ *
+ * Declare that the data of @buffer is stored in @depth rather than as 32-bit
+ * floats. This changes ufo_buffer_get_size() accordingly but does not convert
+ * existing data, so it should be called before filling @buffer through
+ * ufo_buffer_get_raw_host_array() or ufo_buffer_get_raw_device_array().
+ * Allocated memory is kept if it is large enough.
+ *
+ * The data is converted to floats on the first call to
+ * ufo_buffer_get_host_array(), ufo_buffer_get_device_array() or
+ * ufo_buffer_get_device_image(), on the device if it resides there or is
+ * needed there next. Tasks that accept narrow input avoid the conversion
+ * altogether by using the raw accessors.
+ */
+void
+ufo_buffer_set_storage_depth (UfoBuffer *buffer,
+                              UfoBufferDepth depth)
 {
-    gint n_pixels;
-    gfloat *dst;
-
-    n_pixels = (gint) (priv->size / 4);
-    dst = priv->host_array;
+    UfoBufferPrivate *priv;
 
-    /* To save a memory allocation and several copies, we process data from back
-     * to front. This is possible if src bit depth is at most half as wide as
-     * the 32-bit target buffer. The processor cache should not be a
-     * problem. */
-    if (depth == UFO_BUFFER_DEPTH_8U) {
-        const guint8 *src = (const guint8 *) data;
+    g_return_if_fail (UFO_IS_BUFFER (buffer));
+    g_return_if_fail (depth > UFO_BUFFER_DEPTH_INVALID && depth <= UFO_BUFFER_DEPTH_16F);
+    g_return_if_fail (!ufo_buffer_is_shared (buffer));
+    priv = buffer->priv;
 
-        for (gint i = (n_pixels - 1); i >= 0; i--)
-            dst[i] = ((gfloat) src[i]);
-    }
-    else if (depth == UFO_BUFFER_DEPTH_16U) {
-        const guint16 *src = (const guint16 *) data;
+    if (priv->depth == depth)
+        return;
 
-        for (gint i = (n_pixels - 1); i >= 0; i--)
-            dst[i] = ((gfloat) src[i]);
-    }
-    else if (depth == UFO_BUFFER_DEPTH_16S) {
-        const gint16 *src = (const gint16 *) data;
+    wait_all_pending (priv);
+    set_depth (priv, depth);
 
-        for (gint i = (n_pixels - 1); i >= 0; i--)
-            dst[i] = ((gfloat) src[i]);
-    }
-    else if (depth == UFO_BUFFER_DEPTH_32S) {
-        const gint32 *src = (const gint32 *) data;
+    /* Images only hold floats */
+    if (priv->location == UFO_BUFFER_LOCATION_DEVICE_IMAGE)
+        priv->location = UFO_BUFFER_LOCATION_INVALID;
+}
 
-        for (gint i = (n_pixels - 1); i >= 0; i--)
-            dst[i] = ((gfloat) src[i]);
-    }
-    else if (depth == UFO_BUFFER_DEPTH_32U) {
-        const guint32 *src = (const guint32 *) data;
+/**
+ * ufo_buffer_get_storage_depth:
+ * @buffer: A #UfoBuffer
+ *
+ * Returns: The depth in which the data of @buffer is currently stored.
+ */
+UfoBufferDepth
+ufo_buffer_get_storage_depth (UfoBuffer *buffer)
+{
+    g_return_val_if_fail (UFO_IS_BUFFER (buffer), UFO_BUFFER_DEPTH_INVALID);
+    return buffer->priv->depth;
+}
 
-        for (gint i = (n_pixels - 1); i >= 0; i--)
-            dst[i] = ((gfloat) src[i]);
-    }
+static void
+convert_data (UfoBufferPrivate *priv,
+              gconstpointer data,
+              UfoBufferDepth depth)
+{
+    /* To save a memory allocation and several copies, data is converted from
+     * back to front. This is possible if src bit depth is at most as wide as
+     * the 32-bit target buffer. */
+    ufo_convert_to_float (priv->host_array, data, depth, get_num_elements (priv));
 }
 
 /**
@@ -1283,12 +2393,145 @@ ufo_buffer_convert_from_data (UfoBuffer *buffer,
     g_return_if_fail (UFO_IS_BUFFER (buffer));
     priv = buffer->priv;
 
-    if (priv->host_array == NULL)
-        alloc_host_mem (priv);
+    if (priv->depth != UFO_BUFFER_DEPTH_32F) {
+        wait_all_pending (priv);
+        set_depth (priv, UFO_BUFFER_DEPTH_32F);
+    }
 
+    ensure_host_mem (priv);
     convert_data (priv, data, depth);
 }
 
+/**
+ * ufo_buffer_convert_to:
+ * @buffer: A #UfoBuffer
+ * @depth: Target bit depth
+ * @min: Value mapped to the lowest value of @depth
+ * @max: Value mapped to the highest value of @depth
+ * @dst: Memory with room for all elements of @buffer in @depth
+ *
+ * Convert the 32-bit floating point data of @buffer to @depth and write it to
+ * @dst. Values are scaled linearly from [@min, @max] onto the full range of
+ * @depth, rounded to nearest and saturated. If @min equals @max, the range is
+ * determined from the data first. %UFO_BUFFER_DEPTH_32F copies the data
+ * unscaled.
+ *
+ * Data that resides on the device is downloaded first. Use ufo_op_convert_to()
+ * to convert on the device and transfer only the narrow result.
+ */
+void
+ufo_buffer_convert_to (UfoBuffer *buffer,
+                       UfoBufferDepth depth,
+                       gfloat min,
+                       gfloat max,
+                       gpointer dst)
+{
+    gfloat *host_array;
+    gsize n;
+
+    g_return_if_fail (UFO_IS_BUFFER (buffer));
+    g_return_if_fail (depth > UFO_BUFFER_DEPTH_INVALID && depth <= UFO_BUFFER_DEPTH_32F);
+    g_return_if_fail (dst != NULL);
+
+    host_array = ufo_buffer_get_host_array (buffer, NULL);
+    n = get_num_elements (buffer->priv);
+
+    if (min == max && depth != UFO_BUFFER_DEPTH_32F)
+        ufo_convert_find_range (host_array, n, &min, &max);
+
+    ufo_convert_from_float (dst, host_array, depth, n, min, max);
+}
+
+static GValue *
+value_dup (const GValue *value)
+{
+    GValue *copy;
+
+    copy = g_new0 (GValue, 1);
+    g_value_init (copy, G_VALUE_TYPE (value));
+    g_value_copy (value, copy);
+    return copy;
+}
+
+static void
+value_free (GValue *value)
+{
+    g_value_unset (value);
+    g_free (value);
+}
+
+static Metadata *
+metadata_new (void)
+{
+    Metadata *metadata;
+
+    metadata = g_new0 (Metadata, 1);
+    metadata->ref_count = 1;
+    metadata->table = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                             NULL, (GDestroyNotify) value_free);
+    return metadata;
+}
+
+static Metadata *
+metadata_ref (Metadata *metadata)
+{
+    g_atomic_int_inc (&metadata->ref_count);
+    return metadata;
+}
+
+static void
+metadata_unref (Metadata *metadata)
+{
+    if (metadata != NULL && g_atomic_int_dec_and_test (&metadata->ref_count)) {
+        g_hash_table_destroy (metadata->table);
+        g_free (metadata);
+    }
+}
+
+static Metadata *
+metadata_make_writable (Metadata *metadata)
+{
+    Metadata *copy;
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+
+    if (metadata == NULL)
+        return metadata_new ();
+
+    if (g_atomic_int_get (&metadata->ref_count) == 1)
+        return metadata;
+
+    copy = metadata_new ();
+    g_hash_table_iter_init (&iter, metadata->table);
+
+    while (g_hash_table_iter_next (&iter, &key, &value))
+        g_hash_table_insert (copy->table, key, value_dup (value));
+
+    metadata_unref (metadata);
+    return copy;
+}
+
+static gboolean
+metadata_is_subset (Metadata *a,
+                    Metadata *b)
+{
+    GHashTableIter iter;
+    gpointer key;
+
+    if (g_hash_table_size (a->table) > g_hash_table_size (b->table))
+        return FALSE;
+
+    g_hash_table_iter_init (&iter, a->table);
+
+    while (g_hash_table_iter_next (&iter, &key, NULL)) {
+        if (!g_hash_table_contains (b->table, key))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
 /**
  * ufo_buffer_get_metadata:
  * @buffer: A #UfoBuffer
@@ -1302,8 +2545,22 @@ GValue *
 ufo_buffer_get_metadata (UfoBuffer *buffer,
                          const gchar *name)
 {
+    Metadata *metadata;
+    GQuark quark;
+
     g_return_val_if_fail (UFO_IS_BUFFER (buffer), NULL);
-    return g_hash_table_lookup (buffer->priv->metadata, name);
+    metadata = buffer->priv->metadata;
+
+    if (metadata == NULL)
+        return NULL;
+
+    /* Keys are interned when set, a name that never was cannot be a key */
+    quark = g_quark_try_string (name);
+
+    if (quark == 0)
+        return NULL;
+
+    return g_hash_table_lookup (metadata->table, g_quark_to_string (quark));
 }
 
 /**
@@ -1320,23 +2577,12 @@ ufo_buffer_set_metadata (UfoBuffer *buffer,
                          GValue *value)
 {
     UfoBufferPrivate *priv;
-    GValue *old;
-    GValue *new;
 
     g_return_if_fail (UFO_IS_BUFFER (buffer));
     priv = buffer->priv;
 
-    old = g_hash_table_lookup (priv->metadata, name);
-
-    if (old != NULL) {
-        g_value_unset (old);
-    }
-
-    new = g_malloc0 (sizeof (GValue));
-    g_value_init (new, G_VALUE_TYPE ((GValue *) value));
-    g_value_copy (value, new);
-
-    g_hash_table_replace (priv->metadata, g_strdup (name), new);
+    priv->metadata = metadata_make_writable (priv->metadata);
+    g_hash_table_replace (priv->metadata->table, (gpointer) g_intern_string (name), value_dup (value));
 }
 
 /**
@@ -1344,29 +2590,38 @@ ufo_buffer_set_metadata (UfoBuffer *buffer,
  * @src: Source buffer
  * @dst: Destination buffer
  *
- * Copies meta data content from @src to @dst.
+ * Copies meta data content from @src to @dst. If @src has all keys of @dst,
+ * @dst shares the meta data of @src and no values are copied until either of
+ * them is modified.
  */
 void
 ufo_buffer_copy_metadata (UfoBuffer *src,
                           UfoBuffer *dst)
 {
-    UfoBufferPrivate *priv;
-    GList *keys;
-    GList *it;
+    Metadata *smeta;
+    Metadata *dmeta;
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
 
     g_return_if_fail (UFO_IS_BUFFER (src) && UFO_IS_BUFFER (dst));
-    priv = src->priv;
-    keys = g_hash_table_get_keys (priv->metadata);
+    smeta = src->priv->metadata;
+    dmeta = dst->priv->metadata;
 
-    g_list_for (keys, it) {
-        GValue *value;
-        const gchar *name = (const gchar *) it->data;
+    if (smeta == NULL || smeta == dmeta)
+        return;
 
-        value = ufo_buffer_get_metadata (src, name);
-        ufo_buffer_set_metadata (dst, name, value);
+    if (dmeta == NULL || metadata_is_subset (dmeta, smeta)) {
+        metadata_unref (dmeta);
+        dst->priv->metadata = metadata_ref (smeta);
+        return;
     }
 
-    g_list_free (keys);
+    dmeta = dst->priv->metadata = metadata_make_writable (dmeta);
+    g_hash_table_iter_init (&iter, smeta->table);
+
+    while (g_hash_table_iter_next (&iter, &key, &value))
+        g_hash_table_replace (dmeta->table, key, value_dup (value));
 }
 
 /**
@@ -1383,42 +2638,368 @@ GList *
 ufo_buffer_get_metadata_keys (UfoBuffer *buffer)
 {
     g_return_val_if_fail (UFO_IS_BUFFER (buffer), NULL);
-    return g_hash_table_get_keys (buffer->priv->metadata);
+
+    if (buffer->priv->metadata == NULL)
+        return NULL;
+
+    return g_hash_table_get_keys (buffer->priv->metadata->table);
+}
+
+/*
+ * Forget everything the previous user of @buffer attached to it, so that a
+ * buffer handed out again by a #UfoBufferPool looks like a new one. The data
+ * itself and its location are kept.
+ */
+void
+ufo_buffer_reset (UfoBuffer *buffer)
+{
+    UfoBufferPrivate *priv;
+
+    g_return_if_fail (UFO_IS_BUFFER (buffer));
+    priv = buffer->priv;
+
+    /* Pending transfers hold a reference on the profiler of the last user */
+    wait_all_pending (priv);
+    priv->downloaded = FALSE;
+
+    metadata_unref (priv->metadata);
+    priv->metadata = NULL;
+    priv->layout = UFO_BUFFER_LAYOUT_REAL;
+    priv->pinned = get_pinned_default (priv->context);
+
+    /* Buffers are handed out for float data */
+    ufo_buffer_set_storage_depth (buffer, UFO_BUFFER_DEPTH_32F);
+}
+
+/*
+ * Reductions run a few work groups per compute unit that stride over the
+ * data, so that the number of partial results stays small regardless of the
+ * buffer size.
+ */
+static cl_kernel
+get_reduce_kernel (UfoBufferPrivate *priv,
+                   cl_command_queue queue,
+                   const gchar *name,
+                   gsize *local_size,
+                   gsize *global_size)
+{
+    cl_program program;
+    cl_kernel kernel;
+    cl_device_id device;
+    cl_uint n_units;
+    gsize max_size;
+    gsize n_groups;
+    gsize n;
+    cl_int err;
+
+    program = get_program (priv->context);
+
+    if (program == NULL)
+        return NULL;
+
+    kernel = clCreateKernel (program, name, &err);
+    UFO_RESOURCES_CHECK_CLERR (err);
+
+    UFO_RESOURCES_CHECK_CLERR (clGetCommandQueueInfo (queue, CL_QUEUE_DEVICE, sizeof (cl_device_id), &device, NULL));
+    UFO_RESOURCES_CHECK_CLERR (clGetDeviceInfo (device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof (cl_uint), &n_units, NULL));
+    UFO_RESOURCES_CHECK_CLERR (clGetKernelWorkGroupInfo (kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+                                                         sizeof (gsize), &max_size, NULL));
+
+    /* The tree in reduce_moments needs a power of two */
+    *local_size = REDUCE_GROUP_SIZE;
+
+    while (*local_size > max_size && *local_size > 1)
+        *local_size /= 2;
+
+    n = get_num_elements (priv);
+    n_groups = MIN (MIN (4 * n_units, REDUCE_MAX_GROUPS), (n + *local_size - 1) / *local_size);
+    *global_size = MAX (n_groups, 1) * *local_size;
+
+    return kernel;
+}
+
+static gboolean
+use_device (UfoBufferPrivate *priv,
+            cl_command_queue queue)
+{
+    return queue != NULL && priv->context != NULL &&
+        (priv->location == UFO_BUFFER_LOCATION_DEVICE ||
+         priv->location == UFO_BUFFER_LOCATION_DEVICE_IMAGE);
+}
+
+static void
+set_moments (UfoBufferStatistics *stats,
+             gsize n,
+             gdouble mean,
+             gdouble m2)
+{
+    stats->n_values = n;
+    stats->mean = n > 0 ? mean : 0.0;
+    stats->sum = n * stats->mean;
+    stats->variance = n > 0 ? m2 / n : 0.0;
+}
+
+static gboolean
+reduce_on_device (UfoBuffer *buffer,
+                  cl_command_queue queue,
+                  UfoBufferStatistics *stats)
+{
+    UfoBufferPrivate *priv;
+    cl_kernel kernel;
+    cl_mem src;
+    cl_mem partials;
+    cl_ulong n;
+    cl_int err;
+    gfloat *result;
+    gsize local_size;
+    gsize global_size;
+    gsize n_groups;
+    gsize count = 0;
+    gdouble mean = 0.0;
+    gdouble m2 = 0.0;
+
+    priv = buffer->priv;
+    kernel = get_reduce_kernel (priv, queue, "reduce_moments", &local_size, &global_size);
+
+    if (kernel == NULL)
+        return FALSE;
+
+    src = ufo_buffer_get_device_array (buffer, queue);
+    n = get_num_elements (priv);
+    n_groups = global_size / local_size;
+    partials = clCreateBuffer (priv->context, CL_MEM_WRITE_ONLY, n_groups * 5 * sizeof (gfloat), NULL, &err);
+    UFO_RESOURCES_CHECK_CLERR (err);
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &src));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 1, sizeof (cl_ulong), &n));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 2, sizeof (cl_mem), &partials));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 3, local_size * sizeof (cl_uint), NULL));
+
+    for (guint i = 4; i < 8; i++)
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i, local_size * sizeof (cl_float), NULL));
+
+    result = g_new (gfloat, n_groups * 5);
+    UFO_RESOURCES_CHECK_CLERR (clEnqueueNDRangeKernel (queue, kernel, 1, NULL, &global_size, &local_size,
+                                                       0, NULL, NULL));
+    UFO_RESOURCES_CHECK_CLERR (clEnqueueReadBuffer (queue, partials, CL_TRUE, 0, n_groups * 5 * sizeof (gfloat),
+                                                    result, 0, NULL, NULL));
+
+    stats->min = INFINITY;
+    stats->max = -INFINITY;
+
+    /* Combine the groups' counts, means and squared deviations pairwise */
+    for (gsize i = 0; i < n_groups; i++) {
+        const gfloat *p = result + 5 * i;
+        guint32 group_count;
+        gdouble delta;
+        gsize total;
+
+        memcpy (&group_count, p, sizeof (guint32));
+        stats->min = MIN (stats->min, p[3]);
+        stats->max = MAX (stats->max, p[4]);
+
+        if (group_count == 0)
+            continue;
+
+        total = count + group_count;
+        delta = p[1] - mean;
+        mean += delta * group_count / total;
+        m2 += p[2] + delta * delta * count * group_count / total;
+        count = total;
+    }
+
+    set_moments (stats, count, mean, m2);
+
+    g_free (result);
+    UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (partials));
+    UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (kernel));
+    return TRUE;
+}
+
+static gboolean
+histogram_on_device (UfoBuffer *buffer,
+                     cl_command_queue queue,
+                     gfloat min,
+                     gfloat max,
+                     guint n_bins,
+                     guint32 *bins)
+{
+    UfoBufferPrivate *priv;
+    cl_kernel kernel;
+    cl_mem src;
+    cl_mem counts;
+    cl_ulong n;
+    cl_int err;
+    gfloat scale;
+    gsize local_size;
+    gsize global_size;
+
+    priv = buffer->priv;
+    kernel = get_reduce_kernel (priv, queue, "reduce_histogram", &local_size, &global_size);
+
+    if (kernel == NULL)
+        return FALSE;
+
+    src = ufo_buffer_get_device_array (buffer, queue);
+    n = get_num_elements (priv);
+    scale = max > min ? n_bins / (max - min) : 0.0f;
+
+    memset (bins, 0, n_bins * sizeof (guint32));
+    counts = clCreateBuffer (priv->context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                             n_bins * sizeof (cl_uint), bins, &err);
+    UFO_RESOURCES_CHECK_CLERR (err);
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &src));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 1, sizeof (cl_ulong), &n));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 2, sizeof (cl_float), &min));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 3, sizeof (cl_float), &max));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 4, sizeof (cl_float), &scale));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 5, sizeof (cl_uint), &n_bins));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 6, sizeof (cl_mem), &counts));
+
+    UFO_RESOURCES_CHECK_CLERR (clEnqueueNDRangeKernel (queue, kernel, 1, NULL, &global_size, &local_size,
+                                                       0, NULL, NULL));
+    UFO_RESOURCES_CHECK_CLERR (clEnqueueReadBuffer (queue, counts, CL_TRUE, 0, n_bins * sizeof (cl_uint),
+                                                    bins, 0, NULL, NULL));
+
+    UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (counts));
+    UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (kernel));
+    return TRUE;
 }
 
 /**
- * ufo_buffer_max:
+ * UfoBufferStatistics:
+ * @min: Smallest value
+ * @max: Largest value
+ * @sum: Sum of all values
+ * @mean: Arithmetic mean
+ * @variance: Population variance, i.e. the mean squared deviation from @mean
+ * @n_values: Number of values that are not NaN
+ *
+ * Statistics of buffer data as computed by ufo_buffer_get_statistics(). NaN
+ * is ignored. If there are no other values, @min is positive and @max negative
+ * infinity and all other fields are zero.
+ */
+
+/**
+ * ufo_buffer_get_statistics:
  * @buffer: A #UfoBuffer
- * @cmd_queue: An OpenCL command queue or %NULL
+ * @cmd_queue: (allow-none): A cl_command_queue object or %NULL
+ * @stats: (out caller-allocates): Location for the statistics
  *
- * Return the maximum value of @buffer.
+ * Compute minimum, maximum, sum, mean and variance of @buffer in a single
+ * pass. If the data resides on the device, it is reduced there by a parallel
+ * tree reduction and only the partial results of each work group are read
+ * back. Otherwise the host data is reduced with vector instructions on several
+ * threads.
+ */
+void
+ufo_buffer_get_statistics (UfoBuffer *buffer,
+                           gpointer cmd_queue,
+                           UfoBufferStatistics *stats)
+{
+    UfoBufferPrivate *priv;
+    cl_command_queue queue;
+
+    g_return_if_fail (UFO_IS_BUFFER (buffer));
+    g_return_if_fail (stats != NULL);
+
+    priv = buffer->priv;
+    queue = cmd_queue != NULL ? cmd_queue : priv->last_queue;
+
+    if (use_device (priv, queue) && reduce_on_device (buffer, queue, stats))
+        return;
+
+    ufo_convert_get_statistics (ufo_buffer_get_host_array (buffer, cmd_queue), get_num_elements (priv), stats);
+}
+
+/**
+ * ufo_buffer_get_histogram:
+ * @buffer: A #UfoBuffer
+ * @cmd_queue: (allow-none): A cl_command_queue object or %NULL
+ * @min: Lower edge of the first bin
+ * @max: Upper edge of the last bin
+ * @n_bins: Number of bins
+ * @bins: (array length=n_bins): Location for @n_bins counts
  *
- * Returns: The maximum found.
+ * Count the values of @buffer in @n_bins equally wide bins between @min and
+ * @max. @max itself is counted in the last bin, values outside the range and
+ * NaN are not counted. If @min equals @max, the range of the data is used.
+ * Like ufo_buffer_get_statistics(), the histogram is computed where the data
+ * resides.
  */
-gfloat
-ufo_buffer_max (UfoBuffer *buffer,
-                gpointer cmd_queue)
+void
+ufo_buffer_get_histogram (UfoBuffer *buffer,
+                          gpointer cmd_queue,
+                          gfloat min,
+                          gfloat max,
+                          guint n_bins,
+                          guint32 *bins)
 {
     UfoBufferPrivate *priv;
-    gsize n;
-    gfloat max = -G_MAXFLOAT;
+    cl_command_queue queue;
 
-    g_return_val_if_fail (UFO_IS_BUFFER (buffer), 0.0f);
+    g_return_if_fail (UFO_IS_BUFFER (buffer));
+    g_return_if_fail (n_bins > 0 && bins != NULL);
 
     priv = buffer->priv;
+    queue = cmd_queue != NULL ? cmd_queue : priv->last_queue;
 
-    if (priv->location != UFO_BUFFER_LOCATION_HOST) {
-        g_warning ("max() not supported for non-host buffers");
-        return 0.0f;
+    if (min == max) {
+        UfoBufferStatistics stats;
+
+        ufo_buffer_get_statistics (buffer, cmd_queue, &stats);
+        min = stats.min;
+        max = stats.max;
     }
 
-    n = get_num_elements (priv);
+    if (use_device (priv, queue) && histogram_on_device (buffer, queue, min, max, n_bins, bins))
+        return;
+
+    ufo_convert_get_histogram (ufo_buffer_get_host_array (buffer, cmd_queue), get_num_elements (priv),
+                               min, max, n_bins, bins);
+}
 
-    for (gsize i = 0; i < n; i++) {
-        if (priv->host_array[i] > max)
-            max = priv->host_array[i];
+static void
+get_range (UfoBuffer *buffer,
+           gpointer cmd_queue,
+           gfloat *min,
+           gfloat *max)
+{
+    UfoBufferPrivate *priv;
+    UfoBufferStatistics stats;
+    cl_command_queue queue;
+
+    priv = buffer->priv;
+    queue = cmd_queue != NULL ? cmd_queue : priv->last_queue;
+
+    if (use_device (priv, queue) && reduce_on_device (buffer, queue, &stats)) {
+        *min = stats.min;
+        *max = stats.max;
+        return;
     }
 
+    ufo_convert_find_range (ufo_buffer_get_host_array (buffer, cmd_queue), get_num_elements (priv), min, max);
+}
+
+/**
+ * ufo_buffer_max:
+ * @buffer: A #UfoBuffer
+ * @cmd_queue: An OpenCL command queue or %NULL
+ *
+ * Return the maximum value of @buffer, ignoring NaN. The maximum is found on
+ * the device if the data resides there, see ufo_buffer_get_statistics().
+ *
+ * Returns: The maximum found.
+ */
+gfloat
+ufo_buffer_max (UfoBuffer *buffer,
+                gpointer cmd_queue)
+{
+    gfloat min, max;
+
+    g_return_val_if_fail (UFO_IS_BUFFER (buffer), 0.0f);
+    get_range (buffer, cmd_queue, &min, &max);
     return max;
 }
 
@@ -1427,7 +3008,8 @@ ufo_buffer_max (UfoBuffer *buffer,
  * @buffer: A #UfoBuffer
  * @cmd_queue: An OpenCL command queue or %NULL
  *
- * Return the minimum value of @buffer.
+ * Return the minimum value of @buffer, ignoring NaN. The minimum is found on
+ * the device if the data resides there, see ufo_buffer_get_statistics().
  *
  * Returns: The minimum found.
  */
@@ -1435,26 +3017,10 @@ gfloat
 ufo_buffer_min (UfoBuffer *buffer,
                 gpointer cmd_queue)
 {
-    UfoBufferPrivate *priv;
-    gsize n;
-    gfloat min = G_MAXFLOAT;
+    gfloat min, max;
 
     g_return_val_if_fail (UFO_IS_BUFFER (buffer), 0.0f);
-
-    priv = buffer->priv;
-
-    if (priv->location != UFO_BUFFER_LOCATION_HOST) {
-        g_warning ("min() not supported for non-host buffers");
-        return 0.0f;
-    }
-
-    n = get_num_elements (priv);
-
-    for (gsize i = 0; i < n; i++) {
-        if (priv->host_array[i] < min)
-            min = priv->host_array[i];
-    }
-
+    get_range (buffer, cmd_queue, &min, &max);
     return min;
 }
 
@@ -1502,10 +3068,7 @@ ufo_buffer_finalize (GObject *gobject)
     UfoBuffer *buffer = UFO_BUFFER (gobject);
     UfoBufferPrivate *priv = UFO_BUFFER_GET_PRIVATE (buffer);
 
-    if (priv->free)
-        g_free (priv->host_array);
-
-    priv->host_array = NULL;
+    free_host_mem (priv);
 
     g_list_for (priv->sub_device_arrays, it) {
         free_cl_mem ((cl_mem *) &it->data);
@@ -1514,7 +3077,8 @@ ufo_buffer_finalize (GObject *gobject)
     free_cl_mem (&priv->device_array);
     free_cl_mem (&priv->device_image);
 
-    g_hash_table_destroy (priv->metadata);
+    metadata_unref (priv->metadata);
+    g_mutex_clear (&priv->lock);
 
     G_OBJECT_CLASS(ufo_buffer_parent_class)->finalize(gobject);
 }
@@ -1538,12 +3102,31 @@ ufo_buffer_init (UfoBuffer *buffer)
     priv->device_image = NULL;
     priv->host_array = NULL;
     priv->free = TRUE;
+    priv->pinned = FALSE;
+    priv->pinned_mem = NULL;
+    priv->pinned_queue = NULL;
+    priv->depth = UFO_BUFFER_DEPTH_32F;
+    priv->host_size = 0;
+    priv->device_size = 0;
+
+    for (guint i = 0; i < 3; i++) {
+        priv->pending[i] = NULL;
+        priv->pending_queue[i] = NULL;
+        priv->pending_transfer[i] = UFO_BUFFER_TRANSFER_LAST;
+        priv->pending_profiler[i] = NULL;
+    }
+
+    memset (priv->transfers, 0, sizeof (priv->transfers));
+    priv->downloaded = FALSE;
 
     priv->location = UFO_BUFFER_LOCATION_INVALID;
     priv->last_location = UFO_BUFFER_LOCATION_INVALID;
     priv->requisition.n_dims = 0;
-    priv->metadata = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    priv->metadata = NULL;
     priv->sub_device_arrays = NULL;
+    priv->n_readers = 0;
+    priv->valid = 0;
+    g_mutex_init (&priv->lock);
 }
 
 static void
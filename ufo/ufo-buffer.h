@@ -45,6 +45,7 @@ typedef struct _UfoBufferPrivate    UfoBufferPrivate;
 typedef struct _UfoBufferParamSpec  UfoBufferParamSpec;
 typedef struct _UfoRequisition      UfoRequisition;
 typedef struct _UfoRegion           UfoRegion;
+typedef struct _UfoBufferStatistics UfoBufferStatistics;
 
 /**
  * UfoBuffer:
@@ -93,6 +94,15 @@ struct _UfoRegion {
     gsize size[UFO_BUFFER_MAX_NDIMS];
 };
 
+struct _UfoBufferStatistics {
+    gfloat  min;
+    gfloat  max;
+    gdouble sum;
+    gdouble mean;
+    gdouble variance;
+    gsize   n_values;
+};
+
 typedef enum {
     UFO_BUFFER_DEPTH_INVALID,
     UFO_BUFFER_DEPTH_8U,
@@ -100,7 +110,8 @@ typedef enum {
     UFO_BUFFER_DEPTH_16S,
     UFO_BUFFER_DEPTH_32S,
     UFO_BUFFER_DEPTH_32U,
-    UFO_BUFFER_DEPTH_32F
+    UFO_BUFFER_DEPTH_32F,
+    UFO_BUFFER_DEPTH_16F
 } UfoBufferDepth;
 
 typedef enum {
@@ -110,6 +121,15 @@ typedef enum {
     UFO_BUFFER_LOCATION_INVALID
 } UfoBufferLocation;
 
+typedef enum {
+    UFO_BUFFER_TRANSFER_HOST_TO_DEVICE = 0,
+    UFO_BUFFER_TRANSFER_DEVICE_TO_HOST,
+    UFO_BUFFER_TRANSFER_DEVICE_TO_DEVICE,
+    UFO_BUFFER_TRANSFER_BUFFER_TO_IMAGE,
+    UFO_BUFFER_TRANSFER_IMAGE_TO_BUFFER,
+    UFO_BUFFER_TRANSFER_LAST
+} UfoBufferTransfer;
+
 typedef enum {
     UFO_BUFFER_LAYOUT_REAL = 0,
     UFO_BUFFER_LAYOUT_COMPLEX_INTERLEAVED
@@ -129,6 +149,7 @@ gint        ufo_buffer_cmp_dimensions       (UfoBuffer      *buffer,
 void        ufo_buffer_get_requisition      (UfoBuffer      *buffer,
                                              UfoRequisition *requisition);
 gsize       ufo_buffer_get_size             (UfoBuffer      *buffer);
+gpointer    ufo_buffer_get_context          (UfoBuffer      *buffer);
 void        ufo_buffer_copy                 (UfoBuffer      *src,
                                              UfoBuffer      *dst);
 UfoBuffer  *ufo_buffer_dup                  (UfoBuffer      *buffer);
@@ -158,15 +179,40 @@ gpointer    ufo_buffer_get_device_array_with_offset
 UfoBufferLocation
             ufo_buffer_get_location         (UfoBuffer      *buffer);
 void        ufo_buffer_discard_location     (UfoBuffer      *buffer);
+void        ufo_buffer_share                (UfoBuffer      *buffer,
+                                             guint           n_readers);
+gboolean    ufo_buffer_release_shared       (UfoBuffer      *buffer);
+gboolean    ufo_buffer_is_shared            (UfoBuffer      *buffer);
+void        ufo_buffer_set_pinned           (UfoBuffer      *buffer,
+                                             gboolean        pinned);
+gboolean    ufo_buffer_is_pinned            (UfoBuffer      *buffer);
+void        ufo_buffer_get_transfer_counters(UfoBuffer      *buffer,
+                                             UfoBufferTransfer transfer,
+                                             guint64        *n_transfers,
+                                             guint64        *n_bytes,
+                                             gdouble        *time);
 void        ufo_buffer_set_layout           (UfoBuffer      *buffer,
                                              UfoBufferLayout layout);
 UfoBufferLayout
             ufo_buffer_get_layout           (UfoBuffer      *buffer);
+void        ufo_buffer_set_storage_depth    (UfoBuffer      *buffer,
+                                             UfoBufferDepth  depth);
+UfoBufferDepth
+            ufo_buffer_get_storage_depth    (UfoBuffer      *buffer);
+gpointer    ufo_buffer_get_raw_host_array   (UfoBuffer      *buffer,
+                                             gpointer        cmd_queue);
+gpointer    ufo_buffer_get_raw_device_array (UfoBuffer      *buffer,
+                                             gpointer        cmd_queue);
 void        ufo_buffer_convert              (UfoBuffer      *buffer,
                                              UfoBufferDepth  depth);
 void        ufo_buffer_convert_from_data    (UfoBuffer      *buffer,
                                              gconstpointer   data,
                                              UfoBufferDepth  depth);
+void        ufo_buffer_convert_to           (UfoBuffer      *buffer,
+                                             UfoBufferDepth  depth,
+                                             gfloat          min,
+                                             gfloat          max,
+                                             gpointer        dst);
 GValue     *ufo_buffer_get_metadata         (UfoBuffer      *buffer,
                                              const gchar    *name);
 void        ufo_buffer_set_metadata         (UfoBuffer      *buffer,
@@ -180,6 +226,15 @@ gfloat      ufo_buffer_max                  (UfoBuffer      *buffer,
                                              gpointer        cmd_queue);
 gfloat      ufo_buffer_min                  (UfoBuffer      *buffer,
                                              gpointer        cmd_queue);
+void        ufo_buffer_get_statistics       (UfoBuffer      *buffer,
+                                             gpointer        cmd_queue,
+                                             UfoBufferStatistics *stats);
+void        ufo_buffer_get_histogram        (UfoBuffer      *buffer,
+                                             gpointer        cmd_queue,
+                                             gfloat          min,
+                                             gfloat          max,
+                                             guint           n_bins,
+                                             guint32        *bins);
 
 GType       ufo_buffer_get_type             (void);
 
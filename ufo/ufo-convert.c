@@ -0,0 +1,1751 @@
+/*
+ * Copyright (C) 2011-2013 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_DISPATCH 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include "ufo-priv.h"
+
+/*
+ * Conversion of integer host data to the 32-bit float representation. All
+ * kernels walk from the back to the front of the data and load a complete
+ * block before storing it. Because the source is at most as wide as the
+ * destination, this allows converting in place without a temporary copy.
+ *
+ * The reverse direction scales floats from a [min, max] range onto the full
+ * range of the target depth. Values are clamped before they are offset into
+ * the signed 32-bit domain and rounded to nearest even. The clamp keeps the
+ * compiler from fusing multiplication and addition on FMA targets, so every
+ * kernel rounds exactly like the scalar code. Unsigned 16- and 32-bit targets
+ * are flipped back by XORing the sign bit, which lets all targets use signed
+ * saturating packs, the only ones SSE2 offers.
+ *
+ * Statistics are accumulated in double precision from the differences to a
+ * common shift value close to the data, which avoids the cancellation of the
+ * naive sum of squares. NaN is skipped by all reductions.
+ */
+
+#define PARALLEL_THRESHOLD  (1 << 20)
+#define CHUNK_ALIGNMENT     64
+#define N_DEPTHS            (UFO_BUFFER_DEPTH_16F + 1)
+
+typedef struct {
+    gfloat min;
+    gfloat scale;
+    gfloat range;
+    gfloat offset;
+    guint32 bias;
+} Scale;
+
+typedef void (*ConvertFunc)     (gfloat *dst, gconstpointer src, gsize n);
+typedef void (*FromFloatFunc)   (gpointer dst, const gfloat *src, gsize n, const Scale *scale);
+typedef void (*MinMaxFunc)      (const gfloat *src, gsize n, gfloat *min, gfloat *max);
+
+typedef struct {
+    gsize n;            /* number of values that are not NaN */
+    gdouble sum;        /* of differences to the shift */
+    gdouble sum_sq;     /* of squared differences to the shift */
+    gfloat min;
+    gfloat max;
+} Sums;
+
+typedef struct {
+    gfloat min;
+    gfloat max;
+    gfloat scale;
+    guint n_bins;
+} Histogram;
+
+typedef void (*SumsFunc)        (const gfloat *src, gsize n, gfloat shift, Sums *sums);
+
+typedef struct {
+    const gchar *name;
+    ConvertFunc to_float[N_DEPTHS];
+    FromFloatFunc from_float[N_DEPTHS];
+    MinMaxFunc min_max;
+    SumsFunc sums;
+} ConvertTable;
+
+typedef struct {
+    GMutex lock;
+    GCond cond;
+    guint remaining;
+} Completion;
+
+typedef struct _Chunk Chunk;
+
+struct _Chunk {
+    void (*run) (Chunk *chunk);
+    ConvertFunc to_float;
+    FromFloatFunc from_float;
+    MinMaxFunc min_max;
+    SumsFunc sums_func;
+    const Scale *scale;
+    const Histogram *histogram;
+    gpointer dst;
+    gconstpointer src;
+    gsize n;
+    gfloat min;
+    gfloat max;
+    gfloat shift;
+    Sums sums;
+    guint32 *bins;
+    Completion *completion;
+};
+
+#define DEFINE_SCALAR(name, type) \
+static inline void \
+name##_tail (gfloat *dst, const type *src, gsize start, gsize end) \
+{ \
+    for (gsize i = end; i > start; i--) \
+        dst[i - 1] = (gfloat) src[i - 1]; \
+} \
+\
+static void \
+convert_##name##_scalar (gfloat *dst, gconstpointer src, gsize n) \
+{ \
+    name##_tail (dst, (const type *) src, 0, n); \
+}
+
+DEFINE_SCALAR (u8, guint8)
+DEFINE_SCALAR (u16, guint16)
+DEFINE_SCALAR (s16, gint16)
+DEFINE_SCALAR (s32, gint32)
+DEFINE_SCALAR (u32, guint32)
+
+static inline gfloat
+half_to_float (guint16 h)
+{
+    union { guint32 u; gfloat f; } v;
+    guint32 sign = ((guint32) (h & 0x8000)) << 16;
+    guint32 exponent = (h >> 10) & 0x1f;
+    guint32 mantissa = h & 0x3ff;
+
+    if (exponent == 0x1f)
+        v.u = sign | 0x7f800000 | (mantissa << 13);
+    else if (exponent != 0)
+        v.u = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    else {
+        /* Subnormal halves are normal floats, the product is exact */
+        v.f = (gfloat) mantissa * 5.9604644775390625e-8f;
+        v.u |= sign;
+    }
+
+    return v.f;
+}
+
+static inline void
+f16_tail (gfloat *dst, const guint16 *src, gsize start, gsize end)
+{
+    for (gsize i = end; i > start; i--)
+        dst[i - 1] = half_to_float (src[i - 1]);
+}
+
+static void
+convert_f16_scalar (gfloat *dst, gconstpointer src, gsize n)
+{
+    f16_tail (dst, (const guint16 *) src, 0, n);
+}
+
+static inline gint32
+scale_value (gfloat x, const Scale *s)
+{
+    gfloat v = (x - s->min) * s->scale;
+
+    /* Written like the vector min/max so that NaN ends up at the lower end */
+    v = v > 0.0f ? v : 0.0f;
+    v = v < s->range ? v : s->range;
+    return (gint32) lrintf (v + s->offset);
+}
+
+#define DEFINE_FROM_FLOAT_SCALAR(name, type) \
+static inline void \
+name##_tail (type *dst, const gfloat *src, gsize start, gsize end, const Scale *s) \
+{ \
+    for (gsize i = start; i < end; i++) \
+        dst[i] = (type) (((guint32) scale_value (src[i], s)) ^ s->bias); \
+} \
+\
+static void \
+convert_##name##_scalar (gpointer dst, const gfloat *src, gsize n, const Scale *s) \
+{ \
+    name##_tail ((type *) dst, src, 0, n, s); \
+}
+
+DEFINE_FROM_FLOAT_SCALAR (to8, guint8)
+DEFINE_FROM_FLOAT_SCALAR (to16, guint16)
+DEFINE_FROM_FLOAT_SCALAR (to32, guint32)
+
+static inline void
+min_max_tail (const gfloat *src, gsize start, gsize end, gfloat *min, gfloat *max)
+{
+    gfloat lo = *min;
+    gfloat hi = *max;
+
+    /* NaN compares false and is skipped, like in the vector kernels */
+    for (gsize i = start; i < end; i++) {
+        lo = src[i] < lo ? src[i] : lo;
+        hi = src[i] > hi ? src[i] : hi;
+    }
+
+    *min = lo;
+    *max = hi;
+}
+
+static void
+min_max_scalar (const gfloat *src, gsize n, gfloat *min, gfloat *max)
+{
+    *min = INFINITY;
+    *max = -INFINITY;
+    min_max_tail (src, 0, n, min, max);
+}
+
+static inline void
+min_max_reduce (const gfloat *lo, const gfloat *hi, guint n, gfloat *min, gfloat *max)
+{
+    *min = INFINITY;
+    *max = -INFINITY;
+
+    for (guint i = 0; i < n; i++) {
+        *min = lo[i] < *min ? lo[i] : *min;
+        *max = hi[i] > *max ? hi[i] : *max;
+    }
+}
+
+static inline void
+sums_tail (const gfloat *src, gsize start, gsize end, gfloat shift, Sums *sums)
+{
+    for (gsize i = start; i < end; i++) {
+        gdouble d;
+
+        if (isnan (src[i]))
+            continue;
+
+        d = (gdouble) src[i] - shift;
+        sums->n++;
+        sums->sum += d;
+        sums->sum_sq += d * d;
+    }
+
+    min_max_tail (src, start, end, &sums->min, &sums->max);
+}
+
+static void
+sums_scalar (const gfloat *src, gsize n, gfloat shift, Sums *sums)
+{
+    sums->n = 0;
+    sums->sum = sums->sum_sq = 0.0;
+    sums->min = INFINITY;
+    sums->max = -INFINITY;
+    sums_tail (src, 0, n, shift, sums);
+}
+
+static inline void
+sums_reduce (const gdouble *sum, const gdouble *sum_sq, guint n, Sums *sums)
+{
+    sums->sum = sums->sum_sq = 0.0;
+
+    for (guint i = 0; i < n; i++) {
+        sums->sum += sum[i];
+        sums->sum_sq += sum_sq[i];
+    }
+}
+
+static const ConvertTable scalar_table = {
+    .name = "scalar",
+    .to_float = {
+        [UFO_BUFFER_DEPTH_8U]  = convert_u8_scalar,
+        [UFO_BUFFER_DEPTH_16U] = convert_u16_scalar,
+        [UFO_BUFFER_DEPTH_16S] = convert_s16_scalar,
+        [UFO_BUFFER_DEPTH_32S] = convert_s32_scalar,
+        [UFO_BUFFER_DEPTH_32U] = convert_u32_scalar,
+        [UFO_BUFFER_DEPTH_16F] = convert_f16_scalar,
+    },
+    .from_float = {
+        [UFO_BUFFER_DEPTH_8U]  = convert_to8_scalar,
+        [UFO_BUFFER_DEPTH_16U] = convert_to16_scalar,
+        [UFO_BUFFER_DEPTH_16S] = convert_to16_scalar,
+        [UFO_BUFFER_DEPTH_32S] = convert_to32_scalar,
+        [UFO_BUFFER_DEPTH_32U] = convert_to32_scalar,
+    },
+    .min_max = min_max_scalar,
+    .sums = sums_scalar,
+};
+
+#ifdef HAVE_X86_DISPATCH
+
+/* SSE2 is part of the x86-64 baseline and needs no target attribute there. */
+
+#ifdef __x86_64__
+#define TARGET_SSE2
+#else
+#define TARGET_SSE2 __attribute__ ((target ("sse2")))
+#endif
+
+TARGET_SSE2 static void
+convert_u8_sse2 (gfloat *dst, gconstpointer data, gsize n)
+{
+    const guint8 *src = data;
+    const __m128i zero = _mm_setzero_si128 ();
+    gsize blocks = n & ~((gsize) 15);
+
+    u8_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 16) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i - 16));
+        __m128i lo = _mm_unpacklo_epi8 (v, zero);
+        __m128i hi = _mm_unpackhi_epi8 (v, zero);
+        gfloat *d = dst + i - 16;
+
+        _mm_storeu_ps (d + 0, _mm_cvtepi32_ps (_mm_unpacklo_epi16 (lo, zero)));
+        _mm_storeu_ps (d + 4, _mm_cvtepi32_ps (_mm_unpackhi_epi16 (lo, zero)));
+        _mm_storeu_ps (d + 8, _mm_cvtepi32_ps (_mm_unpacklo_epi16 (hi, zero)));
+        _mm_storeu_ps (d + 12, _mm_cvtepi32_ps (_mm_unpackhi_epi16 (hi, zero)));
+    }
+}
+
+TARGET_SSE2 static void
+convert_u16_sse2 (gfloat *dst, gconstpointer data, gsize n)
+{
+    const guint16 *src = data;
+    const __m128i zero = _mm_setzero_si128 ();
+    gsize blocks = n & ~((gsize) 7);
+
+    u16_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 8) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i - 8));
+        gfloat *d = dst + i - 8;
+
+        _mm_storeu_ps (d + 0, _mm_cvtepi32_ps (_mm_unpacklo_epi16 (v, zero)));
+        _mm_storeu_ps (d + 4, _mm_cvtepi32_ps (_mm_unpackhi_epi16 (v, zero)));
+    }
+}
+
+TARGET_SSE2 static void
+convert_s16_sse2 (gfloat *dst, gconstpointer data, gsize n)
+{
+    const gint16 *src = data;
+    gsize blocks = n & ~((gsize) 7);
+
+    s16_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 8) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i - 8));
+        __m128i lo = _mm_srai_epi32 (_mm_unpacklo_epi16 (v, v), 16);
+        __m128i hi = _mm_srai_epi32 (_mm_unpackhi_epi16 (v, v), 16);
+        gfloat *d = dst + i - 8;
+
+        _mm_storeu_ps (d + 0, _mm_cvtepi32_ps (lo));
+        _mm_storeu_ps (d + 4, _mm_cvtepi32_ps (hi));
+    }
+}
+
+TARGET_SSE2 static void
+convert_s32_sse2 (gfloat *dst, gconstpointer data, gsize n)
+{
+    const gint32 *src = data;
+    gsize blocks = n & ~((gsize) 3);
+
+    s32_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 4) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i - 4));
+        _mm_storeu_ps (dst + i - 4, _mm_cvtepi32_ps (v));
+    }
+}
+
+/*
+ * There is no unsigned 32-bit conversion before AVX-512. Converting both 16-bit
+ * halves separately is exact for each half and rounds only once in the final
+ * addition, giving the same result as the scalar cast.
+ */
+TARGET_SSE2 static void
+convert_u32_sse2 (gfloat *dst, gconstpointer data, gsize n)
+{
+    const guint32 *src = data;
+    const __m128i mask = _mm_set1_epi32 (0xffff);
+    const __m128 scale = _mm_set1_ps (65536.0f);
+    gsize blocks = n & ~((gsize) 3);
+
+    u32_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 4) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i - 4));
+        __m128 hi = _mm_cvtepi32_ps (_mm_srli_epi32 (v, 16));
+        __m128 lo = _mm_cvtepi32_ps (_mm_and_si128 (v, mask));
+
+        _mm_storeu_ps (dst + i - 4, _mm_add_ps (_mm_mul_ps (hi, scale), lo));
+    }
+}
+
+TARGET_SSE2 static inline __m128i
+scale_sse2 (__m128 x, __m128 min, __m128 scale, __m128 range, __m128 offset)
+{
+    __m128 v = _mm_mul_ps (_mm_sub_ps (x, min), scale);
+
+    v = _mm_min_ps (_mm_max_ps (v, _mm_setzero_ps ()), range);
+    return _mm_cvtps_epi32 (_mm_add_ps (v, offset));
+}
+
+#define SSE2_SCALE_CONSTANTS(s) \
+    const __m128 min = _mm_set1_ps (s->min); \
+    const __m128 scale = _mm_set1_ps (s->scale); \
+    const __m128 range = _mm_set1_ps (s->range); \
+    const __m128 offset = _mm_set1_ps (s->offset);
+
+TARGET_SSE2 static void
+convert_to8_sse2 (gpointer data, const gfloat *src, gsize n, const Scale *s)
+{
+    guint8 *dst = data;
+    gsize blocks = n & ~((gsize) 15);
+    SSE2_SCALE_CONSTANTS (s)
+
+    for (gsize i = 0; i < blocks; i += 16) {
+        __m128i a = scale_sse2 (_mm_loadu_ps (src + i + 0), min, scale, range, offset);
+        __m128i b = scale_sse2 (_mm_loadu_ps (src + i + 4), min, scale, range, offset);
+        __m128i c = scale_sse2 (_mm_loadu_ps (src + i + 8), min, scale, range, offset);
+        __m128i d = scale_sse2 (_mm_loadu_ps (src + i + 12), min, scale, range, offset);
+        __m128i ab = _mm_packs_epi32 (a, b);
+        __m128i cd = _mm_packs_epi32 (c, d);
+
+        _mm_storeu_si128 ((__m128i *) (dst + i), _mm_packus_epi16 (ab, cd));
+    }
+
+    to8_tail (dst, src, blocks, n, s);
+}
+
+TARGET_SSE2 static void
+convert_to16_sse2 (gpointer data, const gfloat *src, gsize n, const Scale *s)
+{
+    guint16 *dst = data;
+    const __m128i bias = _mm_set1_epi16 ((gint16) s->bias);
+    gsize blocks = n & ~((gsize) 7);
+    SSE2_SCALE_CONSTANTS (s)
+
+    for (gsize i = 0; i < blocks; i += 8) {
+        __m128i a = scale_sse2 (_mm_loadu_ps (src + i + 0), min, scale, range, offset);
+        __m128i b = scale_sse2 (_mm_loadu_ps (src + i + 4), min, scale, range, offset);
+
+        _mm_storeu_si128 ((__m128i *) (dst + i), _mm_xor_si128 (_mm_packs_epi32 (a, b), bias));
+    }
+
+    to16_tail (dst, src, blocks, n, s);
+}
+
+TARGET_SSE2 static void
+convert_to32_sse2 (gpointer data, const gfloat *src, gsize n, const Scale *s)
+{
+    guint32 *dst = data;
+    const __m128i bias = _mm_set1_epi32 ((gint32) s->bias);
+    gsize blocks = n & ~((gsize) 3);
+    SSE2_SCALE_CONSTANTS (s)
+
+    for (gsize i = 0; i < blocks; i += 4) {
+        __m128i a = scale_sse2 (_mm_loadu_ps (src + i), min, scale, range, offset);
+        _mm_storeu_si128 ((__m128i *) (dst + i), _mm_xor_si128 (a, bias));
+    }
+
+    to32_tail (dst, src, blocks, n, s);
+}
+
+TARGET_SSE2 static void
+min_max_sse2 (const gfloat *src, gsize n, gfloat *min, gfloat *max)
+{
+    __m128 lo = _mm_set1_ps (INFINITY);
+    __m128 hi = _mm_set1_ps (-INFINITY);
+    gfloat lanes_lo[4], lanes_hi[4];
+    gsize blocks = n & ~((gsize) 3);
+
+    /* The accumulator is the second operand so that NaN is skipped */
+    for (gsize i = 0; i < blocks; i += 4) {
+        __m128 v = _mm_loadu_ps (src + i);
+        lo = _mm_min_ps (v, lo);
+        hi = _mm_max_ps (v, hi);
+    }
+
+    _mm_storeu_ps (lanes_lo, lo);
+    _mm_storeu_ps (lanes_hi, hi);
+    min_max_reduce (lanes_lo, lanes_hi, 4, min, max);
+    min_max_tail (src, blocks, n, min, max);
+}
+
+TARGET_SSE2 static void
+sums_sse2 (const gfloat *src, gsize n, gfloat shift, Sums *sums)
+{
+    __m128 lo = _mm_set1_ps (INFINITY);
+    __m128 hi = _mm_set1_ps (-INFINITY);
+    __m128d s = _mm_set1_pd (shift);
+    __m128d sum = _mm_setzero_pd ();
+    __m128d sum_sq = _mm_setzero_pd ();
+    gfloat lanes_lo[4], lanes_hi[4];
+    gdouble lanes_sum[2], lanes_sum_sq[2];
+    gsize blocks = n & ~((gsize) 3);
+    gsize count = 0;
+
+    for (gsize i = 0; i < blocks; i += 4) {
+        __m128 v = _mm_loadu_ps (src + i);
+        __m128d d0 = _mm_sub_pd (_mm_cvtps_pd (v), s);
+        __m128d d1 = _mm_sub_pd (_mm_cvtps_pd (_mm_movehl_ps (v, v)), s);
+
+        /* Differences of NaN are NaN and masked to zero */
+        d0 = _mm_and_pd (d0, _mm_cmpord_pd (d0, d0));
+        d1 = _mm_and_pd (d1, _mm_cmpord_pd (d1, d1));
+        sum = _mm_add_pd (sum, _mm_add_pd (d0, d1));
+        sum_sq = _mm_add_pd (sum_sq, _mm_add_pd (_mm_mul_pd (d0, d0), _mm_mul_pd (d1, d1)));
+        count += __builtin_popcount (_mm_movemask_ps (_mm_cmpord_ps (v, v)));
+        lo = _mm_min_ps (v, lo);
+        hi = _mm_max_ps (v, hi);
+    }
+
+    _mm_storeu_pd (lanes_sum, sum);
+    _mm_storeu_pd (lanes_sum_sq, sum_sq);
+    _mm_storeu_ps (lanes_lo, lo);
+    _mm_storeu_ps (lanes_hi, hi);
+    sums_reduce (lanes_sum, lanes_sum_sq, 2, sums);
+    min_max_reduce (lanes_lo, lanes_hi, 4, &sums->min, &sums->max);
+    sums->n = count;
+    sums_tail (src, blocks, n, shift, sums);
+}
+
+static const ConvertTable sse2_table = {
+    .name = "sse2",
+    .to_float = {
+        [UFO_BUFFER_DEPTH_8U]  = convert_u8_sse2,
+        [UFO_BUFFER_DEPTH_16U] = convert_u16_sse2,
+        [UFO_BUFFER_DEPTH_16S] = convert_s16_sse2,
+        [UFO_BUFFER_DEPTH_32S] = convert_s32_sse2,
+        [UFO_BUFFER_DEPTH_32U] = convert_u32_sse2,
+        [UFO_BUFFER_DEPTH_16F] = convert_f16_scalar,
+    },
+    .from_float = {
+        [UFO_BUFFER_DEPTH_8U]  = convert_to8_sse2,
+        [UFO_BUFFER_DEPTH_16U] = convert_to16_sse2,
+        [UFO_BUFFER_DEPTH_16S] = convert_to16_sse2,
+        [UFO_BUFFER_DEPTH_32S] = convert_to32_sse2,
+        [UFO_BUFFER_DEPTH_32U] = convert_to32_sse2,
+    },
+    .min_max = min_max_sse2,
+    .sums = sums_sse2,
+};
+
+#define TARGET_AVX2 __attribute__ ((target ("avx2")))
+
+TARGET_AVX2 static void
+convert_u8_avx2 (gfloat *dst, gconstpointer data, gsize n)
+{
+    const guint8 *src = data;
+    gsize blocks = n & ~((gsize) 15);
+
+    u8_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 16) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i - 16));
+        __m256i lo = _mm256_cvtepu8_epi32 (v);
+        __m256i hi = _mm256_cvtepu8_epi32 (_mm_srli_si128 (v, 8));
+        gfloat *d = dst + i - 16;
+
+        _mm256_storeu_ps (d + 0, _mm256_cvtepi32_ps (lo));
+        _mm256_storeu_ps (d + 8, _mm256_cvtepi32_ps (hi));
+    }
+}
+
+TARGET_AVX2 static void
+convert_u16_avx2 (gfloat *dst, gconstpointer data, gsize n)
+{
+    const guint16 *src = data;
+    gsize blocks = n & ~((gsize) 15);
+
+    u16_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 16) {
+        __m256i v = _mm256_loadu_si256 ((const __m256i *) (src + i - 16));
+        __m256i lo = _mm256_cvtepu16_epi32 (_mm256_castsi256_si128 (v));
+        __m256i hi = _mm256_cvtepu16_epi32 (_mm256_extracti128_si256 (v, 1));
+        gfloat *d = dst + i - 16;
+
+        _mm256_storeu_ps (d + 0, _mm256_cvtepi32_ps (lo));
+        _mm256_storeu_ps (d + 8, _mm256_cvtepi32_ps (hi));
+    }
+}
+
+TARGET_AVX2 static void
+convert_s16_avx2 (gfloat *dst, gconstpointer data, gsize n)
+{
+    const gint16 *src = data;
+    gsize blocks = n & ~((gsize) 15);
+
+    s16_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 16) {
+        __m256i v = _mm256_loadu_si256 ((const __m256i *) (src + i - 16));
+        __m256i lo = _mm256_cvtepi16_epi32 (_mm256_castsi256_si128 (v));
+        __m256i hi = _mm256_cvtepi16_epi32 (_mm256_extracti128_si256 (v, 1));
+        gfloat *d = dst + i - 16;
+
+        _mm256_storeu_ps (d + 0, _mm256_cvtepi32_ps (lo));
+        _mm256_storeu_ps (d + 8, _mm256_cvtepi32_ps (hi));
+    }
+}
+
+TARGET_AVX2 static void
+convert_s32_avx2 (gfloat *dst, gconstpointer data, gsize n)
+{
+    const gint32 *src = data;
+    gsize blocks = n & ~((gsize) 7);
+
+    s32_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 8) {
+        __m256i v = _mm256_loadu_si256 ((const __m256i *) (src + i - 8));
+        _mm256_storeu_ps (dst + i - 8, _mm256_cvtepi32_ps (v));
+    }
+}
+
+TARGET_AVX2 static void
+convert_u32_avx2 (gfloat *dst, gconstpointer data, gsize n)
+{
+    const guint32 *src = data;
+    const __m256i mask = _mm256_set1_epi32 (0xffff);
+    const __m256 scale = _mm256_set1_ps (65536.0f);
+    gsize blocks = n & ~((gsize) 7);
+
+    u32_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 8) {
+        __m256i v = _mm256_loadu_si256 ((const __m256i *) (src + i - 8));
+        __m256 hi = _mm256_cvtepi32_ps (_mm256_srli_epi32 (v, 16));
+        __m256 lo = _mm256_cvtepi32_ps (_mm256_and_si256 (v, mask));
+
+        /* No FMA here, it would round differently than the scalar path */
+        _mm256_storeu_ps (dst + i - 8, _mm256_add_ps (_mm256_mul_ps (hi, scale), lo));
+    }
+}
+
+TARGET_AVX2 static inline __m256i
+scale_avx2 (__m256 x, __m256 min, __m256 scale, __m256 range, __m256 offset)
+{
+    __m256 v = _mm256_mul_ps (_mm256_sub_ps (x, min), scale);
+
+    v = _mm256_min_ps (_mm256_max_ps (v, _mm256_setzero_ps ()), range);
+    return _mm256_cvtps_epi32 (_mm256_add_ps (v, offset));
+}
+
+#define AVX2_SCALE_CONSTANTS(s) \
+    const __m256 min = _mm256_set1_ps (s->min); \
+    const __m256 scale = _mm256_set1_ps (s->scale); \
+    const __m256 range = _mm256_set1_ps (s->range); \
+    const __m256 offset = _mm256_set1_ps (s->offset);
+
+/* AVX2 packs work per 128-bit lane, the permutes restore linear order */
+
+TARGET_AVX2 static void
+convert_to8_avx2 (gpointer data, const gfloat *src, gsize n, const Scale *s)
+{
+    guint8 *dst = data;
+    const __m256i order = _mm256_setr_epi32 (0, 4, 1, 5, 2, 6, 3, 7);
+    gsize blocks = n & ~((gsize) 31);
+    AVX2_SCALE_CONSTANTS (s)
+
+    for (gsize i = 0; i < blocks; i += 32) {
+        __m256i a = scale_avx2 (_mm256_loadu_ps (src + i + 0), min, scale, range, offset);
+        __m256i b = scale_avx2 (_mm256_loadu_ps (src + i + 8), min, scale, range, offset);
+        __m256i c = scale_avx2 (_mm256_loadu_ps (src + i + 16), min, scale, range, offset);
+        __m256i d = scale_avx2 (_mm256_loadu_ps (src + i + 24), min, scale, range, offset);
+        __m256i packed = _mm256_packus_epi16 (_mm256_packs_epi32 (a, b), _mm256_packs_epi32 (c, d));
+
+        _mm256_storeu_si256 ((__m256i *) (dst + i), _mm256_permutevar8x32_epi32 (packed, order));
+    }
+
+    to8_tail (dst, src, blocks, n, s);
+}
+
+TARGET_AVX2 static void
+convert_to16_avx2 (gpointer data, const gfloat *src, gsize n, const Scale *s)
+{
+    guint16 *dst = data;
+    const __m256i bias = _mm256_set1_epi16 ((gint16) s->bias);
+    gsize blocks = n & ~((gsize) 15);
+    AVX2_SCALE_CONSTANTS (s)
+
+    for (gsize i = 0; i < blocks; i += 16) {
+        __m256i a = scale_avx2 (_mm256_loadu_ps (src + i + 0), min, scale, range, offset);
+        __m256i b = scale_avx2 (_mm256_loadu_ps (src + i + 8), min, scale, range, offset);
+        __m256i packed = _mm256_permute4x64_epi64 (_mm256_packs_epi32 (a, b), 0xd8);
+
+        _mm256_storeu_si256 ((__m256i *) (dst + i), _mm256_xor_si256 (packed, bias));
+    }
+
+    to16_tail (dst, src, blocks, n, s);
+}
+
+TARGET_AVX2 static void
+convert_to32_avx2 (gpointer data, const gfloat *src, gsize n, const Scale *s)
+{
+    guint32 *dst = data;
+    const __m256i bias = _mm256_set1_epi32 ((gint32) s->bias);
+    gsize blocks = n & ~((gsize) 7);
+    AVX2_SCALE_CONSTANTS (s)
+
+    for (gsize i = 0; i < blocks; i += 8) {
+        __m256i a = scale_avx2 (_mm256_loadu_ps (src + i), min, scale, range, offset);
+        _mm256_storeu_si256 ((__m256i *) (dst + i), _mm256_xor_si256 (a, bias));
+    }
+
+    to32_tail (dst, src, blocks, n, s);
+}
+
+TARGET_AVX2 static void
+min_max_avx2 (const gfloat *src, gsize n, gfloat *min, gfloat *max)
+{
+    __m256 lo = _mm256_set1_ps (INFINITY);
+    __m256 hi = _mm256_set1_ps (-INFINITY);
+    gfloat lanes_lo[8], lanes_hi[8];
+    gsize blocks = n & ~((gsize) 7);
+
+    for (gsize i = 0; i < blocks; i += 8) {
+        __m256 v = _mm256_loadu_ps (src + i);
+        lo = _mm256_min_ps (v, lo);
+        hi = _mm256_max_ps (v, hi);
+    }
+
+    _mm256_storeu_ps (lanes_lo, lo);
+    _mm256_storeu_ps (lanes_hi, hi);
+    min_max_reduce (lanes_lo, lanes_hi, 8, min, max);
+    min_max_tail (src, blocks, n, min, max);
+}
+
+TARGET_AVX2 static void
+sums_avx2 (const gfloat *src, gsize n, gfloat shift, Sums *sums)
+{
+    __m256 lo = _mm256_set1_ps (INFINITY);
+    __m256 hi = _mm256_set1_ps (-INFINITY);
+    __m256d s = _mm256_set1_pd (shift);
+    __m256d sum = _mm256_setzero_pd ();
+    __m256d sum_sq = _mm256_setzero_pd ();
+    gfloat lanes_lo[8], lanes_hi[8];
+    gdouble lanes_sum[4], lanes_sum_sq[4];
+    gsize blocks = n & ~((gsize) 7);
+    gsize count = 0;
+
+    for (gsize i = 0; i < blocks; i += 8) {
+        __m256 v = _mm256_loadu_ps (src + i);
+        __m256d d0 = _mm256_sub_pd (_mm256_cvtps_pd (_mm256_castps256_ps128 (v)), s);
+        __m256d d1 = _mm256_sub_pd (_mm256_cvtps_pd (_mm256_extractf128_ps (v, 1)), s);
+
+        d0 = _mm256_and_pd (d0, _mm256_cmp_pd (d0, d0, _CMP_ORD_Q));
+        d1 = _mm256_and_pd (d1, _mm256_cmp_pd (d1, d1, _CMP_ORD_Q));
+        sum = _mm256_add_pd (sum, _mm256_add_pd (d0, d1));
+        sum_sq = _mm256_add_pd (sum_sq, _mm256_add_pd (_mm256_mul_pd (d0, d0), _mm256_mul_pd (d1, d1)));
+        count += __builtin_popcount (_mm256_movemask_ps (_mm256_cmp_ps (v, v, _CMP_ORD_Q)));
+        lo = _mm256_min_ps (v, lo);
+        hi = _mm256_max_ps (v, hi);
+    }
+
+    _mm256_storeu_pd (lanes_sum, sum);
+    _mm256_storeu_pd (lanes_sum_sq, sum_sq);
+    _mm256_storeu_ps (lanes_lo, lo);
+    _mm256_storeu_ps (lanes_hi, hi);
+    sums_reduce (lanes_sum, lanes_sum_sq, 4, sums);
+    min_max_reduce (lanes_lo, lanes_hi, 8, &sums->min, &sums->max);
+    sums->n = count;
+    sums_tail (src, blocks, n, shift, sums);
+}
+
+/* Every CPU with AVX2 also has F16C, the dispatcher checks both anyway */
+__attribute__ ((target ("avx2,f16c"))) static void
+convert_f16_avx2 (gfloat *dst, gconstpointer data, gsize n)
+{
+    const guint16 *src = data;
+    gsize blocks = n & ~((gsize) 7);
+
+    f16_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 8) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i - 8));
+        _mm256_storeu_ps (dst + i - 8, _mm256_cvtph_ps (v));
+    }
+}
+
+static const ConvertTable avx2_table = {
+    .name = "avx2",
+    .to_float = {
+        [UFO_BUFFER_DEPTH_8U]  = convert_u8_avx2,
+        [UFO_BUFFER_DEPTH_16U] = convert_u16_avx2,
+        [UFO_BUFFER_DEPTH_16S] = convert_s16_avx2,
+        [UFO_BUFFER_DEPTH_32S] = convert_s32_avx2,
+        [UFO_BUFFER_DEPTH_32U] = convert_u32_avx2,
+        [UFO_BUFFER_DEPTH_16F] = convert_f16_avx2,
+    },
+    .from_float = {
+        [UFO_BUFFER_DEPTH_8U]  = convert_to8_avx2,
+        [UFO_BUFFER_DEPTH_16U] = convert_to16_avx2,
+        [UFO_BUFFER_DEPTH_16S] = convert_to16_avx2,
+        [UFO_BUFFER_DEPTH_32S] = convert_to32_avx2,
+        [UFO_BUFFER_DEPTH_32U] = convert_to32_avx2,
+    },
+    .min_max = min_max_avx2,
+    .sums = sums_avx2,
+};
+
+#if defined(__clang__) || __GNUC__ >= 5
+#define HAVE_AVX512 1
+#define TARGET_AVX512 __attribute__ ((target ("avx512f")))
+
+TARGET_AVX512 static void
+convert_u8_avx512 (gfloat *dst, gconstpointer data, gsize n)
+{
+    const guint8 *src = data;
+    gsize blocks = n & ~((gsize) 15);
+
+    u8_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 16) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i - 16));
+        _mm512_storeu_ps (dst + i - 16, _mm512_cvtepi32_ps (_mm512_cvtepu8_epi32 (v)));
+    }
+}
+
+TARGET_AVX512 static void
+convert_u16_avx512 (gfloat *dst, gconstpointer data, gsize n)
+{
+    const guint16 *src = data;
+    gsize blocks = n & ~((gsize) 15);
+
+    u16_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 16) {
+        __m256i v = _mm256_loadu_si256 ((const __m256i *) (src + i - 16));
+        _mm512_storeu_ps (dst + i - 16, _mm512_cvtepi32_ps (_mm512_cvtepu16_epi32 (v)));
+    }
+}
+
+TARGET_AVX512 static void
+convert_s16_avx512 (gfloat *dst, gconstpointer data, gsize n)
+{
+    const gint16 *src = data;
+    gsize blocks = n & ~((gsize) 15);
+
+    s16_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 16) {
+        __m256i v = _mm256_loadu_si256 ((const __m256i *) (src + i - 16));
+        _mm512_storeu_ps (dst + i - 16, _mm512_cvtepi32_ps (_mm512_cvtepi16_epi32 (v)));
+    }
+}
+
+TARGET_AVX512 static void
+convert_s32_avx512 (gfloat *dst, gconstpointer data, gsize n)
+{
+    const gint32 *src = data;
+    gsize blocks = n & ~((gsize) 15);
+
+    s32_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 16) {
+        __m512i v = _mm512_loadu_si512 ((const void *) (src + i - 16));
+        _mm512_storeu_ps (dst + i - 16, _mm512_cvtepi32_ps (v));
+    }
+}
+
+TARGET_AVX512 static void
+convert_u32_avx512 (gfloat *dst, gconstpointer data, gsize n)
+{
+    const guint32 *src = data;
+    gsize blocks = n & ~((gsize) 15);
+
+    u32_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 16) {
+        __m512i v = _mm512_loadu_si512 ((const void *) (src + i - 16));
+        _mm512_storeu_ps (dst + i - 16, _mm512_cvtepu32_ps (v));
+    }
+}
+
+TARGET_AVX512 static inline __m512i
+scale_avx512 (__m512 x, __m512 min, __m512 scale, __m512 range, __m512 offset)
+{
+    __m512 v = _mm512_mul_ps (_mm512_sub_ps (x, min), scale);
+
+    v = _mm512_min_ps (_mm512_max_ps (v, _mm512_setzero_ps ()), range);
+    return _mm512_cvtps_epi32 (_mm512_add_ps (v, offset));
+}
+
+#define AVX512_SCALE_CONSTANTS(s) \
+    const __m512 min = _mm512_set1_ps (s->min); \
+    const __m512 scale = _mm512_set1_ps (s->scale); \
+    const __m512 range = _mm512_set1_ps (s->range); \
+    const __m512 offset = _mm512_set1_ps (s->offset);
+
+TARGET_AVX512 static void
+convert_to8_avx512 (gpointer data, const gfloat *src, gsize n, const Scale *s)
+{
+    guint8 *dst = data;
+    gsize blocks = n & ~((gsize) 15);
+    AVX512_SCALE_CONSTANTS (s)
+
+    for (gsize i = 0; i < blocks; i += 16) {
+        __m512i a = scale_avx512 (_mm512_loadu_ps (src + i), min, scale, range, offset);
+        _mm_storeu_si128 ((__m128i *) (dst + i), _mm512_cvtepi32_epi8 (a));
+    }
+
+    to8_tail (dst, src, blocks, n, s);
+}
+
+TARGET_AVX512 static void
+convert_to16_avx512 (gpointer data, const gfloat *src, gsize n, const Scale *s)
+{
+    guint16 *dst = data;
+    const __m256i bias = _mm256_set1_epi16 ((gint16) s->bias);
+    gsize blocks = n & ~((gsize) 15);
+    AVX512_SCALE_CONSTANTS (s)
+
+    for (gsize i = 0; i < blocks; i += 16) {
+        __m512i a = scale_avx512 (_mm512_loadu_ps (src + i), min, scale, range, offset);
+        _mm256_storeu_si256 ((__m256i *) (dst + i), _mm256_xor_si256 (_mm512_cvtepi32_epi16 (a), bias));
+    }
+
+    to16_tail (dst, src, blocks, n, s);
+}
+
+TARGET_AVX512 static void
+convert_to32_avx512 (gpointer data, const gfloat *src, gsize n, const Scale *s)
+{
+    guint32 *dst = data;
+    const __m512i bias = _mm512_set1_epi32 ((gint32) s->bias);
+    gsize blocks = n & ~((gsize) 15);
+    AVX512_SCALE_CONSTANTS (s)
+
+    for (gsize i = 0; i < blocks; i += 16) {
+        __m512i a = scale_avx512 (_mm512_loadu_ps (src + i), min, scale, range, offset);
+        _mm512_storeu_si512 ((void *) (dst + i), _mm512_xor_si512 (a, bias));
+    }
+
+    to32_tail (dst, src, blocks, n, s);
+}
+
+TARGET_AVX512 static void
+min_max_avx512 (const gfloat *src, gsize n, gfloat *min, gfloat *max)
+{
+    __m512 lo = _mm512_set1_ps (INFINITY);
+    __m512 hi = _mm512_set1_ps (-INFINITY);
+    gfloat lanes_lo[16], lanes_hi[16];
+    gsize blocks = n & ~((gsize) 15);
+
+    for (gsize i = 0; i < blocks; i += 16) {
+        __m512 v = _mm512_loadu_ps (src + i);
+        lo = _mm512_min_ps (v, lo);
+        hi = _mm512_max_ps (v, hi);
+    }
+
+    _mm512_storeu_ps (lanes_lo, lo);
+    _mm512_storeu_ps (lanes_hi, hi);
+    min_max_reduce (lanes_lo, lanes_hi, 16, min, max);
+    min_max_tail (src, blocks, n, min, max);
+}
+
+TARGET_AVX512 static void
+convert_f16_avx512 (gfloat *dst, gconstpointer data, gsize n)
+{
+    const guint16 *src = data;
+    gsize blocks = n & ~((gsize) 15);
+
+    f16_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 16) {
+        __m256i v = _mm256_loadu_si256 ((const __m256i *) (src + i - 16));
+        _mm512_storeu_ps (dst + i - 16, _mm512_cvtph_ps (v));
+    }
+}
+
+TARGET_AVX512 static void
+sums_avx512 (const gfloat *src, gsize n, gfloat shift, Sums *sums)
+{
+    __m512 lo = _mm512_set1_ps (INFINITY);
+    __m512 hi = _mm512_set1_ps (-INFINITY);
+    __m512d s = _mm512_set1_pd (shift);
+    __m512d sum = _mm512_setzero_pd ();
+    __m512d sum_sq = _mm512_setzero_pd ();
+    gfloat lanes_lo[16], lanes_hi[16];
+    gdouble lanes_sum[8], lanes_sum_sq[8];
+    gsize blocks = n & ~((gsize) 15);
+    gsize count = 0;
+
+    for (gsize i = 0; i < blocks; i += 16) {
+        __m512 v = _mm512_loadu_ps (src + i);
+        __mmask16 valid = _mm512_cmp_ps_mask (v, v, _CMP_ORD_Q);
+        __m512d x0 = _mm512_cvtps_pd (_mm512_castps512_ps256 (v));
+        __m512d x1 = _mm512_cvtps_pd (_mm256_castpd_ps (_mm512_extractf64x4_pd (_mm512_castps_pd (v), 1)));
+        __m512d d0 = _mm512_maskz_sub_pd ((__mmask8) valid, x0, s);
+        __m512d d1 = _mm512_maskz_sub_pd ((__mmask8) (valid >> 8), x1, s);
+
+        sum = _mm512_add_pd (sum, _mm512_add_pd (d0, d1));
+        sum_sq = _mm512_add_pd (sum_sq, _mm512_add_pd (_mm512_mul_pd (d0, d0), _mm512_mul_pd (d1, d1)));
+        count += __builtin_popcount (valid);
+        lo = _mm512_min_ps (v, lo);
+        hi = _mm512_max_ps (v, hi);
+    }
+
+    _mm512_storeu_pd (lanes_sum, sum);
+    _mm512_storeu_pd (lanes_sum_sq, sum_sq);
+    _mm512_storeu_ps (lanes_lo, lo);
+    _mm512_storeu_ps (lanes_hi, hi);
+    sums_reduce (lanes_sum, lanes_sum_sq, 8, sums);
+    min_max_reduce (lanes_lo, lanes_hi, 16, &sums->min, &sums->max);
+    sums->n = count;
+    sums_tail (src, blocks, n, shift, sums);
+}
+
+static const ConvertTable avx512_table = {
+    .name = "avx512",
+    .to_float = {
+        [UFO_BUFFER_DEPTH_8U]  = convert_u8_avx512,
+        [UFO_BUFFER_DEPTH_16U] = convert_u16_avx512,
+        [UFO_BUFFER_DEPTH_16S] = convert_s16_avx512,
+        [UFO_BUFFER_DEPTH_32S] = convert_s32_avx512,
+        [UFO_BUFFER_DEPTH_32U] = convert_u32_avx512,
+        [UFO_BUFFER_DEPTH_16F] = convert_f16_avx512,
+    },
+    .from_float = {
+        [UFO_BUFFER_DEPTH_8U]  = convert_to8_avx512,
+        [UFO_BUFFER_DEPTH_16U] = convert_to16_avx512,
+        [UFO_BUFFER_DEPTH_16S] = convert_to16_avx512,
+        [UFO_BUFFER_DEPTH_32S] = convert_to32_avx512,
+        [UFO_BUFFER_DEPTH_32U] = convert_to32_avx512,
+    },
+    .min_max = min_max_avx512,
+    .sums = sums_avx512,
+};
+#endif
+
+#elif defined(__ARM_NEON)
+
+static void
+convert_u8_neon (gfloat *dst, gconstpointer data, gsize n)
+{
+    const guint8 *src = data;
+    gsize blocks = n & ~((gsize) 15);
+
+    u8_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 16) {
+        uint8x16_t v = vld1q_u8 (src + i - 16);
+        uint16x8_t lo = vmovl_u8 (vget_low_u8 (v));
+        uint16x8_t hi = vmovl_u8 (vget_high_u8 (v));
+        gfloat *d = dst + i - 16;
+
+        vst1q_f32 (d + 0, vcvtq_f32_u32 (vmovl_u16 (vget_low_u16 (lo))));
+        vst1q_f32 (d + 4, vcvtq_f32_u32 (vmovl_u16 (vget_high_u16 (lo))));
+        vst1q_f32 (d + 8, vcvtq_f32_u32 (vmovl_u16 (vget_low_u16 (hi))));
+        vst1q_f32 (d + 12, vcvtq_f32_u32 (vmovl_u16 (vget_high_u16 (hi))));
+    }
+}
+
+static void
+convert_u16_neon (gfloat *dst, gconstpointer data, gsize n)
+{
+    const guint16 *src = data;
+    gsize blocks = n & ~((gsize) 7);
+
+    u16_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 8) {
+        uint16x8_t v = vld1q_u16 (src + i - 8);
+        gfloat *d = dst + i - 8;
+
+        vst1q_f32 (d + 0, vcvtq_f32_u32 (vmovl_u16 (vget_low_u16 (v))));
+        vst1q_f32 (d + 4, vcvtq_f32_u32 (vmovl_u16 (vget_high_u16 (v))));
+    }
+}
+
+static void
+convert_s16_neon (gfloat *dst, gconstpointer data, gsize n)
+{
+    const gint16 *src = data;
+    gsize blocks = n & ~((gsize) 7);
+
+    s16_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 8) {
+        int16x8_t v = vld1q_s16 (src + i - 8);
+        gfloat *d = dst + i - 8;
+
+        vst1q_f32 (d + 0, vcvtq_f32_s32 (vmovl_s16 (vget_low_s16 (v))));
+        vst1q_f32 (d + 4, vcvtq_f32_s32 (vmovl_s16 (vget_high_s16 (v))));
+    }
+}
+
+static void
+convert_s32_neon (gfloat *dst, gconstpointer data, gsize n)
+{
+    const gint32 *src = data;
+    gsize blocks = n & ~((gsize) 3);
+
+    s32_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 4)
+        vst1q_f32 (dst + i - 4, vcvtq_f32_s32 (vld1q_s32 (src + i - 4)));
+}
+
+static void
+convert_u32_neon (gfloat *dst, gconstpointer data, gsize n)
+{
+    const guint32 *src = data;
+    gsize blocks = n & ~((gsize) 3);
+
+    u32_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 4)
+        vst1q_f32 (dst + i - 4, vcvtq_f32_u32 (vld1q_u32 (src + i - 4)));
+}
+
+#ifdef __aarch64__
+static inline int32x4_t
+scale_neon (float32x4_t x, float32x4_t min, float32x4_t scale, float32x4_t range, float32x4_t offset)
+{
+    float32x4_t v = vmulq_f32 (vsubq_f32 (x, min), scale);
+
+    v = vminnmq_f32 (vmaxnmq_f32 (v, vdupq_n_f32 (0.0f)), range);
+    return vcvtnq_s32_f32 (vaddq_f32 (v, offset));
+}
+
+#define NEON_SCALE_CONSTANTS(s) \
+    const float32x4_t min = vdupq_n_f32 (s->min); \
+    const float32x4_t scale = vdupq_n_f32 (s->scale); \
+    const float32x4_t range = vdupq_n_f32 (s->range); \
+    const float32x4_t offset = vdupq_n_f32 (s->offset);
+
+static void
+convert_to8_neon (gpointer data, const gfloat *src, gsize n, const Scale *s)
+{
+    guint8 *dst = data;
+    gsize blocks = n & ~((gsize) 15);
+    NEON_SCALE_CONSTANTS (s)
+
+    for (gsize i = 0; i < blocks; i += 16) {
+        int32x4_t a = scale_neon (vld1q_f32 (src + i + 0), min, scale, range, offset);
+        int32x4_t b = scale_neon (vld1q_f32 (src + i + 4), min, scale, range, offset);
+        int32x4_t c = scale_neon (vld1q_f32 (src + i + 8), min, scale, range, offset);
+        int32x4_t d = scale_neon (vld1q_f32 (src + i + 12), min, scale, range, offset);
+        int16x8_t ab = vcombine_s16 (vmovn_s32 (a), vmovn_s32 (b));
+        int16x8_t cd = vcombine_s16 (vmovn_s32 (c), vmovn_s32 (d));
+
+        vst1q_u8 (dst + i, vcombine_u8 (vmovn_u16 (vreinterpretq_u16_s16 (ab)),
+                                        vmovn_u16 (vreinterpretq_u16_s16 (cd))));
+    }
+
+    to8_tail (dst, src, blocks, n, s);
+}
+
+static void
+convert_to16_neon (gpointer data, const gfloat *src, gsize n, const Scale *s)
+{
+    guint16 *dst = data;
+    const int16x8_t bias = vdupq_n_s16 ((gint16) s->bias);
+    gsize blocks = n & ~((gsize) 7);
+    NEON_SCALE_CONSTANTS (s)
+
+    for (gsize i = 0; i < blocks; i += 8) {
+        int32x4_t a = scale_neon (vld1q_f32 (src + i + 0), min, scale, range, offset);
+        int32x4_t b = scale_neon (vld1q_f32 (src + i + 4), min, scale, range, offset);
+        int16x8_t packed = veorq_s16 (vcombine_s16 (vmovn_s32 (a), vmovn_s32 (b)), bias);
+
+        vst1q_u16 (dst + i, vreinterpretq_u16_s16 (packed));
+    }
+
+    to16_tail (dst, src, blocks, n, s);
+}
+
+static void
+convert_to32_neon (gpointer data, const gfloat *src, gsize n, const Scale *s)
+{
+    guint32 *dst = data;
+    const int32x4_t bias = vdupq_n_s32 ((gint32) s->bias);
+    gsize blocks = n & ~((gsize) 3);
+    NEON_SCALE_CONSTANTS (s)
+
+    for (gsize i = 0; i < blocks; i += 4) {
+        int32x4_t a = scale_neon (vld1q_f32 (src + i), min, scale, range, offset);
+        vst1q_u32 (dst + i, vreinterpretq_u32_s32 (veorq_s32 (a, bias)));
+    }
+
+    to32_tail (dst, src, blocks, n, s);
+}
+
+static void
+min_max_neon (const gfloat *src, gsize n, gfloat *min, gfloat *max)
+{
+    float32x4_t lo = vdupq_n_f32 (INFINITY);
+    float32x4_t hi = vdupq_n_f32 (-INFINITY);
+    gfloat lanes_lo[4], lanes_hi[4];
+    gsize blocks = n & ~((gsize) 3);
+
+    for (gsize i = 0; i < blocks; i += 4) {
+        float32x4_t v = vld1q_f32 (src + i);
+        lo = vminnmq_f32 (v, lo);
+        hi = vmaxnmq_f32 (v, hi);
+    }
+
+    vst1q_f32 (lanes_lo, lo);
+    vst1q_f32 (lanes_hi, hi);
+    min_max_reduce (lanes_lo, lanes_hi, 4, min, max);
+    min_max_tail (src, blocks, n, min, max);
+}
+static void
+sums_neon (const gfloat *src, gsize n, gfloat shift, Sums *sums)
+{
+    float32x4_t lo = vdupq_n_f32 (INFINITY);
+    float32x4_t hi = vdupq_n_f32 (-INFINITY);
+    float64x2_t s = vdupq_n_f64 (shift);
+    float64x2_t sum = vdupq_n_f64 (0.0);
+    float64x2_t sum_sq = vdupq_n_f64 (0.0);
+    gfloat lanes_lo[4], lanes_hi[4];
+    gdouble lanes_sum[2], lanes_sum_sq[2];
+    gsize blocks = n & ~((gsize) 3);
+    gsize count = 0;
+
+    for (gsize i = 0; i < blocks; i += 4) {
+        float32x4_t v = vld1q_f32 (src + i);
+        float64x2_t d0 = vsubq_f64 (vcvt_f64_f32 (vget_low_f32 (v)), s);
+        float64x2_t d1 = vsubq_f64 (vcvt_high_f64_f32 (v), s);
+
+        d0 = vreinterpretq_f64_u64 (vandq_u64 (vreinterpretq_u64_f64 (d0), vceqq_f64 (d0, d0)));
+        d1 = vreinterpretq_f64_u64 (vandq_u64 (vreinterpretq_u64_f64 (d1), vceqq_f64 (d1, d1)));
+        sum = vaddq_f64 (sum, vaddq_f64 (d0, d1));
+        sum_sq = vaddq_f64 (sum_sq, vaddq_f64 (vmulq_f64 (d0, d0), vmulq_f64 (d1, d1)));
+        count += vaddvq_u32 (vshrq_n_u32 (vceqq_f32 (v, v), 31));
+        lo = vminnmq_f32 (v, lo);
+        hi = vmaxnmq_f32 (v, hi);
+    }
+
+    vst1q_f64 (lanes_sum, sum);
+    vst1q_f64 (lanes_sum_sq, sum_sq);
+    vst1q_f32 (lanes_lo, lo);
+    vst1q_f32 (lanes_hi, hi);
+    sums_reduce (lanes_sum, lanes_sum_sq, 2, sums);
+    min_max_reduce (lanes_lo, lanes_hi, 4, &sums->min, &sums->max);
+    sums->n = count;
+    sums_tail (src, blocks, n, shift, sums);
+}
+
+static void
+convert_f16_neon (gfloat *dst, gconstpointer data, gsize n)
+{
+    const guint16 *src = data;
+    gsize blocks = n & ~((gsize) 3);
+
+    f16_tail (dst, src, blocks, n);
+
+    for (gsize i = blocks; i > 0; i -= 4)
+        vst1q_f32 (dst + i - 4, vcvt_f32_f16 (vreinterpret_f16_u16 (vld1_u16 (src + i - 4))));
+}
+#else
+/* Rounding and half conversions only exist on AArch64 */
+#define convert_f16_neon    convert_f16_scalar
+#define convert_to8_neon    convert_to8_scalar
+#define convert_to16_neon   convert_to16_scalar
+#define convert_to32_neon   convert_to32_scalar
+#define min_max_neon        min_max_scalar
+#define sums_neon           sums_scalar
+#endif
+
+static const ConvertTable neon_table = {
+    .name = "neon",
+    .to_float = {
+        [UFO_BUFFER_DEPTH_8U]  = convert_u8_neon,
+        [UFO_BUFFER_DEPTH_16U] = convert_u16_neon,
+        [UFO_BUFFER_DEPTH_16S] = convert_s16_neon,
+        [UFO_BUFFER_DEPTH_32S] = convert_s32_neon,
+        [UFO_BUFFER_DEPTH_32U] = convert_u32_neon,
+        [UFO_BUFFER_DEPTH_16F] = convert_f16_neon,
+    },
+    .from_float = {
+        [UFO_BUFFER_DEPTH_8U]  = convert_to8_neon,
+        [UFO_BUFFER_DEPTH_16U] = convert_to16_neon,
+        [UFO_BUFFER_DEPTH_16S] = convert_to16_neon,
+        [UFO_BUFFER_DEPTH_32S] = convert_to32_neon,
+        [UFO_BUFFER_DEPTH_32U] = convert_to32_neon,
+    },
+    .min_max = min_max_neon,
+    .sums = sums_neon,
+};
+
+#endif
+
+static const ConvertTable *
+select_table (void)
+{
+#ifdef HAVE_X86_DISPATCH
+    __builtin_cpu_init ();
+
+#ifdef HAVE_AVX512
+    if (__builtin_cpu_supports ("avx512f"))
+        return &avx512_table;
+#endif
+
+    if (__builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("f16c"))
+        return &avx2_table;
+
+#ifdef __x86_64__
+    return &sse2_table;
+#else
+    if (__builtin_cpu_supports ("sse2"))
+        return &sse2_table;
+#endif
+#elif defined(__ARM_NEON)
+    return &neon_table;
+#endif
+
+    return &scalar_table;
+}
+
+static const ConvertTable *
+get_table (void)
+{
+    static gsize table = 0;
+
+    if (g_once_init_enter (&table)) {
+        const ConvertTable *selected = select_table ();
+
+        g_debug ("INFO Converting host data with %s kernels", selected->name);
+        g_once_init_leave (&table, (gsize) selected);
+    }
+
+    return (const ConvertTable *) table;
+}
+
+static void
+run_chunk (gpointer data, gpointer user_data)
+{
+    Chunk *chunk = data;
+    Completion *completion = chunk->completion;
+
+    chunk->run (chunk);
+
+    g_mutex_lock (&completion->lock);
+
+    if (--completion->remaining == 0)
+        g_cond_signal (&completion->cond);
+
+    g_mutex_unlock (&completion->lock);
+}
+
+static void
+run_to_float (Chunk *chunk)
+{
+    chunk->to_float (chunk->dst, chunk->src, chunk->n);
+}
+
+static void
+run_from_float (Chunk *chunk)
+{
+    chunk->from_float (chunk->dst, chunk->src, chunk->n, chunk->scale);
+}
+
+static void
+run_min_max (Chunk *chunk)
+{
+    chunk->min_max (chunk->src, chunk->n, &chunk->min, &chunk->max);
+}
+
+static void
+run_sums (Chunk *chunk)
+{
+    chunk->sums_func (chunk->src, chunk->n, chunk->shift, &chunk->sums);
+}
+
+static void
+run_histogram (Chunk *chunk)
+{
+    const Histogram *h = chunk->histogram;
+    const gfloat *src = chunk->src;
+
+    chunk->bins = g_new0 (guint32, h->n_bins);
+
+    /* Same arithmetic as the device kernel so that both agree on the bins */
+    for (gsize i = 0; i < chunk->n; i++) {
+        gfloat x = src[i];
+
+        if (x >= h->min && x <= h->max)
+            chunk->bins[MIN ((guint) ((x - h->min) * h->scale), h->n_bins - 1)]++;
+    }
+}
+
+static GThreadPool *
+get_thread_pool (void)
+{
+    static gsize pool = 0;
+
+    if (g_once_init_enter (&pool)) {
+        GThreadPool *p;
+
+        p = g_thread_pool_new (run_chunk, NULL, (gint) g_get_num_processors () - 1, FALSE, NULL);
+        g_once_init_leave (&pool, (gsize) p);
+    }
+
+    return (GThreadPool *) pool;
+}
+
+static gboolean
+use_threads (gsize n_pixels)
+{
+    return n_pixels >= PARALLEL_THRESHOLD && g_get_num_processors () > 1;
+}
+
+/*
+ * Split @n pixels described by @template into chunks, run them on the thread
+ * pool and the calling thread and return the finished chunks.
+ */
+static Chunk *
+run_parallel (const Chunk *template,
+              gsize n,
+              gsize dst_size,
+              gsize src_size,
+              guint *n_chunks_out)
+{
+    GThreadPool *pool;
+    Completion completion;
+    Chunk *chunks;
+    guint n_chunks;
+    gsize chunk_size;
+
+    n_chunks = MIN (g_get_num_processors (), n / (PARALLEL_THRESHOLD / 4));
+    chunk_size = ((n / n_chunks) + CHUNK_ALIGNMENT - 1) & ~((gsize) CHUNK_ALIGNMENT - 1);
+    chunks = g_new0 (Chunk, n_chunks);
+    pool = get_thread_pool ();
+
+    g_mutex_init (&completion.lock);
+    g_cond_init (&completion.cond);
+    completion.remaining = n_chunks;
+
+    for (guint i = 0; i < n_chunks; i++) {
+        gsize offset = MIN (i * chunk_size, n);
+
+        chunks[i] = *template;
+        chunks[i].dst = ((guint8 *) template->dst) + offset * dst_size;
+        chunks[i].src = ((const guint8 *) template->src) + offset * src_size;
+        chunks[i].n = MIN (chunk_size, n - offset);
+        chunks[i].completion = &completion;
+    }
+
+    /* The calling thread converts the first chunk itself */
+    for (guint i = 1; i < n_chunks; i++)
+        g_thread_pool_push (pool, &chunks[i], NULL);
+
+    run_chunk (&chunks[0], NULL);
+
+    g_mutex_lock (&completion.lock);
+
+    while (completion.remaining > 0)
+        g_cond_wait (&completion.cond, &completion.lock);
+
+    g_mutex_unlock (&completion.lock);
+
+    g_mutex_clear (&completion.lock);
+    g_cond_clear (&completion.cond);
+
+    *n_chunks_out = n_chunks;
+    return chunks;
+}
+
+/*
+ * ufo_convert_get_depth_size:
+ * @depth: Bit depth
+ *
+ * Returns: Number of bytes a single pixel of @depth occupies.
+ */
+gsize
+ufo_convert_get_depth_size (UfoBufferDepth depth)
+{
+    switch (depth) {
+        case UFO_BUFFER_DEPTH_8U:
+            return 1;
+        case UFO_BUFFER_DEPTH_16U:
+        case UFO_BUFFER_DEPTH_16S:
+        case UFO_BUFFER_DEPTH_16F:
+            return 2;
+        default:
+            return 4;
+    }
+}
+
+/*
+ * ufo_convert_to_float:
+ * @dst: Destination with room for @n_pixels floats
+ * @src: Source data of @depth, either not overlapping @dst or equal to it
+ * @depth: Bit depth of @src
+ * @n_pixels: Number of pixels to convert
+ *
+ * Convert @n_pixels of @src to floats in @dst using the widest vector
+ * instructions the CPU supports. Large out-of-place conversions are split
+ * across a thread pool, in-place conversions run on the calling thread because
+ * a chunk would overwrite source data of the next one.
+ */
+void
+ufo_convert_to_float (gfloat *dst,
+                      gconstpointer src,
+                      UfoBufferDepth depth,
+                      gsize n_pixels)
+{
+    ConvertFunc func;
+
+    if (depth <= UFO_BUFFER_DEPTH_INVALID || depth == UFO_BUFFER_DEPTH_32F || depth >= N_DEPTHS)
+        return;
+
+    func = get_table ()->to_float[depth];
+
+    if ((gconstpointer) dst != src && use_threads (n_pixels)) {
+        Chunk template = { .run = run_to_float, .to_float = func, .dst = dst, .src = src };
+        guint n_chunks;
+
+        g_free (run_parallel (&template, n_pixels, sizeof (gfloat), ufo_convert_get_depth_size (depth), &n_chunks));
+    }
+    else
+        func (dst, src, n_pixels);
+}
+
+/*
+ * ufo_convert_from_float:
+ * @dst: Destination with room for @n_pixels of @depth
+ * @src: Source floats, not overlapping @dst
+ * @depth: Bit depth of @dst
+ * @n_pixels: Number of pixels to convert
+ * @min: Value mapped to the lowest value of @depth
+ * @max: Value mapped to the highest value of @depth
+ *
+ * Scale @src linearly from [@min, @max] onto the full range of @depth, round to
+ * nearest and saturate. If @max is not larger than @min, all pixels map to the
+ * lowest value. %UFO_BUFFER_DEPTH_32F copies @src unchanged.
+ */
+void
+ufo_convert_from_float (gpointer dst,
+                        const gfloat *src,
+                        UfoBufferDepth depth,
+                        gsize n_pixels,
+                        gfloat min,
+                        gfloat max)
+{
+    FromFloatFunc func;
+    Scale scale;
+
+    if (depth == UFO_BUFFER_DEPTH_32F) {
+        memcpy (dst, src, n_pixels * sizeof (gfloat));
+        return;
+    }
+
+    /* There are no half float targets yet */
+    if (depth <= UFO_BUFFER_DEPTH_INVALID || depth >= UFO_BUFFER_DEPTH_16F)
+        return;
+
+    switch (depth) {
+        case UFO_BUFFER_DEPTH_8U:
+            scale.range = 255.0f;
+            scale.offset = 0.0f;
+            scale.bias = 0;
+            break;
+        case UFO_BUFFER_DEPTH_16U:
+        case UFO_BUFFER_DEPTH_16S:
+            scale.range = 65535.0f;
+            scale.offset = -32768.0f;
+            scale.bias = depth == UFO_BUFFER_DEPTH_16U ? 0x8000 : 0;
+            break;
+        default:
+            /* Largest float below 2^32, anything above overflows the cast */
+            scale.range = 4294967040.0f;
+            scale.offset = -2147483648.0f;
+            scale.bias = depth == UFO_BUFFER_DEPTH_32U ? 0x80000000 : 0;
+            break;
+    }
+
+    scale.min = min;
+    scale.scale = max > min ? scale.range / (max - min) : 0.0f;
+    func = get_table ()->from_float[depth];
+
+    if (use_threads (n_pixels)) {
+        Chunk template = { .run = run_from_float, .from_float = func, .scale = &scale, .dst = dst, .src = src };
+        guint n_chunks;
+
+        g_free (run_parallel (&template, n_pixels, ufo_convert_get_depth_size (depth), sizeof (gfloat), &n_chunks));
+    }
+    else
+        func (dst, src, n_pixels, &scale);
+}
+
+/*
+ * ufo_convert_find_range:
+ * @src: Source floats
+ * @n_pixels: Number of pixels in @src
+ * @min: Location for the minimum
+ * @max: Location for the maximum
+ *
+ * Find the range of @src, ignoring NaN. If @src contains no numbers, @min is
+ * positive and @max negative infinity.
+ */
+void
+ufo_convert_find_range (const gfloat *src,
+                        gsize n_pixels,
+                        gfloat *min,
+                        gfloat *max)
+{
+    MinMaxFunc func;
+
+    func = get_table ()->min_max;
+
+    if (use_threads (n_pixels)) {
+        Chunk template = { .run = run_min_max, .min_max = func, .src = src };
+        Chunk *chunks;
+        guint n_chunks;
+
+        chunks = run_parallel (&template, n_pixels, 0, sizeof (gfloat), &n_chunks);
+        *min = INFINITY;
+        *max = -INFINITY;
+
+        for (guint i = 0; i < n_chunks; i++) {
+            *min = chunks[i].min < *min ? chunks[i].min : *min;
+            *max = chunks[i].max > *max ? chunks[i].max : *max;
+        }
+
+        g_free (chunks);
+    }
+    else
+        func (src, n_pixels, min, max);
+}
+
+/*
+ * ufo_convert_get_statistics:
+ * @src: Source floats
+ * @n_pixels: Number of pixels in @src
+ * @stats: Location for the statistics
+ *
+ * Compute minimum, maximum, sum, mean and population variance of @src in one
+ * pass, ignoring NaN.
+ */
+void
+ufo_convert_get_statistics (const gfloat *src,
+                            gsize n_pixels,
+                            UfoBufferStatistics *stats)
+{
+    Sums sums;
+    gfloat shift = 0.0f;
+    gdouble mean;
+
+    /* Any value of the data is close enough to its mean */
+    for (gsize i = 0; i < n_pixels; i++) {
+        if (!isnan (src[i])) {
+            shift = isinf (src[i]) ? 0.0f : src[i];
+            break;
+        }
+    }
+
+    if (use_threads (n_pixels)) {
+        Chunk template = { .run = run_sums, .sums_func = get_table ()->sums, .shift = shift, .src = src };
+        Chunk *chunks;
+        guint n_chunks;
+
+        chunks = run_parallel (&template, n_pixels, 0, sizeof (gfloat), &n_chunks);
+        sums = chunks[0].sums;
+
+        for (guint i = 1; i < n_chunks; i++) {
+            sums.n += chunks[i].sums.n;
+            sums.sum += chunks[i].sums.sum;
+            sums.sum_sq += chunks[i].sums.sum_sq;
+            sums.min = chunks[i].sums.min < sums.min ? chunks[i].sums.min : sums.min;
+            sums.max = chunks[i].sums.max > sums.max ? chunks[i].sums.max : sums.max;
+        }
+
+        g_free (chunks);
+    }
+    else
+        get_table ()->sums (src, n_pixels, shift, &sums);
+
+    stats->n_values = sums.n;
+    stats->min = sums.min;
+    stats->max = sums.max;
+
+    if (sums.n == 0) {
+        stats->sum = stats->mean = stats->variance = 0.0;
+        return;
+    }
+
+    mean = sums.sum / sums.n;
+    stats->mean = shift + mean;
+    stats->sum = stats->mean * sums.n;
+    stats->variance = MAX (0.0, sums.sum_sq / sums.n - mean * mean);
+}
+
+/*
+ * ufo_convert_get_histogram:
+ * @src: Source floats
+ * @n_pixels: Number of pixels in @src
+ * @min: Lower edge of the first bin
+ * @max: Upper edge of the last bin
+ * @n_bins: Number of bins
+ * @bins: Location for @n_bins counts
+ *
+ * Count the values of @src in @n_bins equally wide bins between @min and
+ * @max. @max itself falls into the last bin, values outside of the range and
+ * NaN are not counted.
+ */
+void
+ufo_convert_get_histogram (const gfloat *src,
+                           gsize n_pixels,
+                           gfloat min,
+                           gfloat max,
+                           guint n_bins,
+                           guint32 *bins)
+{
+    Histogram histogram;
+    Chunk template = { .run = run_histogram, .histogram = &histogram, .src = src, .n = n_pixels };
+
+    histogram.min = min;
+    histogram.max = max;
+    histogram.n_bins = n_bins;
+    histogram.scale = max > min ? n_bins / (max - min) : 0.0f;
+
+    memset (bins, 0, n_bins * sizeof (guint32));
+
+    if (use_threads (n_pixels)) {
+        Chunk *chunks;
+        guint n_chunks;
+
+        chunks = run_parallel (&template, n_pixels, 0, sizeof (gfloat), &n_chunks);
+
+        for (guint i = 0; i < n_chunks; i++) {
+            for (guint j = 0; j < n_bins; j++)
+                bins[j] += chunks[i].bins[j];
+
+            g_free (chunks[i].bins);
+        }
+
+        g_free (chunks);
+    }
+    else {
+        run_histogram (&template);
+        memcpy (bins, template.bins, n_bins * sizeof (guint32));
+        g_free (template.bins);
+    }
+}
@@ -41,7 +41,8 @@
  * @Title: UfoCopyTask
  *
  * Copies input to output. This is useful in combination with a
- * #UfoFixedScheduler in order to emulate broadcasting behaviour.
+ * #UfoFixedScheduler in order to emulate broadcasting behaviour. The task is
+ * stateless and is replicated across the CPU cores when the graph is expanded.
  */
 
 static void ufo_task_interface_init (UfoTaskIface *iface);
@@ -84,7 +85,7 @@ ufo_copy_task_get_num_dimensions (UfoTask *task,
 static UfoTaskMode
 ufo_copy_task_get_mode (UfoTask *task)
 {
-    return UFO_TASK_MODE_PROCESSOR | UFO_TASK_MODE_CPU;
+    return UFO_TASK_MODE_PROCESSOR | UFO_TASK_MODE_CPU | UFO_TASK_MODE_STATELESS;
 }
 
 static void
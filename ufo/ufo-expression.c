@@ -0,0 +1,536 @@
+/*
+ * Copyright (C) 2011-2013 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "ufo-basic-ops.h"
+#include "ufo-priv.h"
+
+/*
+ * Elementwise expressions over float buffers. An expression is parsed into a
+ * tree once and then either turned into the source of a single OpenCL kernel
+ * or evaluated on the host. The host evaluates the tree block by block, so
+ * that every operator becomes a simple loop over a few cache-resident arrays
+ * that the compiler can vectorize.
+ *
+ *   expr    := term (('+' | '-') term)*
+ *   term    := unary (('*' | '/') unary)*
+ *   unary   := ('-' | '+') unary | primary
+ *   primary := number | name | name '(' expr (',' expr)* ')' | '(' expr ')'
+ */
+
+#define BLOCK_SIZE 1024
+
+typedef enum {
+    EXPR_NUMBER,
+    EXPR_VARIABLE,
+    EXPR_NEGATE,
+    EXPR_BINARY,
+    EXPR_CALL,
+} ExprType;
+
+typedef struct {
+    const gchar *name;
+    guint n_args;
+    const gchar *cl_name;
+    gfloat (*unary) (gfloat);
+    gfloat (*binary) (gfloat, gfloat);
+} Function;
+
+typedef struct _ExprNode ExprNode;
+
+struct _ExprNode {
+    ExprType type;
+    gchar op;
+    gfloat value;
+    guint index;
+    const Function *function;
+    ExprNode *args[2];
+};
+
+struct _UfoExpr {
+    ExprNode *root;
+    guint n_variables;
+    guint depth;
+};
+
+typedef struct {
+    const gchar *start;
+    const gchar *pos;
+    const gchar * const *names;
+    GError **error;
+} Parser;
+
+static const Function functions[] = {
+    { "sqrt", 1, "sqrt", sqrtf, NULL },
+    { "exp",  1, "exp",  expf,  NULL },
+    { "log",  1, "log",  logf,  NULL },
+    { "abs",  1, "fabs", fabsf, NULL },
+    { "sin",  1, "sin",  sinf,  NULL },
+    { "cos",  1, "cos",  cosf,  NULL },
+    { "min",  2, "fmin", NULL,  fminf },
+    { "max",  2, "fmax", NULL,  fmaxf },
+    { "pow",  2, "pow",  NULL,  powf },
+};
+
+static ExprNode *parse_expr (Parser *parser);
+
+static void
+free_node (ExprNode *node)
+{
+    if (node == NULL)
+        return;
+
+    free_node (node->args[0]);
+    free_node (node->args[1]);
+    g_free (node);
+}
+
+static ExprNode *
+new_node (ExprType type)
+{
+    ExprNode *node = g_new0 (ExprNode, 1);
+    node->type = type;
+    return node;
+}
+
+static ExprNode *
+fail (Parser *parser,
+      const gchar *message)
+{
+    /* Only the innermost failure is reported */
+    if (parser->error != NULL && *parser->error == NULL)
+        g_set_error (parser->error, UFO_OP_ERROR, UFO_OP_ERROR_EXPRESSION,
+                     "%s at position %i of `%s'", message, (gint) (parser->pos - parser->start), parser->start);
+
+    return NULL;
+}
+
+static gchar
+peek (Parser *parser)
+{
+    while (g_ascii_isspace (*parser->pos))
+        parser->pos++;
+
+    return *parser->pos;
+}
+
+static gboolean
+accept (Parser *parser,
+        gchar c)
+{
+    if (peek (parser) != c)
+        return FALSE;
+
+    parser->pos++;
+    return TRUE;
+}
+
+static ExprNode *
+parse_call (Parser *parser,
+            const gchar *name,
+            const gchar *start)
+{
+    const Function *function = NULL;
+    ExprNode *node;
+
+    for (guint i = 0; i < G_N_ELEMENTS (functions); i++) {
+        if (g_strcmp0 (functions[i].name, name) == 0)
+            function = &functions[i];
+    }
+
+    if (function == NULL) {
+        parser->pos = start;
+        return fail (parser, "Unknown function");
+    }
+
+    node = new_node (EXPR_CALL);
+    node->function = function;
+
+    for (guint i = 0; i < function->n_args; i++) {
+        if (i > 0 && !accept (parser, ',')) {
+            free_node (node);
+            return fail (parser, "Expected `,'");
+        }
+
+        node->args[i] = parse_expr (parser);
+
+        if (node->args[i] == NULL) {
+            free_node (node);
+            return NULL;
+        }
+    }
+
+    if (!accept (parser, ')')) {
+        free_node (node);
+        return fail (parser, "Expected `)'");
+    }
+
+    return node;
+}
+
+static ExprNode *
+parse_primary (Parser *parser)
+{
+    ExprNode *node;
+    gchar c;
+
+    c = peek (parser);
+
+    if (accept (parser, '(')) {
+        node = parse_expr (parser);
+
+        if (node != NULL && !accept (parser, ')')) {
+            free_node (node);
+            return fail (parser, "Expected `)'");
+        }
+
+        return node;
+    }
+
+    if (g_ascii_isdigit (c) || c == '.') {
+        gchar *end;
+
+        node = new_node (EXPR_NUMBER);
+        node->value = (gfloat) g_ascii_strtod (parser->pos, &end);
+
+        if (end == parser->pos || !isfinite (node->value)) {
+            free_node (node);
+            return fail (parser, "Invalid number");
+        }
+
+        parser->pos = end;
+        return node;
+    }
+
+    if (g_ascii_isalpha (c) || c == '_') {
+        const gchar *start = parser->pos;
+        gchar *name;
+
+        while (g_ascii_isalnum (*parser->pos) || *parser->pos == '_')
+            parser->pos++;
+
+        name = g_strndup (start, parser->pos - start);
+
+        if (accept (parser, '(')) {
+            node = parse_call (parser, name, start);
+            g_free (name);
+            return node;
+        }
+
+        for (guint i = 0; parser->names[i] != NULL; i++) {
+            if (g_strcmp0 (parser->names[i], name) == 0) {
+                node = new_node (EXPR_VARIABLE);
+                node->index = i;
+                g_free (name);
+                return node;
+            }
+        }
+
+        g_free (name);
+        parser->pos = start;
+        return fail (parser, "Unknown variable");
+    }
+
+    return fail (parser, c == '\0' ? "Unexpected end" : "Unexpected character");
+}
+
+static ExprNode *
+parse_unary (Parser *parser)
+{
+    if (accept (parser, '+'))
+        return parse_unary (parser);
+
+    if (accept (parser, '-')) {
+        ExprNode *arg = parse_unary (parser);
+        ExprNode *node;
+
+        if (arg == NULL)
+            return NULL;
+
+        node = new_node (EXPR_NEGATE);
+        node->args[0] = arg;
+        return node;
+    }
+
+    return parse_primary (parser);
+}
+
+static ExprNode *
+parse_binary (Parser *parser,
+              const gchar *ops,
+              ExprNode *(*parse_operand) (Parser *))
+{
+    ExprNode *left;
+
+    left = parse_operand (parser);
+
+    while (left != NULL && peek (parser) != '\0' && strchr (ops, peek (parser)) != NULL) {
+        ExprNode *node;
+
+        node = new_node (EXPR_BINARY);
+        node->op = *parser->pos++;
+        node->args[0] = left;
+        node->args[1] = parse_operand (parser);
+
+        if (node->args[1] == NULL) {
+            free_node (node);
+            return NULL;
+        }
+
+        left = node;
+    }
+
+    return left;
+}
+
+static ExprNode *
+parse_term (Parser *parser)
+{
+    return parse_binary (parser, "*/", parse_unary);
+}
+
+static ExprNode *
+parse_expr (Parser *parser)
+{
+    return parse_binary (parser, "+-", parse_term);
+}
+
+static guint
+get_depth (ExprNode *node)
+{
+    guint left, right;
+
+    if (node == NULL)
+        return 0;
+
+    left = get_depth (node->args[0]);
+    right = get_depth (node->args[1]);
+    return 1 + MAX (left, right);
+}
+
+UfoExpr *
+ufo_expr_parse (const gchar *expression,
+                const gchar * const *names,
+                GError **error)
+{
+    Parser parser = { expression, expression, names, error };
+    ExprNode *root;
+    UfoExpr *expr;
+
+    root = parse_expr (&parser);
+
+    if (root != NULL && peek (&parser) != '\0') {
+        free_node (root);
+        fail (&parser, "Unexpected character");
+        return NULL;
+    }
+
+    if (root == NULL)
+        return NULL;
+
+    expr = g_new0 (UfoExpr, 1);
+    expr->root = root;
+    expr->n_variables = g_strv_length ((gchar **) names);
+    expr->depth = get_depth (root);
+    return expr;
+}
+
+void
+ufo_expr_free (UfoExpr *expr)
+{
+    free_node (expr->root);
+    g_free (expr);
+}
+
+static void
+append_opencl (GString *str,
+               ExprNode *node)
+{
+    switch (node->type) {
+        case EXPR_NUMBER:
+            {
+                gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+                g_ascii_formatd (buffer, sizeof (buffer), "%.9g", node->value);
+                g_string_append (str, buffer);
+
+                /* Keep the literal in single precision */
+                g_string_append (str, strpbrk (buffer, ".e") != NULL ? "f" : ".0f");
+            }
+            break;
+
+        case EXPR_VARIABLE:
+            g_string_append_printf (str, "v%u[i]", node->index);
+            break;
+
+        case EXPR_NEGATE:
+            g_string_append (str, "(-");
+            append_opencl (str, node->args[0]);
+            g_string_append_c (str, ')');
+            break;
+
+        case EXPR_BINARY:
+            g_string_append_c (str, '(');
+            append_opencl (str, node->args[0]);
+            g_string_append_printf (str, " %c ", node->op);
+            append_opencl (str, node->args[1]);
+            g_string_append_c (str, ')');
+            break;
+
+        case EXPR_CALL:
+            g_string_append_printf (str, "%s (", node->function->cl_name);
+
+            for (guint i = 0; i < node->function->n_args; i++) {
+                if (i > 0)
+                    g_string_append (str, ", ");
+
+                append_opencl (str, node->args[i]);
+            }
+
+            g_string_append_c (str, ')');
+            break;
+    }
+}
+
+gchar *
+ufo_expr_get_opencl_source (UfoExpr *expr)
+{
+    GString *str;
+
+    str = g_string_new ("__kernel void expression (");
+
+    for (guint i = 0; i < expr->n_variables; i++)
+        g_string_append_printf (str, "global const float *v%u, ", i);
+
+    g_string_append (str, "global float *out, const ulong n)\n{\n"
+                          "    const size_t i = get_global_id (0);\n\n"
+                          "    if (i < n)\n"
+                          "        out[i] = ");
+    append_opencl (str, expr->root);
+    g_string_append (str, ";\n}\n");
+
+    return g_string_free (str, FALSE);
+}
+
+/*
+ * Evaluate @node for @n elements starting at @offset into @dst. @scratch holds
+ * one block per remaining tree level for intermediate results.
+ */
+static void
+evaluate_block (ExprNode *node,
+                const gfloat **inputs,
+                gsize offset,
+                gsize n,
+                gfloat *restrict dst,
+                gfloat *restrict scratch)
+{
+    const gfloat *right;
+
+    switch (node->type) {
+        case EXPR_NUMBER:
+            for (gsize i = 0; i < n; i++)
+                dst[i] = node->value;
+            return;
+
+        case EXPR_VARIABLE:
+            memcpy (dst, inputs[node->index] + offset, n * sizeof (gfloat));
+            return;
+
+        case EXPR_NEGATE:
+            evaluate_block (node->args[0], inputs, offset, n, dst, scratch);
+
+            for (gsize i = 0; i < n; i++)
+                dst[i] = -dst[i];
+
+            return;
+
+        case EXPR_CALL:
+            evaluate_block (node->args[0], inputs, offset, n, dst, scratch);
+
+            if (node->function->n_args == 1) {
+                for (gsize i = 0; i < n; i++)
+                    dst[i] = node->function->unary (dst[i]);
+
+                return;
+            }
+
+            evaluate_block (node->args[1], inputs, offset, n, scratch, scratch + BLOCK_SIZE);
+
+            for (gsize i = 0; i < n; i++)
+                dst[i] = node->function->binary (dst[i], scratch[i]);
+
+            return;
+
+        case EXPR_BINARY:
+            break;
+    }
+
+    evaluate_block (node->args[0], inputs, offset, n, dst, scratch);
+
+    /* Read variables in place instead of copying them first */
+    if (node->args[1]->type == EXPR_VARIABLE) {
+        right = inputs[node->args[1]->index] + offset;
+    }
+    else {
+        evaluate_block (node->args[1], inputs, offset, n, scratch, scratch + BLOCK_SIZE);
+        right = scratch;
+    }
+
+    switch (node->op) {
+        case '+':
+            for (gsize i = 0; i < n; i++)
+                dst[i] += right[i];
+            break;
+        case '-':
+            for (gsize i = 0; i < n; i++)
+                dst[i] -= right[i];
+            break;
+        case '*':
+            for (gsize i = 0; i < n; i++)
+                dst[i] *= right[i];
+            break;
+        case '/':
+            for (gsize i = 0; i < n; i++)
+                dst[i] /= right[i];
+            break;
+    }
+}
+
+void
+ufo_expr_evaluate (UfoExpr *expr,
+                   const gfloat **inputs,
+                   gfloat *out,
+                   gsize n_pixels)
+{
+    gfloat *scratch;
+
+    /* The first block receives the result, so that @out may alias an input */
+    scratch = g_malloc ((expr->depth + 1) * BLOCK_SIZE * sizeof (gfloat));
+
+    for (gsize offset = 0; offset < n_pixels; offset += BLOCK_SIZE) {
+        gsize n = MIN (BLOCK_SIZE, n_pixels - offset);
+
+        evaluate_block (expr->root, inputs, offset, n, scratch, scratch + BLOCK_SIZE);
+        memcpy (out + offset, scratch, n * sizeof (gfloat));
+    }
+
+    g_free (scratch);
+}
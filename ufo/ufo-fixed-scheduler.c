@@ -33,6 +33,7 @@
 #endif
 
 #include "ufo-buffer.h"
+#include "ufo-buffer-pool.h"
 #include "ufo-fixed-scheduler.h"
 #include "ufo-resources.h"
 #include "ufo-task-node.h"
@@ -46,7 +47,9 @@
  * @Title: UfoFixedScheduler
  *
  * This scheduler has only minimal automatisms. It does not attempt to
- * distribute work among multiple GPUs, which is left to do by the user.
+ * distribute work among multiple GPUs, which is left to do by the user. Each
+ * input is fed by exactly one producer, so frames always arrive in order and
+ * #UfoBaseScheduler:ordered has no effect.
  */
 
 G_DEFINE_TYPE (UfoFixedScheduler, ufo_fixed_scheduler, UFO_TYPE_BASE_SCHEDULER)
@@ -57,6 +60,7 @@ typedef struct {
     UfoTask *from;
     UfoTask *to;
     guint port;
+    guint depth;
     UfoTwoWayQueue *queue;
 } Connection;
 
@@ -104,7 +108,7 @@ ufo_fixed_scheduler_new (void)
 }
 
 static gboolean
-pop_input_data (UfoTwoWayQueue **in_queues, gboolean *finished, UfoBuffer **inputs, guint n_inputs)
+pop_input_data (TaskData *data, UfoTwoWayQueue **in_queues, gboolean *finished, UfoBuffer **inputs, guint n_inputs)
 {
     guint n_finished;
 
@@ -113,7 +117,9 @@ pop_input_data (UfoTwoWayQueue **in_queues, gboolean *finished, UfoBuffer **inpu
     for (guint i = 0; i < n_inputs; i++) {
         if (!finished[i]) {
             UfoBuffer *input;
+            gint64 start;
 
+            start = g_get_monotonic_time ();
             input = ufo_two_way_queue_consumer_pop (in_queues[i]);
 
             if (input == POISON_PILL) {
@@ -122,6 +128,9 @@ pop_input_data (UfoTwoWayQueue **in_queues, gboolean *finished, UfoBuffer **inpu
             }
             else {
                 inputs[i] = input;
+                ufo_task_node_account_input (UFO_TASK_NODE (data->task), i, ufo_buffer_get_size (input),
+                                             (guint64) (g_get_monotonic_time () - start),
+                                             ufo_two_way_queue_get_num_queued (in_queues[i]));
             }
         }
         else {
@@ -133,32 +142,54 @@ pop_input_data (UfoTwoWayQueue **in_queues, gboolean *finished, UfoBuffer **inpu
 }
 
 static void
-release_input_data (UfoTwoWayQueue **in_queues, UfoBuffer **inputs, guint n_inputs)
+release_input_data (UfoTwoWayQueue **in_queues, gboolean *finished, UfoBuffer **inputs, guint n_inputs)
 {
-    for (guint i = 0; i < n_inputs; i++)
-        ufo_two_way_queue_consumer_push (in_queues[i], inputs[i]);
+    /* Finished inputs keep their last buffer which was already released */
+    for (guint i = 0; i < n_inputs; i++) {
+        if (!finished[i])
+            ufo_two_way_queue_consumer_push (in_queues[i], inputs[i]);
+    }
 }
 
 static UfoBuffer *
-pop_output_data (UfoTwoWayQueue *queue, UfoRequisition *requisition, cl_context context)
+pop_output_data (TaskData *data, Connection *connection, UfoRequisition *requisition)
 {
+    UfoTwoWayQueue *queue;
+    UfoBufferPool *pool;
     UfoBuffer *buffer;
+    cl_context context;
+    gint64 start;
+
+    queue = connection->queue;
+    pool = ufo_buffer_pool_get_default ();
+    context = data->context;
 
-    if (ufo_two_way_queue_get_capacity (queue) < 2) {
-        buffer = ufo_buffer_new (requisition, context);
+    if (ufo_two_way_queue_get_capacity (queue) < connection->depth) {
+        buffer = ufo_buffer_pool_acquire (pool, requisition, context, UFO_BUFFER_LOCATION_INVALID);
         ufo_two_way_queue_insert (queue, buffer);
     }
 
+    start = g_get_monotonic_time ();
     buffer = ufo_two_way_queue_producer_pop (queue);
-
-    if (ufo_buffer_cmp_dimensions (buffer, requisition))
-        ufo_buffer_resize (buffer, requisition);
+    ufo_task_node_add_to_counter (UFO_TASK_NODE (data->task), UFO_TASK_NODE_COUNTER_RELEASE_TIME,
+                                  (guint64) (g_get_monotonic_time () - start));
+
+    if (ufo_buffer_cmp_dimensions (buffer, requisition)) {
+        UfoBuffer *replacement;
+        UfoBufferLocation location;
+
+        location = ufo_buffer_get_location (buffer);
+        ufo_buffer_pool_release (pool, buffer);
+        replacement = ufo_buffer_pool_acquire (pool, requisition, context, location);
+        ufo_two_way_queue_replace (queue, buffer, replacement);
+        buffer = replacement;
+    }
 
     return buffer;
 }
 
 static GList *
-get_output_queue_list (TaskData *data)
+get_output_connections (TaskData *data)
 {
     GList *result = NULL;
     GList *it;
@@ -167,7 +198,7 @@ get_output_queue_list (TaskData *data)
         Connection *connection = (Connection *) it->data;
 
         if (connection->from == data->task)
-            result = g_list_append (result, connection->queue);
+            result = g_list_append (result, connection);
     }
 
     return result;
@@ -193,13 +224,13 @@ get_input_queues (TaskData *data, guint *n_inputs)
 }
 
 static void
-finish_successors (GList *out_queues)
+finish_successors (GList *out_connections)
 {
     GList *it;
 
-    g_list_for (out_queues, it) {
-        UfoTwoWayQueue *out_queue = (UfoTwoWayQueue *) it->data;
-        ufo_two_way_queue_producer_push (out_queue, POISON_PILL);
+    g_list_for (out_connections, it) {
+        Connection *connection = (Connection *) it->data;
+        ufo_two_way_queue_producer_push (connection->queue, POISON_PILL);
     }
 }
 
@@ -208,16 +239,16 @@ generate_loop (TaskData *data, GError **error)
 {
     UfoRequisition requisition;
     UfoBuffer *output;
-    GList *out_queues;
+    GList *out_connections;
     GList *it;
     GError *tmp_error = NULL;
     gboolean active = TRUE;
 
-    out_queues = get_output_queue_list (data);
+    out_connections = get_output_connections (data);
 
     while (active) {
-        g_list_for (out_queues, it) {
-            UfoTwoWayQueue *out_queue = (UfoTwoWayQueue *) it->data;
+        g_list_for (out_connections, it) {
+            Connection *connection = (Connection *) it->data;
 
             ufo_task_get_requisition (data->task, NULL, &requisition, &tmp_error);
 
@@ -226,21 +257,21 @@ generate_loop (TaskData *data, GError **error)
                 break;
             }
 
-            output = pop_output_data (out_queue, &requisition, data->context);
+            output = pop_output_data (data, connection, &requisition);
             active = ufo_task_generate (data->task, output, &requisition);
 
             if (!active)
                 break;
 
-            ufo_two_way_queue_producer_push (out_queue, output);
+            ufo_two_way_queue_producer_push (connection->queue, output);
         }
     }
 
     if (tmp_error)
         g_propagate_error (error, tmp_error);
 
-    finish_successors (out_queues);
-    g_list_free (out_queues);
+    finish_successors (out_connections);
+    g_list_free (out_connections);
 }
 
 static void
@@ -251,7 +282,7 @@ process_loop (TaskData *data, GError **error)
     UfoBuffer *output;
     UfoTwoWayQueue **in_queues;
     gboolean *finished;
-    GList *out_queues;
+    GList *out_connections;
     GList *it;
     guint n_inputs;
     GError *tmp_error = NULL;
@@ -259,13 +290,13 @@ process_loop (TaskData *data, GError **error)
     gboolean is_sink;
 
     in_queues = get_input_queues (data, &n_inputs);
-    out_queues = get_output_queue_list (data);
+    out_connections = get_output_connections (data);
     inputs = g_new0 (UfoBuffer *, n_inputs);
     finished = g_new0 (gboolean, n_inputs);
-    is_sink = g_list_length (out_queues) == 0;
+    is_sink = g_list_length (out_connections) == 0;
 
     while (active) {
-        active = pop_input_data (in_queues, finished, inputs, n_inputs);
+        active = pop_input_data (data, in_queues, finished, inputs, n_inputs);
 
         if (!active)
             break;
@@ -279,10 +310,10 @@ process_loop (TaskData *data, GError **error)
             active = ufo_task_process (data->task, inputs, NULL, &requisition);
         }
         else {
-            g_list_for (out_queues, it) {
-                UfoTwoWayQueue *out_queue = (UfoTwoWayQueue *) it->data;
+            g_list_for (out_connections, it) {
+                Connection *connection = (Connection *) it->data;
 
-                output = pop_output_data (out_queue, &requisition, data->context);
+                output = pop_output_data (data, connection, &requisition);
 
                 for (guint i = 0; i < n_inputs; i++)
                     ufo_buffer_copy_metadata (inputs[i], output);
@@ -293,27 +324,27 @@ process_loop (TaskData *data, GError **error)
                 if (!active)
                     break;
 
-                ufo_two_way_queue_producer_push (out_queue, output);
+                ufo_two_way_queue_producer_push (connection->queue, output);
             }
         }
 
-        release_input_data (in_queues, inputs, n_inputs);
+        release_input_data (in_queues, finished, inputs, n_inputs);
     }
 
     if (tmp_error) {
         /* flush outstanding input data */
-        while (pop_input_data (in_queues, finished, inputs, n_inputs))
-            release_input_data (in_queues, inputs, n_inputs);
+        while (pop_input_data (data, in_queues, finished, inputs, n_inputs))
+            release_input_data (in_queues, finished, inputs, n_inputs);
 
         g_propagate_error (error, tmp_error);
     }
 
-    finish_successors (out_queues);
+    finish_successors (out_connections);
 
     g_free (in_queues);
     g_free (inputs);
     g_free (finished);
-    g_list_free (out_queues);
+    g_list_free (out_connections);
 }
 
 static void
@@ -321,47 +352,47 @@ reduce_loop (TaskData *data, GError **error)
 {
     UfoRequisition requisition;
     UfoTwoWayQueue **in_queues;
-    UfoTwoWayQueue **output_queues;
+    Connection **output_connections;
     UfoBuffer **inputs;
     UfoBuffer **outputs;
     gboolean *finished;
     GList *it;
-    GList *out_queues;
+    GList *out_connections;
     guint n_inputs;
     GError *tmp_error = NULL;
     guint n_outputs;
     gboolean active = TRUE;
 
     in_queues = get_input_queues (data, &n_inputs);
-    out_queues = get_output_queue_list (data);
+    out_connections = get_output_connections (data);
     inputs = g_new0 (UfoBuffer *, n_inputs);
     finished = g_new0 (gboolean, n_inputs);
 
-    n_outputs = g_list_length (out_queues);
+    n_outputs = g_list_length (out_connections);
     outputs = g_new0 (UfoBuffer *, n_outputs);
-    output_queues = g_new0 (UfoTwoWayQueue *, n_outputs);
-    it = g_list_first (out_queues);
+    output_connections = g_new0 (Connection *, n_outputs);
+    it = g_list_first (out_connections);
 
     for (guint i = 0; it != NULL; it = g_list_next (it)) {
-        output_queues[i] = (UfoTwoWayQueue *) it->data;
+        output_connections[i] = (Connection *) it->data;
     }
 
     /* Read first input item */
-    if (!pop_input_data (in_queues, finished, inputs, n_inputs))
+    if (!pop_input_data (data, in_queues, finished, inputs, n_inputs))
         return;
 
     ufo_task_get_requisition (data->task, inputs, &requisition, &tmp_error);
 
     if (tmp_error) {
         /* flush outstanding input data */
-        while (pop_input_data (in_queues, finished, inputs, n_inputs))
-            release_input_data (in_queues, inputs, n_inputs);
+        while (pop_input_data (data, in_queues, finished, inputs, n_inputs))
+            release_input_data (in_queues, finished, inputs, n_inputs);
 
         g_propagate_error (error, tmp_error);
     } else {
         /* Get the scratchpad output buffers from all successors */
         for (guint i = 0; i < n_outputs; i++) {
-            outputs[i] = pop_output_data (output_queues[i], &requisition, data->context);
+            outputs[i] = pop_output_data (data, output_connections[i], &requisition);
         }
 
         do {
@@ -374,8 +405,8 @@ reduce_loop (TaskData *data, GError **error)
                         ufo_buffer_copy_metadata (inputs[j], outputs[i]);
 
                     go_on = ufo_task_process (data->task, inputs, outputs[i], &requisition);
-                    release_input_data (in_queues, inputs, n_inputs);
-                    active = pop_input_data (in_queues, finished, inputs, n_inputs);
+                    release_input_data (in_queues, finished, inputs, n_inputs);
+                    active = pop_input_data (data, in_queues, finished, inputs, n_inputs);
                     go_on = go_on && active;
                 }
             } while (go_on);
@@ -386,23 +417,23 @@ reduce_loop (TaskData *data, GError **error)
                     go_on = ufo_task_generate (data->task, outputs[i], &requisition);
 
                     if (go_on) {
-                        ufo_two_way_queue_producer_push (output_queues[i], outputs[i]);
-                        outputs[i] = ufo_two_way_queue_producer_pop (output_queues[i]);
+                        ufo_two_way_queue_producer_push (output_connections[i]->queue, outputs[i]);
+                        outputs[i] = ufo_two_way_queue_producer_pop (output_connections[i]->queue);
                     }
                 }
             } while (go_on);
         } while (active);
     }
 
-    finish_successors (out_queues);
+    finish_successors (out_connections);
 
     g_free (inputs);
     g_free (in_queues);
 
     g_free (outputs);
-    g_free (output_queues);
+    g_free (output_connections);
     g_free (finished);
-    g_list_free (out_queues);
+    g_list_free (out_connections);
 }
 
 static gpointer
@@ -472,6 +503,7 @@ setup_tasks (UfoGraph *graph,
     GList *gpu_nodes;
     GList *nodes;
     GList *it;
+    guint default_depth;
 
     data = g_new0 (ProcessData, 1);
 
@@ -481,6 +513,11 @@ setup_tasks (UfoGraph *graph,
 
     nodes = ufo_graph_get_nodes (graph);
     gpu_nodes = ufo_resources_get_gpu_nodes (resources);
+    g_object_get (scheduler, "queue-depth", &default_depth, NULL);
+
+    /* Double buffering unless told otherwise */
+    if (default_depth == 0)
+        default_depth = 2;
 
     g_list_for (nodes, it) {
         UfoNode *source_node;
@@ -506,8 +543,12 @@ setup_tasks (UfoGraph *graph,
             connection->from = source_task;
             connection->to = dest_task;
             connection->port = (guint) GPOINTER_TO_INT (ufo_graph_get_edge_label (graph, source_node, dest_node));
+            connection->depth = ufo_task_node_get_queue_depth (UFO_TASK_NODE (dest_task), connection->port);
             connection->queue = ufo_two_way_queue_new (NULL);
 
+            if (connection->depth == 0)
+                connection->depth = default_depth;
+
             data->queues = g_list_append (data->queues, connection->queue);
             data->connections = g_list_append (data->connections, connection);
             data->tasks = append_if_not_existing (data->tasks, dest_task);
@@ -535,13 +576,11 @@ setup_tasks (UfoGraph *graph,
                 ufo_task_node_set_proc_node (UFO_TASK_NODE (task), g_list_nth_data (gpu_nodes, 0));
             }
         }
-
-        ufo_task_setup (task, resources, error);
-
-        if (*error != NULL)
-            break;
     }
 
+    if (*error == NULL)
+        ufo_base_scheduler_setup_tasks (scheduler, data->tasks, resources, error);
+
     g_list_free (nodes);
 
     return data;
@@ -557,9 +596,15 @@ ufo_fixed_scheduler_run (UfoBaseScheduler *scheduler,
     GList *threads;
     GList *it;
     GError *tmp_error = NULL;
+    gboolean ordered;
 
     g_return_if_fail (UFO_IS_FIXED_SCHEDULER (scheduler));
 
+    g_object_get (scheduler, "ordered", &ordered, NULL);
+
+    if (ordered)
+        g_debug ("WARN Graph is not expanded, frames arrive in order without `ordered'");
+
     resources = ufo_base_scheduler_get_resources (scheduler, error);
 
     if (resources == NULL)
@@ -604,6 +649,15 @@ ufo_fixed_scheduler_run (UfoBaseScheduler *scheduler,
     join_threads (threads, error);
 #endif
 
+    g_list_for (pdata->connections, it) {
+        Connection *connection = (Connection *) it->data;
+
+        g_debug ("INFO Queue %s-%p -> %s-%p: depth=%u high-water=%u",
+                 ufo_task_node_get_plugin_name (UFO_TASK_NODE (connection->from)), (gpointer) connection->from,
+                 ufo_task_node_get_plugin_name (UFO_TASK_NODE (connection->to)), (gpointer) connection->to,
+                 connection->depth, ufo_two_way_queue_get_high_water_mark (connection->queue));
+    }
+
     g_list_for (pdata->queues, it) {
         UfoTwoWayQueue *queue;
         GList *buffers;
@@ -613,7 +667,7 @@ ufo_fixed_scheduler_run (UfoBaseScheduler *scheduler,
         buffers = ufo_two_way_queue_get_inserted (queue);
 
         g_list_for (buffers, jt)
-            g_object_unref (jt->data);
+            ufo_buffer_pool_release (ufo_buffer_pool_get_default (), UFO_BUFFER (jt->data));
 
         ufo_two_way_queue_free (queue);
     }
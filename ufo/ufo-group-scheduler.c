@@ -460,25 +460,21 @@ ufo_group_scheduler_run (UfoBaseScheduler *scheduler,
     tasks = NULL;
 
     g_list_for (groups, it) {
-        GThread *thread;
-        GList *jt;
         TaskGroup *group;
 
         group = ufo_node_get_label (UFO_NODE (it->data));
+        tasks = g_list_concat (tasks, g_list_copy (group->tasks));
+    }
 
-        /* Setup each task in a group */
-        g_list_for (group->tasks, jt) {
-            UfoTaskNode *task = UFO_TASK_NODE (jt->data);
-
-            ufo_task_setup (UFO_TASK (task), resources, error);
-
-            tasks = g_list_append (tasks, task);
+    /* Setup the tasks of all groups before running any of them */
+    if (!ufo_base_scheduler_setup_tasks (scheduler, tasks, resources, error))
+        goto cleanup_run;
 
-            if (error && *error)
-                goto cleanup_run;
-        }
+    g_list_for (groups, it) {
+        GThread *thread;
+        TaskGroup *group;
 
-        /* Run this group */
+        group = ufo_node_get_label (UFO_NODE (it->data));
         thread = g_thread_new (NULL, (GThreadFunc) run_group, group);
         threads = g_list_append (threads, thread);
     }
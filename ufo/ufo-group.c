@@ -25,9 +25,11 @@
 #include <CL/cl.h>
 #endif
 
+#include "ufo-buffer-pool.h"
 #include "ufo-group.h"
 #include "ufo-task-node.h"
 #include "ufo-two-way-queue.h"
+#include "ufo-priv.h"
 
 G_DEFINE_TYPE (UfoGroup, ufo_group, G_TYPE_OBJECT)
 
@@ -38,12 +40,18 @@ struct _UfoGroupPrivate {
     guint            n_targets;
     UfoTwoWayQueue  **queues;
     gint            *n_expected;
+    guint           *depths;
+    gboolean        *writable;
+    guint            n_readers;
+    guint            home;
     gint             n_received;
     gboolean        *ready;
+    UfoGroupNotify  *notify;
+    gpointer        *notify_data;
     UfoSendPattern   pattern;
     guint            current;
     cl_context       context;
-    GList           *buffers;
+    UfoBufferPool   *pool;
 };
 
 enum {
@@ -52,6 +60,21 @@ enum {
 };
 
 
+static void
+update_readers (UfoGroupPrivate *priv)
+{
+    priv->n_readers = 0;
+    priv->home = 0;
+
+    /* Shared buffers are owned by the queue of the first reading target */
+    for (guint i = priv->n_targets; i > 0; i--) {
+        if (!priv->writable[i - 1]) {
+            priv->n_readers++;
+            priv->home = i - 1;
+        }
+    }
+}
+
 /**
  * ufo_group_new:
  * @targets: (element-type UfoNode): A list of #UfoNode targets
@@ -77,14 +100,28 @@ ufo_group_new (GList *targets,
     priv->n_targets = g_list_length (targets);
     priv->queues = g_new0 (UfoTwoWayQueue *, priv->n_targets);
     priv->n_expected = g_new0 (gint, priv->n_targets);
+    priv->depths = g_new0 (guint, priv->n_targets);
+    priv->writable = g_new0 (gboolean, priv->n_targets);
+    priv->notify = g_new0 (UfoGroupNotify, priv->n_targets);
+    priv->notify_data = g_new0 (gpointer, priv->n_targets);
     priv->pattern = pattern;
     priv->current = 0;
     priv->context = context;
     priv->n_received = 0;
 
-    for (guint i = 0; i < priv->n_targets; i++)
+    for (guint i = 0; i < priv->n_targets; i++) {
+        gpointer target;
+
+        target = g_list_nth_data (targets, i);
         priv->queues[i] = ufo_two_way_queue_new (NULL);
+        priv->depths[i] = priv->n_targets + 1;
+
+        /* Only targets that promise not to modify their inputs share them */
+        priv->writable[i] = !UFO_IS_TASK (target) ||
+                            !(ufo_task_get_mode (UFO_TASK (target)) & UFO_TASK_MODE_READ_ONLY_INPUTS);
+    }
 
+    update_readers (priv);
     return group;
 }
 
@@ -95,6 +132,17 @@ ufo_group_get_num_targets (UfoGroup *group)
     return group->priv->n_targets;
 }
 
+static void
+push_to_target (UfoGroupPrivate *priv,
+                guint pos,
+                UfoBuffer *buffer)
+{
+    ufo_two_way_queue_producer_push (priv->queues[pos], buffer);
+
+    if (priv->notify[pos] != NULL)
+        priv->notify[pos] (priv->notify_data[pos]);
+}
+
 static UfoBuffer *
 pop_or_alloc_buffer (UfoGroupPrivate *priv,
                      guint pos,
@@ -102,16 +150,25 @@ pop_or_alloc_buffer (UfoGroupPrivate *priv,
 {
     UfoBuffer *buffer;
 
-    if (ufo_two_way_queue_get_capacity (priv->queues[pos]) < (priv->n_targets + 1)) {
-        buffer = ufo_buffer_new (requisition, priv->context);
-        priv->buffers = g_list_append (priv->buffers, buffer);
+    if (ufo_two_way_queue_get_capacity (priv->queues[pos]) < priv->depths[pos]) {
+        buffer = ufo_buffer_pool_acquire (priv->pool, requisition, priv->context,
+                                          UFO_BUFFER_LOCATION_INVALID);
         ufo_two_way_queue_insert (priv->queues[pos], buffer);
     }
 
     buffer = ufo_two_way_queue_producer_pop (priv->queues[pos]);
 
-    if (ufo_buffer_cmp_dimensions (buffer, requisition))
-        ufo_buffer_resize (buffer, requisition);
+    if (ufo_buffer_cmp_dimensions (buffer, requisition)) {
+        UfoBuffer *replacement;
+        UfoBufferLocation location;
+
+        /* Hand the old buffer back so a later size change can re-use it */
+        location = ufo_buffer_get_location (buffer);
+        ufo_buffer_pool_release (priv->pool, buffer);
+        replacement = ufo_buffer_pool_acquire (priv->pool, requisition, priv->context, location);
+        ufo_two_way_queue_replace (priv->queues[pos], buffer, replacement);
+        buffer = replacement;
+    }
 
     return buffer;
 }
@@ -150,29 +207,53 @@ ufo_group_push_output_buffer (UfoGroup *group,
 
     /* Copy or not depending on the send pattern */
     if (priv->pattern == UFO_SEND_SCATTER) {
-        ufo_two_way_queue_producer_push (priv->queues[priv->current], buffer);
+        push_to_target (priv, priv->current, buffer);
         priv->current = (priv->current + 1) % priv->n_targets;
     }
     else if (priv->pattern == UFO_SEND_BROADCAST) {
         UfoRequisition requisition;
+        UfoBuffer *shared;
 
         ufo_buffer_get_requisition (buffer, &requisition);
+        shared = buffer;
+
+        /*
+         * Only targets that write to their inputs get a private copy, all
+         * others read the same buffer which returns to the home queue once
+         * the last reader released it.
+         */
+        if (priv->writable[0] && priv->n_readers > 0) {
+            shared = pop_or_alloc_buffer (priv, priv->home, &requisition);
+            ufo_buffer_copy (buffer, shared);
+        }
 
         for (guint pos = 1; pos < priv->n_targets; pos++) {
             UfoBuffer *copy;
 
+            if (!priv->writable[pos])
+                continue;
+
             copy = pop_or_alloc_buffer (priv, pos, &requisition);
             ufo_buffer_copy (buffer, copy);
-            ufo_two_way_queue_producer_push (priv->queues[pos], copy);
+            push_to_target (priv, pos, copy);
         }
 
-        ufo_two_way_queue_producer_push (priv->queues[0], buffer);
+        if (priv->n_readers > 1)
+            ufo_buffer_share (shared, priv->n_readers);
+
+        for (guint pos = 0; pos < priv->n_targets; pos++) {
+            if (!priv->writable[pos])
+                push_to_target (priv, pos, shared);
+        }
+
+        if (priv->writable[0])
+            push_to_target (priv, 0, buffer);
     }
     else if (priv->pattern == UFO_SEND_SEQUENTIAL) {
-        ufo_two_way_queue_producer_push (priv->queues[priv->current], buffer);
+        push_to_target (priv, priv->current, buffer);
 
         if (priv->n_expected[priv->current] == priv->n_received) {
-            ufo_two_way_queue_producer_push (priv->queues[priv->current], UFO_END_OF_STREAM);
+            push_to_target (priv, priv->current, UFO_END_OF_STREAM);
 
             /* FIXME: setting priv->current to 0 again wouldn't be right */
             priv->current = (priv->current + 1) % priv->n_targets;
@@ -195,6 +276,155 @@ ufo_group_set_num_expected (UfoGroup *group,
     priv->n_expected[pos] = n_expected;
 }
 
+/**
+ * ufo_group_set_queue_depth:
+ * @group: A #UfoGroup
+ * @target: The #UfoTask that is a target in @group
+ * @depth: Maximum number of buffers in flight to @target
+ *
+ * Set how many output buffers may be in flight to @target before the producer
+ * has to wait for @target to release one. The default is the number of
+ * targets plus one. Changing the depth is only allowed before data is sent.
+ */
+void
+ufo_group_set_queue_depth (UfoGroup *group,
+                           UfoTask *target,
+                           guint depth)
+{
+    UfoGroupPrivate *priv;
+    gint pos;
+
+    g_return_if_fail (UFO_IS_GROUP (group));
+    g_return_if_fail (depth > 0 && depth <= UFO_TWO_WAY_QUEUE_MAX_CAPACITY);
+    priv = group->priv;
+    pos = g_list_index (priv->targets, target);
+
+    if (pos >= 0)
+        priv->depths[pos] = depth;
+}
+
+guint
+ufo_group_get_queue_depth (UfoGroup *group,
+                           UfoTask *target)
+{
+    UfoGroupPrivate *priv;
+    gint pos;
+
+    g_return_val_if_fail (UFO_IS_GROUP (group), 0);
+    priv = group->priv;
+    pos = g_list_index (priv->targets, target);
+    return pos >= 0 ? priv->depths[pos] : 0;
+}
+
+/**
+ * ufo_group_set_writable:
+ * @group: A #UfoGroup
+ * @target: The #UfoTask that is a target in @group
+ * @writable: %TRUE if @target modifies its input buffers
+ *
+ * With the broadcast pattern, all targets that do not modify their inputs
+ * share the same read-only buffer instead of receiving a copy each. Targets
+ * marked as writable receive a private copy. By default, only targets with the
+ * %UFO_TASK_MODE_READ_ONLY_INPUTS mode are read-only.
+ */
+void
+ufo_group_set_writable (UfoGroup *group,
+                        UfoTask *target,
+                        gboolean writable)
+{
+    UfoGroupPrivate *priv;
+    gint pos;
+
+    g_return_if_fail (UFO_IS_GROUP (group));
+    priv = group->priv;
+    pos = g_list_index (priv->targets, target);
+
+    if (pos < 0)
+        return;
+
+    priv->writable[pos] = writable;
+    update_readers (priv);
+}
+
+/*
+ * ufo_group_set_notify:
+ * @group: A #UfoGroup
+ * @target: The #UfoTask that is a target in @group
+ * @notify: Function called after a buffer was sent to @target or %NULL
+ * @user_data: Data passed to @notify
+ *
+ * Let @target wait for data from several groups at once. @notify is called
+ * from the producer thread after each buffer or end-of-stream marker was made
+ * available to @target.
+ */
+void
+ufo_group_set_notify (UfoGroup *group,
+                      UfoTask *target,
+                      UfoGroupNotify notify,
+                      gpointer user_data)
+{
+    UfoGroupPrivate *priv;
+    gint pos;
+
+    g_return_if_fail (UFO_IS_GROUP (group));
+    priv = group->priv;
+    pos = g_list_index (priv->targets, target);
+
+    if (pos < 0)
+        return;
+
+    priv->notify[pos] = notify;
+    priv->notify_data[pos] = user_data;
+}
+
+/**
+ * ufo_group_get_high_water_mark:
+ * @group: A #UfoGroup
+ * @target: The #UfoTask that is a target in @group
+ *
+ * Get the largest number of buffers that were waiting to be processed by
+ * @target at the same time. A value close to the queue depth hints that
+ * @target is slower than its producer.
+ *
+ * Returns: Maximum number of queued buffers.
+ */
+guint
+ufo_group_get_high_water_mark (UfoGroup *group,
+                               UfoTask *target)
+{
+    UfoGroupPrivate *priv;
+    gint pos;
+
+    g_return_val_if_fail (UFO_IS_GROUP (group), 0);
+    priv = group->priv;
+    pos = g_list_index (priv->targets, target);
+    return pos >= 0 ? ufo_two_way_queue_get_high_water_mark (priv->queues[pos]) : 0;
+}
+
+/**
+ * ufo_group_get_num_queued:
+ * @group: A #UfoGroup
+ * @target: The #UfoTask that is a target in @group
+ *
+ * Get the number of buffers that are currently waiting to be processed by
+ * @target. The value is a snapshot and may be outdated immediately if the
+ * producer or @target are running.
+ *
+ * Returns: Number of queued buffers.
+ */
+guint
+ufo_group_get_num_queued (UfoGroup *group,
+                          UfoTask *target)
+{
+    UfoGroupPrivate *priv;
+    gint pos;
+
+    g_return_val_if_fail (UFO_IS_GROUP (group), 0);
+    priv = group->priv;
+    pos = g_list_index (priv->targets, target);
+    return pos >= 0 ? ufo_two_way_queue_get_num_queued (priv->queues[pos]) : 0;
+}
+
 /**
  * ufo_group_pop_input_buffer:
  * @group: A #UfoGroup
@@ -218,6 +448,30 @@ ufo_group_pop_input_buffer (UfoGroup *group,
     return input;
 }
 
+/**
+ * ufo_group_try_pop_input_buffer:
+ * @group: A #UfoGroup
+ * @target: The #UfoTask that is a target in @group
+ *
+ * Like ufo_group_pop_input_buffer() but returns immediately if no buffer is
+ * available for @target.
+ *
+ * Return value: (transfer full): A buffer that must be released with
+ * ufo_group_push_input_buffer() or %NULL.
+ */
+UfoBuffer *
+ufo_group_try_pop_input_buffer (UfoGroup *group,
+                                UfoTask *target)
+{
+    UfoGroupPrivate *priv;
+    gint pos;
+
+    priv = group->priv;
+    pos = g_list_index (priv->targets, target);
+
+    return pos >= 0 ? ufo_two_way_queue_consumer_try_pop (priv->queues[pos]) : NULL;
+}
+
 void
 ufo_group_push_input_buffer (UfoGroup *group,
                              UfoTask *target,
@@ -229,8 +483,17 @@ ufo_group_push_input_buffer (UfoGroup *group,
     priv = group->priv;
     pos = g_list_index (priv->targets, target);
 
-    if (pos >= 0)
-        ufo_two_way_queue_consumer_push (priv->queues[pos], input);
+    if (pos < 0)
+        return;
+
+    if (input != UFO_END_OF_STREAM && ufo_buffer_is_shared (input)) {
+        if (ufo_buffer_release_shared (input))
+            ufo_two_way_queue_consumer_push (priv->queues[priv->home], input);
+
+        return;
+    }
+
+    ufo_two_way_queue_consumer_push (priv->queues[pos], input);
 }
 
 void
@@ -241,7 +504,7 @@ ufo_group_finish (UfoGroup *group)
     priv = group->priv;
 
     for (guint i = 0; i < priv->n_targets; i++)
-        ufo_two_way_queue_producer_push (priv->queues[i], UFO_END_OF_STREAM);
+        push_to_target (priv, i, UFO_END_OF_STREAM);
 }
 
 static void
@@ -250,7 +513,22 @@ ufo_group_dispose(GObject *object)
     UfoGroupPrivate *priv;
 
     priv = UFO_GROUP_GET_PRIVATE (object);
-    g_list_foreach (priv->buffers, (GFunc) g_object_unref, NULL);
+
+    /* The queues own the buffers, give them back before the queues go */
+    if (priv->queues != NULL) {
+        for (guint i = 0; i < priv->n_targets; i++) {
+            GList *it;
+
+            g_list_for (ufo_two_way_queue_get_inserted (priv->queues[i]), it)
+                ufo_buffer_pool_release (priv->pool, UFO_BUFFER (it->data));
+
+            ufo_two_way_queue_free (priv->queues[i]);
+        }
+
+        g_free (priv->queues);
+        priv->queues = NULL;
+    }
+
     G_OBJECT_CLASS (ufo_group_parent_class)->dispose (object);
 }
 
@@ -262,19 +540,14 @@ ufo_group_finalize (GObject *object)
     priv = UFO_GROUP_GET_PRIVATE (object);
 
     g_free (priv->n_expected);
+    g_free (priv->depths);
+    g_free (priv->writable);
+    g_free (priv->notify);
+    g_free (priv->notify_data);
 
     g_list_free (priv->targets);
     priv->targets = NULL;
 
-    g_list_free (priv->buffers);
-    priv->buffers = NULL;
-
-    for (guint i = 0; i < priv->n_targets; i++)
-        ufo_two_way_queue_free (priv->queues[i]);
-
-    g_free (priv->queues);
-    priv->queues = NULL;
-
     G_OBJECT_CLASS (ufo_group_parent_class)->finalize (object);
 }
 
@@ -294,5 +567,5 @@ ufo_group_init (UfoGroup *self)
 {
     UfoGroupPrivate *priv;
     self->priv = priv = UFO_GROUP_GET_PRIVATE (self);
-    priv->buffers = NULL;
+    priv->pool = ufo_buffer_pool_get_default ();
 }
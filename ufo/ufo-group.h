@@ -87,12 +87,26 @@ guint       ufo_group_get_num_targets       (UfoGroup       *group);
 void        ufo_group_set_num_expected      (UfoGroup       *group,
                                              UfoTask        *target,
                                              gint            n_expected);
+void        ufo_group_set_queue_depth       (UfoGroup       *group,
+                                             UfoTask        *target,
+                                             guint           depth);
+guint       ufo_group_get_queue_depth       (UfoGroup       *group,
+                                             UfoTask        *target);
+void        ufo_group_set_writable          (UfoGroup       *group,
+                                             UfoTask        *target,
+                                             gboolean        writable);
+guint       ufo_group_get_high_water_mark   (UfoGroup       *group,
+                                             UfoTask        *target);
+guint       ufo_group_get_num_queued        (UfoGroup       *group,
+                                             UfoTask        *target);
 UfoBuffer * ufo_group_pop_output_buffer     (UfoGroup       *group,
                                              UfoRequisition *requisition);
 void        ufo_group_push_output_buffer    (UfoGroup       *group,
                                              UfoBuffer      *buffer);
 UfoBuffer * ufo_group_pop_input_buffer      (UfoGroup       *group,
                                              UfoTask        *target);
+UfoBuffer * ufo_group_try_pop_input_buffer  (UfoGroup       *group,
+                                             UfoTask        *target);
 void        ufo_group_push_input_buffer     (UfoGroup       *group,
                                              UfoTask        *target,
                                              UfoBuffer      *input);
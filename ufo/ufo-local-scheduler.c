@@ -257,7 +257,8 @@ join_threads (GList *threads)
 }
 
 static GHashTable *
-setup_tasks (UfoGraph *graph,
+setup_tasks (UfoBaseScheduler *scheduler,
+             UfoGraph *graph,
              UfoResources *resources,
              ProcessorPool *pp,
              GError **error)
@@ -334,12 +335,15 @@ setup_tasks (UfoGraph *graph,
             }
         }
 
-        ufo_task_setup (task, resources, error);
-
         g_list_free (successors);
         g_list_free (predecessors);
     }
 
+    if (!ufo_base_scheduler_setup_tasks (scheduler, nodes, resources, error)) {
+        g_hash_table_destroy (local);
+        local = NULL;
+    }
+
     g_list_free (nodes);
     return local;
 }
@@ -368,7 +372,13 @@ ufo_local_scheduler_run (UfoBaseScheduler *scheduler,
     pp = ufo_pp_new (gpu_nodes);
     g_list_free (gpu_nodes);
 
-    task_data = setup_tasks (UFO_GRAPH (task_graph), resources, pp, error);
+    task_data = setup_tasks (scheduler, UFO_GRAPH (task_graph), resources, pp, error);
+
+    if (task_data == NULL) {
+        ufo_pp_destroy (pp);
+        return;
+    }
+
     local_data = g_hash_table_get_values (task_data);
 
     threads = NULL;
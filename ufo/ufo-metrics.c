@@ -0,0 +1,426 @@
+/*
+ * Copyright (C) 2011-2013 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "ufo-task-node.h"
+#include "ufo-task-iface.h"
+#include "ufo-priv.h"
+
+/*
+ * Live metrics of a running graph. A background thread periodically reads the
+ * counters of all watched task nodes (see ufo_task_node_get_counter()) and
+ * replaces the metrics file with a snapshot in the Prometheus text exposition
+ * format, so that it can be picked up by the textfile collector of the node
+ * exporter or simply be looked at with cat. The file is replaced atomically,
+ * readers never see a partial snapshot.
+ *
+ * Nodes are labelled with their plugin name and their position in the list of
+ * watched nodes, which distinguishes copies made by expanding the graph.
+ * Kernels sampled by the profilers of the nodes are exported as summaries
+ * with the median and the 99th percentile of their run time, buffer transfers
+ * per direction and round trips as counters.
+ */
+
+struct _UfoMetrics {
+    gchar       *filename;
+    gint64       interval;
+    gint64       start;
+    GList       *nodes;
+    GThread     *thread;
+    GMutex       lock;
+    GCond        cond;
+    gboolean     stop;
+    gboolean     warned;
+};
+
+typedef struct {
+    const gchar         *name;
+    const gchar         *help;
+    UfoTaskNodeCounter   counter;
+    gboolean             is_time;
+} NodeMetric;
+
+static const NodeMetric node_metrics[] = {
+    { "ufo_task_frames_in_total", "Number of process calls", UFO_TASK_NODE_COUNTER_FRAMES_IN, FALSE },
+    { "ufo_task_frames_out_total", "Number of produced buffers", UFO_TASK_NODE_COUNTER_FRAMES_OUT, FALSE },
+    { "ufo_task_bytes_in_total", "Size of all received buffers", UFO_TASK_NODE_COUNTER_BYTES_IN, FALSE },
+    { "ufo_task_bytes_out_total", "Size of all produced buffers", UFO_TASK_NODE_COUNTER_BYTES_OUT, FALSE },
+    { "ufo_task_process_seconds_total", "Time spent in process", UFO_TASK_NODE_COUNTER_PROCESS_TIME, TRUE },
+    { "ufo_task_generate_seconds_total", "Time spent in generate", UFO_TASK_NODE_COUNTER_GENERATE_TIME, TRUE },
+    { "ufo_task_fetch_wait_seconds_total", "Time spent waiting for inputs", UFO_TASK_NODE_COUNTER_FETCH_TIME, TRUE },
+    { "ufo_task_release_wait_seconds_total", "Time spent waiting for a free output buffer", UFO_TASK_NODE_COUNTER_RELEASE_TIME, TRUE },
+};
+
+enum {
+    INPUT_FRAMES,
+    INPUT_BYTES,
+    INPUT_WAIT_TIME,
+    INPUT_QUEUED,
+    N_INPUT_METRICS
+};
+
+enum {
+    TRANSFER_COUNT,
+    TRANSFER_BYTES,
+    TRANSFER_TIME,
+    N_TRANSFER_METRICS
+};
+
+static const gchar *transfer_metrics[N_TRANSFER_METRICS][2] = {
+    { "ufo_transfers_total", "Number of buffer transfers" },
+    { "ufo_transfer_bytes_total", "Size of all buffer transfers" },
+    { "ufo_transfer_seconds_total", "Device time of finished buffer transfers" },
+};
+
+static const gchar *transfer_directions[UFO_BUFFER_TRANSFER_LAST] = {
+    "host_to_device",
+    "device_to_host",
+    "device_to_device",
+    "buffer_to_image",
+    "image_to_buffer",
+};
+
+static const gchar *input_metrics[N_INPUT_METRICS][3] = {
+    { "ufo_input_frames_total", "counter", "Number of buffers received on an input" },
+    { "ufo_input_bytes_total", "counter", "Size of all buffers received on an input" },
+    { "ufo_input_wait_seconds_total", "counter", "Time spent waiting for buffers on an input" },
+    { "ufo_input_queued", "gauge", "Number of buffers that were waiting when the last one was received" },
+};
+
+static void
+append_header (GString *str,
+               const gchar *name,
+               const gchar *type,
+               const gchar *help)
+{
+    g_string_append_printf (str, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void
+append_value (GString *str,
+              guint64 value,
+              gboolean is_time)
+{
+    gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+    if (is_time)
+        g_string_append (str, g_ascii_dtostr (buffer, sizeof (buffer), value / (gdouble) G_USEC_PER_SEC));
+    else
+        g_string_append_printf (str, "%" G_GUINT64_FORMAT, value);
+
+    g_string_append_c (str, '\n');
+}
+
+static void
+append_label_value (GString *str,
+                    const gchar *value)
+{
+    /* Label values must escape backslashes, quotes and new lines */
+    for (const gchar *c = value; *c != '\0'; c++) {
+        if (*c == '\\' || *c == '"')
+            g_string_append_c (str, '\\');
+
+        if (*c == '\n')
+            g_string_append (str, "\\n");
+        else
+            g_string_append_c (str, *c);
+    }
+}
+
+static gchar *
+get_labels (UfoTaskNode *node,
+            guint index)
+{
+    const gchar *name;
+    GString *labels;
+
+    name = ufo_task_node_get_plugin_name (node);
+
+    if (name == NULL)
+        name = G_OBJECT_TYPE_NAME (node);
+
+    labels = g_string_new ("task=\"");
+    append_label_value (labels, name);
+    g_string_append_printf (labels, "\",node=\"%u\"", index);
+    return g_string_free (labels, FALSE);
+}
+
+typedef struct {
+    GString     *str;
+    const gchar *labels;
+    gboolean     launches;
+} KernelContext;
+
+static void
+append_kernel_stats (const gchar *kernel,
+                     guint64 n_launches,
+                     guint64 n_samples,
+                     gdouble total,
+                     gdouble p50,
+                     gdouble p99,
+                     KernelContext *context)
+{
+    const gchar *name = "ufo_kernel_duration_seconds";
+    gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+    GString *labels;
+
+    labels = g_string_new (context->labels);
+    g_string_append (labels, ",kernel=\"");
+    append_label_value (labels, kernel);
+    g_string_append_c (labels, '"');
+
+    if (context->launches) {
+        g_string_append_printf (context->str, "ufo_kernel_launches_total{%s} %" G_GUINT64_FORMAT "\n",
+                                labels->str, n_launches);
+    }
+    else {
+        g_string_append_printf (context->str, "%s{%s,quantile=\"0.5\"} %s\n", name, labels->str,
+                                g_ascii_dtostr (buffer, sizeof (buffer), p50));
+        g_string_append_printf (context->str, "%s{%s,quantile=\"0.99\"} %s\n", name, labels->str,
+                                g_ascii_dtostr (buffer, sizeof (buffer), p99));
+        g_string_append_printf (context->str, "%s_sum{%s} %s\n", name, labels->str,
+                                g_ascii_dtostr (buffer, sizeof (buffer), total));
+        g_string_append_printf (context->str, "%s_count{%s} %" G_GUINT64_FORMAT "\n",
+                                name, labels->str, n_samples);
+    }
+
+    g_string_free (labels, TRUE);
+}
+
+static gchar *
+get_snapshot (UfoMetrics *metrics)
+{
+    GString *str;
+    GList *it;
+    gchar **labels;
+    gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+    guint n_nodes;
+    guint i;
+
+    str = g_string_new (NULL);
+    n_nodes = g_list_length (metrics->nodes);
+    labels = g_new0 (gchar *, n_nodes + 1);
+
+    for (it = metrics->nodes, i = 0; it != NULL; it = g_list_next (it), i++)
+        labels[i] = get_labels (UFO_TASK_NODE (it->data), i);
+
+    append_header (str, "ufo_elapsed_seconds", "gauge", "Time since the graph was started");
+    g_string_append_printf (str, "ufo_elapsed_seconds %s\n",
+                            g_ascii_dtostr (buffer, sizeof (buffer),
+                                            (g_get_monotonic_time () - metrics->start) / (gdouble) G_USEC_PER_SEC));
+
+    for (guint m = 0; m < G_N_ELEMENTS (node_metrics); m++) {
+        append_header (str, node_metrics[m].name, "counter", node_metrics[m].help);
+
+        for (it = metrics->nodes, i = 0; it != NULL; it = g_list_next (it), i++) {
+            g_string_append_printf (str, "%s{%s} ", node_metrics[m].name, labels[i]);
+            append_value (str, ufo_task_node_get_counter (UFO_TASK_NODE (it->data), node_metrics[m].counter),
+                          node_metrics[m].is_time);
+        }
+    }
+
+    for (guint m = 0; m < N_INPUT_METRICS; m++) {
+        append_header (str, input_metrics[m][0], input_metrics[m][1], input_metrics[m][2]);
+
+        for (it = metrics->nodes, i = 0; it != NULL; it = g_list_next (it), i++) {
+            UfoTaskNode *node = UFO_TASK_NODE (it->data);
+            guint n_inputs;
+
+            n_inputs = MIN (ufo_task_get_num_inputs (UFO_TASK (node)), UFO_TASK_NODE_MAX_INPUTS);
+
+            for (guint j = 0; j < n_inputs; j++) {
+                guint64 values[N_INPUT_METRICS];
+                guint n_queued;
+
+                ufo_task_node_get_input_counters (node, j, &values[INPUT_FRAMES], &values[INPUT_BYTES],
+                                                  &values[INPUT_WAIT_TIME], &n_queued);
+                values[INPUT_QUEUED] = n_queued;
+
+                g_string_append_printf (str, "%s{%s,input=\"%u\"} ", input_metrics[m][0], labels[i], j);
+                append_value (str, values[m], m == INPUT_WAIT_TIME);
+            }
+        }
+    }
+
+    for (guint m = 0; m < N_TRANSFER_METRICS; m++) {
+        append_header (str, transfer_metrics[m][0], "counter", transfer_metrics[m][1]);
+
+        for (it = metrics->nodes, i = 0; it != NULL; it = g_list_next (it), i++) {
+            UfoProfiler *profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (it->data));
+
+            for (guint j = 0; j < UFO_BUFFER_TRANSFER_LAST; j++) {
+                guint64 values[N_TRANSFER_METRICS];
+                gdouble time;
+
+                ufo_profiler_get_transfer_counters (profiler, j, &values[TRANSFER_COUNT],
+                                                    &values[TRANSFER_BYTES], &time);
+
+                g_string_append_printf (str, "%s{%s,direction=\"%s\"} ",
+                                        transfer_metrics[m][0], labels[i], transfer_directions[j]);
+
+                if (m == TRANSFER_TIME)
+                    g_string_append_printf (str, "%s\n", g_ascii_dtostr (buffer, sizeof (buffer), time));
+                else
+                    append_value (str, values[m], FALSE);
+            }
+        }
+    }
+
+    append_header (str, "ufo_transfer_round_trips_total", "counter",
+                   "Number of buffers downloaded and uploaded again within one call");
+
+    for (it = metrics->nodes, i = 0; it != NULL; it = g_list_next (it), i++) {
+        guint64 n_round_trips;
+
+        ufo_profiler_get_round_trips (ufo_task_node_get_profiler (UFO_TASK_NODE (it->data)), &n_round_trips, NULL);
+        g_string_append_printf (str, "ufo_transfer_round_trips_total{%s} ", labels[i]);
+        append_value (str, n_round_trips, FALSE);
+    }
+
+    for (guint m = 0; m < 2; m++) {
+        if (m == 0)
+            append_header (str, "ufo_kernel_launches_total", "counter", "Number of kernel calls while sampling");
+        else
+            append_header (str, "ufo_kernel_duration_seconds", "summary", "Run time of sampled kernel calls");
+
+        for (it = metrics->nodes, i = 0; it != NULL; it = g_list_next (it), i++) {
+            KernelContext context = { str, labels[i], m == 0 };
+
+            ufo_profiler_foreach_kernel_stats (ufo_task_node_get_profiler (UFO_TASK_NODE (it->data)),
+                                               (UfoProfilerKernelFunc) append_kernel_stats, &context);
+        }
+    }
+
+    g_strfreev (labels);
+    return g_string_free (str, FALSE);
+}
+
+static void
+write_snapshot (UfoMetrics *metrics)
+{
+    GError *error = NULL;
+    gchar *snapshot;
+
+    snapshot = get_snapshot (metrics);
+
+    if (!g_file_set_contents (metrics->filename, snapshot, -1, &error)) {
+        if (!metrics->warned) {
+            g_debug ("WARN Could not write metrics: %s", error->message);
+            metrics->warned = TRUE;
+        }
+
+        g_error_free (error);
+    }
+
+    g_free (snapshot);
+}
+
+static gpointer
+write_periodically (UfoMetrics *metrics)
+{
+    g_mutex_lock (&metrics->lock);
+
+    while (!metrics->stop) {
+        gint64 end_time;
+
+        end_time = g_get_monotonic_time () + metrics->interval;
+
+        if (!g_cond_wait_until (&metrics->cond, &metrics->lock, end_time))
+            write_snapshot (metrics);
+    }
+
+    g_mutex_unlock (&metrics->lock);
+    return NULL;
+}
+
+/**
+ * ufo_metrics_new: (skip)
+ * @filename: File that is replaced with each snapshot
+ * @interval: Seconds between two snapshots
+ *
+ * Start writing metrics of all nodes passed to ufo_metrics_watch().
+ *
+ * Returns: A new #UfoMetrics that must be freed with ufo_metrics_free().
+ */
+UfoMetrics *
+ufo_metrics_new (const gchar *filename,
+                 gdouble interval)
+{
+    UfoMetrics *metrics;
+
+    metrics = g_new0 (UfoMetrics, 1);
+    metrics->filename = g_strdup (filename);
+    metrics->interval = MAX ((gint64) (interval * G_USEC_PER_SEC), 1000);
+    metrics->start = g_get_monotonic_time ();
+    g_mutex_init (&metrics->lock);
+    g_cond_init (&metrics->cond);
+    metrics->thread = g_thread_new ("ufo-metrics", (GThreadFunc) write_periodically, metrics);
+
+    return metrics;
+}
+
+/**
+ * ufo_metrics_watch: (skip)
+ * @metrics: A #UfoMetrics
+ * @nodes: (element-type UfoTaskNode): Task nodes to include in the snapshots
+ *
+ * Add @nodes to the snapshots. Nodes that are already watched are ignored.
+ */
+void
+ufo_metrics_watch (UfoMetrics *metrics,
+                   GList *nodes)
+{
+    GList *it;
+
+    g_mutex_lock (&metrics->lock);
+
+    g_list_for (nodes, it) {
+        if (g_list_find (metrics->nodes, it->data) == NULL)
+            metrics->nodes = g_list_append (metrics->nodes, g_object_ref (it->data));
+    }
+
+    g_mutex_unlock (&metrics->lock);
+}
+
+/**
+ * ufo_metrics_free: (skip)
+ * @metrics: A #UfoMetrics
+ *
+ * Stop the background thread and write a final snapshot.
+ */
+void
+ufo_metrics_free (UfoMetrics *metrics)
+{
+    g_mutex_lock (&metrics->lock);
+    metrics->stop = TRUE;
+    g_cond_signal (&metrics->cond);
+    g_mutex_unlock (&metrics->lock);
+
+    g_thread_join (metrics->thread);
+    write_snapshot (metrics);
+
+    g_list_free_full (metrics->nodes, g_object_unref);
+    g_mutex_clear (&metrics->lock);
+    g_cond_clear (&metrics->cond);
+    g_free (metrics->filename);
+    g_free (metrics);
+}
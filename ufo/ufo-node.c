@@ -20,6 +20,7 @@
 #include "config.h"
 
 #include "ufo-node.h"
+#include "ufo-priv.h"
 
 /**
  * SECTION:ufo-node
@@ -166,6 +167,13 @@ ufo_node_get_index (UfoNode *node)
     return node->priv->index;
 }
 
+UfoNode *
+ufo_node_get_origin (UfoNode *node)
+{
+    g_return_val_if_fail (UFO_IS_NODE (node), NULL);
+    return node->priv->orig;
+}
+
 /**
  * ufo_node_get_total:
  * @node: A #UfoNode
@@ -29,8 +29,10 @@
 #include <CL/cl.h>
 #endif
 
+#include "ufo-buffer-pool.h"
 #include "ufo-output-task.h"
 #include "ufo-task-iface.h"
+#include "ufo-priv.h"
 
 /**
  * SECTION:ufo-output-task
@@ -181,7 +183,9 @@ ufo_output_task_process (UfoTask *task,
     priv = UFO_OUTPUT_TASK_GET_PRIVATE (task);
 
     if (priv->n_copies == 0) {
-        copy = ufo_buffer_dup (outputs[0]);
+        copy = ufo_buffer_pool_acquire (ufo_buffer_pool_get_default (), &req,
+                                        ufo_buffer_get_context (outputs[0]),
+                                        UFO_BUFFER_LOCATION_HOST);
         priv->copies = g_list_append (priv->copies, copy);
         priv->n_copies++;
     }
@@ -230,9 +234,15 @@ static void
 ufo_output_task_dispose (GObject *object)
 {
     UfoOutputTaskPrivate *priv;
+    GList *it;
 
     priv = UFO_OUTPUT_TASK_GET_PRIVATE (object);
-    g_list_foreach (priv->copies, (GFunc) g_object_unref, NULL);
+
+    g_list_for (priv->copies, it)
+        ufo_buffer_pool_release (ufo_buffer_pool_get_default (), UFO_BUFFER (it->data));
+
+    g_list_free (priv->copies);
+    priv->copies = NULL;
 
     G_OBJECT_CLASS (ufo_output_task_parent_class)->dispose (object);
 }
@@ -0,0 +1,1166 @@
+/*
+ * Copyright (C) 2011-2013 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.h"
+
+#ifdef WITH_PYTHON
+#include <Python.h>
+#endif
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "ufo-buffer.h"
+#include "ufo-buffer-pool.h"
+#include "ufo-pool-scheduler.h"
+#include "ufo-resources.h"
+#include "ufo-task-node.h"
+#include "ufo-task-iface.h"
+#include "ufo-two-way-queue.h"
+#include "ufo-priv.h"
+
+/**
+ * SECTION:ufo-pool-scheduler
+ * @Short_description: Run tasks on a fixed number of worker threads
+ * @Title: UfoPoolScheduler
+ *
+ * Instead of spawning one thread per task, this scheduler executes all tasks
+ * on a fixed number of worker threads. A task is queued whenever it might be
+ * able to make progress, i.e. when new input arrived or a consumer released
+ * an output buffer. Each worker takes tasks from its own deque and steals from
+ * the others when it runs out of work. Tasks never block a worker while
+ * waiting for data, so that graphs with many nodes do not oversubscribe the
+ * machine.
+ *
+ * Like #UfoFixedScheduler, this scheduler does not expand the task graph, so
+ * frames always arrive in order and #UfoBaseScheduler:ordered has no effect. If
+ * two or more successors of a task declare %UFO_TASK_MODE_READ_ONLY_INPUTS,
+ * they read the same output buffer, all others receive a copy. Graphs of CPU
+ * tasks also run if no OpenCL platform is available.
+ */
+
+G_DEFINE_TYPE (UfoPoolScheduler, ufo_pool_scheduler, UFO_TYPE_BASE_SCHEDULER)
+
+#define UFO_POOL_SCHEDULER_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), UFO_TYPE_POOL_SCHEDULER, UfoPoolSchedulerPrivate))
+
+/* Number of units a task may run before it has to give way to others */
+#define MAX_UNITS_PER_TURN  8
+
+typedef struct _Node Node;
+typedef struct _Pool Pool;
+
+typedef enum {
+    NODE_IDLE = 0,
+    NODE_QUEUED,
+    NODE_RUNNING,
+    NODE_NOTIFIED,
+    NODE_DONE
+} NodeState;
+
+typedef enum {
+    PHASE_PROCESS,
+    PHASE_GENERATE,
+    PHASE_DRAIN
+} Phase;
+
+typedef enum {
+    UNIT_BLOCKED,
+    UNIT_PROGRESS,
+    UNIT_DONE
+} UnitResult;
+
+typedef enum {
+    INPUTS_READY,
+    INPUTS_BLOCKED,
+    INPUTS_EXHAUSTED
+} InputState;
+
+typedef struct _Connection Connection;
+
+struct _Connection {
+    Node *from;
+    Node *to;
+    guint port;
+    guint depth;
+    UfoTwoWayQueue *queue;
+    Connection *home;       /* owner of buffers shared with read-only targets */
+};
+
+struct _Node {
+    Pool *pool;
+    UfoTask *task;
+    UfoTaskMode mode;
+    gint state;
+    Phase phase;
+    gboolean exhausted;
+    UfoRequisition requisition;
+    guint n_inputs;
+    Connection **inputs;
+    UfoBuffer **in_buffers;
+    gboolean *have_input;
+    gboolean *finished;
+    guint n_outputs;
+    Connection **outputs;
+    UfoBuffer **out_buffers;
+    guint primary;
+    guint n_readers;
+};
+
+typedef struct {
+    Pool *pool;
+    guint index;
+    GMutex lock;
+    GQueue nodes;
+    guint n_units;
+    guint n_stolen;
+} Worker;
+
+struct _Pool {
+    Worker *workers;
+    guint n_workers;
+    gint n_active;
+    gint n_ready;
+    gint next;
+    gboolean finished;
+    GMutex lock;
+    GCond cond;
+    GError *error;
+    cl_context context;
+    UfoBufferPool *buffer_pool;
+};
+
+struct _UfoPoolSchedulerPrivate {
+    guint n_workers;
+};
+
+enum {
+    PROP_0,
+    PROP_NUM_WORKERS,
+    N_PROPERTIES,
+};
+
+static GParamSpec *properties[N_PROPERTIES] = { NULL, };
+
+static UfoBuffer *POISON_PILL = (UfoBuffer *) 0x1;
+
+static GPrivate current_worker = G_PRIVATE_INIT (NULL);
+
+/**
+ * ufo_pool_scheduler_new:
+ *
+ * Creates a new #UfoPoolScheduler.
+ *
+ * Return value: A new #UfoPoolScheduler
+ */
+UfoBaseScheduler *
+ufo_pool_scheduler_new (void)
+{
+    return UFO_BASE_SCHEDULER (g_object_new (UFO_TYPE_POOL_SCHEDULER, NULL));
+}
+
+static void
+enqueue (Pool *pool, Node *node)
+{
+    Worker *worker;
+
+    worker = g_private_get (&current_worker);
+
+    /* Keep the work local if possible, so that data stays in cache */
+    if (worker == NULL || worker->pool != pool)
+        worker = &pool->workers[((guint) g_atomic_int_add (&pool->next, 1)) % pool->n_workers];
+
+    g_mutex_lock (&worker->lock);
+    g_queue_push_tail (&worker->nodes, node);
+    g_mutex_unlock (&worker->lock);
+
+    g_atomic_int_inc (&pool->n_ready);
+
+    g_mutex_lock (&pool->lock);
+    g_cond_signal (&pool->cond);
+    g_mutex_unlock (&pool->lock);
+}
+
+static void
+notify (Node *node)
+{
+    for (;;) {
+        switch (g_atomic_int_get (&node->state)) {
+            case NODE_IDLE:
+                if (g_atomic_int_compare_and_exchange (&node->state, NODE_IDLE, NODE_QUEUED)) {
+                    enqueue (node->pool, node);
+                    return;
+                }
+                break;
+
+            case NODE_RUNNING:
+                /* Let the running worker look again once it is done */
+                if (g_atomic_int_compare_and_exchange (&node->state, NODE_RUNNING, NODE_NOTIFIED))
+                    return;
+                break;
+
+            default:
+                return;
+        }
+    }
+}
+
+static Node *
+take_node (Worker *worker)
+{
+    Pool *pool;
+    Node *node;
+
+    g_mutex_lock (&worker->lock);
+    node = g_queue_pop_tail (&worker->nodes);
+    g_mutex_unlock (&worker->lock);
+
+    if (node != NULL)
+        return node;
+
+    /* Steal the oldest work of the other workers */
+    pool = worker->pool;
+
+    for (guint i = 1; i < pool->n_workers && node == NULL; i++) {
+        Worker *victim = &pool->workers[(worker->index + i) % pool->n_workers];
+
+        g_mutex_lock (&victim->lock);
+        node = g_queue_pop_head (&victim->nodes);
+        g_mutex_unlock (&victim->lock);
+    }
+
+    if (node != NULL)
+        worker->n_stolen++;
+
+    return node;
+}
+
+static void
+set_error (Pool *pool, GError *error)
+{
+    g_mutex_lock (&pool->lock);
+
+    if (pool->error == NULL)
+        pool->error = error;
+    else
+        g_error_free (error);
+
+    g_mutex_unlock (&pool->lock);
+}
+
+static InputState
+get_inputs (Node *node)
+{
+    gboolean blocked = FALSE;
+    gboolean starved = FALSE;
+    guint n_finished = 0;
+
+    for (guint i = 0; i < node->n_inputs; i++) {
+        if (!node->finished[i] && !node->have_input[i]) {
+            UfoBuffer *input;
+
+            input = ufo_two_way_queue_consumer_try_pop (node->inputs[i]->queue);
+
+            if (input == NULL) {
+                blocked = TRUE;
+            }
+            else if (input == POISON_PILL) {
+                node->finished[i] = TRUE;
+            }
+            else {
+                node->in_buffers[i] = input;
+                node->have_input[i] = TRUE;
+
+                /* Workers never block on a queue, so there is no wait time */
+                ufo_task_node_account_input (UFO_TASK_NODE (node->task), i, ufo_buffer_get_size (input), 0,
+                                             ufo_two_way_queue_get_num_queued (node->inputs[i]->queue));
+            }
+        }
+
+        if (node->finished[i]) {
+            n_finished++;
+
+            /* Finished inputs keep providing their last buffer, if any */
+            starved = starved || node->in_buffers[i] == NULL;
+        }
+    }
+
+    if (n_finished == node->n_inputs || starved)
+        return INPUTS_EXHAUSTED;
+
+    return blocked ? INPUTS_BLOCKED : INPUTS_READY;
+}
+
+static void
+give_back (Connection *connection, UfoBuffer *buffer)
+{
+    if (connection->home != NULL && ufo_buffer_is_shared (buffer)) {
+        /* The last reader returns the buffer to the queue it came from */
+        if (!ufo_buffer_release_shared (buffer))
+            return;
+
+        ufo_two_way_queue_consumer_push (connection->home->queue, buffer);
+    }
+    else {
+        ufo_two_way_queue_consumer_push (connection->queue, buffer);
+    }
+
+    notify (connection->from);
+}
+
+static void
+release_inputs (Node *node)
+{
+    for (guint i = 0; i < node->n_inputs; i++) {
+        if (node->have_input[i]) {
+            give_back (node->inputs[i], node->in_buffers[i]);
+            node->have_input[i] = FALSE;
+        }
+    }
+}
+
+static UfoBuffer *
+try_pop_output (Pool *pool, Connection *connection, UfoRequisition *requisition)
+{
+    UfoTwoWayQueue *queue;
+    UfoBuffer *buffer;
+
+    queue = connection->queue;
+    buffer = ufo_two_way_queue_producer_try_pop (queue);
+
+    if (buffer == NULL) {
+        if (ufo_two_way_queue_get_capacity (queue) >= connection->depth)
+            return NULL;
+
+        buffer = ufo_buffer_pool_acquire (pool->buffer_pool, requisition, pool->context,
+                                          UFO_BUFFER_LOCATION_INVALID);
+        ufo_two_way_queue_insert (queue, buffer);
+        buffer = ufo_two_way_queue_producer_try_pop (queue);
+    }
+
+    if (ufo_buffer_cmp_dimensions (buffer, requisition)) {
+        UfoBuffer *replacement;
+        UfoBufferLocation location;
+
+        location = ufo_buffer_get_location (buffer);
+        ufo_buffer_pool_release (pool->buffer_pool, buffer);
+        replacement = ufo_buffer_pool_acquire (pool->buffer_pool, requisition, pool->context, location);
+        ufo_two_way_queue_replace (queue, buffer, replacement);
+        buffer = replacement;
+    }
+
+    return buffer;
+}
+
+static gboolean
+get_outputs (Node *node, UfoRequisition *requisition)
+{
+    for (guint i = 0; i < node->n_outputs; i++) {
+        /* Read-only targets only need the primary buffer */
+        if (node->outputs[i]->home != NULL && i != node->primary)
+            continue;
+
+        if (node->out_buffers[i] == NULL) {
+            node->out_buffers[i] = try_pop_output (node->pool, node->outputs[i], requisition);
+
+            if (node->out_buffers[i] == NULL)
+                return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static UfoBuffer *
+get_primary_output (Node *node)
+{
+    return node->n_outputs > 0 ? node->out_buffers[node->primary] : NULL;
+}
+
+static void
+send_outputs (Node *node)
+{
+    UfoBuffer *result;
+
+    if (node->n_outputs == 0)
+        return;
+
+    result = node->out_buffers[node->primary];
+
+    /* Successors that may write to their input get a copy of the result */
+    for (guint i = 0; i < node->n_outputs; i++) {
+        if (i == node->primary || node->outputs[i]->home != NULL)
+            continue;
+
+        ufo_buffer_copy (result, node->out_buffers[i]);
+        ufo_buffer_copy_metadata (result, node->out_buffers[i]);
+    }
+
+    if (node->n_readers > 0)
+        ufo_buffer_share (result, node->n_readers);
+
+    for (guint i = 0; i < node->n_outputs; i++) {
+        UfoBuffer *buffer;
+
+        buffer = node->outputs[i]->home != NULL ? result : node->out_buffers[i];
+        ufo_two_way_queue_producer_push (node->outputs[i]->queue, buffer);
+        node->out_buffers[i] = NULL;
+        notify (node->outputs[i]->to);
+    }
+}
+
+static UnitResult
+finish_node (Node *node)
+{
+    /* Hand back unused output buffers and tell successors we are done */
+    for (guint i = 0; i < node->n_outputs; i++) {
+        if (node->out_buffers[i] != NULL) {
+            ufo_two_way_queue_consumer_push (node->outputs[i]->queue, node->out_buffers[i]);
+            node->out_buffers[i] = NULL;
+        }
+
+        ufo_two_way_queue_producer_push (node->outputs[i]->queue, POISON_PILL);
+        notify (node->outputs[i]->to);
+    }
+
+    release_inputs (node);
+
+    for (guint i = 0; i < node->n_inputs; i++) {
+        if (!node->finished[i]) {
+            /* Consume outstanding input so that predecessors can finish */
+            node->phase = PHASE_DRAIN;
+            return UNIT_PROGRESS;
+        }
+    }
+
+    return UNIT_DONE;
+}
+
+static UnitResult
+fail_node (Node *node, GError *error)
+{
+    set_error (node->pool, error);
+    return finish_node (node);
+}
+
+static UnitResult
+drain_unit (Node *node)
+{
+    gboolean progress = FALSE;
+    gboolean done = TRUE;
+
+    for (guint i = 0; i < node->n_inputs; i++) {
+        UfoBuffer *input;
+
+        if (node->finished[i])
+            continue;
+
+        while ((input = ufo_two_way_queue_consumer_try_pop (node->inputs[i]->queue)) != NULL) {
+            progress = TRUE;
+
+            if (input == POISON_PILL) {
+                node->finished[i] = TRUE;
+                break;
+            }
+
+            give_back (node->inputs[i], input);
+        }
+
+        done = done && node->finished[i];
+    }
+
+    if (done)
+        return UNIT_DONE;
+
+    return progress ? UNIT_PROGRESS : UNIT_BLOCKED;
+}
+
+static UnitResult
+generate_unit (Node *node)
+{
+    GError *error = NULL;
+
+    /* There is nothing to generate into */
+    if (node->n_outputs == 0) {
+        g_debug ("WARN %s-%p generates data but has no successors",
+                 ufo_task_node_get_plugin_name (UFO_TASK_NODE (node->task)), (gpointer) node->task);
+        return finish_node (node);
+    }
+
+    ufo_task_get_requisition (node->task, NULL, &node->requisition, &error);
+
+    if (error != NULL)
+        return fail_node (node, error);
+
+    if (!get_outputs (node, &node->requisition))
+        return UNIT_BLOCKED;
+
+    if (!ufo_task_generate (node->task, node->out_buffers[node->primary], &node->requisition))
+        return finish_node (node);
+
+    send_outputs (node);
+    return UNIT_PROGRESS;
+}
+
+static UnitResult
+process_unit (Node *node)
+{
+    UfoBuffer *output = NULL;
+    GError *error = NULL;
+    InputState state;
+
+    state = get_inputs (node);
+
+    if (state == INPUTS_EXHAUSTED)
+        return finish_node (node);
+
+    if (state == INPUTS_BLOCKED)
+        return UNIT_BLOCKED;
+
+    ufo_task_get_requisition (node->task, node->in_buffers, &node->requisition, &error);
+
+    if (error != NULL)
+        return fail_node (node, error);
+
+    if (node->n_outputs > 0) {
+        /* Keep the inputs until there is room for the result */
+        if (!get_outputs (node, &node->requisition))
+            return UNIT_BLOCKED;
+
+        output = get_primary_output (node);
+        ufo_buffer_discard_location (output);
+
+        for (guint i = 0; i < node->n_inputs; i++)
+            ufo_buffer_copy_metadata (node->in_buffers[i], output);
+
+        ufo_buffer_set_layout (output, ufo_buffer_get_layout (node->in_buffers[0]));
+    }
+
+    if (!ufo_task_process (node->task, node->in_buffers, output, &node->requisition))
+        return finish_node (node);
+
+    if (node->n_outputs > 0)
+        send_outputs (node);
+
+    release_inputs (node);
+    return UNIT_PROGRESS;
+}
+
+static UnitResult
+reduce_unit (Node *node)
+{
+    GError *error = NULL;
+
+    if (node->phase == PHASE_PROCESS) {
+        InputState state;
+        UfoBuffer *output;
+        gboolean go_on;
+
+        state = get_inputs (node);
+
+        if (state == INPUTS_BLOCKED)
+            return UNIT_BLOCKED;
+
+        if (state == INPUTS_EXHAUSTED) {
+            /*
+             * Nothing was ever reduced without an output buffer and a
+             * reductor without successors has nowhere to send the result.
+             */
+            if (get_primary_output (node) == NULL)
+                return finish_node (node);
+
+            node->exhausted = TRUE;
+            node->phase = PHASE_GENERATE;
+            return UNIT_PROGRESS;
+        }
+
+        if (get_primary_output (node) == NULL) {
+            ufo_task_get_requisition (node->task, node->in_buffers, &node->requisition, &error);
+
+            if (error != NULL)
+                return fail_node (node, error);
+
+            if (!get_outputs (node, &node->requisition))
+                return UNIT_BLOCKED;
+        }
+
+        output = get_primary_output (node);
+
+        for (guint i = 0; i < node->n_inputs && output != NULL; i++)
+            ufo_buffer_copy_metadata (node->in_buffers[i], output);
+
+        go_on = ufo_task_process (node->task, node->in_buffers, output, &node->requisition);
+        release_inputs (node);
+
+        if (!go_on && output == NULL)
+            return finish_node (node);
+
+        if (!go_on)
+            node->phase = PHASE_GENERATE;
+
+        return UNIT_PROGRESS;
+    }
+
+    if (!get_outputs (node, &node->requisition))
+        return UNIT_BLOCKED;
+
+    if (ufo_task_generate (node->task, node->out_buffers[node->primary], &node->requisition)) {
+        send_outputs (node);
+        return UNIT_PROGRESS;
+    }
+
+    if (node->exhausted)
+        return finish_node (node);
+
+    node->phase = PHASE_PROCESS;
+    return UNIT_PROGRESS;
+}
+
+static UnitResult
+run_unit (Node *node)
+{
+    if (node->phase == PHASE_DRAIN)
+        return drain_unit (node);
+
+    switch (node->mode & UFO_TASK_MODE_TYPE_MASK) {
+        case UFO_TASK_MODE_GENERATOR:
+            return generate_unit (node);
+
+        case UFO_TASK_MODE_PROCESSOR:
+        case UFO_TASK_MODE_SINK:
+            return process_unit (node);
+
+        case UFO_TASK_MODE_REDUCTOR:
+            return reduce_unit (node);
+
+        default:
+            g_warning ("Unknown task mode");
+            return finish_node (node);
+    }
+}
+
+static void
+run_node (Worker *worker, Node *node)
+{
+    Pool *pool;
+    UnitResult result = UNIT_BLOCKED;
+
+    pool = node->pool;
+    g_atomic_int_set (&node->state, NODE_RUNNING);
+
+    for (guint i = 0; i < MAX_UNITS_PER_TURN; i++) {
+        result = run_unit (node);
+
+        if (result != UNIT_BLOCKED)
+            worker->n_units++;
+
+        if (result != UNIT_PROGRESS)
+            break;
+    }
+
+    switch (result) {
+        case UNIT_DONE:
+            g_atomic_int_set (&node->state, NODE_DONE);
+
+            if (g_atomic_int_dec_and_test (&pool->n_active)) {
+                g_mutex_lock (&pool->lock);
+                pool->finished = TRUE;
+                g_cond_broadcast (&pool->cond);
+                g_mutex_unlock (&pool->lock);
+            }
+            break;
+
+        case UNIT_PROGRESS:
+            g_atomic_int_set (&node->state, NODE_QUEUED);
+            enqueue (pool, node);
+            break;
+
+        case UNIT_BLOCKED:
+            /* Someone might have produced or released data in the meantime */
+            if (!g_atomic_int_compare_and_exchange (&node->state, NODE_RUNNING, NODE_IDLE)) {
+                g_atomic_int_set (&node->state, NODE_QUEUED);
+                enqueue (pool, node);
+            }
+            break;
+    }
+}
+
+static gpointer
+run_worker (Worker *worker)
+{
+    Pool *pool;
+    gboolean finished = FALSE;
+
+    pool = worker->pool;
+    g_private_set (&current_worker, worker);
+
+    while (!finished) {
+        Node *node;
+
+        node = take_node (worker);
+
+        if (node != NULL) {
+            g_atomic_int_add (&pool->n_ready, -1);
+            run_node (worker, node);
+            continue;
+        }
+
+        g_mutex_lock (&pool->lock);
+
+        while (g_atomic_int_get (&pool->n_ready) == 0 && !pool->finished)
+            g_cond_wait (&pool->cond, &pool->lock);
+
+        finished = pool->finished;
+        g_mutex_unlock (&pool->lock);
+    }
+
+    g_private_set (&current_worker, NULL);
+    return NULL;
+}
+
+static void
+join_threads (GThread **threads, guint n_threads)
+{
+    for (guint i = 0; i < n_threads; i++)
+        g_thread_join (threads[i]);
+}
+
+static Node *
+node_new (Pool *pool, UfoGraph *graph, UfoTask *task)
+{
+    Node *node;
+
+    node = g_new0 (Node, 1);
+    node->pool = pool;
+    node->task = task;
+    node->mode = ufo_task_get_mode (task);
+    node->state = NODE_IDLE;
+    node->phase = (node->mode & UFO_TASK_MODE_GENERATOR) ? PHASE_GENERATE : PHASE_PROCESS;
+    node->n_inputs = ufo_graph_get_num_predecessors (graph, UFO_NODE (task));
+    node->inputs = g_new0 (Connection *, node->n_inputs);
+    node->in_buffers = g_new0 (UfoBuffer *, node->n_inputs);
+    node->have_input = g_new0 (gboolean, node->n_inputs);
+    node->finished = g_new0 (gboolean, node->n_inputs);
+    node->n_outputs = ufo_graph_get_num_successors (graph, UFO_NODE (task));
+    node->outputs = g_new0 (Connection *, node->n_outputs);
+    node->out_buffers = g_new0 (UfoBuffer *, node->n_outputs);
+
+    return node;
+}
+
+static void
+node_free (Node *node)
+{
+    g_free (node->inputs);
+    g_free (node->in_buffers);
+    g_free (node->have_input);
+    g_free (node->finished);
+    g_free (node->outputs);
+    g_free (node->out_buffers);
+    g_free (node);
+}
+
+static const gchar *
+get_name (Node *node)
+{
+    return ufo_task_node_get_plugin_name (UFO_TASK_NODE (node->task));
+}
+
+static gboolean
+check_inputs (Node *node, GError **error)
+{
+    for (guint i = 0; i < node->n_inputs; i++) {
+        if (node->inputs[i] == NULL) {
+            g_set_error (error, UFO_BASE_SCHEDULER_ERROR, UFO_BASE_SCHEDULER_ERROR_SETUP,
+                         "Input %u of %s-%p is not connected or %u inputs are connected more than once",
+                         i, get_name (node), (gpointer) node->task, node->n_inputs);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/*
+ * Connect all nodes. On error, the connections made so far are returned, so
+ * that they can be cleaned up as usual.
+ */
+static GList *
+setup_connections (UfoGraph *graph,
+                   GHashTable *nodes,
+                   guint default_depth,
+                   GError **error)
+{
+    GList *connections = NULL;
+    GList *tasks;
+    GList *it;
+    GError *tmp_error = NULL;
+
+    tasks = ufo_graph_get_nodes (graph);
+
+    g_list_for (tasks, it) {
+        Node *from;
+        GList *successors;
+        GList *jt;
+        guint n_outputs = 0;
+
+        from = g_hash_table_lookup (nodes, it->data);
+        successors = ufo_graph_get_successors (graph, UFO_NODE (it->data));
+
+        g_list_for (successors, jt) {
+            Connection *connection;
+
+            connection = g_new0 (Connection, 1);
+            connection->from = from;
+            connection->to = g_hash_table_lookup (nodes, jt->data);
+            connection->port = (guint) GPOINTER_TO_INT (ufo_graph_get_edge_label (graph, UFO_NODE (it->data),
+                                                                                   UFO_NODE (jt->data)));
+            connection->depth = ufo_task_node_get_queue_depth (UFO_TASK_NODE (jt->data), connection->port);
+            connection->queue = ufo_two_way_queue_new (NULL);
+
+            if (connection->depth == 0)
+                connection->depth = default_depth;
+
+            from->outputs[n_outputs++] = connection;
+            connections = g_list_append (connections, connection);
+
+            if (connection->port >= ufo_task_get_num_inputs (connection->to->task)) {
+                if (tmp_error == NULL)
+                    g_set_error (&tmp_error, UFO_BASE_SCHEDULER_ERROR, UFO_BASE_SCHEDULER_ERROR_SETUP,
+                                 "%s-%p has %u inputs but is connected on input %u",
+                                 get_name (connection->to), (gpointer) connection->to->task,
+                                 ufo_task_get_num_inputs (connection->to->task), connection->port);
+            }
+            else if (connection->port < connection->to->n_inputs &&
+                     connection->to->inputs[connection->port] == NULL) {
+                connection->to->inputs[connection->port] = connection;
+            }
+
+            if (connection->to->mode & UFO_TASK_MODE_READ_ONLY_INPUTS)
+                from->n_readers++;
+        }
+
+        /* Sharing pays off only with at least two readers */
+        if (from->n_readers < 2)
+            from->n_readers = 0;
+
+        for (guint i = 0; i < n_outputs && from->n_readers > 0; i++) {
+            Connection *connection = from->outputs[i];
+
+            if (connection->to->mode & UFO_TASK_MODE_READ_ONLY_INPUTS) {
+                if (from->outputs[from->primary]->home == NULL)
+                    from->primary = i;
+
+                connection->home = from->outputs[from->primary];
+            }
+        }
+
+        g_list_free (successors);
+    }
+
+    /* Ports connected twice or beyond the number of edges leave a gap */
+    g_list_for (tasks, it) {
+        if (tmp_error != NULL)
+            break;
+
+        check_inputs (g_hash_table_lookup (nodes, it->data), &tmp_error);
+    }
+
+    if (tmp_error != NULL)
+        g_propagate_error (error, tmp_error);
+
+    g_list_free (tasks);
+    return connections;
+}
+
+static gboolean
+needs_gpu (GList *tasks)
+{
+    GList *it;
+
+    g_list_for (tasks, it) {
+        if (ufo_task_get_mode (UFO_TASK (it->data)) & UFO_TASK_MODE_GPU)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static gboolean
+setup_tasks (UfoBaseScheduler *scheduler,
+             GList *tasks,
+             UfoResources *resources,
+             GError **error)
+{
+    GList *gpu_nodes;
+    GList *it;
+
+    gpu_nodes = resources != NULL ? ufo_resources_get_gpu_nodes (resources) : NULL;
+
+    g_list_for (tasks, it) {
+        UfoTask *task;
+
+        task = UFO_TASK (it->data);
+
+        /* Set a default GPU if not assigned by user */
+        if (ufo_task_get_mode (task) & UFO_TASK_MODE_GPU) {
+            if (ufo_task_node_get_proc_node (UFO_TASK_NODE (task)) == NULL) {
+                if (g_list_length (gpu_nodes) == 0) {
+                    g_set_error_literal (error, UFO_BASE_SCHEDULER_ERROR, UFO_BASE_SCHEDULER_ERROR_SETUP,
+                                         "Using GPU tasks but no GPU available");
+                    g_list_free (gpu_nodes);
+                    return FALSE;
+                }
+
+                ufo_task_node_set_proc_node (UFO_TASK_NODE (task), g_list_nth_data (gpu_nodes, 0));
+            }
+        }
+    }
+
+    g_list_free (gpu_nodes);
+    return ufo_base_scheduler_setup_tasks (scheduler, tasks, resources, error);
+}
+
+static void
+run_pool (Pool *pool, GList *tasks, GHashTable *nodes)
+{
+    GThread **threads;
+    GList *it;
+
+    for (guint i = 0; i < pool->n_workers; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        g_mutex_init (&pool->workers[i].lock);
+        g_queue_init (&pool->workers[i].nodes);
+    }
+
+    /* Every task gets a first chance, those without data go idle right away */
+    g_list_for (tasks, it) {
+        Node *node = g_hash_table_lookup (nodes, it->data);
+
+        node->state = NODE_QUEUED;
+        enqueue (pool, node);
+    }
+
+    g_debug ("INFO Running %u tasks on %u workers", g_list_length (tasks), pool->n_workers);
+    threads = g_new0 (GThread *, pool->n_workers);
+
+    for (guint i = 0; i < pool->n_workers; i++)
+        threads[i] = g_thread_new (NULL, (GThreadFunc) run_worker, &pool->workers[i]);
+
+#ifdef WITH_PYTHON
+    if (Py_IsInitialized ()) {
+        PyGILState_STATE state = PyGILState_Ensure ();
+        Py_BEGIN_ALLOW_THREADS
+
+        join_threads (threads, pool->n_workers);
+
+        Py_END_ALLOW_THREADS
+        PyGILState_Release (state);
+    }
+    else {
+        join_threads (threads, pool->n_workers);
+    }
+#else
+    join_threads (threads, pool->n_workers);
+#endif
+
+    for (guint i = 0; i < pool->n_workers; i++) {
+        g_debug ("INFO Worker %u: units=%u stolen=%u", i, pool->workers[i].n_units, pool->workers[i].n_stolen);
+        g_mutex_clear (&pool->workers[i].lock);
+        g_queue_clear (&pool->workers[i].nodes);
+    }
+
+    g_free (threads);
+}
+
+static void
+ufo_pool_scheduler_run (UfoBaseScheduler *scheduler,
+                        UfoTaskGraph *task_graph,
+                        GError **error)
+{
+    UfoPoolSchedulerPrivate *priv;
+    UfoResources *resources;
+    UfoGraph *graph;
+    GHashTable *nodes;
+    GList *connections;
+    GList *tasks;
+    GList *it;
+    Pool pool = { 0, };
+    guint default_depth;
+    gboolean ordered;
+    GError *tmp_error = NULL;
+
+    g_return_if_fail (UFO_IS_POOL_SCHEDULER (scheduler));
+
+    g_object_get (scheduler, "ordered", &ordered, NULL);
+
+    if (ordered)
+        g_debug ("WARN Graph is not expanded, frames arrive in order without `ordered'");
+
+    priv = UFO_POOL_SCHEDULER_GET_PRIVATE (scheduler);
+    graph = UFO_GRAPH (task_graph);
+    tasks = ufo_graph_get_nodes (graph);
+    resources = ufo_base_scheduler_get_resources (scheduler, &tmp_error);
+
+    if (resources == NULL) {
+        if (needs_gpu (tasks)) {
+            g_propagate_error (error, tmp_error);
+            g_list_free (tasks);
+            return;
+        }
+
+        g_debug ("WARN %s, running without OpenCL", tmp_error->message);
+        g_clear_error (&tmp_error);
+    }
+
+    if (!setup_tasks (scheduler, tasks, resources, &tmp_error)) {
+        g_propagate_error (error, tmp_error);
+        g_list_free (tasks);
+        return;
+    }
+
+    g_object_get (scheduler, "queue-depth", &default_depth, NULL);
+
+    /* Double buffering unless told otherwise */
+    if (default_depth == 0)
+        default_depth = 2;
+
+    pool.n_workers = priv->n_workers > 0 ? priv->n_workers : (guint) g_get_num_processors ();
+    pool.workers = g_new0 (Worker, pool.n_workers);
+    pool.n_active = (gint) g_list_length (tasks);
+    pool.finished = pool.n_active == 0;
+    pool.context = resources != NULL ? ufo_resources_get_context (resources) : NULL;
+    pool.buffer_pool = ufo_buffer_pool_get_default ();
+    g_mutex_init (&pool.lock);
+    g_cond_init (&pool.cond);
+
+    nodes = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) node_free);
+
+    g_list_for (tasks, it)
+        g_hash_table_insert (nodes, it->data, node_new (&pool, graph, UFO_TASK (it->data)));
+
+    connections = setup_connections (graph, nodes, default_depth, &tmp_error);
+
+    if (tmp_error == NULL)
+        run_pool (&pool, tasks, nodes);
+    else
+        pool.error = tmp_error;
+
+    g_list_for (connections, it) {
+        Connection *connection = (Connection *) it->data;
+        GList *buffers;
+        GList *jt;
+
+        g_debug ("INFO Queue %s-%p -> %s-%p: depth=%u high-water=%u",
+                 ufo_task_node_get_plugin_name (UFO_TASK_NODE (connection->from->task)), (gpointer) connection->from->task,
+                 ufo_task_node_get_plugin_name (UFO_TASK_NODE (connection->to->task)), (gpointer) connection->to->task,
+                 connection->depth, ufo_two_way_queue_get_high_water_mark (connection->queue));
+
+        buffers = ufo_two_way_queue_get_inserted (connection->queue);
+
+        g_list_for (buffers, jt)
+            ufo_buffer_pool_release (pool.buffer_pool, UFO_BUFFER (jt->data));
+
+        ufo_two_way_queue_free (connection->queue);
+        g_free (connection);
+    }
+
+    if (pool.error != NULL)
+        g_propagate_error (error, pool.error);
+
+    g_list_free (connections);
+    g_hash_table_destroy (nodes);
+    g_list_free (tasks);
+    g_free (pool.workers);
+    g_mutex_clear (&pool.lock);
+    g_cond_clear (&pool.cond);
+}
+
+static void
+ufo_pool_scheduler_set_property (GObject *object,
+                                 guint property_id,
+                                 const GValue *value,
+                                 GParamSpec *pspec)
+{
+    UfoPoolSchedulerPrivate *priv = UFO_POOL_SCHEDULER_GET_PRIVATE (object);
+
+    switch (property_id) {
+        case PROP_NUM_WORKERS:
+            priv->n_workers = g_value_get_uint (value);
+            break;
+
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+            break;
+    }
+}
+
+static void
+ufo_pool_scheduler_get_property (GObject *object,
+                                 guint property_id,
+                                 GValue *value,
+                                 GParamSpec *pspec)
+{
+    UfoPoolSchedulerPrivate *priv = UFO_POOL_SCHEDULER_GET_PRIVATE (object);
+
+    switch (property_id) {
+        case PROP_NUM_WORKERS:
+            g_value_set_uint (value, priv->n_workers);
+            break;
+
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+            break;
+    }
+}
+
+static void
+ufo_pool_scheduler_class_init (UfoPoolSchedulerClass *klass)
+{
+    GObjectClass *oclass;
+    UfoBaseSchedulerClass *sclass;
+
+    oclass = G_OBJECT_CLASS (klass);
+    oclass->set_property = ufo_pool_scheduler_set_property;
+    oclass->get_property = ufo_pool_scheduler_get_property;
+
+    sclass = UFO_BASE_SCHEDULER_CLASS (klass);
+    sclass->run = ufo_pool_scheduler_run;
+
+    properties[PROP_NUM_WORKERS] =
+        g_param_spec_uint ("num-workers",
+                           "Number of worker threads",
+                           "Number of worker threads, 0 uses one per processor",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READWRITE);
+
+    for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
+        g_object_class_install_property (oclass, i, properties[i]);
+
+    g_type_class_add_private (klass, sizeof (UfoPoolSchedulerPrivate));
+}
+
+static void
+ufo_pool_scheduler_init (UfoPoolScheduler *scheduler)
+{
+    scheduler->priv = UFO_POOL_SCHEDULER_GET_PRIVATE (scheduler);
+    scheduler->priv->n_workers = 0;
+}
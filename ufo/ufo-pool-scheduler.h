@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2011-2013 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UFO_POOL_SCHEDULER_H
+#define __UFO_POOL_SCHEDULER_H
+
+#if !defined (__UFO_H_INSIDE__) && !defined (UFO_COMPILATION)
+#error "Only <ufo/ufo.h> can be included directly."
+#endif
+
+#include <ufo/ufo-task-graph.h>
+#include <ufo/ufo-base-scheduler.h>
+
+G_BEGIN_DECLS
+
+#define UFO_TYPE_POOL_SCHEDULER             (ufo_pool_scheduler_get_type())
+#define UFO_POOL_SCHEDULER(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj), UFO_TYPE_POOL_SCHEDULER, UfoPoolScheduler))
+#define UFO_IS_POOL_SCHEDULER(obj)          (G_TYPE_CHECK_INSTANCE_TYPE((obj), UFO_TYPE_POOL_SCHEDULER))
+#define UFO_POOL_SCHEDULER_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST((klass), UFO_TYPE_POOL_SCHEDULER, UfoPoolSchedulerClass))
+#define UFO_IS_POOL_SCHEDULER_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE((klass), UFO_TYPE_POOL_SCHEDULER))
+#define UFO_POOL_SCHEDULER_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj), UFO_TYPE_POOL_SCHEDULER, UfoPoolSchedulerClass))
+
+typedef struct _UfoPoolScheduler           UfoPoolScheduler;
+typedef struct _UfoPoolSchedulerClass      UfoPoolSchedulerClass;
+typedef struct _UfoPoolSchedulerPrivate    UfoPoolSchedulerPrivate;
+
+/**
+ * UfoPoolScheduler:
+ *
+ * A scheduler that runs all tasks of a graph on a fixed number of worker
+ * threads. The contents of the #UfoPoolScheduler structure are private and
+ * should only be accessed via the provided API.
+ */
+struct _UfoPoolScheduler {
+    /*< private >*/
+    UfoBaseScheduler parent_instance;
+
+    UfoPoolSchedulerPrivate *priv;
+};
+
+/**
+ * UfoPoolSchedulerClass:
+ *
+ * #UfoPoolScheduler class
+ */
+struct _UfoPoolSchedulerClass {
+    /*< private >*/
+    UfoBaseSchedulerClass parent_class;
+};
+
+UfoBaseScheduler *ufo_pool_scheduler_new            (void);
+GType             ufo_pool_scheduler_get_type       (void);
+
+G_END_DECLS
+
+#endif
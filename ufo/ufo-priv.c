@@ -72,11 +72,11 @@ get_sorted_trace_events (GList *nodes)
 
             event->pid = 1;
             event->tid = g_strdup_printf ("%s-%p", G_OBJECT_TYPE_NAME (node), (gpointer) node);
-            sorted = g_list_insert_sorted (sorted, event, (GCompareFunc) compare_events);
+            sorted = g_list_prepend (sorted, event);
         }
     }
 
-    return sorted;
+    return g_list_sort (sorted, (GCompareFunc) compare_events);
 }
 
 static Event *
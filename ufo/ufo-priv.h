@@ -21,11 +21,93 @@
 #define UFO_PRIV_H
 
 #include <glib.h>
+#include <ufo/ufo-buffer.h>
+#include <ufo/ufo-group.h>
+#include <ufo/ufo-node.h>
+#include <ufo/ufo-profiler.h>
 
 void    ufo_write_profile_events    (GList *nodes);
 void    ufo_write_opencl_events     (GList *nodes);
 gchar * ufo_escape_device_name      (gchar *name);
+UfoNode * ufo_node_get_origin       (UfoNode *node);
+void    ufo_buffer_set_pinned_default (gpointer context,
+                                       gboolean pinned);
+void    ufo_buffer_reset            (UfoBuffer *buffer);
+void    ufo_buffer_release_programs (gpointer context);
+void    ufo_convert_to_float        (gfloat *dst,
+                                     gconstpointer src,
+                                     UfoBufferDepth depth,
+                                     gsize n_pixels);
+void    ufo_convert_from_float      (gpointer dst,
+                                     const gfloat *src,
+                                     UfoBufferDepth depth,
+                                     gsize n_pixels,
+                                     gfloat min,
+                                     gfloat max);
+void    ufo_convert_find_range      (const gfloat *src,
+                                     gsize n_pixels,
+                                     gfloat *min,
+                                     gfloat *max);
+gsize   ufo_convert_get_depth_size  (UfoBufferDepth depth);
+void    ufo_convert_get_statistics  (const gfloat *src,
+                                     gsize n_pixels,
+                                     UfoBufferStatistics *stats);
+void    ufo_convert_get_histogram   (const gfloat *src,
+                                     gsize n_pixels,
+                                     gfloat min,
+                                     gfloat max,
+                                     guint n_bins,
+                                     guint32 *bins);
 
+typedef void (*UfoGroupNotify) (gpointer user_data);
+
+void    ufo_group_set_notify        (UfoGroup *group,
+                                     UfoTask *target,
+                                     UfoGroupNotify notify,
+                                     gpointer user_data);
+
+typedef struct _UfoExpr UfoExpr;
+
+UfoExpr * ufo_expr_parse            (const gchar *expression,
+                                     const gchar * const *names,
+                                     GError **error);
+gchar * ufo_expr_get_opencl_source  (UfoExpr *expr);
+void    ufo_expr_evaluate           (UfoExpr *expr,
+                                     const gfloat **inputs,
+                                     gfloat *out,
+                                     gsize n_pixels);
+void    ufo_expr_free               (UfoExpr *expr);
+
+gint    ufo_tuner_enqueue           (gpointer command_queue,
+                                     gpointer kernel,
+                                     guint work_dim,
+                                     const gsize *global_work_size,
+                                     gpointer *event);
+
+void    ufo_profiler_set_current    (UfoProfiler *profiler);
+UfoProfiler * ufo_profiler_get_current
+                                    (void);
+void    ufo_profiler_add_transfer   (UfoProfiler *profiler,
+                                     UfoBufferTransfer transfer,
+                                     gsize n_bytes,
+                                     gpointer command_queue,
+                                     gpointer event);
+void    ufo_profiler_add_transfer_time
+                                    (UfoProfiler *profiler,
+                                     UfoBufferTransfer transfer,
+                                     guint64 duration);
+void    ufo_profiler_add_round_trip (UfoProfiler *profiler,
+                                     gsize n_bytes);
+void    ufo_profiler_reset_transfers
+                                    (UfoProfiler *profiler);
+
+typedef struct _UfoMetrics UfoMetrics;
+
+UfoMetrics * ufo_metrics_new        (const gchar *filename,
+                                     gdouble interval);
+void    ufo_metrics_watch           (UfoMetrics *metrics,
+                                     GList *nodes);
+void    ufo_metrics_free            (UfoMetrics *metrics);
 
 /* g_list_for() never existed, but it's nice to have anyway. */
 #define g_list_for(list, it) \
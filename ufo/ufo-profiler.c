@@ -30,6 +30,7 @@
 
 #include "ufo-profiler.h"
 #include "ufo-resources.h"
+#include "ufo-priv.h"
 
 /**
  * SECTION:ufo-profiler
@@ -43,6 +44,29 @@
  * the managing #UfoBaseScheduler. Task implementations should call
  * ufo_task_node_get_profiler() to receive their profiler and make profiled
  * kernel calls with ufo_profiler_call().
+ *
+ * Kernels called without a local work size are tuned on first use: the first
+ * calls for each kernel, device and global work size try different local
+ * sizes and the fastest one is used from then on and remembered on disk next
+ * to the program cache of #UfoResources. Set the `UFO_WORK_SIZE_TUNING`
+ * environment variable to `freeze` to only use stored results or to `off` to
+ * leave the local size to the OpenCL driver.
+ *
+ * Tracing keeps the event of every kernel call until the end of a run. For a
+ * cheaper look at kernel run times, ufo_profiler_set_sample_rate() records
+ * only every n-th call of each kernel. The events of these calls are read and
+ * released on a background thread and their durations are added to a
+ * histogram per kernel, from which ufo_profiler_foreach_kernel_stats()
+ * reports the median and the 99th percentile while the graph is running.
+ *
+ * Data transfers of #UfoBuffer objects made while a task processes or
+ * generates are accounted to the profiler of its node. For each direction,
+ * ufo_profiler_get_transfer_counters() returns the number of transfers, the
+ * bytes moved and the time the device spent on them. Buffer data that is
+ * downloaded to the host and uploaded again unchanged, by the same or by a
+ * later task, made a round trip over the bus, these are counted by
+ * ufo_profiler_get_round_trips(). With tracing enabled, transfers appear in
+ * the OpenCL trace next to the kernels, one track per direction.
  */
 
 G_DEFINE_TYPE(UfoProfiler, ufo_profiler, G_TYPE_OBJECT)
@@ -51,15 +75,69 @@ G_DEFINE_TYPE(UfoProfiler, ufo_profiler, G_TYPE_OBJECT)
 
 struct EventRow {
     cl_event    event;
-    cl_kernel   kernel;
+    cl_kernel   kernel;         /* NULL for transfers */
+    const gchar *name;          /* of transfers */
     cl_command_queue queue;
 };
 
+typedef struct {
+    guint64     n_transfers;
+    guint64     n_bytes;
+    guint64     time;           /* in ns */
+} TransferCounters;
+
+/* Trace names, each direction is shown as a track of its own */
+static const gchar *transfer_names[UFO_BUFFER_TRANSFER_LAST] = {
+    "transfer host to device",
+    "transfer device to host",
+    "transfer device to device",
+    "transfer buffer to image",
+    "transfer image to buffer",
+};
+
+/*
+ * Durations are binned with eight linear sub-buckets per power of two of
+ * nanoseconds, which keeps percentiles within about 6% of the exact value.
+ */
+#define N_SUB_BUCKETS_LOG2  3
+#define N_SUB_BUCKETS       (1 << N_SUB_BUCKETS_LOG2)
+#define N_BUCKETS           ((64 - N_SUB_BUCKETS_LOG2 + 1) * N_SUB_BUCKETS)
+
+typedef struct {
+    gchar      *name;
+    guint64     n_launches;
+    guint64     n_samples;
+    guint64     total;          /* of all samples in ns */
+    guint64     buckets[N_BUCKETS];
+} KernelStats;
+
+typedef struct {
+    cl_event     event;
+    KernelStats *stats;         /* NULL stops the sampler */
+    UfoProfilerPrivate *priv;
+} KernelSample;
+
 struct _UfoProfilerPrivate {
     GArray  *event_array;
     GTimer **timers;
     GList   *trace_events;
     gboolean trace;
+    UfoTraceWriter *trace_writer;
+    UfoTraceWriter *opencl_writer;
+    GHashTable *kernel_names;   /* cl_kernel -> interned name + 1 */
+    guint    track;
+    guint    process_name;
+    guint    generate_name;
+    gdouble  gpu_time;          /* of events already written */
+    guint    sample_rate;
+    GHashTable *kernel_stats;   /* kernel name -> KernelStats */
+    GHashTable *kernel_aliases; /* retained cl_kernel -> KernelStats */
+    GMutex   stats_lock;
+    GCond    collected;
+    guint    n_pending;         /* samples not yet collected */
+    TransferCounters transfers[UFO_BUFFER_TRANSFER_LAST];
+    guint64  n_round_trips;
+    guint64  round_trip_bytes;
 };
 
 enum {
@@ -68,6 +146,13 @@ enum {
 };
 
 static GTimer *global_clock = NULL;
+static GPrivate current_profiler;
+
+/* One sampler thread serves all profilers that are sampling */
+static GAsyncQueue *samples = NULL;
+static GThread *sampler = NULL;
+static guint n_sampling = 0;
+G_LOCK_DEFINE_STATIC (sampler);
 
 
 /**
@@ -79,6 +164,7 @@ static GTimer *global_clock = NULL;
  *  time to fetch data from the queues.
  * @UFO_PROFILER_TIMER_RELEASE: Select timer that measures the synchronization
  *  time to push data to the queues.
+ * @UFO_PROFILER_TIMER_SETUP: Select timer that measures the setup of a task.
  * @UFO_PROFILER_TIMER_LAST: Auxiliary value, do not use.
  *
  * Use these values to select a specific timer when calling
@@ -98,6 +184,178 @@ ufo_profiler_new (void)
     return UFO_PROFILER (g_object_new (UFO_TYPE_PROFILER, NULL));
 }
 
+static void write_opencl_events (UfoProfilerPrivate *priv, gboolean wait);
+
+static cl_int
+enqueue (cl_command_queue queue,
+         cl_kernel kernel,
+         guint work_dim,
+         const gsize *global_work_size,
+         const gsize *local_work_size,
+         cl_event *event)
+{
+    /* An explicit local size may be required by the kernel, keep it */
+    if (local_work_size != NULL)
+        return clEnqueueNDRangeKernel (queue, kernel, work_dim, NULL, global_work_size, local_work_size, 0, NULL, event);
+
+    return ufo_tuner_enqueue (queue, kernel, work_dim, global_work_size, (gpointer *) event);
+}
+
+static guint
+get_bucket (guint64 duration)
+{
+    guint exponent;
+
+    if (duration < N_SUB_BUCKETS)
+        return (guint) duration;
+
+    exponent = g_bit_storage (duration) - 1;
+
+    return (exponent - N_SUB_BUCKETS_LOG2 + 1) * N_SUB_BUCKETS +
+           (guint) ((duration >> (exponent - N_SUB_BUCKETS_LOG2)) & (N_SUB_BUCKETS - 1));
+}
+
+static gdouble
+get_bucket_value (guint bucket)
+{
+    guint64 width;
+
+    if (bucket < N_SUB_BUCKETS)
+        return (gdouble) bucket;
+
+    /* Middle of the bucket */
+    width = G_GUINT64_CONSTANT (1) << (bucket / N_SUB_BUCKETS - 1);
+    return (gdouble) ((N_SUB_BUCKETS + bucket % N_SUB_BUCKETS) * width) + width / 2.0;
+}
+
+static gdouble
+get_percentile (KernelStats *stats, gdouble fraction)
+{
+    guint64 rank;
+    guint64 seen = 0;
+
+    if (stats->n_samples == 0)
+        return 0.0;
+
+    /* Nearest rank, i.e. the smallest sample that is not below @fraction */
+    rank = (guint64) (fraction * stats->n_samples);
+
+    if (rank < fraction * stats->n_samples || rank == 0)
+        rank++;
+
+    for (guint i = 0; i < N_BUCKETS; i++) {
+        seen += stats->buckets[i];
+
+        if (seen >= rank)
+            return get_bucket_value (i) * 1e-9;
+    }
+
+    return get_bucket_value (N_BUCKETS - 1) * 1e-9;
+}
+
+static gpointer
+collect_samples (GAsyncQueue *queue)
+{
+    KernelSample *sample;
+
+    while ((sample = g_async_queue_pop (queue))->stats != NULL) {
+        UfoProfilerPrivate *priv = sample->priv;
+        cl_ulong start = 0;
+        cl_ulong end = 0;
+        guint64 duration;
+
+        UFO_RESOURCES_CHECK_CLERR (clWaitForEvents (1, &sample->event));
+        UFO_RESOURCES_CHECK_CLERR (clGetEventProfilingInfo (sample->event, CL_PROFILING_COMMAND_START, sizeof (cl_ulong), &start, NULL));
+        UFO_RESOURCES_CHECK_CLERR (clGetEventProfilingInfo (sample->event, CL_PROFILING_COMMAND_END, sizeof (cl_ulong), &end, NULL));
+        UFO_RESOURCES_CHECK_CLERR (clReleaseEvent (sample->event));
+        duration = end >= start ? end - start : 0;
+
+        g_mutex_lock (&priv->stats_lock);
+        sample->stats->n_samples++;
+        sample->stats->total += duration;
+        sample->stats->buckets[MIN (get_bucket (duration), N_BUCKETS - 1)]++;
+        priv->n_pending--;
+        g_cond_broadcast (&priv->collected);
+        g_mutex_unlock (&priv->stats_lock);
+
+        g_free (sample);
+    }
+
+    g_free (sample);
+    return NULL;
+}
+
+static void
+acquire_sampler (void)
+{
+    G_LOCK (sampler);
+
+    if (n_sampling++ == 0) {
+        if (samples == NULL)
+            samples = g_async_queue_new ();
+
+        sampler = g_thread_new ("ufo-kernel-sampler", (GThreadFunc) collect_samples, samples);
+    }
+
+    G_UNLOCK (sampler);
+}
+
+static void
+release_sampler (void)
+{
+    G_LOCK (sampler);
+
+    if (--n_sampling == 0) {
+        g_async_queue_push (samples, g_new0 (KernelSample, 1));
+        g_thread_join (sampler);
+        sampler = NULL;
+    }
+
+    G_UNLOCK (sampler);
+}
+
+static gchar *get_kernel_name (cl_kernel kernel);
+
+/*
+ * Count a call of @kernel and return its statistics if the call should be
+ * sampled. Copies of a kernel, e.g. one per thread, share the statistics of
+ * their name.
+ */
+static KernelStats *
+count_launch (UfoProfilerPrivate *priv, cl_kernel kernel)
+{
+    KernelStats *stats;
+    gboolean sampled;
+
+    g_mutex_lock (&priv->stats_lock);
+    stats = g_hash_table_lookup (priv->kernel_aliases, kernel);
+
+    if (stats == NULL) {
+        gchar *name;
+
+        name = get_kernel_name (kernel);
+        stats = g_hash_table_lookup (priv->kernel_stats, name);
+
+        if (stats == NULL) {
+            stats = g_new0 (KernelStats, 1);
+            stats->name = name;
+            g_hash_table_insert (priv->kernel_stats, stats->name, stats);
+        }
+        else
+            g_free (name);
+
+        /* Keep the kernel alive so that its address is not re-used */
+        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (kernel));
+        g_hash_table_insert (priv->kernel_aliases, kernel, stats);
+    }
+
+    sampled = priv->sample_rate > 0 && stats->n_launches % priv->sample_rate == 0;
+    stats->n_launches++;
+    g_mutex_unlock (&priv->stats_lock);
+
+    return sampled ? stats : NULL;
+}
+
 static void
 _ufo_profiler_call (UfoProfiler    *profiler,
                     gpointer        command_queue,
@@ -108,6 +366,7 @@ _ufo_profiler_call (UfoProfiler    *profiler,
                     gboolean        block)
 {
     UfoProfilerPrivate *priv;
+    KernelStats        *stats = NULL;
     cl_int              cl_err;
     cl_event            event;
 
@@ -117,26 +376,55 @@ _ufo_profiler_call (UfoProfiler    *profiler,
     if (priv->trace) {
         struct EventRow row;
 
-        cl_err = clEnqueueNDRangeKernel (command_queue, kernel, work_dim, NULL, global_work_size, local_work_size, 0, NULL, &event);
+        cl_err = enqueue (command_queue, kernel, work_dim, global_work_size, local_work_size, &event);
 
         row.event = event;
         row.kernel = kernel;
+        row.name = NULL;
         row.queue = command_queue;
         g_array_append_val (priv->event_array, row);
+
+        if (priv->opencl_writer != NULL)
+            write_opencl_events (priv, FALSE);
     }
     else {
-        cl_err = clEnqueueNDRangeKernel (command_queue, kernel, work_dim, NULL, global_work_size, local_work_size, 0, NULL, &event);
+        if (priv->sample_rate > 0)
+            stats = count_launch (priv, kernel);
+
+        /* Only ask for an event if somebody is going to look at it */
+        cl_err = enqueue (command_queue, kernel, work_dim, global_work_size, local_work_size,
+                          block || stats != NULL ? &event : NULL);
+
+        if (stats != NULL && cl_err == CL_SUCCESS) {
+            KernelSample *sample;
+
+            sample = g_new0 (KernelSample, 1);
+            sample->event = event;
+            sample->stats = stats;
+            sample->priv = priv;
+            UFO_RESOURCES_CHECK_CLERR (clRetainEvent (event));
+
+            g_mutex_lock (&priv->stats_lock);
+            priv->n_pending++;
+            g_mutex_unlock (&priv->stats_lock);
+
+            g_async_queue_push (samples, sample);
+        }
     }
 
     UFO_RESOURCES_CHECK_CLERR (cl_err);
 
+    if (cl_err != CL_SUCCESS)
+        return;
+
     if (block) {
         /* Wait for the kernel to finish */
         UFO_RESOURCES_CHECK_CLERR (clWaitForEvents (1, &event));
-        /* Let the tracing handle the event if enabled */
-        if (!priv->trace) {
-            UFO_RESOURCES_CHECK_CLERR (clReleaseEvent (event));
-        }
+    }
+
+    /* Let the tracing handle the event if enabled */
+    if (!priv->trace && (block || stats != NULL)) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseEvent (event));
     }
 }
 
@@ -148,8 +436,9 @@ _ufo_profiler_call (UfoProfiler    *profiler,
  * @work_dim: Number of working dimensions.
  * @global_work_size: Sizes of global dimensions. The array must have at least
  *      @work_dim entries.
- * @local_work_size: Sizes of local work group dimensions. The array must have
- *      at least @work_dim entries.
+ * @local_work_size: (allow-none): Sizes of local work group dimensions. The
+ *      array must have at least @work_dim entries. If %NULL, a tuned local
+ *      size is used.
  *
  * Execute the @kernel using the command queue and execution parameters. The
  * event associated with the clEnqueueNDRangeKernel() call is recorded and may
@@ -174,8 +463,9 @@ ufo_profiler_call (UfoProfiler    *profiler,
  * @work_dim: Number of working dimensions.
  * @global_work_size: Sizes of global dimensions. The array must have at least
  *      @work_dim entries.
- * @local_work_size: Sizes of local work group dimensions. The array must have
- *      at least @work_dim entries.
+ * @local_work_size: (allow-none): Sizes of local work group dimensions. The
+ *      array must have at least @work_dim entries. If %NULL, a tuned local
+ *      size is used.
  *
  * Execute the @kernel using the command queue and execution parameters and wait
  * for the kernel to finish. The event associated with the
@@ -216,6 +506,7 @@ ufo_profiler_register_event (UfoProfiler *profiler,
         struct EventRow row;
         row.event = event;
         row.kernel = kernel;
+        row.name = NULL;
         row.queue = command_queue;
         g_array_append_val (priv->event_array, row);
     }
@@ -272,6 +563,17 @@ ufo_profiler_trace_event (UfoProfiler *profiler,
     if (!profiler->priv->trace)
         return;
 
+    if (profiler->priv->trace_writer != NULL) {
+        UfoProfilerPrivate *priv = profiler->priv;
+
+        ufo_trace_writer_add (priv->trace_writer,
+                              type & UFO_TRACE_EVENT_BEGIN ? 'B' : 'E',
+                              type & UFO_TRACE_EVENT_PROCESS ? priv->process_name : priv->generate_name,
+                              priv->track, 1,
+                              (guint64) (g_timer_elapsed (global_clock, NULL) * 1e9), 0);
+        return;
+    }
+
     event = g_malloc0 (sizeof(UfoTraceEvent));
     event->type = type;
     event->thread_id = g_thread_self ();
@@ -295,6 +597,278 @@ ufo_profiler_enable_tracing (UfoProfiler *profiler,
     profiler->priv->trace = enable;
 }
 
+/**
+ * ufo_profiler_set_trace_writers: (skip)
+ * @profiler: A #UfoProfiler object
+ * @trace_writer: (allow-none): A #UfoTraceWriter for trace events or %NULL
+ * @opencl_writer: (allow-none): A #UfoTraceWriter for OpenCL events or %NULL
+ * @track: Name under which the trace events of @profiler appear
+ *
+ * Stream trace events into @trace_writer and kernel events into
+ * @opencl_writer while tracing is enabled instead of keeping them in memory.
+ * Kernel events are written as soon as they have completed and are not
+ * reported by ufo_profiler_foreach() anymore. Passing %NULL writes all
+ * outstanding kernel events and detaches the writers.
+ */
+void
+ufo_profiler_set_trace_writers (UfoProfiler *profiler,
+                                UfoTraceWriter *trace_writer,
+                                UfoTraceWriter *opencl_writer,
+                                const gchar *track)
+{
+    UfoProfilerPrivate *priv;
+
+    g_return_if_fail (UFO_IS_PROFILER (profiler));
+    priv = profiler->priv;
+
+    if (priv->opencl_writer != NULL)
+        write_opencl_events (priv, TRUE);
+
+    g_hash_table_remove_all (priv->kernel_names);
+    priv->trace_writer = trace_writer;
+    priv->opencl_writer = opencl_writer;
+
+    if (trace_writer != NULL) {
+        priv->track = ufo_trace_writer_intern (trace_writer, track);
+        priv->process_name = ufo_trace_writer_intern (trace_writer, "process");
+        priv->generate_name = ufo_trace_writer_intern (trace_writer, "generate");
+    }
+}
+
+/**
+ * ufo_profiler_set_sample_rate:
+ * @profiler: A #UfoProfiler object
+ * @rate: Sample every @rate-th call of a kernel or 0 to stop sampling
+ *
+ * Record the run time of the first and then every @rate-th call of each
+ * kernel launched through @profiler while tracing is disabled. Kernels are
+ * told apart by their function name. The measurements are collected on a
+ * background thread shared by all profilers and can be queried with
+ * ufo_profiler_foreach_kernel_stats() at any time. Stopping waits until all
+ * outstanding measurements have been collected, the statistics are kept until
+ * sampling is started again. The rate should not be changed while kernels
+ * are launched through @profiler.
+ */
+void
+ufo_profiler_set_sample_rate (UfoProfiler *profiler,
+                              guint rate)
+{
+    UfoProfilerPrivate *priv;
+    gboolean sampling;
+
+    g_return_if_fail (UFO_IS_PROFILER (profiler));
+    priv = profiler->priv;
+
+    g_mutex_lock (&priv->stats_lock);
+    sampling = priv->sample_rate > 0;
+    priv->sample_rate = 0;
+
+    while (priv->n_pending > 0)
+        g_cond_wait (&priv->collected, &priv->stats_lock);
+
+    /* Statistics stay, the kernels are not needed to look them up anymore */
+    g_hash_table_remove_all (priv->kernel_aliases);
+    g_mutex_unlock (&priv->stats_lock);
+
+    if (sampling)
+        release_sampler ();
+
+    if (rate > 0) {
+        acquire_sampler ();
+
+        g_mutex_lock (&priv->stats_lock);
+        g_hash_table_remove_all (priv->kernel_stats);
+        priv->sample_rate = rate;
+        g_mutex_unlock (&priv->stats_lock);
+    }
+}
+
+/**
+ * ufo_profiler_foreach_kernel_stats:
+ * @profiler: A #UfoProfiler object
+ * @func: (scope call): The function to be called for each kernel
+ * @user_data: User parameters
+ *
+ * Calls @func with the statistics of each kernel sampled since the last call
+ * to ufo_profiler_set_sample_rate(). @func must not call back into @profiler.
+ */
+void
+ufo_profiler_foreach_kernel_stats (UfoProfiler *profiler,
+                                   UfoProfilerKernelFunc func,
+                                   gpointer user_data)
+{
+    UfoProfilerPrivate *priv;
+    GHashTableIter iter;
+    KernelStats *stats;
+
+    g_return_if_fail (UFO_IS_PROFILER (profiler));
+    priv = profiler->priv;
+
+    g_mutex_lock (&priv->stats_lock);
+    g_hash_table_iter_init (&iter, priv->kernel_stats);
+
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &stats)) {
+        func (stats->name, stats->n_launches, stats->n_samples, stats->total * 1e-9,
+              get_percentile (stats, 0.5), get_percentile (stats, 0.99), user_data);
+    }
+
+    g_mutex_unlock (&priv->stats_lock);
+}
+
+/*
+ * Make @profiler the one that buffer transfers on the calling thread are
+ * accounted to until it is reset with %NULL.
+ */
+void
+ufo_profiler_set_current (UfoProfiler *profiler)
+{
+    g_private_set (&current_profiler, profiler);
+}
+
+/*
+ * Return the profiler set with ufo_profiler_set_current() on the calling
+ * thread or %NULL.
+ */
+UfoProfiler *
+ufo_profiler_get_current (void)
+{
+    return g_private_get (&current_profiler);
+}
+
+/*
+ * Count a transfer and trace its @event, which may be %NULL, if tracing is
+ * enabled. The duration is added separately with
+ * ufo_profiler_add_transfer_time() once the transfer has finished.
+ */
+void
+ufo_profiler_add_transfer (UfoProfiler *profiler,
+                           UfoBufferTransfer transfer,
+                           gsize n_bytes,
+                           gpointer command_queue,
+                           gpointer event)
+{
+    UfoProfilerPrivate *priv;
+
+    g_return_if_fail (UFO_IS_PROFILER (profiler));
+    g_return_if_fail (transfer < UFO_BUFFER_TRANSFER_LAST);
+
+    priv = profiler->priv;
+    __atomic_fetch_add (&priv->transfers[transfer].n_transfers, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add (&priv->transfers[transfer].n_bytes, n_bytes, __ATOMIC_RELAXED);
+
+    if (priv->trace && event != NULL) {
+        struct EventRow row;
+
+        UFO_RESOURCES_CHECK_CLERR (clRetainEvent (event));
+        row.event = event;
+        row.kernel = NULL;
+        row.name = transfer_names[transfer];
+        row.queue = command_queue;
+        g_array_append_val (priv->event_array, row);
+
+        if (priv->opencl_writer != NULL)
+            write_opencl_events (priv, FALSE);
+    }
+}
+
+void
+ufo_profiler_add_transfer_time (UfoProfiler *profiler,
+                                UfoBufferTransfer transfer,
+                                guint64 duration)
+{
+    g_return_if_fail (UFO_IS_PROFILER (profiler));
+    g_return_if_fail (transfer < UFO_BUFFER_TRANSFER_LAST);
+    __atomic_fetch_add (&profiler->priv->transfers[transfer].time, duration, __ATOMIC_RELAXED);
+}
+
+void
+ufo_profiler_add_round_trip (UfoProfiler *profiler,
+                             gsize n_bytes)
+{
+    g_return_if_fail (UFO_IS_PROFILER (profiler));
+    __atomic_fetch_add (&profiler->priv->n_round_trips, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add (&profiler->priv->round_trip_bytes, n_bytes, __ATOMIC_RELAXED);
+}
+
+void
+ufo_profiler_reset_transfers (UfoProfiler *profiler)
+{
+    UfoProfilerPrivate *priv;
+
+    g_return_if_fail (UFO_IS_PROFILER (profiler));
+    priv = profiler->priv;
+
+    for (guint i = 0; i < UFO_BUFFER_TRANSFER_LAST; i++) {
+        __atomic_store_n (&priv->transfers[i].n_transfers, 0, __ATOMIC_RELAXED);
+        __atomic_store_n (&priv->transfers[i].n_bytes, 0, __ATOMIC_RELAXED);
+        __atomic_store_n (&priv->transfers[i].time, 0, __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n (&priv->n_round_trips, 0, __ATOMIC_RELAXED);
+    __atomic_store_n (&priv->round_trip_bytes, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * ufo_profiler_get_transfer_counters:
+ * @profiler: A #UfoProfiler object
+ * @transfer: Direction of the transfers
+ * @n_transfers: (out) (allow-none): Location for the number of transfers
+ * @n_bytes: (out) (allow-none): Location for the number of bytes moved
+ * @time: (out) (allow-none): Location for the device time in seconds
+ *
+ * Get the buffer transfers in direction @transfer made by the task that owns
+ * @profiler since it was last set up. The time only includes transfers that
+ * have finished and been waited for or superseded by another transfer.
+ */
+void
+ufo_profiler_get_transfer_counters (UfoProfiler *profiler,
+                                    UfoBufferTransfer transfer,
+                                    guint64 *n_transfers,
+                                    guint64 *n_bytes,
+                                    gdouble *time)
+{
+    TransferCounters *counters;
+
+    g_return_if_fail (UFO_IS_PROFILER (profiler));
+    g_return_if_fail (transfer < UFO_BUFFER_TRANSFER_LAST);
+
+    counters = &profiler->priv->transfers[transfer];
+
+    if (n_transfers != NULL)
+        *n_transfers = __atomic_load_n (&counters->n_transfers, __ATOMIC_RELAXED);
+
+    if (n_bytes != NULL)
+        *n_bytes = __atomic_load_n (&counters->n_bytes, __ATOMIC_RELAXED);
+
+    if (time != NULL)
+        *time = __atomic_load_n (&counters->time, __ATOMIC_RELAXED) * 1e-9;
+}
+
+/**
+ * ufo_profiler_get_round_trips:
+ * @profiler: A #UfoProfiler object
+ * @n_round_trips: (out) (allow-none): Location for the number of round trips
+ * @n_bytes: (out) (allow-none): Location for the bytes uploaded again
+ *
+ * Get how often the task that owns @profiler uploaded buffer data that had
+ * been downloaded to the host before, by this or an earlier task, and was not
+ * changed on the host since. Each round trip costs two transfers that could
+ * likely be avoided by keeping the work on the device.
+ */
+void
+ufo_profiler_get_round_trips (UfoProfiler *profiler,
+                              guint64 *n_round_trips,
+                              guint64 *n_bytes)
+{
+    g_return_if_fail (UFO_IS_PROFILER (profiler));
+
+    if (n_round_trips != NULL)
+        *n_round_trips = __atomic_load_n (&profiler->priv->n_round_trips, __ATOMIC_RELAXED);
+
+    if (n_bytes != NULL)
+        *n_bytes = __atomic_load_n (&profiler->priv->round_trip_bytes, __ATOMIC_RELAXED);
+}
+
 /**
  * ufo_profiler_get_trace_events: (skip)
  * @profiler: A #UfoProfiler object.
@@ -320,31 +894,113 @@ get_time_stamps (cl_event event, gulong *queued, gulong *submitted, gulong *star
     UFO_RESOURCES_CHECK_CLERR (clGetEventProfilingInfo (event, CL_PROFILING_COMMAND_END, sizeof (cl_ulong), end, NULL));
 }
 
+static gdouble
+get_duration (gulong start, gulong end)
+{
+    if (end < start)
+        return (gdouble) ((G_MAXULONG - start) + end) * 1e-9;
+
+    return ((gdouble) (end - start)) * 1e-9;
+}
+
+static gchar *
+get_kernel_name (cl_kernel kernel)
+{
+    gsize size;
+    gchar *s;
+
+    clGetKernelInfo (kernel, CL_KERNEL_FUNCTION_NAME, 0, NULL, &size);
+    s = g_malloc0(size + 1);
+    clGetKernelInfo (kernel, CL_KERNEL_FUNCTION_NAME, size, s, NULL);
+    return s;
+}
+
+static gpointer
+get_row_key (struct EventRow *row)
+{
+    return row->kernel != NULL ? (gpointer) row->kernel : (gpointer) row->name;
+}
+
+static gchar *
+get_row_name (struct EventRow *row)
+{
+    return row->kernel != NULL ? get_kernel_name (row->kernel) : g_strdup (row->name);
+}
+
+/*
+ * Write completed kernel events to the OpenCL trace writer and release them.
+ * Events complete in order per queue, so scanning stops at the first pending
+ * one unless @wait is set.
+ */
+static void
+write_opencl_events (UfoProfilerPrivate *priv, gboolean wait)
+{
+    guint n_written = 0;
+
+    for (guint i = 0; i < priv->event_array->len; i++) {
+        struct EventRow *row;
+        gulong start, end;
+        gpointer name;
+
+        row = &g_array_index (priv->event_array, struct EventRow, i);
+
+        if (!wait) {
+            cl_int status;
+
+            UFO_RESOURCES_CHECK_CLERR (clGetEventInfo (row->event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                                       sizeof (cl_int), &status, NULL));
+
+            if (status != CL_COMPLETE)
+                break;
+        }
+
+        if (!g_hash_table_lookup_extended (priv->kernel_names, get_row_key (row), NULL, &name)) {
+            gchar *kernel_name;
+
+            kernel_name = get_row_name (row);
+            name = GUINT_TO_POINTER (ufo_trace_writer_intern (priv->opencl_writer, kernel_name));
+            g_hash_table_insert (priv->kernel_names, get_row_key (row), name);
+            g_free (kernel_name);
+        }
+
+        get_time_stamps (row->event, NULL, NULL, &start, &end);
+        ufo_trace_writer_add (priv->opencl_writer, 'X', GPOINTER_TO_UINT (name), GPOINTER_TO_UINT (name),
+                              (guint64) (gsize) row->queue, start, end >= start ? end - start : 0);
+
+        if (row->kernel != NULL)
+            priv->gpu_time += get_duration (start, end);
+        UFO_RESOURCES_CHECK_CLERR (clReleaseEvent (row->event));
+        n_written++;
+    }
+
+    if (n_written > 0)
+        g_array_remove_range (priv->event_array, 0, n_written);
+}
+
 static gdouble
 gpu_elapsed (UfoProfilerPrivate *priv)
 {
     struct EventRow *row;
-    gdouble elapsed = 0.0;
+    gdouble elapsed = priv->gpu_time;
     guint len = priv->event_array->len;
 
     if (len == 0)
-        return 0.0;
+        return elapsed;
 
     for (guint i = 0; i < len; i++) {
         gulong start, end;
 
         row = &g_array_index (priv->event_array, struct EventRow, i);
 
+        if (row->kernel == NULL)
+            continue;
+
         UFO_RESOURCES_CHECK_CLERR (clGetEventInfo (row->event, CL_EVENT_COMMAND_QUEUE,
                                                    sizeof (cl_command_queue), &row->queue,
                                                    NULL));
 
         get_time_stamps (row->event, NULL, NULL, &start, &end);
-
-        if (end < start)
-            elapsed += (gdouble) ((G_MAXULONG - start) + end) * 1e-9;
-        else
-            elapsed += ((gdouble) (end - start)) * 1e-9;
+        elapsed += get_duration (start, end);
     }
 
     return elapsed;
@@ -371,18 +1027,6 @@ ufo_profiler_elapsed (UfoProfiler       *profiler,
     return g_timer_elapsed (profiler->priv->timers[timer], NULL);
 }
 
-static gchar *
-get_kernel_name (cl_kernel kernel)
-{
-    gsize size;
-    gchar *s;
-
-    clGetKernelInfo (kernel, CL_KERNEL_FUNCTION_NAME, 0, NULL, &size);
-    s = g_malloc0(size + 1);
-    clGetKernelInfo (kernel, CL_KERNEL_FUNCTION_NAME, size, s, NULL);
-    return s;
-}
-
 /**
  * ufo_profiler_foreach:
  * @profiler: A #UfoProfiler object
@@ -411,11 +1055,11 @@ ufo_profiler_foreach (UfoProfiler    *profiler,
         gulong queued, submitted, start, end;
 
         row = &g_array_index (priv->event_array, struct EventRow, i);
-        name = g_hash_table_lookup (names, row->kernel);
+        name = g_hash_table_lookup (names, get_row_key (row));
 
         if (name == NULL) {
-            name = get_kernel_name (row->kernel);
-            g_hash_table_insert (names, row->kernel, name);
+            name = get_row_name (row);
+            g_hash_table_insert (names, get_row_key (row), name);
         }
 
         clGetEventInfo (row->event, CL_EVENT_COMMAND_QUEUE, sizeof (cl_command_queue), &queue, NULL);
@@ -426,9 +1070,24 @@ ufo_profiler_foreach (UfoProfiler    *profiler,
     g_hash_table_destroy (names);
 }
 
+static void
+free_kernel_stats (KernelStats *stats)
+{
+    g_free (stats->name);
+    g_free (stats);
+}
+
+static void
+release_kernel (cl_kernel kernel)
+{
+    UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (kernel));
+}
+
 static void
 ufo_profiler_dispose (GObject *object)
 {
+    /* Samples still refer to the statistics */
+    ufo_profiler_set_sample_rate (UFO_PROFILER (object), 0);
     G_OBJECT_CLASS (ufo_profiler_parent_class)->dispose (object);
 }
 
@@ -447,6 +1106,11 @@ ufo_profiler_finalize (GObject *object)
     }
 
     g_array_free (priv->event_array, TRUE);
+    g_hash_table_destroy (priv->kernel_names);
+    g_hash_table_destroy (priv->kernel_aliases);
+    g_hash_table_destroy (priv->kernel_stats);
+    g_mutex_clear (&priv->stats_lock);
+    g_cond_clear (&priv->collected);
 
     g_list_foreach (priv->trace_events, (GFunc) g_free, NULL);
     g_list_free (priv->trace_events);
@@ -479,6 +1143,15 @@ ufo_profiler_init (UfoProfiler *manager)
     priv->event_array = g_array_sized_new (FALSE, TRUE, sizeof(struct EventRow), 2048);
     priv->trace_events = NULL;
     priv->trace = FALSE;
+    priv->kernel_names = g_hash_table_new (g_direct_hash, g_direct_equal);
+    priv->kernel_stats = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                NULL, (GDestroyNotify) free_kernel_stats);
+    priv->kernel_aliases = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                                  (GDestroyNotify) release_kernel, NULL);
+    priv->sample_rate = 0;
+    priv->n_pending = 0;
+    g_mutex_init (&priv->stats_lock);
+    g_cond_init (&priv->collected);
 
     /* Setup timers for all events */
     priv->timers = g_new0 (GTimer *, UFO_PROFILER_TIMER_LAST);
@@ -25,6 +25,8 @@
 #endif
 
 #include <glib-object.h>
+#include <ufo/ufo-buffer.h>
+#include <ufo/ufo-trace.h>
 
 G_BEGIN_DECLS
 
@@ -72,6 +74,27 @@ typedef void (*UfoProfilerFunc) (const gchar *kernel,
                                  gulong end,
                                  gpointer user_data);
 
+/**
+ * UfoProfilerKernelFunc:
+ * @kernel: Kernel name
+ * @n_launches: Number of calls of @kernel
+ * @n_samples: Number of calls whose run time was measured
+ * @total: Sum of all measured run times in seconds
+ * @p50: Median run time in seconds
+ * @p99: 99th percentile of the run time in seconds
+ * @user_data: User data passed to ufo_profiler_foreach_kernel_stats().
+ *
+ * Specifies the type of functions passed to
+ * ufo_profiler_foreach_kernel_stats().
+ */
+typedef void (*UfoProfilerKernelFunc) (const gchar *kernel,
+                                       guint64 n_launches,
+                                       guint64 n_samples,
+                                       gdouble total,
+                                       gdouble p50,
+                                       gdouble p99,
+                                       gpointer user_data);
+
 /**
  * UfoProfilerClass:
  *
@@ -117,6 +140,7 @@ typedef enum {
     UFO_PROFILER_TIMER_GPU,
     UFO_PROFILER_TIMER_FETCH,
     UFO_PROFILER_TIMER_RELEASE,
+    UFO_PROFILER_TIMER_SETUP,
     UFO_PROFILER_TIMER_LAST
 } UfoProfilerTimer;
 
@@ -150,6 +174,28 @@ void         ufo_profiler_trace_event   (UfoProfiler        *profiler,
 void         ufo_profiler_enable_tracing
                                         (UfoProfiler        *profiler,
                                          gboolean            enable);
+void         ufo_profiler_set_trace_writers
+                                        (UfoProfiler        *profiler,
+                                         UfoTraceWriter     *trace_writer,
+                                         UfoTraceWriter     *opencl_writer,
+                                         const gchar        *track);
+void         ufo_profiler_set_sample_rate
+                                        (UfoProfiler        *profiler,
+                                         guint               rate);
+void         ufo_profiler_foreach_kernel_stats
+                                        (UfoProfiler        *profiler,
+                                         UfoProfilerKernelFunc func,
+                                         gpointer            user_data);
+void         ufo_profiler_get_transfer_counters
+                                        (UfoProfiler        *profiler,
+                                         UfoBufferTransfer   transfer,
+                                         guint64            *n_transfers,
+                                         guint64            *n_bytes,
+                                         gdouble            *time);
+void         ufo_profiler_get_round_trips
+                                        (UfoProfiler        *profiler,
+                                         guint64            *n_round_trips,
+                                         guint64            *n_bytes);
 GList       *ufo_profiler_get_trace_events
                                         (UfoProfiler        *profiler);
 gdouble      ufo_profiler_elapsed       (UfoProfiler        *profiler,
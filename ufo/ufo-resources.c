@@ -20,6 +20,7 @@
 #include "config.h"
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <gio/gio.h>
 #include <stdio.h>
 #include <string.h>
@@ -31,6 +32,7 @@
 #endif
 
 #include "ufo-resources.h"
+#include "ufo-buffer-pool.h"
 #include "ufo-gpu-node.h"
 #include "ufo-enums.h"
 #include "ufo-priv.h"
@@ -44,6 +46,18 @@
  * from disk or directly as a string. By default the kernel search path is in
  * `$datadir/ufo` but can be extended by the `UFO_KERNEL_PATH` environment
  * variable.
+ *
+ * Built programs are cached on disk as device binaries, so that subsequent
+ * processes skip the OpenCL compiler. Entries are keyed by the source, the
+ * contents of included headers, the build options and the device, driver and
+ * platform versions; binaries that fail to verify or load are removed and
+ * rebuilt. The cache lives in `$XDG_CACHE_HOME/ufo/kernels` unless the
+ * `UFO_KERNEL_CACHE_DIR` environment variable names another directory. Setting
+ * it to an empty string disables the cache.
+ *
+ * Kernels may be requested from several threads at once, e.g. from the
+ * setup() of different tasks. Distinct programs then compile in parallel,
+ * while requests for a program that is still being built wait for it.
  */
 
 static void ufo_resources_initable_iface_init (GInitableIface *iface);
@@ -77,6 +91,7 @@ struct _UfoResourcesPrivate {
 
     UfoDeviceType    device_type;
     gint             platform_index;
+    gboolean         pinned_host_memory;
 
     cl_platform_id   platform;
     cl_context       context;
@@ -88,20 +103,47 @@ struct _UfoResourcesPrivate {
 
     GList       *paths;         /* List of paths containing kernels and header files */
     GHashTable  *kernel_cache;
-    GHashTable  *programs;      /* Maps source to program */
+    GHashTable  *programs;      /* Maps options and source to ProgramEntry */
     GList       *kernels;
+    GMutex       lock;          /* Protects programs, kernels and kernel_cache */
+    GCond        built;         /* Signalled whenever a program entry is done */
     GString     *build_opts;
+    gchar       *cache_dir;     /* Program binary cache or NULL if disabled */
 };
 
+/*
+ * Programs are built outside the lock so that tasks can compile concurrently.
+ * Threads requesting a program that is still being built wait for it instead
+ * of building it a second time.
+ */
+typedef struct {
+    cl_program   program;
+    GError      *error;
+    gboolean     done;
+} ProgramEntry;
+
+typedef struct {
+    cl_program   program;
+    const gchar *options;
+    cl_device_id *devices;
+    cl_uint      n_devices;
+    cl_int       errcode;
+} BuildGroup;
+
 enum {
     PROP_0,
     PROP_PLATFORM_INDEX,
     PROP_DEVICE_TYPE,
+    PROP_PINNED_HOST_MEMORY,
     N_PROPERTIES
 };
 
 static GParamSpec *properties[N_PROPERTIES] = { NULL, };
 
+/* Serial number of each thread, unlike addresses these are never reused */
+static GPrivate thread_serial;
+static gsize n_threads = 0;
+
 const gchar *opencl_error_msgs[] = {
     "CL_SUCCESS",
     "CL_DEVICE_NOT_FOUND",
@@ -228,6 +270,16 @@ release_program (cl_program program)
     UFO_RESOURCES_CHECK_CLERR (clReleaseProgram (program));
 }
 
+static void
+free_program_entry (ProgramEntry *entry)
+{
+    if (entry->program != NULL)
+        release_program (entry->program);
+
+    g_clear_error (&entry->error);
+    g_free (entry);
+}
+
 static gchar *
 lookup_kernel_path (UfoResourcesPrivate *priv,
                   const gchar *filename)
@@ -562,20 +614,344 @@ handle_build_error (cl_program program,
     g_free (log);
 }
 
+static gchar *
+get_build_options (UfoResourcesPrivate *priv,
+                   guint device_index,
+                   const gchar *options)
+{
+    GString *build_options;
+
+    build_options = g_string_new (priv->build_opts->str);
+    opt_append_device_options (build_options, priv, device_index);
+    opt_append_include_paths (build_options, priv);
+
+    if (options != NULL) {
+        gchar *stripped_opts = g_strstrip (g_strdup (options));
+        g_string_append (build_options, " ");
+        g_string_append (build_options, stripped_opts);
+        g_free (stripped_opts);
+    }
+
+    return g_string_free (build_options, FALSE);
+}
+
+#define CACHE_MAGIC         "UFOCLBIN1\n"
+#define CACHE_DIGEST_LENGTH 64
+
+static void
+checksum_string (GChecksum *checksum,
+                 const gchar *str)
+{
+    /* Include the terminator so that adjacent strings cannot run together */
+    g_checksum_update (checksum, (const guchar *) str, strlen (str) + 1);
+}
+
+static void
+checksum_device_info (GChecksum *checksum,
+                      cl_device_id device,
+                      cl_device_info param)
+{
+    gsize size;
+    gchar *info;
+
+    UFO_RESOURCES_CHECK_CLERR (clGetDeviceInfo (device, param, 0, NULL, &size));
+    info = g_malloc0 (size + 1);
+    UFO_RESOURCES_CHECK_CLERR (clGetDeviceInfo (device, param, size, info, NULL));
+    checksum_string (checksum, info);
+    g_free (info);
+}
+
+static void
+checksum_includes (GChecksum *checksum,
+                   UfoResourcesPrivate *priv,
+                   const gchar *source,
+                   GHashTable *visited)
+{
+    static GRegex *regex = NULL;
+    GMatchInfo *match;
+
+    if (g_once_init_enter (&regex)) {
+        GRegex *include = g_regex_new ("^\\s*#\\s*include\\s*[\"<]([^\">]+)[\">]",
+                                       G_REGEX_MULTILINE | G_REGEX_OPTIMIZE, 0, NULL);
+        g_once_init_leave (&regex, include);
+    }
+
+    g_regex_match (regex, source, 0, &match);
+
+    while (g_match_info_matches (match)) {
+        gchar *name;
+        gchar *path;
+
+        name = g_match_info_fetch (match, 1);
+        path = lookup_kernel_path (priv, name);
+
+        /* System headers are not found and covered by the driver version */
+        if (path != NULL && !g_hash_table_contains (visited, path)) {
+            gchar *contents;
+
+            contents = read_file (path);
+            g_hash_table_add (visited, path);
+
+            if (contents != NULL) {
+                checksum_string (checksum, path);
+                checksum_string (checksum, contents);
+                checksum_includes (checksum, priv, contents, visited);
+                g_free (contents);
+            }
+        }
+        else {
+            g_free (path);
+        }
+
+        g_free (name);
+        g_match_info_next (match, NULL);
+    }
+
+    g_match_info_free (match);
+}
+
+/*
+ * Return the cache file names for each device or NULL if caching is disabled.
+ */
+static gchar **
+get_cache_filenames (UfoResourcesPrivate *priv,
+                     const gchar *source,
+                     gchar **build_options)
+{
+    GChecksum *sources;
+    GHashTable *visited;
+    gchar *platform_version;
+    gchar **filenames;
+    gsize size;
+
+    if (priv->cache_dir == NULL)
+        return NULL;
+
+    sources = g_checksum_new (G_CHECKSUM_SHA256);
+    visited = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    checksum_string (sources, source);
+    checksum_includes (sources, priv, source, visited);
+    g_hash_table_destroy (visited);
+
+    UFO_RESOURCES_CHECK_CLERR (clGetPlatformInfo (priv->platform, CL_PLATFORM_VERSION, 0, NULL, &size));
+    platform_version = g_malloc0 (size + 1);
+    UFO_RESOURCES_CHECK_CLERR (clGetPlatformInfo (priv->platform, CL_PLATFORM_VERSION, size, platform_version, NULL));
+
+    filenames = g_new0 (gchar *, priv->n_devices + 1);
+
+    for (guint i = 0; i < priv->n_devices; i++) {
+        GChecksum *checksum;
+        gchar *name;
+
+        checksum = g_checksum_copy (sources);
+        checksum_string (checksum, build_options[i]);
+        checksum_string (checksum, platform_version);
+        checksum_device_info (checksum, priv->devices[i], CL_DEVICE_NAME);
+        checksum_device_info (checksum, priv->devices[i], CL_DEVICE_VENDOR);
+        checksum_device_info (checksum, priv->devices[i], CL_DEVICE_VERSION);
+        checksum_device_info (checksum, priv->devices[i], CL_DRIVER_VERSION);
+
+        name = g_strdup_printf ("%s.bin", g_checksum_get_string (checksum));
+        filenames[i] = g_build_filename (priv->cache_dir, name, NULL);
+        g_checksum_free (checksum);
+        g_free (name);
+    }
+
+    g_free (platform_version);
+    g_checksum_free (sources);
+    return filenames;
+}
+
+/*
+ * Cache entries consist of a magic line, the SHA-256 of the binary and the
+ * binary itself. Truncated or otherwise damaged entries are removed.
+ */
+static guchar *
+read_cached_binary (const gchar *filename,
+                    gsize *size)
+{
+    gchar *contents;
+    gsize length;
+    gsize header_length;
+    gboolean valid = FALSE;
+
+    if (!g_file_get_contents (filename, &contents, &length, NULL))
+        return NULL;
+
+    header_length = strlen (CACHE_MAGIC) + CACHE_DIGEST_LENGTH + 1;
+
+    if (length > header_length && g_str_has_prefix (contents, CACHE_MAGIC)) {
+        gchar *digest;
+
+        digest = g_compute_checksum_for_data (G_CHECKSUM_SHA256,
+                                              (const guchar *) contents + header_length,
+                                              length - header_length);
+        valid = strncmp (digest, contents + strlen (CACHE_MAGIC), CACHE_DIGEST_LENGTH) == 0 &&
+            contents[header_length - 1] == '\n';
+        g_free (digest);
+    }
+
+    if (!valid) {
+        g_debug ("WARN Removing damaged program cache entry %s", filename);
+        g_unlink (filename);
+        g_free (contents);
+        return NULL;
+    }
+
+    *size = length - header_length;
+    memmove (contents, contents + header_length, *size);
+    return (guchar *) contents;
+}
+
+static void
+write_cached_binary (const gchar *filename,
+                     const guchar *binary,
+                     gsize size)
+{
+    GString *contents;
+    GError *error = NULL;
+    gchar *digest;
+
+    digest = g_compute_checksum_for_data (G_CHECKSUM_SHA256, binary, size);
+    contents = g_string_sized_new (size + strlen (CACHE_MAGIC) + CACHE_DIGEST_LENGTH + 1);
+    g_string_append (contents, CACHE_MAGIC);
+    g_string_append (contents, digest);
+    g_string_append_c (contents, '\n');
+    g_string_append_len (contents, (const gchar *) binary, size);
+
+    /* Writes to a temporary file and renames it, so readers never see partial entries */
+    if (!g_file_set_contents (filename, contents->str, contents->len, &error)) {
+        g_debug ("WARN Could not write program cache entry: %s", error->message);
+        g_error_free (error);
+    }
+
+    g_string_free (contents, TRUE);
+    g_free (digest);
+}
+
 static cl_program
-add_program_from_source (UfoResourcesPrivate *priv,
-                         const gchar *source,
-                         const gchar *options,
-                         GError **error)
+create_program_from_cache (UfoResourcesPrivate *priv,
+                           gchar **filenames)
 {
-    cl_program program;
+    cl_program program = NULL;
     cl_int errcode = CL_SUCCESS;
-    GTimer *timer;
+    guchar **binaries;
+    gsize *sizes;
+    cl_int *status;
+    guint i;
+
+    if (filenames == NULL)
+        return NULL;
 
-    program = g_hash_table_lookup (priv->programs, source);
+    binaries = g_new0 (guchar *, priv->n_devices);
+    sizes = g_new0 (gsize, priv->n_devices);
+    status = g_new0 (cl_int, priv->n_devices);
 
-    if (program != NULL)
-        return program;
+    for (i = 0; i < priv->n_devices; i++) {
+        binaries[i] = read_cached_binary (filenames[i], &sizes[i]);
+
+        if (binaries[i] == NULL)
+            goto exit;
+    }
+
+    program = clCreateProgramWithBinary (priv->context, priv->n_devices, priv->devices, sizes,
+                                         (const guchar **) binaries, status, &errcode);
+
+    if (errcode == CL_SUCCESS)
+        errcode = clBuildProgram (program, priv->n_devices, priv->devices, NULL, NULL, NULL);
+
+    if (errcode != CL_SUCCESS) {
+        g_debug ("WARN Discarding cached program binaries: %s", ufo_resources_clerr (errcode));
+
+        if (program != NULL)
+            release_program (program);
+
+        for (i = 0; i < priv->n_devices; i++)
+            g_unlink (filenames[i]);
+
+        program = NULL;
+    }
+
+exit:
+    for (i = 0; i < priv->n_devices; i++)
+        g_free (binaries[i]);
+
+    g_free (binaries);
+    g_free (sizes);
+    g_free (status);
+    return program;
+}
+
+static void
+store_program_in_cache (UfoResourcesPrivate *priv,
+                        cl_program program,
+                        gchar **filenames)
+{
+    cl_uint n_devices;
+    cl_device_id *devices;
+    gsize *sizes;
+    guchar **binaries;
+
+    if (filenames == NULL)
+        return;
+
+    if (g_mkdir_with_parents (priv->cache_dir, 0700) != 0) {
+        g_debug ("WARN Could not create program cache directory %s", priv->cache_dir);
+        return;
+    }
+
+    UFO_RESOURCES_CHECK_CLERR (clGetProgramInfo (program, CL_PROGRAM_NUM_DEVICES, sizeof (cl_uint), &n_devices, NULL));
+
+    devices = g_new0 (cl_device_id, n_devices);
+    sizes = g_new0 (gsize, n_devices);
+    binaries = g_new0 (guchar *, n_devices);
+
+    UFO_RESOURCES_CHECK_CLERR (clGetProgramInfo (program, CL_PROGRAM_DEVICES, n_devices * sizeof (cl_device_id), devices, NULL));
+    UFO_RESOURCES_CHECK_CLERR (clGetProgramInfo (program, CL_PROGRAM_BINARY_SIZES, n_devices * sizeof (gsize), sizes, NULL));
+
+    for (guint i = 0; i < n_devices; i++)
+        binaries[i] = g_malloc (MAX (sizes[i], 1));
+
+    UFO_RESOURCES_CHECK_CLERR (clGetProgramInfo (program, CL_PROGRAM_BINARIES, n_devices * sizeof (guchar *), binaries, NULL));
+
+    /* Binaries are reported in program device order, which need not be ours */
+    for (guint i = 0; i < n_devices; i++) {
+        for (guint j = 0; j < priv->n_devices; j++) {
+            if (devices[i] == priv->devices[j] && sizes[i] > 0)
+                write_cached_binary (filenames[j], binaries[i], sizes[i]);
+        }
+
+        g_free (binaries[i]);
+    }
+
+    g_free (binaries);
+    g_free (sizes);
+    g_free (devices);
+}
+
+static gpointer
+build_group (BuildGroup *group)
+{
+    group->errcode = clBuildProgram (group->program, group->n_devices, group->devices, group->options, NULL, NULL);
+    return NULL;
+}
+
+/*
+ * Devices whose build options match are built with a single call, which lets
+ * the driver share the front-end work. Distinct option sets, i.e. different
+ * device models, are built concurrently from separate threads.
+ */
+static cl_program
+build_program_from_source (UfoResourcesPrivate *priv,
+                           const gchar *source,
+                           gchar **build_options,
+                           GError **error)
+{
+    cl_program program;
+    cl_int errcode = CL_SUCCESS;
+    BuildGroup *groups;
+    GThread **threads;
+    guint n_groups = 0;
 
     program = clCreateProgramWithSource (priv->context, 1, &source, NULL, &errcode);
 
@@ -585,41 +961,136 @@ add_program_from_source (UfoResourcesPrivate *priv,
         return NULL;
     }
 
-    timer = g_timer_new ();
+    groups = g_new0 (BuildGroup, priv->n_devices);
 
     for (guint i = 0; i < priv->n_devices; i++) {
-        GString *build_options;
+        guint g = 0;
 
-        build_options = g_string_new (priv->build_opts->str);
-        opt_append_device_options (build_options, priv, i);
-        opt_append_include_paths (build_options, priv);
+        while (g < n_groups && g_strcmp0 (groups[g].options, build_options[i]))
+            g++;
 
-        if (options != NULL) {
-            gchar *stripped_opts = g_strstrip (g_strdup (options));
-            g_string_append (build_options, " ");
-            g_string_append (build_options, stripped_opts);
-            g_free (stripped_opts);
+        if (g == n_groups) {
+            groups[g].program = program;
+            groups[g].options = build_options[i];
+            groups[g].devices = g_new0 (cl_device_id, priv->n_devices);
+            n_groups++;
         }
 
-        errcode = clBuildProgram (program, 1, &priv->devices[i], build_options->str, NULL, NULL);
+        groups[g].devices[groups[g].n_devices++] = priv->devices[i];
+    }
+
+    threads = g_new0 (GThread *, n_groups);
 
-        if (errcode != CL_SUCCESS) {
-            handle_build_error (program, priv->devices[0], errcode, error);
-            return NULL;
+    for (guint g = 1; g < n_groups; g++)
+        threads[g] = g_thread_new ("ufo-build", (GThreadFunc) build_group, &groups[g]);
+
+    if (n_groups > 0)
+        build_group (&groups[0]);
+
+    for (guint g = 1; g < n_groups; g++)
+        g_thread_join (threads[g]);
+
+    for (guint g = 0; g < n_groups; g++) {
+        if (groups[g].errcode != CL_SUCCESS && program != NULL) {
+            handle_build_error (program, groups[g].devices[0], groups[g].errcode, error);
+            release_program (program);
+            program = NULL;
+        }
+        else if (program != NULL) {
+            g_debug ("INFO Built with `%s' for %i device(s)", groups[g].options, groups[g].n_devices);
         }
 
-        if (options)
-            g_debug ("INFO Built with `%s %s' for device %i", build_options->str, options, i);
-        else
-            g_debug ("INFO Built with `%s' for device %i", build_options->str, i);
+        g_free (groups[g].devices);
+    }
+
+    g_free (threads);
+    g_free (groups);
+    return program;
+}
+
+static cl_program
+build_program (UfoResourcesPrivate *priv,
+               const gchar *source,
+               const gchar *options,
+               GError **error)
+{
+    cl_program program;
+    gchar **build_options;
+    gchar **filenames;
+    GTimer *timer;
+
+    timer = g_timer_new ();
+    build_options = g_new0 (gchar *, priv->n_devices + 1);
+
+    for (guint i = 0; i < priv->n_devices; i++)
+        build_options[i] = get_build_options (priv, i, options);
 
-        g_string_free (build_options, TRUE);
+    filenames = get_cache_filenames (priv, source, build_options);
+    program = create_program_from_cache (priv, filenames);
+
+    if (program != NULL) {
+        g_debug ("INFO Loaded program binaries for %i devices in %3.5fs", priv->n_devices, g_timer_elapsed (timer, NULL));
+    }
+    else {
+        program = build_program_from_source (priv, source, build_options, error);
+
+        if (program != NULL) {
+            g_debug ("INFO Built program for %i devices in %3.5fs", priv->n_devices, g_timer_elapsed (timer, NULL));
+            store_program_in_cache (priv, program, filenames);
+        }
     }
 
-    g_timer_stop (timer);
-    g_debug ("INFO Built program for %i devices in %3.5fs", priv->n_devices, g_timer_elapsed (timer, NULL));
+    g_strfreev (filenames);
+    g_strfreev (build_options);
     g_timer_destroy (timer);
-    g_hash_table_insert (priv->programs, g_strdup (source), program);
+    return program;
+}
+
+static cl_program
+add_program_from_source (UfoResourcesPrivate *priv,
+                         const gchar *source,
+                         const gchar *options,
+                         GError **error)
+{
+    ProgramEntry *entry;
+    cl_program program;
+    GError *tmp_error = NULL;
+    gchar *key;
+
+    key = g_strconcat (options != NULL ? options : "", "\n", source, NULL);
+
+    g_mutex_lock (&priv->lock);
+    entry = g_hash_table_lookup (priv->programs, key);
+
+    if (entry != NULL) {
+        g_free (key);
+
+        while (!entry->done)
+            g_cond_wait (&priv->built, &priv->lock);
+
+        if (entry->error != NULL)
+            g_propagate_error (error, g_error_copy (entry->error));
+
+        program = entry->program;
+        g_mutex_unlock (&priv->lock);
+        return program;
+    }
+
+    entry = g_new0 (ProgramEntry, 1);
+    g_hash_table_insert (priv->programs, key, entry);
+    g_mutex_unlock (&priv->lock);
+
+    program = build_program (priv, source, options, &tmp_error);
+
+    g_mutex_lock (&priv->lock);
+    entry->program = program;
+    entry->error = tmp_error != NULL ? g_error_copy (tmp_error) : NULL;
+    entry->done = TRUE;
+    g_cond_broadcast (&priv->built);
+    g_mutex_unlock (&priv->lock);
+
+    if (tmp_error != NULL)
+        g_propagate_error (error, tmp_error);
 
     return program;
 }
@@ -652,6 +1123,7 @@ get_first_kernel_name (const gchar *source)
 static cl_kernel
 create_kernel (UfoResourcesPrivate *priv,
                cl_program program,
+               const gchar *source,
                const gchar *kernel_name,
                GError **error)
 {
@@ -659,19 +1131,11 @@ create_kernel (UfoResourcesPrivate *priv,
     gchar *name;
     cl_int errcode = CL_SUCCESS;
 
-    if (kernel_name == NULL) {
-        gchar *source;
-        gsize size;
-
-        UFO_RESOURCES_CHECK_CLERR (clGetProgramInfo (program, CL_PROGRAM_SOURCE, 0, NULL, &size));
-        source = g_malloc0 (size);
-        UFO_RESOURCES_CHECK_CLERR (clGetProgramInfo (program, CL_PROGRAM_SOURCE, size, source, NULL));
+    /* Programs loaded from binaries do not know their source */
+    if (kernel_name == NULL)
         name = get_first_kernel_name (source);
-        g_free (source);
-    }
-    else {
+    else
         name = g_strdup (kernel_name);
-    }
 
     kernel = clCreateKernel (program, name, &errcode);
     g_free (name);
@@ -682,7 +1146,9 @@ create_kernel (UfoResourcesPrivate *priv,
         return NULL;
     }
 
+    g_mutex_lock (&priv->lock);
     priv->kernels = g_list_append (priv->kernels, kernel);
+    g_mutex_unlock (&priv->lock);
     return kernel;
 }
 
@@ -749,7 +1215,7 @@ ufo_resources_get_kernel (UfoResources *resources,
         goto exit;
 
     g_debug ("INFO Compiled `%s' kernel from %s", kernel, path);
-    result = create_kernel (priv, program, kernel, error);
+    result = create_kernel (priv, program, buffer, kernel, error);
 
 exit:
     g_free (buffer);
@@ -790,7 +1256,7 @@ ufo_resources_get_kernel_from_source (UfoResources *resources,
         return NULL;
 
     g_debug ("INFO Added program %p from source", (gpointer) program);
-    return create_kernel (priv, program, kernel, error);
+    return create_kernel (priv, program, source, kernel, error);
 }
 
 /**
@@ -826,7 +1292,9 @@ ufo_resources_get_cached_kernel (UfoResources *resources,
         gchar *cache_key;
 
         cache_key = create_cache_key (filename, kernelname);
+        g_mutex_lock (&priv->lock);
         kernel = g_hash_table_lookup (priv->kernel_cache, cache_key);
+        g_mutex_unlock (&priv->lock);
 
         if (kernel != NULL) {
             g_free (cache_key);
@@ -840,12 +1308,129 @@ ufo_resources_get_cached_kernel (UfoResources *resources,
         gchar *cache_key;
 
         cache_key = create_cache_key (filename, kernelname);
+        g_mutex_lock (&priv->lock);
         g_hash_table_insert (priv->kernel_cache, cache_key, kernel);
+        g_mutex_unlock (&priv->lock);
     }
 
     return kernel;
 }
 
+static gsize
+get_thread_serial (void)
+{
+    gsize serial;
+
+    serial = GPOINTER_TO_SIZE (g_private_get (&thread_serial));
+
+    if (serial == 0) {
+        serial = __atomic_add_fetch (&n_threads, 1, __ATOMIC_RELAXED);
+        g_private_set (&thread_serial, GSIZE_TO_POINTER (serial));
+    }
+
+    return serial;
+}
+
+/*
+ * Look up the instance of @kernel from either @filename or @source that
+ * belongs to the calling thread or create it. Like all other kernels it is
+ * released together with @resources.
+ */
+static cl_kernel
+get_thread_kernel (UfoResources *resources,
+                   const gchar *filename,
+                   const gchar *source,
+                   const gchar *kernel,
+                   GError **error)
+{
+    UfoResourcesPrivate *priv;
+    cl_kernel result;
+    gchar *cache_key;
+
+    priv = resources->priv;
+    cache_key = g_strdup_printf ("%s:%s:%" G_GSIZE_FORMAT, filename != NULL ? filename : source,
+                                 kernel, get_thread_serial ());
+
+    g_mutex_lock (&priv->lock);
+    result = g_hash_table_lookup (priv->kernel_cache, cache_key);
+    g_mutex_unlock (&priv->lock);
+
+    if (result != NULL) {
+        g_free (cache_key);
+        return result;
+    }
+
+    if (filename != NULL)
+        result = ufo_resources_get_kernel (resources, filename, kernel, NULL, error);
+    else
+        result = ufo_resources_get_kernel_from_source (resources, source, kernel, NULL, error);
+
+    if (result == NULL) {
+        g_free (cache_key);
+        return NULL;
+    }
+
+    g_mutex_lock (&priv->lock);
+    g_hash_table_insert (priv->kernel_cache, cache_key, result);
+    g_mutex_unlock (&priv->lock);
+
+    return result;
+}
+
+/**
+ * ufo_resources_get_thread_kernel:
+ * @resources: A #UfoResources object
+ * @filename: Name of the .cl kernel file
+ * @kernel: Name of a kernel
+ * @error: Return location for a GError from #UfoResourcesError, or %NULL
+ *
+ * Like ufo_resources_get_cached_kernel() but the kernel object is private to
+ * the calling thread. Its arguments can be set and the kernel enqueued without
+ * a lock while other threads use their own instances. All instances are
+ * created from the same program, which is built only once. The kernel is
+ * released with @resources.
+ *
+ * Returns: (transfer none): a cl_kernel object that is load from @filename or
+ *  %NULL on error
+ */
+gpointer
+ufo_resources_get_thread_kernel (UfoResources *resources,
+                                 const gchar *filename,
+                                 const gchar *kernel,
+                                 GError **error)
+{
+    g_return_val_if_fail (UFO_IS_RESOURCES (resources) &&
+                          (filename != NULL) && (kernel != NULL), NULL);
+
+    return get_thread_kernel (resources, filename, NULL, kernel, error);
+}
+
+/**
+ * ufo_resources_get_thread_kernel_from_source:
+ * @resources: A #UfoResources object
+ * @source: OpenCL source string
+ * @kernel: Name of a kernel
+ * @error: Return location for a GError from #UfoResourcesError, or %NULL
+ *
+ * Like ufo_resources_get_thread_kernel() but builds the kernel from @source.
+ * This is meant for generated code that is requested repeatedly, the program
+ * is built only once per source string.
+ *
+ * Returns: (transfer none): a cl_kernel object built from @source or %NULL on
+ *  error
+ */
+gpointer
+ufo_resources_get_thread_kernel_from_source (UfoResources *resources,
+                                             const gchar *source,
+                                             const gchar *kernel,
+                                             GError **error)
+{
+    g_return_val_if_fail (UFO_IS_RESOURCES (resources) &&
+                          (source != NULL) && (kernel != NULL), NULL);
+
+    return get_thread_kernel (resources, NULL, source, kernel, error);
+}
+
 /**
  * ufo_resources_get_kernel_source:
  * @resources: A #UfoResources object
@@ -990,6 +1575,13 @@ ufo_resources_set_property (GObject *object,
             priv->device_type = g_value_get_flags (value);
             break;
 
+        case PROP_PINNED_HOST_MEMORY:
+            priv->pinned_host_memory = g_value_get_boolean (value);
+
+            if (priv->context != NULL)
+                ufo_buffer_set_pinned_default (priv->context, priv->pinned_host_memory);
+            break;
+
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -1013,6 +1605,10 @@ ufo_resources_get_property (GObject *object,
             g_value_set_flags (value, priv->device_type);
             break;
 
+        case PROP_PINNED_HOST_MEMORY:
+            g_value_set_boolean (value, priv->pinned_host_memory);
+            break;
+
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -1050,6 +1646,8 @@ ufo_resources_finalize (GObject *object)
     g_list_free_full (priv->kernels, (GDestroyNotify) release_kernel);
 
     g_hash_table_destroy (priv->programs);
+    g_mutex_clear (&priv->lock);
+    g_cond_clear (&priv->built);
 
     if (priv->device_names != NULL) {
         for (guint i = 0; i < priv->n_devices; i++)
@@ -1057,12 +1655,16 @@ ufo_resources_finalize (GObject *object)
     }
 
     if (priv->context) {
+        ufo_buffer_set_pinned_default (priv->context, FALSE);
+        ufo_buffer_pool_purge (ufo_buffer_pool_get_default (), priv->context);
+        ufo_buffer_release_programs (priv->context);
         g_debug ("FREE context=%p", (gpointer) priv->context);
         UFO_RESOURCES_CHECK_CLERR (clReleaseContext (priv->context));
     }
 
     g_string_free (priv->build_opts, TRUE);
 
+    g_free (priv->cache_dir);
     g_free (priv->device_names);
     g_free (priv->devices);
 
@@ -1148,6 +1750,20 @@ ufo_resources_class_init (UfoResourcesClass *klass)
                             UFO_TYPE_DEVICE_TYPE, UFO_DEVICE_GPU,
                             G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
 
+    /**
+     * UfoResources:pinned-host-memory:
+     *
+     * Back the host arrays of all buffers created from now on for the context
+     * of these resources with page-locked memory. Buffers of other contexts
+     * are not affected. See ufo_buffer_set_pinned() for details.
+     */
+    properties[PROP_PINNED_HOST_MEMORY] =
+        g_param_spec_boolean ("pinned-host-memory",
+                              "Allocate page-locked host memory for buffers",
+                              "Allocate page-locked host memory for buffers",
+                              FALSE,
+                              G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (oclass, i, properties[i]);
 
@@ -1159,15 +1775,18 @@ ufo_resources_init (UfoResources *self)
 {
     UfoResourcesPrivate *priv;
     const gchar *kernel_path;
+    const gchar *cache_dir;
     gchar **kernel_paths;
     gchar **path;
 
     self->priv = priv = UFO_RESOURCES_GET_PRIVATE (self);
 
     priv->construct_error = NULL;
-    priv->programs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) release_program);
+    priv->programs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) free_program_entry);
     priv->kernels = NULL;
     priv->kernel_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    g_mutex_init (&priv->lock);
+    g_cond_init (&priv->built);
     priv->build_opts = g_string_new ("-cl-mad-enable ");
 
     priv->paths = g_list_append (NULL, g_strdup ("."));
@@ -1188,8 +1807,16 @@ ufo_resources_init (UfoResources *self)
         g_free (kernel_paths);
     }
 
+    cache_dir = g_getenv ("UFO_KERNEL_CACHE_DIR");
+
+    if (cache_dir == NULL)
+        priv->cache_dir = g_build_filename (g_get_user_cache_dir (), "ufo", "kernels", NULL);
+    else
+        priv->cache_dir = *cache_dir ? g_strdup (cache_dir) : NULL;
+
     priv->device_type = UFO_DEVICE_GPU;
     priv->platform_index = -1;
+    priv->pinned_host_memory = FALSE;
 
     initialize_opencl (priv);
 }
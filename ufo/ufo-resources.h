@@ -149,6 +149,15 @@ gpointer         ufo_resources_get_cached_kernel        (UfoResources   *resourc
                                                          const gchar    *filename,
                                                          const gchar    *kernel,
                                                          GError        **error);
+gpointer         ufo_resources_get_thread_kernel        (UfoResources   *resources,
+                                                         const gchar    *filename,
+                                                         const gchar    *kernel,
+                                                         GError        **error);
+gpointer         ufo_resources_get_thread_kernel_from_source
+                                                        (UfoResources   *resources,
+                                                         const gchar    *source,
+                                                         const gchar    *kernel,
+                                                         GError        **error);
 gchar          * ufo_resources_get_kernel_source        (UfoResources   *resources,
                                                          const gchar    *filename,
                                                          GError        **error);
@@ -54,16 +54,47 @@ G_DEFINE_TYPE (UfoScheduler, ufo_scheduler, UFO_TYPE_BASE_SCHEDULER)
 
 #define UFO_SCHEDULER_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), UFO_TYPE_SCHEDULER, UfoSchedulerPrivate))
 
+/*
+ * Where several copies of an expanded path join, a gather receives from all of
+ * their groups and uses the sequence number stamped by the generator to emit
+ * frames in order. Each copy delivers its frames in order, so a copy that sent
+ * a frame ahead of the next expected one cannot deliver the missing frame and
+ * is not read from until that frame is emitted. Therefore at most one buffer
+ * per copy is held back. While waiting for any of several copies, the groups
+ * wake the gather up through a counter of sent buffers.
+ */
+typedef struct {
+    UfoGroup       **groups;
+    UfoTask         *task;
+    GMutex           lock;
+    GCond            cond;
+    guint64          n_sent;
+    UfoBuffer      **held;
+    guint64         *held_seq;
+    gboolean        *finished;
+    guint            n_groups;
+    guint            source;
+    guint64          next;
+    guint            n_out_of_order;
+    guint64          max_distance;
+    guint            n_gaps;
+} Gather;
+
 typedef struct {
     UfoTask         *task;
     UfoTaskMode      mode;
     guint            n_inputs;
     guint           *dims;
     gboolean        *finished;
+    Gather         **gathers;
     gboolean         strict;
     gboolean         timestamps;
+    gboolean         ordered;
+    guint64          sequence;
 } TaskLocalData;
 
+#define SEQUENCE_KEY    "seq"
+
 
 struct _UfoSchedulerPrivate {
     gboolean ran;
@@ -93,6 +124,159 @@ ufo_scheduler_new (void)
     return UFO_BASE_SCHEDULER (g_object_new (UFO_TYPE_SCHEDULER, NULL));
 }
 
+static void
+gather_notify (Gather *gather)
+{
+    g_mutex_lock (&gather->lock);
+    gather->n_sent++;
+    g_cond_signal (&gather->cond);
+    g_mutex_unlock (&gather->lock);
+}
+
+static Gather *
+gather_new (GList *groups,
+            UfoTask *task)
+{
+    Gather *gather;
+    GList *it;
+    guint i = 0;
+
+    gather = g_new0 (Gather, 1);
+    gather->task = task;
+    gather->n_groups = g_list_length (groups);
+    gather->groups = g_new0 (UfoGroup *, gather->n_groups);
+    gather->held = g_new0 (UfoBuffer *, gather->n_groups);
+    gather->held_seq = g_new0 (guint64, gather->n_groups);
+    gather->finished = g_new0 (gboolean, gather->n_groups);
+    g_mutex_init (&gather->lock);
+    g_cond_init (&gather->cond);
+
+    g_list_for (groups, it) {
+        gather->groups[i++] = UFO_GROUP (it->data);
+        ufo_group_set_notify (UFO_GROUP (it->data), task, (UfoGroupNotify) gather_notify, gather);
+    }
+
+    return gather;
+}
+
+static void
+gather_free (Gather *gather)
+{
+    for (guint i = 0; i < gather->n_groups; i++)
+        ufo_group_set_notify (gather->groups[i], gather->task, NULL, NULL);
+
+    g_mutex_clear (&gather->lock);
+    g_cond_clear (&gather->cond);
+    g_free (gather->groups);
+    g_free (gather->held);
+    g_free (gather->held_seq);
+    g_free (gather->finished);
+    g_free (gather);
+}
+
+static UfoBuffer *
+gather_pop_any (Gather *gather,
+                UfoTask *task,
+                guint *source)
+{
+    for (;;) {
+        guint64 n_sent;
+
+        g_mutex_lock (&gather->lock);
+        n_sent = gather->n_sent;
+        g_mutex_unlock (&gather->lock);
+
+        for (guint i = 0; i < gather->n_groups; i++) {
+            UfoBuffer *buffer;
+
+            if (gather->held[i] != NULL || gather->finished[i])
+                continue;
+
+            buffer = ufo_group_try_pop_input_buffer (gather->groups[i], task);
+
+            if (buffer != NULL) {
+                *source = i;
+                return buffer;
+            }
+        }
+
+        /* Anything sent after we looked changes the counter */
+        g_mutex_lock (&gather->lock);
+
+        while (gather->n_sent == n_sent)
+            g_cond_wait (&gather->cond, &gather->lock);
+
+        g_mutex_unlock (&gather->lock);
+    }
+}
+
+static UfoBuffer *
+gather_pop (Gather *gather,
+            UfoTask *task)
+{
+    for (;;) {
+        UfoBuffer *buffer;
+        GValue *value;
+        guint64 seq = 0;
+        guint oldest = gather->n_groups;
+        guint source = 0;
+        guint n_candidates = 0;
+
+        for (guint i = 0; i < gather->n_groups; i++) {
+            if (gather->held[i] != NULL) {
+                if (oldest == gather->n_groups || gather->held_seq[i] < gather->held_seq[oldest])
+                    oldest = i;
+            }
+            else if (!gather->finished[i]) {
+                n_candidates++;
+                source = i;
+            }
+        }
+
+        /* Emit the oldest held frame if it is next or nothing else can come */
+        if (oldest < gather->n_groups &&
+            (gather->held_seq[oldest] == gather->next || n_candidates == 0)) {
+            if (gather->held_seq[oldest] != gather->next)
+                gather->n_gaps++;
+
+            buffer = gather->held[oldest];
+            gather->held[oldest] = NULL;
+            gather->next = gather->held_seq[oldest] + 1;
+            gather->source = oldest;
+            return buffer;
+        }
+
+        if (n_candidates == 0)
+            return UFO_END_OF_STREAM;
+
+        if (n_candidates == 1)
+            buffer = ufo_group_pop_input_buffer (gather->groups[source], task);
+        else
+            buffer = gather_pop_any (gather, task, &source);
+
+        if (buffer == UFO_END_OF_STREAM) {
+            gather->finished[source] = TRUE;
+            continue;
+        }
+
+        value = ufo_buffer_get_metadata (buffer, SEQUENCE_KEY);
+
+        /* Unnumbered and late frames are passed on as they come */
+        if (value == NULL || (seq = g_value_get_uint64 (value)) <= gather->next) {
+            if (value != NULL && seq == gather->next)
+                gather->next++;
+
+            gather->source = source;
+            return buffer;
+        }
+
+        gather->held[source] = buffer;
+        gather->held_seq[source] = seq;
+        gather->n_out_of_order++;
+        gather->max_distance = MAX (gather->max_distance, seq - gather->next);
+    }
+}
+
 static gboolean
 get_inputs (TaskLocalData *tld,
             UfoBuffer **inputs)
@@ -106,9 +290,24 @@ get_inputs (TaskLocalData *tld,
 
         if (!tld->finished[i]) {
             UfoBuffer *input;
+            gint64 start;
 
-            group = ufo_task_node_get_current_in_group (node, i);
-            input = ufo_group_pop_input_buffer (group, tld->task);
+            start = g_get_monotonic_time ();
+
+            if (tld->gathers[i] != NULL) {
+                input = gather_pop (tld->gathers[i], tld->task);
+                group = tld->gathers[i]->groups[tld->gathers[i]->source];
+            }
+            else {
+                group = ufo_task_node_get_current_in_group (node, i);
+                input = ufo_group_pop_input_buffer (group, tld->task);
+            }
+
+            if (input != UFO_END_OF_STREAM) {
+                ufo_task_node_account_input (node, i, ufo_buffer_get_size (input),
+                                             (guint64) (g_get_monotonic_time () - start),
+                                             ufo_group_get_num_queued (group, tld->task));
+            }
 
             if (tld->strict && input != UFO_END_OF_STREAM) {
                 ufo_buffer_get_requisition (input, &req);
@@ -143,12 +342,35 @@ release_inputs (TaskLocalData *tld,
     for (guint i = 0; i < tld->n_inputs; i++) {
         UfoGroup *group;
 
-        group = ufo_task_node_get_current_in_group (node, i);
-        ufo_group_push_input_buffer (group, tld->task, inputs[i]);
+        /* Finished inputs keep their last buffer which was already released */
+        if (!tld->finished[i]) {
+            if (tld->gathers[i] != NULL)
+                group = tld->gathers[i]->groups[tld->gathers[i]->source];
+            else
+                group = ufo_task_node_get_current_in_group (node, i);
+
+            ufo_group_push_input_buffer (group, tld->task, inputs[i]);
+        }
+
         ufo_task_node_switch_in_group (node, i);
     }
 }
 
+static UfoBuffer *
+pop_output_buffer (UfoTaskNode *node,
+                   UfoGroup *group,
+                   UfoRequisition *requisition)
+{
+    UfoBuffer *output;
+    gint64 start;
+
+    start = g_get_monotonic_time ();
+    output = ufo_group_pop_output_buffer (group, requisition);
+    ufo_task_node_add_to_counter (node, UFO_TASK_NODE_COUNTER_RELEASE_TIME,
+                                  (guint64) (g_get_monotonic_time () - start));
+    return output;
+}
+
 static gpointer
 run_task (TaskLocalData *tld)
 {
@@ -188,7 +410,7 @@ run_task (TaskLocalData *tld)
             break;
 
         if (produces) {
-            output = ufo_group_pop_output_buffer (group, &requisition);
+            output = pop_output_buffer (node, group, &requisition);
             g_assert (output != NULL);
         }
 
@@ -224,7 +446,7 @@ run_task (TaskLocalData *tld)
 
                         if (go_on) {
                             ufo_group_push_output_buffer (group, output);
-                            output = ufo_group_pop_output_buffer (group, &requisition);
+                            output = pop_output_buffer (node, group, &requisition);
                         }
                     } while (go_on);
                 } while (active);
@@ -241,6 +463,14 @@ run_task (TaskLocalData *tld)
                         ufo_buffer_set_metadata (output, "ts", &v);
                     }
 
+                    if (tld->ordered) {
+                        GValue v = { 0, };
+
+                        g_value_init (&v, G_TYPE_UINT64);
+                        g_value_set_uint64 (&v, tld->sequence++);
+                        ufo_buffer_set_metadata (output, SEQUENCE_KEY, &v);
+                    }
+
                     active = ufo_task_generate (tld->task, output, &requisition);
 
                 }
@@ -283,8 +513,22 @@ cleanup_task_local_data (TaskLocalData **tlds,
 
         ufo_task_node_reset (UFO_TASK_NODE (tld->task));
 
+        for (guint j = 0; j < tld->n_inputs; j++) {
+            Gather *gather = tld->gathers[j];
+
+            if (gather == NULL)
+                continue;
+
+            g_debug ("INFO Gather %s input %u: out-of-order=%u max-distance=%" G_GUINT64_FORMAT " gaps=%u",
+                     ufo_task_node_get_identifier (UFO_TASK_NODE (tld->task)), j,
+                     gather->n_out_of_order, gather->max_distance, gather->n_gaps);
+
+            gather_free (gather);
+        }
+
         g_free (tld->dims);
         g_free (tld->finished);
+        g_free (tld->gathers);
         g_free (tld);
     }
 
@@ -361,6 +605,11 @@ setup_tasks (UfoBaseScheduler *scheduler,
     nodes = ufo_graph_get_nodes (UFO_GRAPH (task_graph));
     n_nodes = g_list_length (nodes);
 
+    if (!ufo_base_scheduler_setup_tasks (scheduler, nodes, resources, error)) {
+        g_list_free (nodes);
+        return NULL;
+    }
+
     tlds = g_new0 (TaskLocalData *, n_nodes);
 
     for (guint i = 0; i < n_nodes; i++) {
@@ -372,7 +621,6 @@ setup_tasks (UfoBaseScheduler *scheduler,
         tld->task = UFO_TASK (node);
         tlds[i] = tld;
 
-        ufo_task_setup (tld->task, resources, error);
         tld->mode = ufo_task_get_mode (tld->task);
         tld->n_inputs = ufo_task_get_num_inputs (tld->task);
         tld->dims = g_new0 (guint, tld->n_inputs);
@@ -389,6 +637,7 @@ setup_tasks (UfoBaseScheduler *scheduler,
         }
 
         tld->finished = g_new0 (gboolean, tld->n_inputs);
+        tld->gathers = g_new0 (Gather *, tld->n_inputs);
 
         if (error && *error != NULL) {
             return NULL;
@@ -410,6 +659,7 @@ setup_groups (UfoBaseScheduler *scheduler,
     GList *nodes;
     GList *it;
     cl_context context;
+    guint default_depth;
 
     groups = NULL;
     nodes = ufo_graph_get_nodes (UFO_GRAPH (task_graph));
@@ -419,6 +669,7 @@ setup_groups (UfoBaseScheduler *scheduler,
         return NULL;
 
     context = ufo_resources_get_context (resources);
+    g_object_get (scheduler, "queue-depth", &default_depth, NULL);
 
     g_list_for (nodes, it) {
         GList *successors;
@@ -439,6 +690,7 @@ setup_groups (UfoBaseScheduler *scheduler,
             UfoNode *target;
             gpointer label;
             guint input;
+            guint depth;
 
             target = UFO_NODE (jt->data);
             label = ufo_graph_get_edge_label (UFO_GRAPH (task_graph), node, target);
@@ -447,6 +699,14 @@ setup_groups (UfoBaseScheduler *scheduler,
             ufo_group_set_num_expected (group, UFO_TASK (target),
                                         ufo_task_node_get_num_expected (UFO_TASK_NODE (target),
                                                                         input));
+
+            depth = ufo_task_node_get_queue_depth (UFO_TASK_NODE (target), input);
+
+            if (depth == 0)
+                depth = default_depth;
+
+            if (depth > 0)
+                ufo_group_set_queue_depth (group, UFO_TASK (target), depth);
         }
 
         g_list_free (successors);
@@ -456,6 +716,87 @@ setup_groups (UfoBaseScheduler *scheduler,
     return groups;
 }
 
+static void
+setup_gathers (UfoTaskGraph *task_graph,
+               TaskLocalData **tlds,
+               guint n_nodes)
+{
+    gboolean have_gathers = FALSE;
+
+    for (guint i = 0; i < n_nodes; i++) {
+        TaskLocalData *tld = tlds[i];
+        GList *predecessors;
+
+        predecessors = ufo_graph_get_predecessors (UFO_GRAPH (task_graph), UFO_NODE (tld->task));
+
+        for (guint j = 0; j < tld->n_inputs; j++) {
+            GList *groups = NULL;
+            GList *it;
+
+            g_list_for (predecessors, it) {
+                gpointer label;
+
+                label = ufo_graph_get_edge_label (UFO_GRAPH (task_graph), UFO_NODE (it->data),
+                                                  UFO_NODE (tld->task));
+
+                if (GPOINTER_TO_INT (label) == (gint) j)
+                    groups = g_list_append (groups, ufo_task_node_get_out_group (UFO_TASK_NODE (it->data)));
+            }
+
+            if (g_list_length (groups) > 1) {
+                tld->gathers[j] = gather_new (groups, tld->task);
+                have_gathers = TRUE;
+            }
+
+            g_list_free (groups);
+        }
+
+        g_list_free (predecessors);
+    }
+
+    /* Only number frames if anyone is going to look at the numbers */
+    for (guint i = 0; i < n_nodes; i++) {
+        TaskLocalData *tld = tlds[i];
+
+        tld->ordered = have_gathers && (tld->mode & UFO_TASK_MODE_GENERATOR);
+        tld->sequence = 0;
+    }
+}
+
+static void
+log_queue_statistics (UfoTaskGraph *task_graph)
+{
+    GList *nodes;
+    GList *it;
+
+    nodes = ufo_graph_get_nodes (UFO_GRAPH (task_graph));
+
+    g_list_for (nodes, it) {
+        UfoTaskNode *node;
+        UfoGroup *group;
+        GList *successors;
+        GList *jt;
+
+        node = UFO_TASK_NODE (it->data);
+        group = ufo_task_node_get_out_group (node);
+        successors = ufo_graph_get_successors (UFO_GRAPH (task_graph), UFO_NODE (node));
+
+        g_list_for (successors, jt) {
+            UfoTaskNode *target = UFO_TASK_NODE (jt->data);
+
+            g_debug ("INFO Queue %s-%p -> %s-%p: depth=%u high-water=%u",
+                     ufo_task_node_get_plugin_name (node), (gpointer) node,
+                     ufo_task_node_get_plugin_name (target), (gpointer) target,
+                     ufo_group_get_queue_depth (group, UFO_TASK (target)),
+                     ufo_group_get_high_water_mark (group, UFO_TASK (target)));
+        }
+
+        g_list_free (successors);
+    }
+
+    g_list_free (nodes);
+}
+
 static gboolean
 correct_connections (UfoTaskGraph *graph,
                      GError **error)
@@ -536,10 +877,14 @@ ufo_scheduler_run (UfoBaseScheduler *scheduler,
     GThread **threads;
     TaskLocalData **tlds;
     gboolean expand;
+    gboolean ordered;
 
     priv = UFO_SCHEDULER_GET_PRIVATE (scheduler);
 
-    g_object_get (scheduler, "expand", &expand, NULL);
+    g_object_get (scheduler,
+                  "expand", &expand,
+                  "ordered", &ordered,
+                  NULL);
 
     graph = task_graph;
     resources = ufo_base_scheduler_get_resources (scheduler, error);
@@ -574,6 +919,10 @@ ufo_scheduler_run (UfoBaseScheduler *scheduler,
         return;
 
     n_nodes = ufo_graph_get_num_nodes (UFO_GRAPH (graph));
+
+    if (ordered)
+        setup_gathers (graph, tlds, n_nodes);
+
     threads = g_new0 (GThread *, n_nodes);
 
     /* Spawn threads */
@@ -601,6 +950,8 @@ ufo_scheduler_run (UfoBaseScheduler *scheduler,
     join_threads (threads, n_nodes, error);
 #endif
 
+    log_queue_statistics (graph);
+
     /* Cleanup */
     cleanup_task_local_data (tlds, n_nodes);
     g_list_foreach (groups, (GFunc) g_object_unref, NULL);
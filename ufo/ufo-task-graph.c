@@ -227,6 +227,11 @@ get_json_representation (UfoTaskGraph *graph,
             json_object_set_int_member (to_object, "input", port);
             json_object_set_object_member (edge_object, "to", to_object);
             json_object_set_object_member (edge_object, "from", from_object);
+
+            if (ufo_task_node_get_queue_depth (UFO_TASK_NODE (to), (guint) port) > 0)
+                json_object_set_int_member (edge_object, "depth",
+                                            ufo_task_node_get_queue_depth (UFO_TASK_NODE (to), (guint) port));
+
             json_array_add_object_element (edges, edge_object);
         }
 
@@ -333,26 +338,114 @@ nodes_with_common_ancestries (UfoTaskGraph *graph, GList *path)
     return result;
 }
 
-/**
- * ufo_task_graph_expand:
- * @graph: A #UfoTaskGraph
- * @resources: A #UfoResources objects
- * @n_gpus: Number of GPUs to expand the graph for
- *
- * Expands @graph in a way that most of the resources in @graph can be occupied.
- * In the simple pipeline case, the longest possible GPU paths are duplicated as
- * much as there are GPUs in @arch_graph.
- */
-void
-ufo_task_graph_expand (UfoTaskGraph *graph,
-                       UfoResources *resources,
-                       guint n_gpus)
+static gboolean
+is_replicable (UfoTaskGraph *graph, UfoNode *node)
+{
+    UfoTaskMode mode;
+    UfoNode *predecessor;
+    GList *predecessors;
+    gboolean result;
+
+    mode = ufo_task_get_mode (UFO_TASK (node));
+
+    if (((mode & UFO_TASK_MODE_TYPE_MASK) != UFO_TASK_MODE_PROCESSOR) ||
+        (mode & UFO_TASK_MODE_GPU) ||
+        ufo_task_get_num_inputs (UFO_TASK (node)) != 1 ||
+        ufo_node_get_total (node) > 1)
+        return FALSE;
+
+    if (ufo_graph_get_num_predecessors (UFO_GRAPH (graph), node) != 1 ||
+        ufo_graph_get_num_successors (UFO_GRAPH (graph), node) != 1)
+        return FALSE;
+
+    /* The predecessor must scatter to the copies and nobody else */
+    predecessors = ufo_graph_get_predecessors (UFO_GRAPH (graph), node);
+    predecessor = UFO_NODE (predecessors->data);
+    g_list_free (predecessors);
+
+    result = ufo_graph_get_num_successors (UFO_GRAPH (graph), predecessor) == 1 &&
+             ufo_task_node_get_send_pattern (UFO_TASK_NODE (predecessor)) == UFO_SEND_SCATTER;
+
+    return result;
+}
+
+static void
+replicate_cpu_tasks (UfoTaskGraph *graph,
+                     guint n_cpus)
+{
+    GList *nodes;
+    GList *candidates = NULL;
+    GList *it;
+    guint n_automatic = 0;
+
+    nodes = ufo_graph_get_nodes (UFO_GRAPH (graph));
+
+    g_list_for (nodes, it) {
+        UfoNode *node;
+        guint replicas;
+
+        node = UFO_NODE (it->data);
+
+        if (!is_replicable (graph, node))
+            continue;
+
+        g_object_get (node, "replicas", &replicas, NULL);
+
+        if (replicas == 0 && (ufo_task_get_mode (UFO_TASK (node)) & UFO_TASK_MODE_STATELESS))
+            n_automatic++;
+        else if (replicas <= 1)
+            continue;
+
+        candidates = g_list_append (candidates, node);
+    }
+
+    g_list_for (candidates, it) {
+        UfoNode *node;
+        GList *predecessors;
+        GList *successors;
+        GList *path;
+        guint replicas;
+
+        node = UFO_NODE (it->data);
+        g_object_get (node, "replicas", &replicas, NULL);
+
+        /* Share the cores among all stateless tasks that did not ask for a number */
+        if (replicas == 0)
+            replicas = MAX (1, n_cpus / n_automatic);
+
+        predecessors = ufo_graph_get_predecessors (UFO_GRAPH (graph), node);
+        successors = ufo_graph_get_successors (UFO_GRAPH (graph), node);
+        path = g_list_append (NULL, predecessors->data);
+        path = g_list_append (path, node);
+        path = g_list_append (path, successors->data);
+
+        g_debug ("INFO Replicate %s %u times",
+                 ufo_task_node_get_identifier (UFO_TASK_NODE (node)), replicas);
+
+        /*
+         * The predecessor scatters round-robin to the copies in the order they
+         * were connected and the successor gathers in the same order, so the
+         * order of the stream is preserved.
+         */
+        for (guint i = 1; i < replicas; i++)
+            ufo_graph_expand (UFO_GRAPH (graph), path);
+
+        g_list_free (path);
+        g_list_free (predecessors);
+        g_list_free (successors);
+    }
+
+    g_list_free (candidates);
+    g_list_free (nodes);
+}
+
+static void
+expand_gpu_path (UfoTaskGraph *graph,
+                 guint n_gpus)
 {
     GList *path;
     GList *common;
 
-    g_return_if_fail (UFO_IS_TASK_GRAPH (graph));
-
     path = ufo_graph_find_longest_path (UFO_GRAPH (graph), (UfoFilterPredicate) is_gpu_task, NULL);
     common = nodes_with_common_ancestries (graph, path);
 
@@ -410,6 +503,34 @@ ufo_task_graph_expand (UfoTaskGraph *graph,
     g_list_free (path);
 }
 
+/**
+ * ufo_task_graph_expand:
+ * @graph: A #UfoTaskGraph
+ * @resources: A #UfoResources objects
+ * @n_gpus: Number of GPUs to expand the graph for
+ *
+ * Expands @graph in a way that most of the resources in @graph can be occupied.
+ * In the simple pipeline case, the longest possible GPU paths are duplicated as
+ * much as there are GPUs in @arch_graph.
+ *
+ * CPU processors with a single input that are fed by a single predecessor are
+ * replicated as well. The number of copies is taken from the "replicas"
+ * property of the node. If it is 0 and the task is marked with
+ * %UFO_TASK_MODE_STATELESS, the available cores are divided among all such
+ * tasks. Input data is scattered round-robin to the copies and gathered in the
+ * same order.
+ */
+void
+ufo_task_graph_expand (UfoTaskGraph *graph,
+                       UfoResources *resources,
+                       guint n_gpus)
+{
+    g_return_if_fail (UFO_IS_TASK_GRAPH (graph));
+
+    expand_gpu_path (graph, n_gpus);
+    replicate_cpu_tasks (graph, g_get_num_processors ());
+}
+
 /**
  * ufo_task_graph_fuse:
  * @graph: A #UfoTaskGraph
@@ -572,8 +693,33 @@ ufo_task_graph_connect_nodes_full (UfoTaskGraph *graph,
                                    UfoTaskNode *n2,
                                    guint input)
 {
-    g_debug ("CONN %s -> %s [input=%i]", ufo_task_node_get_identifier (n1), ufo_task_node_get_identifier (n2), input);
+    ufo_task_graph_connect_nodes_with_depth (graph, n1, n2, input, 0);
+}
+
+/**
+ * ufo_task_graph_connect_nodes_with_depth:
+ * @graph: A #UfoTaskGraph
+ * @n1: A source node
+ * @n2: A destination node
+ * @input: Input port of @n2
+ * @depth: Maximum number of buffers in flight between @n1 and @n2 or 0 to use
+ * the scheduler default
+ *
+ * Connect @n1 with @n2 using @n2's @input port and set the queue depth of that
+ * edge. See also ufo_task_node_set_queue_depth().
+ */
+void
+ufo_task_graph_connect_nodes_with_depth (UfoTaskGraph *graph,
+                                         UfoTaskNode *n1,
+                                         UfoTaskNode *n2,
+                                         guint input,
+                                         guint depth)
+{
+    g_debug ("CONN %s -> %s [input=%i, depth=%u]", ufo_task_node_get_identifier (n1), ufo_task_node_get_identifier (n2), input, depth);
     ufo_graph_connect_nodes (UFO_GRAPH (graph), UFO_NODE (n1), UFO_NODE (n2), GINT_TO_POINTER (input));
+
+    if (depth > 0)
+        ufo_task_node_set_queue_depth (n2, input, depth);
 }
 
 /**
@@ -808,6 +954,7 @@ handle_json_task_edge (JsonArray *array,
     UfoTaskNode *from_node, *to_node;
     JsonObject *from_object, *to_object;
     guint to_port;
+    guint depth;
     const gchar *from_name;
     const gchar *to_name;
     GError *error = NULL;
@@ -844,6 +991,11 @@ handle_json_task_edge (JsonArray *array,
     if (json_object_has_member (to_object, "input"))
         to_port = (guint) json_object_get_int_member (to_object, "input");
 
+    depth = 0;
+
+    if (json_object_has_member (edge, "depth"))
+        depth = (guint) json_object_get_int_member (edge, "depth");
+
     /* Get actual filters and connect them */
     from_node = g_hash_table_lookup (priv->json_nodes, from_name);
     to_node = g_hash_table_lookup (priv->json_nodes, to_name);
@@ -854,7 +1006,7 @@ handle_json_task_edge (JsonArray *array,
     if (to_node == NULL)
         g_error ("No filter `%s' defined", to_name);
 
-    ufo_task_graph_connect_nodes_full (graph, from_node, to_node, to_port);
+    ufo_task_graph_connect_nodes_with_depth (graph, from_node, to_node, to_port, depth);
 
     if (error != NULL)
         g_warning ("%s", error->message);
@@ -100,6 +100,11 @@ void         ufo_task_graph_connect_nodes_full  (UfoTaskGraph       *graph,
                                                  UfoTaskNode        *n1,
                                                  UfoTaskNode        *n2,
                                                  guint               input);
+void         ufo_task_graph_connect_nodes_with_depth (UfoTaskGraph   *graph,
+                                                      UfoTaskNode    *n1,
+                                                      UfoTaskNode    *n2,
+                                                      guint           input,
+                                                      guint           depth);
 void         ufo_task_graph_fuse                (UfoTaskGraph       *graph);
 void         ufo_task_graph_set_partition       (UfoTaskGraph       *graph,
                                                  guint               index,
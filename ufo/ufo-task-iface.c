@@ -25,6 +25,7 @@
 
 #include "ufo-task-iface.h"
 #include "ufo-task-node.h"
+#include "ufo-priv.h"
 
 /**
  * SECTION:ufo-task-iface
@@ -79,6 +80,44 @@ ufo_task_setup (UfoTask *task,
     }
 }
 
+/**
+ * ufo_task_share_setup:
+ * @task: A #UfoTask
+ * @origin: The #UfoTask from which @task was copied when expanding the graph
+ * @resources: A #UfoResources object
+ * @error: Location for a #GError or %NULL
+ *
+ * Let @task take over state that @origin prepared in its setup, e.g. a lookup
+ * table read from disk, instead of preparing it again. @origin is completely
+ * set up when this is called. Tasks opt in by implementing the share_setup
+ * method, by default nothing is shared.
+ *
+ * Returns: %TRUE if @task is ready to run, %FALSE if ufo_task_setup() must be
+ * called as usual.
+ */
+gboolean
+ufo_task_share_setup (UfoTask *task,
+                      UfoTask *origin,
+                      UfoResources *resources,
+                      GError **error)
+{
+    GError *tmp_error = NULL;
+    gboolean shared;
+
+    shared = UFO_TASK_GET_IFACE (task)->share_setup (task, origin, resources, &tmp_error);
+
+    if (tmp_error != NULL) {
+        g_propagate_prefixed_error (error, tmp_error,
+                                    "%s: ", ufo_task_node_get_plugin_name (UFO_TASK_NODE (task)));
+        return FALSE;
+    }
+
+    if (shared)
+        ufo_task_node_setup (UFO_TASK_NODE (task));
+
+    return shared;
+}
+
 void
 ufo_task_get_requisition (UfoTask *task,
                           UfoBuffer **inputs,
@@ -141,15 +180,32 @@ ufo_task_process (UfoTask *task,
                   UfoRequisition *requisition)
 {
     UfoProfiler *profiler;
+    UfoTaskNode *node;
     gboolean result;
+    gint64 start;
 
-    profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
+    node = UFO_TASK_NODE (task);
+    profiler = ufo_task_node_get_profiler (node);
     ufo_profiler_trace_event (profiler, UFO_TRACE_EVENT_PROCESS | UFO_TRACE_EVENT_BEGIN);
+    start = g_get_monotonic_time ();
+    ufo_profiler_set_current (profiler);
     result = UFO_TASK_GET_IFACE (task)->process (task, inputs, output, requisition);
+    ufo_profiler_set_current (NULL);
+    ufo_task_node_add_to_counter (node, UFO_TASK_NODE_COUNTER_PROCESS_TIME,
+                                  (guint64) (g_get_monotonic_time () - start));
     ufo_profiler_trace_event (profiler, UFO_TRACE_EVENT_PROCESS | UFO_TRACE_EVENT_END);
 
+    ufo_task_node_add_to_counter (node, UFO_TASK_NODE_COUNTER_FRAMES_IN, 1);
+
+    /* Reductors only produce output in generate */
+    if (result && output != NULL &&
+        (ufo_task_get_mode (task) & UFO_TASK_MODE_TYPE_MASK) == UFO_TASK_MODE_PROCESSOR) {
+        ufo_task_node_add_to_counter (node, UFO_TASK_NODE_COUNTER_FRAMES_OUT, 1);
+        ufo_task_node_add_to_counter (node, UFO_TASK_NODE_COUNTER_BYTES_OUT, ufo_buffer_get_size (output));
+    }
+
     emit_signal (task, signals[PROCESSED], 0);
-    ufo_task_node_increase_processed (UFO_TASK_NODE (task));
+    ufo_task_node_increase_processed (node);
 
     return result;
 }
@@ -160,13 +216,26 @@ ufo_task_generate (UfoTask *task,
                    UfoRequisition *requisition)
 {
     UfoProfiler *profiler;
+    UfoTaskNode *node;
     gboolean result;
+    gint64 start;
 
-    profiler = ufo_task_node_get_profiler (UFO_TASK_NODE(task));
+    node = UFO_TASK_NODE (task);
+    profiler = ufo_task_node_get_profiler (node);
     ufo_profiler_trace_event (profiler, UFO_TRACE_EVENT_GENERATE | UFO_TRACE_EVENT_BEGIN);
+    start = g_get_monotonic_time ();
+    ufo_profiler_set_current (profiler);
     result = UFO_TASK_GET_IFACE (task)->generate (task, output, requisition);
+    ufo_profiler_set_current (NULL);
+    ufo_task_node_add_to_counter (node, UFO_TASK_NODE_COUNTER_GENERATE_TIME,
+                                  (guint64) (g_get_monotonic_time () - start));
     ufo_profiler_trace_event (profiler, UFO_TRACE_EVENT_GENERATE | UFO_TRACE_EVENT_END);
 
+    if (result) {
+        ufo_task_node_add_to_counter (node, UFO_TASK_NODE_COUNTER_FRAMES_OUT, 1);
+        ufo_task_node_add_to_counter (node, UFO_TASK_NODE_COUNTER_BYTES_OUT, ufo_buffer_get_size (output));
+    }
+
     emit_signal (task, signals[GENERATED], 0);
 
     return result;
@@ -257,6 +326,15 @@ ufo_task_generate_real (UfoTask *task,
     return FALSE;
 }
 
+static gboolean
+ufo_task_share_setup_real (UfoTask *task,
+                           UfoTask *origin,
+                           UfoResources *resources,
+                           GError **error)
+{
+    return FALSE;
+}
+
 static void
 ufo_task_default_init (UfoTaskInterface *iface)
 {
@@ -268,6 +346,7 @@ ufo_task_default_init (UfoTaskInterface *iface)
     iface->set_json_object_property = ufo_task_set_json_object_property_real;
     iface->process = ufo_task_process_real;
     iface->generate = ufo_task_generate_real;
+    iface->share_setup = ufo_task_share_setup_real;
 
     signals[PROCESSED] =
         g_signal_new ("processed",
@@ -57,6 +57,11 @@ typedef enum {
  * @UFO_TASK_MODE_GPU: runs on GPU
  * @UFO_TASK_MODE_CPU: runs on CPU
  * @UFO_TASK_MODE_SHARE_DATA: sibling tasks share the same input data
+ * @UFO_TASK_MODE_READ_ONLY_INPUTS: task never modifies its inputs, so that
+ *  broadcasted data can be shared with other read-only consumers instead of
+ *  being copied
+ * @UFO_TASK_MODE_STATELESS: processor does not keep state between inputs and
+ *  may be replicated to process several inputs at the same time
  * @UFO_TASK_MODE_TYPE_MASK: mask to get type from UfoTaskMode
  * @UFO_TASK_MODE_PROCESSOR_MASK: mask to get processor from UfoTaskMode
  *
@@ -71,6 +76,8 @@ typedef enum {
     UFO_TASK_MODE_CPU           = 1 << 4,
     UFO_TASK_MODE_GPU           = 1 << 5,
     UFO_TASK_MODE_SHARE_DATA    = 1 << 6,
+    UFO_TASK_MODE_READ_ONLY_INPUTS = 1 << 7,
+    UFO_TASK_MODE_STATELESS     = 1 << 8,
 
     UFO_TASK_MODE_TYPE_MASK     = UFO_TASK_MODE_PROCESSOR | UFO_TASK_MODE_GENERATOR | UFO_TASK_MODE_REDUCTOR  | UFO_TASK_MODE_SINK,
 
@@ -112,11 +119,19 @@ struct _UfoTaskIface {
     gboolean (*generate)                (UfoTask        *task,
                                          UfoBuffer      *output,
                                          UfoRequisition *requisition);
+    gboolean (*share_setup)             (UfoTask        *task,
+                                         UfoTask        *origin,
+                                         UfoResources   *resources,
+                                         GError        **error);
 };
 
 void    ufo_task_setup              (UfoTask        *task,
                                      UfoResources   *resources,
                                      GError        **error);
+gboolean ufo_task_share_setup       (UfoTask        *task,
+                                     UfoTask        *origin,
+                                     UfoResources   *resources,
+                                     GError        **error);
 guint   ufo_task_get_num_inputs     (UfoTask        *task);
 guint   ufo_task_get_num_dimensions (UfoTask        *task,
                                      guint           input);
@@ -23,6 +23,8 @@
 #include <sched.h>
 
 #include "ufo-task-node.h"
+#include "ufo-two-way-queue.h"
+#include "ufo-priv.h"
 
 /**
  * SECTION:ufo-task-node
@@ -39,9 +41,17 @@ G_DEFINE_TYPE (UfoTaskNode, ufo_task_node, UFO_TYPE_NODE)
 enum {
     PROP_0,
     PROP_NUM_PROCESSED,
+    PROP_REPLICAS,
     N_PROPERTIES
 };
 
+typedef struct {
+    guint64          n_frames;
+    guint64          n_bytes;
+    guint64          wait_time;
+    guint            n_queued;
+} InputCounters;
+
 struct _UfoTaskNodePrivate {
     gchar           *plugin;
     gchar           *identifier;
@@ -49,12 +59,16 @@ struct _UfoTaskNodePrivate {
     UfoNode         *proc_node;
     UfoGroup        *out_group;
     UfoProfiler     *profiler;
-    GList           *in_groups[16];
-    GList           *current[16];
-    gint             n_expected[16];
+    GList           *in_groups[UFO_TASK_NODE_MAX_INPUTS];
+    GList           *current[UFO_TASK_NODE_MAX_INPUTS];
+    gint             n_expected[UFO_TASK_NODE_MAX_INPUTS];
+    guint            queue_depth[UFO_TASK_NODE_MAX_INPUTS];
     guint            index;
     guint            total;
     guint            num_processed;
+    guint            replicas;
+    guint64          counters[UFO_TASK_NODE_COUNTER_LAST];
+    InputCounters    inputs[UFO_TASK_NODE_MAX_INPUTS];
 };
 
 static GParamSpec *properties[N_PROPERTIES] = { NULL, };
@@ -64,6 +78,19 @@ ufo_task_node_setup (UfoTaskNode *node)
 {
     g_return_if_fail (UFO_IS_TASK_NODE (node));
     node->priv->num_processed = 0;
+    ufo_profiler_reset_transfers (node->priv->profiler);
+
+    for (guint i = 0; i < UFO_TASK_NODE_COUNTER_LAST; i++)
+        __atomic_store_n (&node->priv->counters[i], 0, __ATOMIC_RELAXED);
+
+    for (guint i = 0; i < UFO_TASK_NODE_MAX_INPUTS; i++) {
+        InputCounters *input = &node->priv->inputs[i];
+
+        __atomic_store_n (&input->n_frames, 0, __ATOMIC_RELAXED);
+        __atomic_store_n (&input->n_bytes, 0, __ATOMIC_RELAXED);
+        __atomic_store_n (&input->wait_time, 0, __ATOMIC_RELAXED);
+        __atomic_store_n (&input->n_queued, 0, __ATOMIC_RELAXED);
+    }
 }
 
 void
@@ -133,7 +160,7 @@ ufo_task_node_set_num_expected (UfoTaskNode *node,
                                 gint n_expected)
 {
     g_return_if_fail (UFO_IS_TASK_NODE (node));
-    g_return_if_fail (pos < 16);
+    g_return_if_fail (pos < UFO_TASK_NODE_MAX_INPUTS);
     node->priv->n_expected[pos] = n_expected;
 }
 
@@ -142,10 +169,39 @@ ufo_task_node_get_num_expected (UfoTaskNode *node,
                                 guint pos)
 {
     g_return_val_if_fail (UFO_IS_TASK_NODE (node), 0);
-    g_return_val_if_fail (pos < 16, 0);
+    g_return_val_if_fail (pos < UFO_TASK_NODE_MAX_INPUTS, 0);
     return node->priv->n_expected[pos];
 }
 
+/**
+ * ufo_task_node_set_queue_depth:
+ * @node: A #UfoTaskNode
+ * @pos: Input port of @node
+ * @depth: Maximum number of buffers in flight or 0 for the scheduler default
+ *
+ * Set how many buffers may be in flight on the edge leading into input @pos
+ * of @node. A deeper queue lets a producer run ahead of a slow or bursty
+ * consumer at the expense of memory.
+ */
+void
+ufo_task_node_set_queue_depth (UfoTaskNode *node,
+                               guint pos,
+                               guint depth)
+{
+    g_return_if_fail (UFO_IS_TASK_NODE (node));
+    g_return_if_fail (pos < UFO_TASK_NODE_MAX_INPUTS);
+    node->priv->queue_depth[pos] = MIN (depth, UFO_TWO_WAY_QUEUE_MAX_CAPACITY);
+}
+
+guint
+ufo_task_node_get_queue_depth (UfoTaskNode *node,
+                               guint pos)
+{
+    g_return_val_if_fail (UFO_IS_TASK_NODE (node), 0);
+    g_return_val_if_fail (pos < UFO_TASK_NODE_MAX_INPUTS, 0);
+    return node->priv->queue_depth[pos];
+}
+
 void
 ufo_task_node_set_out_group (UfoTaskNode *node,
                              UfoGroup *group)
@@ -170,14 +226,26 @@ ufo_task_node_get_out_group (UfoTaskNode *node)
     return node->priv->out_group;
 }
 
+/**
+ * ufo_task_node_add_in_group:
+ * @node: A #UfoTaskNode
+ * @pos: Input port of @node
+ * @group: A #UfoGroup that sends data to @pos
+ *
+ * Add @group to the groups @node receives data from at input @pos. When
+ * several groups feed the same input, e.g. the copies of an expanded path,
+ * @node takes one buffer from each in turn, in the order the groups were
+ * added. Since 0.16 this is the order in which a scattering predecessor sends
+ * to them, before the groups were visited in reverse order.
+ */
 void
 ufo_task_node_add_in_group (UfoTaskNode *node,
                             guint pos,
                             UfoGroup *group)
 {
     g_return_if_fail (UFO_IS_TASK_NODE (node));
-    /* TODO: check out-of-bounds condition */
-    node->priv->in_groups[pos] = g_list_prepend (node->priv->in_groups[pos], group);
+    g_return_if_fail (pos < UFO_TASK_NODE_MAX_INPUTS);
+    node->priv->in_groups[pos] = g_list_append (node->priv->in_groups[pos], group);
     node->priv->current[pos] = node->priv->in_groups[pos];
 }
 
@@ -197,7 +265,7 @@ ufo_task_node_reset (UfoTaskNode *node)
     priv->out_group = NULL;
     priv->proc_node = NULL;
 
-    for (guint i = 0; i < 16; i++) {
+    for (guint i = 0; i < UFO_TASK_NODE_MAX_INPUTS; i++) {
         g_list_free (priv->in_groups[i]);
         priv->in_groups[i] = NULL;
     }
@@ -219,7 +287,7 @@ ufo_task_node_get_current_in_group (UfoTaskNode *node,
                                     guint pos)
 {
     g_return_val_if_fail (UFO_IS_TASK_NODE (node), NULL);
-    g_assert (pos < 16);
+    g_assert (pos < UFO_TASK_NODE_MAX_INPUTS);
     g_assert (node->priv->current[pos] != NULL);
     return UFO_GROUP (node->priv->current[pos]->data);
 }
@@ -317,6 +385,118 @@ ufo_task_node_increase_processed (UfoTaskNode *node)
     node->priv->num_processed++;
 }
 
+/**
+ * ufo_task_node_add_to_counter:
+ * @node: A #UfoTaskNode
+ * @counter: Counter to increase
+ * @amount: Value that is added to @counter
+ *
+ * Increase one of the counters of @node. Counters can be updated and read from
+ * any thread and are reset by ufo_task_node_setup().
+ */
+void
+ufo_task_node_add_to_counter (UfoTaskNode *node,
+                              UfoTaskNodeCounter counter,
+                              guint64 amount)
+{
+    g_return_if_fail (UFO_IS_TASK_NODE (node));
+    g_return_if_fail (counter < UFO_TASK_NODE_COUNTER_LAST);
+    __atomic_fetch_add (&node->priv->counters[counter], amount, __ATOMIC_RELAXED);
+}
+
+/**
+ * ufo_task_node_get_counter:
+ * @node: A #UfoTaskNode
+ * @counter: Counter to read
+ *
+ * Returns: Current value of @counter.
+ */
+guint64
+ufo_task_node_get_counter (UfoTaskNode *node,
+                           UfoTaskNodeCounter counter)
+{
+    g_return_val_if_fail (UFO_IS_TASK_NODE (node), 0);
+    g_return_val_if_fail (counter < UFO_TASK_NODE_COUNTER_LAST, 0);
+    return __atomic_load_n (&node->priv->counters[counter], __ATOMIC_RELAXED);
+}
+
+/**
+ * ufo_task_node_account_input:
+ * @node: A #UfoTaskNode
+ * @pos: Input port
+ * @n_bytes: Size of the received buffer
+ * @wait_time: Time in microseconds spent waiting for the buffer
+ * @n_queued: Number of buffers still waiting after this one was received
+ *
+ * Record that a buffer was received on input @pos. This is called by the
+ * schedulers, @n_bytes and @wait_time are also added to
+ * %UFO_TASK_NODE_COUNTER_BYTES_IN and %UFO_TASK_NODE_COUNTER_FETCH_TIME.
+ * Buffers received on ports from %UFO_TASK_NODE_MAX_INPUTS on are only added
+ * to these.
+ */
+void
+ufo_task_node_account_input (UfoTaskNode *node,
+                             guint pos,
+                             gsize n_bytes,
+                             guint64 wait_time,
+                             guint n_queued)
+{
+    InputCounters *input;
+
+    g_return_if_fail (UFO_IS_TASK_NODE (node));
+
+    if (pos < UFO_TASK_NODE_MAX_INPUTS) {
+        input = &node->priv->inputs[pos];
+        __atomic_fetch_add (&input->n_frames, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add (&input->n_bytes, n_bytes, __ATOMIC_RELAXED);
+        __atomic_fetch_add (&input->wait_time, wait_time, __ATOMIC_RELAXED);
+        __atomic_store_n (&input->n_queued, n_queued, __ATOMIC_RELAXED);
+    }
+
+    __atomic_fetch_add (&node->priv->counters[UFO_TASK_NODE_COUNTER_BYTES_IN], n_bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add (&node->priv->counters[UFO_TASK_NODE_COUNTER_FETCH_TIME], wait_time, __ATOMIC_RELAXED);
+}
+
+/**
+ * ufo_task_node_get_input_counters:
+ * @node: A #UfoTaskNode
+ * @pos: Input port
+ * @n_frames: (out): Location for the number of received buffers
+ * @n_bytes: (out): Location for the size of all received buffers
+ * @wait_time: (out): Location for the time in microseconds spent waiting
+ * @n_queued: (out): Location for the number of buffers that were waiting when
+ * the last one was received
+ *
+ * Get the values recorded with ufo_task_node_account_input(). They are zero for
+ * ports from %UFO_TASK_NODE_MAX_INPUTS on.
+ */
+void
+ufo_task_node_get_input_counters (UfoTaskNode *node,
+                                  guint pos,
+                                  guint64 *n_frames,
+                                  guint64 *n_bytes,
+                                  guint64 *wait_time,
+                                  guint *n_queued)
+{
+    InputCounters *input;
+
+    g_return_if_fail (UFO_IS_TASK_NODE (node));
+
+    if (pos >= UFO_TASK_NODE_MAX_INPUTS) {
+        *n_frames = 0;
+        *n_bytes = 0;
+        *wait_time = 0;
+        *n_queued = 0;
+        return;
+    }
+
+    input = &node->priv->inputs[pos];
+    *n_frames = __atomic_load_n (&input->n_frames, __ATOMIC_RELAXED);
+    *n_bytes = __atomic_load_n (&input->n_bytes, __ATOMIC_RELAXED);
+    *wait_time = __atomic_load_n (&input->wait_time, __ATOMIC_RELAXED);
+    *n_queued = __atomic_load_n (&input->n_queued, __ATOMIC_RELAXED);
+}
+
 static UfoNode *
 ufo_task_node_copy (UfoNode *node,
                     GError **error)
@@ -329,14 +509,35 @@ ufo_task_node_copy (UfoNode *node,
 
     copy->priv->pattern = orig->priv->pattern;
 
-    for (guint i = 0; i < 16; i++)
+    for (guint i = 0; i < UFO_TASK_NODE_MAX_INPUTS; i++) {
         copy->priv->n_expected[i] = orig->priv->n_expected[i];
+        copy->priv->queue_depth[i] = orig->priv->queue_depth[i];
+    }
 
     ufo_task_node_set_plugin_name (copy, orig->priv->plugin);
 
     return UFO_NODE (copy);
 }
 
+static void
+ufo_task_node_set_property (GObject *object,
+                            guint property_id,
+                            const GValue *value,
+                            GParamSpec *pspec)
+{
+    UfoTaskNodePrivate *priv = UFO_TASK_NODE_GET_PRIVATE (object);
+
+    switch (property_id) {
+        case PROP_REPLICAS:
+            priv->replicas = g_value_get_uint (value);
+            break;
+
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+            break;
+    }
+}
+
 static void
 ufo_task_node_get_property (GObject *object,
                             guint property_id,
@@ -350,6 +551,10 @@ ufo_task_node_get_property (GObject *object,
             g_value_set_uint (value, priv->num_processed);
             break;
 
+        case PROP_REPLICAS:
+            g_value_set_uint (value, priv->replicas);
+            break;
+
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -398,6 +603,7 @@ ufo_task_node_class_init (UfoTaskNodeClass *klass)
     UfoNodeClass *nclass;
 
     oclass = G_OBJECT_CLASS (klass);
+    oclass->set_property = ufo_task_node_set_property;
     oclass->get_property = ufo_task_node_get_property;
     oclass->dispose = ufo_task_node_dispose;
     oclass->finalize = ufo_task_node_finalize;
@@ -414,7 +620,15 @@ ufo_task_node_class_init (UfoTaskNodeClass *klass)
                            0, G_MAXUINT, 0,
                            G_PARAM_READABLE);
 
+    properties[PROP_REPLICAS] =
+        g_param_spec_uint ("replicas",
+                           "Number of parallel copies of a CPU processor",
+                           "Number of parallel copies of a CPU processor, 0 to decide automatically for stateless tasks and 1 to disable replication",
+                           0, 256, 0,
+                           G_PARAM_READWRITE);
+
     g_object_class_install_property (oclass, PROP_NUM_PROCESSED, properties[PROP_NUM_PROCESSED]);
+    g_object_class_install_property (oclass, PROP_REPLICAS, properties[PROP_REPLICAS]);
 
     g_type_class_add_private (klass, sizeof(UfoTaskNodePrivate));
 }
@@ -431,11 +645,13 @@ ufo_task_node_init (UfoTaskNode *self)
     self->priv->index = 0;
     self->priv->total = 1;
     self->priv->num_processed = 0;
+    self->priv->replicas = 0;
     self->priv->profiler = ufo_profiler_new ();
 
-    for (guint i = 0; i < 16; i++) {
+    for (guint i = 0; i < UFO_TASK_NODE_MAX_INPUTS; i++) {
         self->priv->in_groups[i] = NULL;
         self->priv->current[i] = NULL;
         self->priv->n_expected[i] = -1;
+        self->priv->queue_depth[i] = 0;
     }
 }
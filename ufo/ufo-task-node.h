@@ -37,6 +37,13 @@ G_BEGIN_DECLS
 #define UFO_IS_TASK_NODE_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE((klass), UFO_TYPE_TASK_NODE))
 #define UFO_TASK_NODE_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj), UFO_TYPE_TASK_NODE, UfoTaskNodeClass))
 
+/**
+ * UFO_TASK_NODE_MAX_INPUTS:
+ *
+ * Maximum number of input ports of a #UfoTaskNode.
+ */
+#define UFO_TASK_NODE_MAX_INPUTS        16
+
 typedef struct _UfoTaskNode           UfoTaskNode;
 typedef struct _UfoTaskNodeClass      UfoTaskNodeClass;
 typedef struct _UfoTaskNodePrivate    UfoTaskNodePrivate;
@@ -67,6 +74,34 @@ struct _UfoTaskNodeClass {
     const gchar *(*get_package_name)(UfoTaskNode *self);
 };
 
+/**
+ * UfoTaskNodeCounter:
+ * @UFO_TASK_NODE_COUNTER_FRAMES_IN: Number of process calls
+ * @UFO_TASK_NODE_COUNTER_FRAMES_OUT: Number of produced output buffers
+ * @UFO_TASK_NODE_COUNTER_BYTES_IN: Size of all received input buffers
+ * @UFO_TASK_NODE_COUNTER_BYTES_OUT: Size of all produced output buffers
+ * @UFO_TASK_NODE_COUNTER_PROCESS_TIME: Time spent in process in microseconds
+ * @UFO_TASK_NODE_COUNTER_GENERATE_TIME: Time spent in generate in microseconds
+ * @UFO_TASK_NODE_COUNTER_FETCH_TIME: Time spent waiting for inputs in
+ * microseconds
+ * @UFO_TASK_NODE_COUNTER_RELEASE_TIME: Time spent waiting for successors to
+ * release an output buffer in microseconds
+ * @UFO_TASK_NODE_COUNTER_LAST: Number of counters
+ *
+ * Counters that are kept for each #UfoTaskNode while a graph is executed.
+ */
+typedef enum {
+    UFO_TASK_NODE_COUNTER_FRAMES_IN = 0,
+    UFO_TASK_NODE_COUNTER_FRAMES_OUT,
+    UFO_TASK_NODE_COUNTER_BYTES_IN,
+    UFO_TASK_NODE_COUNTER_BYTES_OUT,
+    UFO_TASK_NODE_COUNTER_PROCESS_TIME,
+    UFO_TASK_NODE_COUNTER_GENERATE_TIME,
+    UFO_TASK_NODE_COUNTER_FETCH_TIME,
+    UFO_TASK_NODE_COUNTER_RELEASE_TIME,
+    UFO_TASK_NODE_COUNTER_LAST
+} UfoTaskNodeCounter;
+
 void            ufo_task_node_setup                 (UfoTaskNode    *node);
 void            ufo_task_node_set_plugin_name       (UfoTaskNode    *node,
                                                      const gchar    *name);
@@ -85,6 +120,11 @@ void            ufo_task_node_set_num_expected      (UfoTaskNode    *node,
                                                      gint            n_expected);
 gint            ufo_task_node_get_num_expected      (UfoTaskNode    *node,
                                                      guint           pos);
+void            ufo_task_node_set_queue_depth       (UfoTaskNode    *node,
+                                                     guint           pos,
+                                                     guint           depth);
+guint           ufo_task_node_get_queue_depth       (UfoTaskNode    *node,
+                                                     guint           pos);
 void            ufo_task_node_set_out_group         (UfoTaskNode    *node,
                                                      UfoGroup       *group);
 UfoGroup       *ufo_task_node_get_out_group         (UfoTaskNode    *node);
@@ -109,6 +149,22 @@ void            ufo_task_node_set_profiler          (UfoTaskNode    *node,
 void            ufo_task_node_reset                 (UfoTaskNode    *node);
 UfoProfiler    *ufo_task_node_get_profiler          (UfoTaskNode    *node);
 void            ufo_task_node_increase_processed    (UfoTaskNode    *node);
+void            ufo_task_node_add_to_counter        (UfoTaskNode    *node,
+                                                     UfoTaskNodeCounter counter,
+                                                     guint64         amount);
+guint64         ufo_task_node_get_counter           (UfoTaskNode    *node,
+                                                     UfoTaskNodeCounter counter);
+void            ufo_task_node_account_input         (UfoTaskNode    *node,
+                                                     guint           pos,
+                                                     gsize           n_bytes,
+                                                     guint64         wait_time,
+                                                     guint           n_queued);
+void            ufo_task_node_get_input_counters    (UfoTaskNode    *node,
+                                                     guint           pos,
+                                                     guint64        *n_frames,
+                                                     guint64        *n_bytes,
+                                                     guint64        *wait_time,
+                                                     guint          *n_queued);
 GType           ufo_task_node_get_type              (void);
 
 G_END_DECLS
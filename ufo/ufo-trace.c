@@ -0,0 +1,578 @@
+/*
+ * Copyright (C) 2011-2013 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ufo-trace.h"
+
+/**
+ * SECTION:ufo-trace
+ * @Short_description: Stream trace events to disk
+ * @Title: UfoTraceWriter
+ *
+ * A #UfoTraceWriter streams trace events into a compact binary file while the
+ * program runs, so that tracing long runs needs neither memory proportional to
+ * the number of events nor a long flush at the end.
+ *
+ * Every thread that adds events gets its own ring buffer, which it fills
+ * without taking a lock. A background thread drains the rings into the file.
+ * If a ring is full because the disk cannot keep up, further events of that
+ * thread are dropped and counted instead of stalling the pipeline.
+ *
+ * Trace files are converted to the JSON format of the Chrome trace viewer and
+ * Perfetto with ufo_trace_convert_to_json() or the `ufo-trace` tool.
+ */
+
+/**
+ * UfoTraceError:
+ * @UFO_TRACE_ERROR_IO: Trace file could not be read or written
+ * @UFO_TRACE_ERROR_FORMAT: Trace file is malformed
+ *
+ * Trace file related errors.
+ */
+GQuark
+ufo_trace_error_quark (void)
+{
+    return g_quark_from_static_string ("ufo-trace-error-quark");
+}
+
+#define TRACE_MAGIC         "UFOTRACE"
+#define TRACE_VERSION       1
+#define TRACE_BYTE_ORDER    0x01020304
+#define RING_SIZE           4096            /* records, must be a power of two */
+#define FLUSH_INTERVAL      (20 * G_TIME_SPAN_MILLISECOND)
+#define N_CACHED_RINGS      4
+
+typedef enum {
+    RECORD_STRING = 1,
+    RECORD_EVENT,
+    RECORD_DROPPED,
+} RecordKind;
+
+typedef struct {
+    gchar magic[8];
+    guint32 version;
+    guint32 byte_order;
+} Header;
+
+/*
+ * A string record is followed by the string itself. Its length is stored in
+ * @timestamp and its identifier in @name.
+ */
+typedef struct {
+    guint64 timestamp;
+    guint64 duration;
+    guint64 group;
+    guint32 name;
+    guint32 track;
+    guint8  kind;
+    gchar   phase;
+    guint8  padding[6];
+} Record;
+
+typedef struct {
+    UfoTraceWriter *writer;
+    GThread *thread;
+    gint head;      /* written by the owning thread */
+    gint tail;      /* written by the flush thread */
+    gboolean dropping;
+    Record records[RING_SIZE];
+} Ring;
+
+typedef struct {
+    guint serial;
+    Ring *ring;
+} CachedRing;
+
+typedef struct {
+    CachedRing rings[N_CACHED_RINGS];
+    guint next;
+} RingCache;
+
+struct _UfoTraceWriter {
+    guint serial;
+    FILE *fp;
+    GMutex lock;            /* protects fp, rings and strings */
+    GCond flush;
+    GThread *flush_thread;
+    gboolean stop;
+    GList *rings;
+    GHashTable *strings;
+    guint n_strings;
+    gint n_dropped;
+};
+
+static gint serials = 0;
+
+static void
+free_ring_cache (RingCache *cache)
+{
+    g_free (cache);
+}
+
+static GPrivate ring_cache = G_PRIVATE_INIT ((GDestroyNotify) free_ring_cache);
+
+/* Must be called with the lock held */
+static gsize
+drain_rings (UfoTraceWriter *writer)
+{
+    GList *it;
+    gsize n_records = 0;
+
+    for (it = writer->rings; it != NULL; it = g_list_next (it)) {
+        Ring *ring = it->data;
+        guint head, tail;
+
+        head = (guint) g_atomic_int_get (&ring->head);
+        tail = (guint) ring->tail;
+
+        while (tail != head) {
+            guint start = tail & (RING_SIZE - 1);
+            guint n = MIN (head - tail, RING_SIZE - start);
+
+            fwrite (&ring->records[start], sizeof (Record), n, writer->fp);
+            tail += n;
+            n_records += n;
+        }
+
+        g_atomic_int_set (&ring->tail, (gint) tail);
+    }
+
+    return n_records;
+}
+
+static gpointer
+flush_loop (UfoTraceWriter *writer)
+{
+    g_mutex_lock (&writer->lock);
+
+    while (!writer->stop) {
+        g_cond_wait_until (&writer->flush, &writer->lock, g_get_monotonic_time () + FLUSH_INTERVAL);
+
+        if (drain_rings (writer) > 0)
+            fflush (writer->fp);
+    }
+
+    g_mutex_unlock (&writer->lock);
+    return NULL;
+}
+
+/**
+ * ufo_trace_writer_new: (skip)
+ * @filename: Name of the trace file
+ * @error: Return location for a GError from #UfoTraceError, or %NULL
+ *
+ * Create a trace file @filename and start streaming events into it.
+ *
+ * Returns: A new #UfoTraceWriter or %NULL on error. Free with
+ * ufo_trace_writer_free().
+ */
+UfoTraceWriter *
+ufo_trace_writer_new (const gchar *filename,
+                      GError **error)
+{
+    UfoTraceWriter *writer;
+    Header header = { TRACE_MAGIC, TRACE_VERSION, TRACE_BYTE_ORDER };
+    FILE *fp;
+
+    fp = fopen (filename, "wb");
+
+    if (fp == NULL || fwrite (&header, sizeof (header), 1, fp) != 1) {
+        g_set_error (error, UFO_TRACE_ERROR, UFO_TRACE_ERROR_IO,
+                     "Could not write trace file `%s': %s", filename, g_strerror (errno));
+
+        if (fp != NULL)
+            fclose (fp);
+
+        return NULL;
+    }
+
+    writer = g_new0 (UfoTraceWriter, 1);
+    writer->serial = (guint) g_atomic_int_add (&serials, 1) + 1;
+    writer->fp = fp;
+    writer->strings = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    g_mutex_init (&writer->lock);
+    g_cond_init (&writer->flush);
+    writer->flush_thread = g_thread_new ("ufo-trace", (GThreadFunc) flush_loop, writer);
+
+    return writer;
+}
+
+/**
+ * ufo_trace_writer_intern: (skip)
+ * @writer: A #UfoTraceWriter
+ * @string: A string
+ *
+ * Store @string once in the trace and get an identifier for it, which can be
+ * used as name or track of events. Intern strings up front, e.g. task and
+ * kernel names, because this function takes a lock.
+ *
+ * Returns: Identifier of @string.
+ */
+guint
+ufo_trace_writer_intern (UfoTraceWriter *writer,
+                         const gchar *string)
+{
+    gpointer id;
+
+    g_mutex_lock (&writer->lock);
+
+    if (!g_hash_table_lookup_extended (writer->strings, string, NULL, &id)) {
+        Record record = { 0 };
+
+        id = GUINT_TO_POINTER (writer->n_strings++);
+        g_hash_table_insert (writer->strings, g_strdup (string), id);
+
+        /* Written right away, so it precedes all events that refer to it */
+        record.kind = RECORD_STRING;
+        record.name = GPOINTER_TO_UINT (id);
+        record.timestamp = strlen (string);
+        fwrite (&record, sizeof (Record), 1, writer->fp);
+        fwrite (string, 1, record.timestamp, writer->fp);
+    }
+
+    g_mutex_unlock (&writer->lock);
+    return GPOINTER_TO_UINT (id);
+}
+
+static Ring *
+get_ring (UfoTraceWriter *writer)
+{
+    RingCache *cache;
+    Ring *ring = NULL;
+    GThread *self;
+
+    cache = g_private_get (&ring_cache);
+
+    if (cache == NULL) {
+        cache = g_new0 (RingCache, 1);
+        g_private_set (&ring_cache, cache);
+    }
+
+    for (guint i = 0; i < N_CACHED_RINGS; i++) {
+        if (cache->rings[i].serial == writer->serial)
+            return cache->rings[i].ring;
+    }
+
+    self = g_thread_self ();
+    g_mutex_lock (&writer->lock);
+
+    for (GList *it = writer->rings; it != NULL && ring == NULL; it = g_list_next (it)) {
+        if (((Ring *) it->data)->thread == self)
+            ring = it->data;
+    }
+
+    if (ring == NULL) {
+        ring = g_new0 (Ring, 1);
+        ring->writer = writer;
+        ring->thread = self;
+        writer->rings = g_list_prepend (writer->rings, ring);
+    }
+
+    g_mutex_unlock (&writer->lock);
+
+    cache->rings[cache->next].serial = writer->serial;
+    cache->rings[cache->next].ring = ring;
+    cache->next = (cache->next + 1) % N_CACHED_RINGS;
+
+    return ring;
+}
+
+/**
+ * ufo_trace_writer_add: (skip)
+ * @writer: A #UfoTraceWriter
+ * @phase: Event phase in terms of the Chrome trace format, i.e. 'B' and 'E'
+ *  for the begin and end of a duration or 'X' for a complete event with
+ *  @duration
+ * @name: Identifier of the event name from ufo_trace_writer_intern()
+ * @track: Identifier of the track name from ufo_trace_writer_intern()
+ * @group: Group of the track, e.g. a command queue
+ * @timestamp: Time stamp in ns
+ * @duration: Duration in ns for complete events
+ *
+ * Add an event to the trace. This does not block and can be called from any
+ * thread.
+ */
+void
+ufo_trace_writer_add (UfoTraceWriter *writer,
+                      gchar phase,
+                      guint name,
+                      guint track,
+                      guint64 group,
+                      guint64 timestamp,
+                      guint64 duration)
+{
+    Ring *ring;
+    Record *record;
+    guint head;
+    guint used;
+
+    ring = get_ring (writer);
+    head = (guint) ring->head;
+    used = head - (guint) g_atomic_int_get (&ring->tail);
+
+    /*
+     * Keep begin and end events paired: a begin needs room for its end and
+     * once a begin was dropped, the following events up to the next begin are
+     * dropped as well.
+     */
+    if ((ring->dropping && phase != 'B') || used + (phase == 'B' ? 2 : 1) > RING_SIZE) {
+        ring->dropping = TRUE;
+        g_atomic_int_inc (&writer->n_dropped);
+        return;
+    }
+
+    ring->dropping = FALSE;
+
+    record = &ring->records[head & (RING_SIZE - 1)];
+    record->kind = RECORD_EVENT;
+    record->phase = phase;
+    record->name = name;
+    record->track = track;
+    record->group = group;
+    record->timestamp = timestamp;
+    record->duration = duration;
+    g_atomic_int_set (&ring->head, (gint) (head + 1));
+
+    /* Wake up the flush thread early instead of dropping events */
+    if (used == RING_SIZE / 2)
+        g_cond_signal (&writer->flush);
+}
+
+/**
+ * ufo_trace_writer_get_n_dropped: (skip)
+ * @writer: A #UfoTraceWriter
+ *
+ * Get the number of events that were dropped because a ring buffer was full.
+ *
+ * Returns: Number of dropped events.
+ */
+guint64
+ufo_trace_writer_get_n_dropped (UfoTraceWriter *writer)
+{
+    return (guint64) g_atomic_int_get (&writer->n_dropped);
+}
+
+/**
+ * ufo_trace_writer_free: (skip)
+ * @writer: A #UfoTraceWriter
+ *
+ * Write all remaining events, close the trace file and free @writer. No other
+ * thread may add events at this point.
+ */
+void
+ufo_trace_writer_free (UfoTraceWriter *writer)
+{
+    Record record = { 0 };
+
+    g_mutex_lock (&writer->lock);
+    writer->stop = TRUE;
+    g_cond_signal (&writer->flush);
+    g_mutex_unlock (&writer->lock);
+    g_thread_join (writer->flush_thread);
+
+    drain_rings (writer);
+
+    if (writer->n_dropped > 0) {
+        g_debug ("WARN Dropped %i trace events", writer->n_dropped);
+        record.kind = RECORD_DROPPED;
+        record.duration = (guint64) writer->n_dropped;
+        fwrite (&record, sizeof (Record), 1, writer->fp);
+    }
+
+    fclose (writer->fp);
+    g_list_free_full (writer->rings, g_free);
+    g_hash_table_destroy (writer->strings);
+    g_mutex_clear (&writer->lock);
+    g_cond_clear (&writer->flush);
+    g_free (writer);
+}
+
+static void
+write_json_string (FILE *fp,
+                   const gchar *string)
+{
+    fputc ('"', fp);
+
+    for (const gchar *c = string; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\')
+            fprintf (fp, "\\%c", *c);
+        else if ((guchar) *c < 0x20)
+            fprintf (fp, "\\u%04x", (guint) *c);
+        else
+            fputc (*c, fp);
+    }
+
+    fputc ('"', fp);
+}
+
+static void
+write_json_event (FILE *fp,
+                  gboolean first,
+                  gchar phase,
+                  guint64 timestamp,
+                  guint64 group,
+                  const gchar *track,
+                  const gchar *name)
+{
+    /* Same layout as the JSON traces ufo-prof reads, time stamps in µs */
+    fprintf (fp, "%s\n{\"cat\":\"f\",\"ph\":\"%c\",\"ts\":%" G_GUINT64_FORMAT ".%03u,\"pid\":%" G_GUINT64_FORMAT ",\"tid\":",
+             first ? "" : ",", phase, timestamp / 1000, (guint) (timestamp % 1000), group);
+    write_json_string (fp, track);
+    fprintf (fp, ",\"name\":");
+    write_json_string (fp, name);
+    fprintf (fp, ",\"args\":{}}");
+}
+
+static const gchar *
+lookup_string (GPtrArray *strings,
+               guint id)
+{
+    if (id < strings->len && g_ptr_array_index (strings, id) != NULL)
+        return g_ptr_array_index (strings, id);
+
+    return "unknown";
+}
+
+/**
+ * ufo_trace_convert_to_json:
+ * @input: Name of a trace file written by a #UfoTraceWriter
+ * @output: Name of the JSON file
+ * @error: Return location for a GError from #UfoTraceError, or %NULL
+ *
+ * Convert a binary trace into the JSON format understood by the Chrome trace
+ * viewer, Perfetto and `ufo-prof`. The trace is processed as a stream, so
+ * arbitrarily large traces can be converted.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+gboolean
+ufo_trace_convert_to_json (const gchar *input,
+                           const gchar *output,
+                           GError **error)
+{
+    Header header;
+    Record record;
+    GPtrArray *strings;
+    FILE *in;
+    FILE *out;
+    gboolean first = TRUE;
+    gboolean success = TRUE;
+    guint64 n_dropped = 0;
+
+    in = fopen (input, "rb");
+
+    if (in == NULL) {
+        g_set_error (error, UFO_TRACE_ERROR, UFO_TRACE_ERROR_IO,
+                     "Could not open `%s': %s", input, g_strerror (errno));
+        return FALSE;
+    }
+
+    if (fread (&header, sizeof (header), 1, in) != 1 ||
+        memcmp (header.magic, TRACE_MAGIC, sizeof (header.magic)) != 0 ||
+        header.version != TRACE_VERSION || header.byte_order != TRACE_BYTE_ORDER) {
+        g_set_error (error, UFO_TRACE_ERROR, UFO_TRACE_ERROR_FORMAT,
+                     "`%s' is not a trace file of this version and platform", input);
+        fclose (in);
+        return FALSE;
+    }
+
+    out = fopen (output, "w");
+
+    if (out == NULL) {
+        g_set_error (error, UFO_TRACE_ERROR, UFO_TRACE_ERROR_IO,
+                     "Could not create `%s': %s", output, g_strerror (errno));
+        fclose (in);
+        return FALSE;
+    }
+
+    strings = g_ptr_array_new_with_free_func (g_free);
+    fprintf (out, "{\"traceEvents\":[");
+
+    while (success && fread (&record, sizeof (record), 1, in) == 1) {
+        const gchar *name;
+        const gchar *track;
+
+        switch (record.kind) {
+            case RECORD_STRING:
+                {
+                    gchar *string;
+
+                    string = g_malloc0 (record.timestamp + 1);
+
+                    if (record.timestamp > G_MAXUINT16 || fread (string, 1, record.timestamp, in) != record.timestamp) {
+                        g_free (string);
+                        success = FALSE;
+                        break;
+                    }
+
+                    if (record.name >= strings->len)
+                        g_ptr_array_set_size (strings, record.name + 1);
+
+                    g_free (g_ptr_array_index (strings, record.name));
+                    g_ptr_array_index (strings, record.name) = string;
+                }
+                break;
+
+            case RECORD_EVENT:
+                name = lookup_string (strings, record.name);
+                track = lookup_string (strings, record.track);
+
+                if (record.phase == 'X') {
+                    /* Complete events become pairs, which ufo-prof expects */
+                    write_json_event (out, first, 'B', record.timestamp, record.group, track, name);
+                    write_json_event (out, FALSE, 'E', record.timestamp + record.duration, record.group, track, name);
+                }
+                else {
+                    write_json_event (out, first, record.phase, record.timestamp, record.group, track, name);
+                }
+
+                first = FALSE;
+                break;
+
+            case RECORD_DROPPED:
+                n_dropped += record.duration;
+                break;
+
+            default:
+                success = FALSE;
+        }
+    }
+
+    fprintf (out, "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"droppedEvents\":%" G_GUINT64_FORMAT "}}\n",
+             n_dropped);
+
+    if (!success || ferror (in)) {
+        g_set_error (error, UFO_TRACE_ERROR, UFO_TRACE_ERROR_FORMAT,
+                     "`%s' is truncated or corrupted", input);
+        success = FALSE;
+    }
+
+    if (fclose (out) != 0 && success) {
+        g_set_error (error, UFO_TRACE_ERROR, UFO_TRACE_ERROR_IO,
+                     "Could not write `%s': %s", output, g_strerror (errno));
+        success = FALSE;
+    }
+
+    fclose (in);
+    g_ptr_array_free (strings, TRUE);
+    return success;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2011-2013 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UFO_TRACE_H
+#define __UFO_TRACE_H
+
+#if !defined (__UFO_H_INSIDE__) && !defined (UFO_COMPILATION)
+#error "Only <ufo/ufo.h> can be included directly."
+#endif
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define UFO_TRACE_ERROR ufo_trace_error_quark()
+
+typedef struct _UfoTraceWriter UfoTraceWriter;
+
+typedef enum {
+    UFO_TRACE_ERROR_IO,
+    UFO_TRACE_ERROR_FORMAT
+} UfoTraceError;
+
+UfoTraceWriter  *ufo_trace_writer_new           (const gchar    *filename,
+                                                 GError        **error);
+guint            ufo_trace_writer_intern        (UfoTraceWriter *writer,
+                                                 const gchar    *string);
+void             ufo_trace_writer_add           (UfoTraceWriter *writer,
+                                                 gchar           phase,
+                                                 guint           name,
+                                                 guint           track,
+                                                 guint64         group,
+                                                 guint64         timestamp,
+                                                 guint64         duration);
+guint64          ufo_trace_writer_get_n_dropped (UfoTraceWriter *writer);
+void             ufo_trace_writer_free          (UfoTraceWriter *writer);
+gboolean         ufo_trace_convert_to_json      (const gchar    *input,
+                                                 const gchar    *output,
+                                                 GError        **error);
+GQuark           ufo_trace_error_quark          (void);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,609 @@
+/*
+ * Copyright (C) 2011-2013 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <glib.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "ufo-resources.h"
+#include "ufo-priv.h"
+
+/*
+ * Local work size tuning for kernels that are enqueued without an explicit
+ * local size. Each (device, kernel, global size) combination is tuned online:
+ * the first calls are issued with different candidate local sizes, including
+ * the choice of the driver, and timed with their profiling events. Kernels are
+ * never run more often than requested, so that kernels with side effects are
+ * safe to tune. Once all samples have arrived, the fastest candidate is used
+ * for all further calls and stored in `work-sizes.ini` next to the program
+ * cache (see #UfoResources).
+ *
+ * Kernels are identified by name and number of arguments, because programs
+ * loaded from cached binaries have no source to hash. A collision can only
+ * cost performance, since candidates are only applied if they are valid for
+ * the global size and the kernel falls back to the driver choice otherwise.
+ *
+ * The `UFO_WORK_SIZE_TUNING` environment variable selects the mode: `on` (the
+ * default) tunes new combinations, `freeze` only uses stored results and `off`
+ * always leaves the choice to the driver.
+ */
+
+#define N_SAMPLES       3
+#define MAX_CANDIDATES  16
+#define CACHE_FILENAME  "work-sizes.ini"
+
+typedef enum {
+    TUNING_ON,
+    TUNING_FREEZE,
+    TUNING_OFF
+} TuningMode;
+
+typedef struct {
+    cl_event event;
+    guint candidate;
+} Sample;
+
+typedef struct {
+    gchar *device;
+    gchar *key;
+    guint work_dim;
+    gsize candidates[MAX_CANDIDATES][3];
+    guint n_candidates;
+    guint64 best[MAX_CANDIDATES];
+    guint n_issued;
+    guint n_received;
+    GList *pending;
+    gint winner;
+} Tuning;
+
+static GMutex lock;
+static GHashTable *tunings = NULL;      /* "device\nkey" -> Tuning */
+static GHashTable *devices = NULL;      /* cl_device_id -> name */
+static GHashTable *loaded_files = NULL;
+
+static const gsize candidates_1d[][3] = {
+    { 32, 1, 1 }, { 64, 1, 1 }, { 128, 1, 1 }, { 256, 1, 1 }, { 512, 1, 1 }, { 1024, 1, 1 },
+};
+
+static const gsize candidates_2d[][3] = {
+    { 8, 8, 1 }, { 16, 4, 1 }, { 16, 8, 1 }, { 16, 16, 1 }, { 32, 4, 1 },
+    { 32, 8, 1 }, { 32, 16, 1 }, { 64, 2, 1 }, { 64, 4, 1 }, { 128, 1, 1 },
+};
+
+static const gsize candidates_3d[][3] = {
+    { 8, 8, 1 }, { 16, 8, 1 }, { 16, 16, 1 }, { 32, 4, 1 }, { 32, 8, 1 }, { 8, 4, 4 }, { 8, 8, 4 },
+};
+
+static TuningMode
+get_mode (void)
+{
+    const gchar *mode;
+
+    mode = g_getenv ("UFO_WORK_SIZE_TUNING");
+
+    if (mode == NULL || g_strcmp0 (mode, "on") == 0)
+        return TUNING_ON;
+
+    if (g_strcmp0 (mode, "freeze") == 0)
+        return TUNING_FREEZE;
+
+    return TUNING_OFF;
+}
+
+static gchar *
+get_cache_filename (void)
+{
+    const gchar *dir;
+
+    dir = g_getenv ("UFO_KERNEL_CACHE_DIR");
+
+    if (dir == NULL)
+        return g_build_filename (g_get_user_cache_dir (), "ufo", CACHE_FILENAME, NULL);
+
+    return *dir ? g_build_filename (dir, CACHE_FILENAME, NULL) : NULL;
+}
+
+static gchar *
+get_info_string (cl_device_id device,
+                 cl_device_info info)
+{
+    gchar *value;
+    gsize size;
+
+    UFO_RESOURCES_CHECK_CLERR (clGetDeviceInfo (device, info, 0, NULL, &size));
+    value = g_malloc0 (size + 1);
+    UFO_RESOURCES_CHECK_CLERR (clGetDeviceInfo (device, info, size, value, NULL));
+    return value;
+}
+
+/* Must be called with the lock held */
+static const gchar *
+get_device_name (cl_device_id device)
+{
+    gchar *name;
+
+    name = g_hash_table_lookup (devices, device);
+
+    if (name == NULL) {
+        gchar *device_name;
+        gchar *driver;
+
+        device_name = get_info_string (device, CL_DEVICE_NAME);
+        driver = get_info_string (device, CL_DRIVER_VERSION);
+
+        /* Group names of key files must not contain brackets */
+        name = g_strdelimit (g_strdup_printf ("%s %s", g_strstrip (device_name), driver), "[]\n", '_');
+        g_hash_table_insert (devices, device, name);
+        g_free (device_name);
+        g_free (driver);
+    }
+
+    return name;
+}
+
+static gchar *
+get_tuning_key (cl_kernel kernel,
+                guint work_dim,
+                const gsize *global_work_size)
+{
+    GString *key;
+    gchar *name;
+    cl_uint n_args;
+    gsize size;
+
+    UFO_RESOURCES_CHECK_CLERR (clGetKernelInfo (kernel, CL_KERNEL_FUNCTION_NAME, 0, NULL, &size));
+    name = g_malloc0 (size + 1);
+    UFO_RESOURCES_CHECK_CLERR (clGetKernelInfo (kernel, CL_KERNEL_FUNCTION_NAME, size, name, NULL));
+    UFO_RESOURCES_CHECK_CLERR (clGetKernelInfo (kernel, CL_KERNEL_NUM_ARGS, sizeof (cl_uint), &n_args, NULL));
+
+    key = g_string_new (NULL);
+    g_string_printf (key, "%s/%u/", name, n_args);
+
+    for (guint i = 0; i < work_dim; i++)
+        g_string_append_printf (key, i == 0 ? "%zu" : "x%zu", global_work_size[i]);
+
+    g_free (name);
+    return g_string_free (key, FALSE);
+}
+
+static void
+free_sample (Sample *sample)
+{
+    clReleaseEvent (sample->event);
+    g_free (sample);
+}
+
+static void
+free_tuning (Tuning *tuning)
+{
+    g_list_free_full (tuning->pending, (GDestroyNotify) free_sample);
+    g_free (tuning->device);
+    g_free (tuning->key);
+    g_free (tuning);
+}
+
+static Tuning *
+new_tuning (const gchar *device,
+            const gchar *key,
+            guint work_dim)
+{
+    Tuning *tuning;
+
+    tuning = g_new0 (Tuning, 1);
+    tuning->device = g_strdup (device);
+    tuning->key = g_strdup (key);
+    tuning->work_dim = work_dim;
+    tuning->winner = -1;
+
+    /* The first candidate leaves the choice to the driver */
+    tuning->n_candidates = 1;
+    return tuning;
+}
+
+static gboolean
+is_valid_local_size (const gsize *local,
+                     guint work_dim,
+                     const gsize *global_work_size,
+                     gsize max_size)
+{
+    gsize size = 1;
+
+    if (local[0] == 0)
+        return TRUE;
+
+    for (guint i = 0; i < work_dim; i++) {
+        if (global_work_size[i] % local[i] != 0)
+            return FALSE;
+
+        size *= local[i];
+    }
+
+    return size <= max_size;
+}
+
+static void
+add_candidates (Tuning *tuning,
+                cl_kernel kernel,
+                cl_device_id device,
+                const gsize *global_work_size)
+{
+    const gsize (*candidates)[3];
+    gsize required[3] = { 0, 0, 0 };
+    gsize max_size;
+    guint n_candidates;
+
+    /* Kernels that declare reqd_work_group_size get exactly that */
+    UFO_RESOURCES_CHECK_CLERR (clGetKernelWorkGroupInfo (kernel, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE,
+                                                         sizeof (required), required, NULL));
+
+    if (required[0] != 0) {
+        tuning->winner = 0;
+        return;
+    }
+
+    UFO_RESOURCES_CHECK_CLERR (clGetKernelWorkGroupInfo (kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+                                                         sizeof (gsize), &max_size, NULL));
+
+    switch (tuning->work_dim) {
+        case 1:
+            candidates = candidates_1d;
+            n_candidates = G_N_ELEMENTS (candidates_1d);
+            break;
+        case 2:
+            candidates = candidates_2d;
+            n_candidates = G_N_ELEMENTS (candidates_2d);
+            break;
+        default:
+            candidates = candidates_3d;
+            n_candidates = G_N_ELEMENTS (candidates_3d);
+            break;
+    }
+
+    for (guint i = 0; i < n_candidates && tuning->n_candidates < MAX_CANDIDATES; i++) {
+        if (is_valid_local_size (candidates[i], tuning->work_dim, global_work_size, max_size)) {
+            memcpy (tuning->candidates[tuning->n_candidates], candidates[i], sizeof (candidates[i]));
+            tuning->n_candidates++;
+        }
+    }
+
+    if (tuning->n_candidates == 1)
+        tuning->winner = 0;
+}
+
+/* Must be called with the lock held */
+static void
+load_results (const gchar *filename)
+{
+    GKeyFile *file;
+    gchar **groups;
+
+    if (filename == NULL || g_hash_table_contains (loaded_files, filename))
+        return;
+
+    g_hash_table_add (loaded_files, g_strdup (filename));
+    file = g_key_file_new ();
+
+    if (!g_key_file_load_from_file (file, filename, G_KEY_FILE_NONE, NULL)) {
+        g_key_file_free (file);
+        return;
+    }
+
+    groups = g_key_file_get_groups (file, NULL);
+
+    for (guint i = 0; groups[i] != NULL; i++) {
+        gchar **keys;
+
+        keys = g_key_file_get_keys (file, groups[i], NULL, NULL);
+
+        for (guint j = 0; keys != NULL && keys[j] != NULL; j++) {
+            Tuning *tuning;
+            gint *local;
+            gsize length;
+            gchar *id;
+
+            local = g_key_file_get_integer_list (file, groups[i], keys[j], &length, NULL);
+            id = g_strdup_printf ("%s\n%s", groups[i], keys[j]);
+
+            if (local != NULL && length >= 1 && length <= 3 && !g_hash_table_contains (tunings, id)) {
+                tuning = new_tuning (groups[i], keys[j], length);
+                tuning->winner = 0;
+
+                if (local[0] > 0) {
+                    for (guint k = 0; k < length; k++)
+                        tuning->candidates[1][k] = (gsize) MAX (local[k], 1);
+
+                    tuning->n_candidates = 2;
+                    tuning->winner = 1;
+                }
+
+                g_hash_table_insert (tunings, id, tuning);
+            }
+            else {
+                g_free (id);
+            }
+
+            g_free (local);
+        }
+
+        g_strfreev (keys);
+    }
+
+    g_strfreev (groups);
+    g_key_file_free (file);
+}
+
+/* Must be called with the lock held */
+static void
+store_result (Tuning *tuning)
+{
+    GKeyFile *file;
+    GError *error = NULL;
+    gchar *filename;
+    gchar *dirname;
+    gchar *data;
+    gint local[3];
+    gsize size;
+
+    filename = get_cache_filename ();
+
+    if (filename == NULL)
+        return;
+
+    file = g_key_file_new ();
+    g_key_file_load_from_file (file, filename, G_KEY_FILE_KEEP_COMMENTS, NULL);
+
+    for (guint i = 0; i < tuning->work_dim; i++)
+        local[i] = (gint) tuning->candidates[tuning->winner][i];
+
+    g_key_file_set_integer_list (file, tuning->device, tuning->key, local, tuning->work_dim);
+    data = g_key_file_to_data (file, &size, NULL);
+    dirname = g_path_get_dirname (filename);
+
+    if (g_mkdir_with_parents (dirname, 0700) != 0 ||
+        !g_file_set_contents (filename, data, size, &error)) {
+        g_debug ("WARN Could not store work sizes in %s: %s", filename,
+                 error != NULL ? error->message : "cannot create directory");
+        g_clear_error (&error);
+    }
+
+    g_free (dirname);
+    g_free (data);
+    g_free (filename);
+    g_key_file_free (file);
+}
+
+/* Must be called with the lock held */
+static void
+collect_samples (Tuning *tuning)
+{
+    GList *it = tuning->pending;
+
+    if (tuning->winner >= 0) {
+        /* Decided without these samples, they are not needed anymore */
+        g_list_free_full (tuning->pending, (GDestroyNotify) free_sample);
+        tuning->pending = NULL;
+        return;
+    }
+
+    while (it != NULL) {
+        GList *next = g_list_next (it);
+        Sample *sample = it->data;
+        cl_int status;
+        cl_ulong start, end;
+
+        UFO_RESOURCES_CHECK_CLERR (clGetEventInfo (sample->event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                                   sizeof (cl_int), &status, NULL));
+
+        if (status != CL_COMPLETE && status >= 0) {
+            it = next;
+            continue;
+        }
+
+        if (status < 0 ||
+            clGetEventProfilingInfo (sample->event, CL_PROFILING_COMMAND_START, sizeof (cl_ulong), &start, NULL) != CL_SUCCESS ||
+            clGetEventProfilingInfo (sample->event, CL_PROFILING_COMMAND_END, sizeof (cl_ulong), &end, NULL) != CL_SUCCESS) {
+            /* Without timings there is nothing to tune, keep the driver choice */
+            tuning->winner = 0;
+        }
+        else if (tuning->best[sample->candidate] == 0 || end - start < tuning->best[sample->candidate]) {
+            /* The minimum filters out warm-up and interference */
+            tuning->best[sample->candidate] = MAX (end - start, 1);
+        }
+
+        tuning->n_received++;
+        tuning->pending = g_list_delete_link (tuning->pending, it);
+        free_sample (sample);
+        it = next;
+    }
+
+    if (tuning->winner < 0 && tuning->n_received == tuning->n_candidates * N_SAMPLES) {
+        tuning->winner = 0;
+
+        for (guint i = 1; i < tuning->n_candidates; i++) {
+            if (tuning->best[i] < tuning->best[tuning->winner])
+                tuning->winner = i;
+        }
+
+        g_debug ("INFO Tuned %s on %s: local size %zu x %zu x %zu (%.3f ms, driver choice %.3f ms)",
+                 tuning->key, tuning->device,
+                 tuning->candidates[tuning->winner][0],
+                 tuning->candidates[tuning->winner][1],
+                 tuning->candidates[tuning->winner][2],
+                 tuning->best[tuning->winner] * 1e-6, tuning->best[0] * 1e-6);
+
+        store_result (tuning);
+    }
+}
+
+/* Must be called with the lock held */
+static Tuning *
+get_tuning (cl_command_queue queue,
+            cl_kernel kernel,
+            guint work_dim,
+            const gsize *global_work_size,
+            TuningMode mode)
+{
+    Tuning *tuning;
+    cl_device_id device;
+    const gchar *device_name;
+    gchar *key;
+    gchar *id;
+
+    if (tunings == NULL) {
+        tunings = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) free_tuning);
+        devices = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+        loaded_files = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    }
+
+    UFO_RESOURCES_CHECK_CLERR (clGetCommandQueueInfo (queue, CL_QUEUE_DEVICE, sizeof (cl_device_id), &device, NULL));
+    device_name = get_device_name (device);
+    key = get_tuning_key (kernel, work_dim, global_work_size);
+    id = g_strdup_printf ("%s\n%s", device_name, key);
+    tuning = g_hash_table_lookup (tunings, id);
+
+    if (tuning == NULL) {
+        gchar *filename;
+
+        filename = get_cache_filename ();
+        load_results (filename);
+        g_free (filename);
+        tuning = g_hash_table_lookup (tunings, id);
+    }
+
+    if (tuning == NULL && mode == TUNING_ON) {
+        tuning = new_tuning (device_name, key, work_dim);
+        add_candidates (tuning, kernel, device, global_work_size);
+        g_hash_table_insert (tunings, id, tuning);
+        id = NULL;
+    }
+
+    g_free (id);
+    g_free (key);
+    return tuning;
+}
+
+/*
+ * Enqueue @kernel like clEnqueueNDRangeKernel() without a local work size and
+ * return its error code. The local size is chosen by the tuner. @event may be
+ * %NULL.
+ */
+gint
+ufo_tuner_enqueue (gpointer command_queue,
+                   gpointer kernel,
+                   guint work_dim,
+                   const gsize *global_work_size,
+                   gpointer *event)
+{
+    Tuning *tuning;
+    TuningMode mode;
+    gsize local[3];
+    gboolean sample = FALSE;
+    guint candidate = 0;
+    cl_event own_event = NULL;
+    cl_int errcode;
+
+    mode = get_mode ();
+
+    if (mode == TUNING_OFF || work_dim < 1 || work_dim > 3)
+        return clEnqueueNDRangeKernel (command_queue, kernel, work_dim, NULL, global_work_size, NULL,
+                                       0, NULL, (cl_event *) event);
+
+    g_mutex_lock (&lock);
+    tuning = get_tuning (command_queue, kernel, work_dim, global_work_size, mode);
+
+    if (tuning != NULL) {
+        if (tuning->winner < 0 || tuning->pending != NULL)
+            collect_samples (tuning);
+
+        if (tuning->winner >= 0) {
+            candidate = (guint) tuning->winner;
+        }
+        else if (tuning->n_issued < tuning->n_candidates * N_SAMPLES) {
+            candidate = tuning->n_issued % tuning->n_candidates;
+            tuning->n_issued++;
+            sample = TRUE;
+        }
+
+        memcpy (local, tuning->candidates[candidate], sizeof (local));
+    }
+
+    g_mutex_unlock (&lock);
+
+    /* Trial runs are timed even if the caller does not want the event */
+    if (event == NULL && sample)
+        event = (gpointer *) &own_event;
+
+    if (candidate == 0) {
+        errcode = clEnqueueNDRangeKernel (command_queue, kernel, work_dim, NULL, global_work_size, NULL,
+                                          0, NULL, (cl_event *) event);
+    }
+    else {
+        errcode = clEnqueueNDRangeKernel (command_queue, kernel, work_dim, NULL, global_work_size, local,
+                                          0, NULL, (cl_event *) event);
+
+        if (errcode == CL_INVALID_WORK_GROUP_SIZE || errcode == CL_OUT_OF_RESOURCES) {
+            /* Resource limits are only known at launch, e.g. local memory */
+            errcode = clEnqueueNDRangeKernel (command_queue, kernel, work_dim, NULL, global_work_size, NULL,
+                                              0, NULL, (cl_event *) event);
+            sample = FALSE;
+
+            g_mutex_lock (&lock);
+
+            if (tuning->winner == (gint) candidate)
+                tuning->winner = 0;
+            else
+                tuning->best[candidate] = G_MAXUINT64;
+
+            if (tuning->winner < 0)
+                tuning->n_received++;
+
+            g_mutex_unlock (&lock);
+        }
+    }
+
+    if (sample && errcode == CL_SUCCESS) {
+        Sample *s;
+
+        s = g_new0 (Sample, 1);
+        s->event = *event;
+        s->candidate = candidate;
+        UFO_RESOURCES_CHECK_CLERR (clRetainEvent (s->event));
+
+        g_mutex_lock (&lock);
+        tuning->pending = g_list_append (tuning->pending, s);
+        g_mutex_unlock (&lock);
+    }
+    else if (sample) {
+        g_mutex_lock (&lock);
+        tuning->n_received++;
+        g_mutex_unlock (&lock);
+    }
+
+    if (own_event != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clReleaseEvent (own_event));
+
+    return errcode;
+}
@@ -22,14 +22,207 @@
 #include "ufo-two-way-queue.h"
 #include "ufo-priv.h"
 
+/*
+ * Both directions of a two-way queue are bounded multi-producer/multi-consumer
+ * rings with per-slot sequence numbers. Pushing and popping is lock-free; only
+ * a consumer that finds its ring empty for a longer time parks on a condition
+ * variable, so that idle threads do not burn CPU time.
+ *
+ * Rings have twice as many slots as items can be inserted to leave room for
+ * end-of-stream markers. A ring that is full nevertheless means that items are
+ * pushed that were never inserted. Dropping one would leave its consumer or
+ * producer waiting forever, so this aborts instead.
+ */
+
+#define RING_SIZE           (2 * UFO_TWO_WAY_QUEUE_MAX_CAPACITY)
+#define RING_MASK           (RING_SIZE - 1)
+#define CACHE_LINE_SIZE     64
+#define N_SPINS             256
+#define N_YIELDS            16
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax()         __builtin_ia32_pause ()
+#else
+#define cpu_relax()         __asm__ __volatile__ ("" ::: "memory")
+#endif
+
+typedef struct {
+    gsize       sequence;
+    gpointer    data;
+} Slot;
+
+typedef struct {
+    gsize       head __attribute__ ((aligned (CACHE_LINE_SIZE)));
+    gsize       tail __attribute__ ((aligned (CACHE_LINE_SIZE)));
+    gint        n_waiting __attribute__ ((aligned (CACHE_LINE_SIZE)));
+    GMutex      lock;
+    GCond       cond;
+    Slot        slots[RING_SIZE];
+} Ring;
 
 struct _UfoTwoWayQueue {
-    GAsyncQueue *producer_queue;
-    GAsyncQueue *consumer_queue;
-    GList *inserted;
-    guint capacity;
+    Ring       *producer_ring;
+    Ring       *consumer_ring;
+    GPtrArray  *inserted;
+    GList      *inserted_list;
+    gboolean    list_stale;
+    guint       capacity;
+    guint       high_water;
 };
 
+G_STATIC_ASSERT ((RING_SIZE & RING_MASK) == 0);
+
+static Ring *
+ring_new (void)
+{
+    Ring *ring;
+
+    ring = g_malloc0 (sizeof (Ring));
+    g_mutex_init (&ring->lock);
+    g_cond_init (&ring->cond);
+
+    for (gsize i = 0; i < RING_SIZE; i++)
+        ring->slots[i].sequence = i;
+
+    return ring;
+}
+
+static void
+ring_free (Ring *ring)
+{
+    g_mutex_clear (&ring->lock);
+    g_cond_clear (&ring->cond);
+    g_free (ring);
+}
+
+static gboolean
+ring_try_push (Ring *ring, gpointer data)
+{
+    Slot *slot;
+    gsize pos;
+
+    pos = __atomic_load_n (&ring->tail, __ATOMIC_RELAXED);
+
+    for (;;) {
+        gssize diff;
+
+        slot = &ring->slots[pos & RING_MASK];
+        diff = (gssize) __atomic_load_n (&slot->sequence, __ATOMIC_ACQUIRE) - (gssize) pos;
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n (&ring->tail, &pos, pos + 1, TRUE,
+                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0) {
+            return FALSE;
+        }
+        else {
+            pos = __atomic_load_n (&ring->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->data = data;
+    __atomic_store_n (&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+static gboolean
+ring_try_pop (Ring *ring, gpointer *data)
+{
+    Slot *slot;
+    gsize pos;
+
+    pos = __atomic_load_n (&ring->head, __ATOMIC_RELAXED);
+
+    for (;;) {
+        gssize diff;
+
+        slot = &ring->slots[pos & RING_MASK];
+        diff = (gssize) __atomic_load_n (&slot->sequence, __ATOMIC_ACQUIRE) - (gssize) (pos + 1);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n (&ring->head, &pos, pos + 1, TRUE,
+                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0) {
+            return FALSE;
+        }
+        else {
+            pos = __atomic_load_n (&ring->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    *data = slot->data;
+    __atomic_store_n (&slot->sequence, pos + RING_SIZE, __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+static void
+ring_push (Ring *ring, gpointer data)
+{
+    if (!ring_try_push (ring, data))
+        g_error ("Two-way queue is full, cannot push item %p", data);
+
+    /* Pairs with the fence in ring_pop() to avoid lost wake-ups */
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n (&ring->n_waiting, __ATOMIC_RELAXED) > 0) {
+        g_mutex_lock (&ring->lock);
+        g_cond_signal (&ring->cond);
+        g_mutex_unlock (&ring->lock);
+    }
+}
+
+static guint
+get_num_spins (void)
+{
+    static gsize n_spins = 0;
+
+    if (g_once_init_enter (&n_spins)) {
+        /* Spinning only makes sense if someone else can make progress */
+        g_once_init_leave (&n_spins, g_get_num_processors () > 1 ? N_SPINS + 1 : 1);
+    }
+
+    return (guint) n_spins - 1;
+}
+
+static gpointer
+ring_pop (Ring *ring)
+{
+    gpointer data;
+    guint n_spins;
+
+    n_spins = get_num_spins ();
+
+    for (guint i = 0; i < n_spins; i++) {
+        if (ring_try_pop (ring, &data))
+            return data;
+
+        cpu_relax ();
+    }
+
+    for (guint i = 0; i < N_YIELDS; i++) {
+        if (ring_try_pop (ring, &data))
+            return data;
+
+        g_thread_yield ();
+    }
+
+    g_mutex_lock (&ring->lock);
+    __atomic_add_fetch (&ring->n_waiting, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+
+    while (!ring_try_pop (ring, &data))
+        g_cond_wait (&ring->cond, &ring->lock);
+
+    __atomic_sub_fetch (&ring->n_waiting, 1, __ATOMIC_SEQ_CST);
+    g_mutex_unlock (&ring->lock);
+
+    return data;
+}
+
 /**
  * ufo_two_way_queue_new: (skip)
  * @init: (element-type gpointer): List with elements inserted into
@@ -46,10 +239,13 @@ ufo_two_way_queue_new (GList *init)
     GList *it;
     UfoTwoWayQueue *queue = g_new0 (UfoTwoWayQueue, 1);
 
-    queue->producer_queue = g_async_queue_new ();
-    queue->consumer_queue = g_async_queue_new ();
-    queue->inserted = NULL;
+    queue->producer_ring = ring_new ();
+    queue->consumer_ring = ring_new ();
+    queue->inserted = g_ptr_array_new ();
+    queue->inserted_list = NULL;
+    queue->list_stale = FALSE;
     queue->capacity = 0;
+    queue->high_water = 0;
 
     g_list_for (init, it) {
         ufo_two_way_queue_insert (queue, it->data);
@@ -61,9 +257,10 @@ ufo_two_way_queue_new (GList *init)
 void
 ufo_two_way_queue_free (UfoTwoWayQueue *queue)
 {
-    g_async_queue_unref (queue->producer_queue);
-    g_async_queue_unref (queue->consumer_queue);
-    g_list_free (queue->inserted);
+    ring_free (queue->producer_ring);
+    ring_free (queue->consumer_ring);
+    g_ptr_array_free (queue->inserted, TRUE);
+    g_list_free (queue->inserted_list);
     g_free (queue);
 }
 
@@ -78,13 +275,29 @@ ufo_two_way_queue_free (UfoTwoWayQueue *queue)
 gpointer
 ufo_two_way_queue_consumer_pop (UfoTwoWayQueue *queue)
 {
-    return g_async_queue_pop (queue->consumer_queue);
+    return ring_pop (queue->consumer_ring);
+}
+
+/**
+ * ufo_two_way_queue_consumer_try_pop: (skip)
+ * @queue: A #UfoTwoWayQueue
+ *
+ * Fetch an item for consumption without waiting.
+ *
+ * Returns: (transfer none): A consumable item or %NULL if none is available.
+ */
+gpointer
+ufo_two_way_queue_consumer_try_pop (UfoTwoWayQueue *queue)
+{
+    gpointer data;
+
+    return ring_try_pop (queue->consumer_ring, &data) ? data : NULL;
 }
 
 void
 ufo_two_way_queue_consumer_push (UfoTwoWayQueue *queue, gpointer data)
 {
-    g_async_queue_push (queue->producer_queue, data);
+    ring_push (queue->producer_ring, data);
 }
 
 /**
@@ -98,13 +311,80 @@ ufo_two_way_queue_consumer_push (UfoTwoWayQueue *queue, gpointer data)
 gpointer
 ufo_two_way_queue_producer_pop (UfoTwoWayQueue *queue)
 {
-    return g_async_queue_pop (queue->producer_queue);
+    return ring_pop (queue->producer_ring);
+}
+
+/**
+ * ufo_two_way_queue_producer_try_pop: (skip)
+ * @queue: A #UfoTwoWayQueue
+ *
+ * Fetch an item for production without waiting.
+ *
+ * Returns: (transfer none): A producable item or %NULL if none is available.
+ */
+gpointer
+ufo_two_way_queue_producer_try_pop (UfoTwoWayQueue *queue)
+{
+    gpointer data;
+
+    return ring_try_pop (queue->producer_ring, &data) ? data : NULL;
+}
+
+/**
+ * ufo_two_way_queue_get_num_queued: (skip)
+ * @queue: A #UfoTwoWayQueue
+ *
+ * Get the number of items currently waiting for a consumer. The result is only
+ * an estimate if producer or consumer are active at the same time.
+ *
+ * Returns: Number of items in the consumer queue.
+ */
+guint
+ufo_two_way_queue_get_num_queued (UfoTwoWayQueue *queue)
+{
+    Ring *ring;
+    gsize head;
+    guint n_queued;
+
+    /*
+     * Only an estimate, head and tail may move while we look at them. Reading
+     * head first guarantees that it does not overtake tail.
+     */
+    ring = queue->consumer_ring;
+    head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+    n_queued = (guint) (__atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE) - head);
+
+    /*
+     * End-of-stream markers are pushed on top of the inserted items. Queues
+     * without inserted items only pass on items shared from other queues.
+     */
+    if (queue->capacity > 0)
+        n_queued = MIN (n_queued, queue->capacity);
+
+    return n_queued;
+}
+
+static void
+update_high_water_mark (UfoTwoWayQueue *queue)
+{
+    guint n_queued;
+    guint high_water;
+
+    n_queued = ufo_two_way_queue_get_num_queued (queue);
+    high_water = __atomic_load_n (&queue->high_water, __ATOMIC_RELAXED);
+
+    while (n_queued > high_water) {
+        if (__atomic_compare_exchange_n (&queue->high_water, &high_water, n_queued, TRUE,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+    }
 }
 
 void
 ufo_two_way_queue_producer_push (UfoTwoWayQueue *queue, gpointer data)
 {
-    g_async_queue_push (queue->consumer_queue, data);
+    ring_push (queue->consumer_ring, data);
+    update_high_water_mark (queue);
 }
 
 /**
@@ -118,19 +398,82 @@ ufo_two_way_queue_producer_push (UfoTwoWayQueue *queue, gpointer data)
 GList *
 ufo_two_way_queue_get_inserted (UfoTwoWayQueue *queue)
 {
-    return queue->inserted;
+    if (queue->list_stale) {
+        g_list_free (queue->inserted_list);
+        queue->inserted_list = NULL;
+
+        for (guint i = queue->inserted->len; i > 0; i--)
+            queue->inserted_list = g_list_prepend (queue->inserted_list, g_ptr_array_index (queue->inserted, i - 1));
+
+        queue->list_stale = FALSE;
+    }
+
+    return queue->inserted_list;
 }
 
+/**
+ * ufo_two_way_queue_insert: (skip)
+ * @queue: A #UfoTwoWayQueue
+ * @data: Item to be produced
+ *
+ * Add a new item to the producer side of @queue. At most
+ * %UFO_TWO_WAY_QUEUE_MAX_CAPACITY items can be inserted, inserting more is a
+ * programming error and aborts.
+ */
 void
 ufo_two_way_queue_insert (UfoTwoWayQueue *queue, gpointer data)
 {
-    g_async_queue_push (queue->producer_queue, data);
-    queue->inserted = g_list_append (queue->inserted, data);
+    if (queue->capacity >= UFO_TWO_WAY_QUEUE_MAX_CAPACITY)
+        g_error ("Cannot insert more than %i items into a two-way queue",
+                 UFO_TWO_WAY_QUEUE_MAX_CAPACITY);
+
+    ring_push (queue->producer_ring, data);
+    g_ptr_array_add (queue->inserted, data);
+    queue->list_stale = TRUE;
     queue->capacity++;
 }
 
+/**
+ * ufo_two_way_queue_replace: (skip)
+ * @queue: A #UfoTwoWayQueue
+ * @old_data: An item previously inserted and currently owned by the producer
+ * @new_data: Item that takes the place of @old_data
+ *
+ * Exchange an inserted item, e.g. if it had to be re-allocated with a
+ * different size. The capacity of @queue does not change.
+ */
+void
+ufo_two_way_queue_replace (UfoTwoWayQueue *queue, gpointer old_data, gpointer new_data)
+{
+    for (guint i = 0; i < queue->inserted->len; i++) {
+        if (g_ptr_array_index (queue->inserted, i) == old_data) {
+            g_ptr_array_index (queue->inserted, i) = new_data;
+            queue->list_stale = TRUE;
+            return;
+        }
+    }
+
+    g_warning ("Replaced item %p was never inserted", old_data);
+}
+
 guint
 ufo_two_way_queue_get_capacity (UfoTwoWayQueue *queue)
 {
     return queue->capacity;
 }
+
+/**
+ * ufo_two_way_queue_get_high_water_mark: (skip)
+ * @queue: A #UfoTwoWayQueue
+ *
+ * Get the largest number of items that waited for a consumer at the same
+ * time. If this equals the capacity, the producer was likely throttled by the
+ * consumer.
+ *
+ * Returns: Maximum number of items seen in the consumer queue.
+ */
+guint
+ufo_two_way_queue_get_high_water_mark (UfoTwoWayQueue *queue)
+{
+    return __atomic_load_n (&queue->high_water, __ATOMIC_RELAXED);
+}
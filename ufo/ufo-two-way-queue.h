@@ -28,19 +28,36 @@
 
 G_BEGIN_DECLS
 
+/**
+ * UFO_TWO_WAY_QUEUE_MAX_CAPACITY:
+ *
+ * Maximum number of items that can be inserted into a #UfoTwoWayQueue.
+ */
+#define UFO_TWO_WAY_QUEUE_MAX_CAPACITY  256
+
 typedef struct _UfoTwoWayQueue          UfoTwoWayQueue;
 
 UfoTwoWayQueue  * ufo_two_way_queue_new             (GList *init);
 void              ufo_two_way_queue_free            (UfoTwoWayQueue *queue);
 gpointer          ufo_two_way_queue_consumer_pop    (UfoTwoWayQueue *queue);
+gpointer          ufo_two_way_queue_consumer_try_pop
+                                                    (UfoTwoWayQueue *queue);
 void              ufo_two_way_queue_consumer_push   (UfoTwoWayQueue *queue,
                                                      gpointer data);
 gpointer          ufo_two_way_queue_producer_pop    (UfoTwoWayQueue *queue);
+gpointer          ufo_two_way_queue_producer_try_pop
+                                                    (UfoTwoWayQueue *queue);
 void              ufo_two_way_queue_producer_push   (UfoTwoWayQueue *queue,
                                                      gpointer data);
 void              ufo_two_way_queue_insert          (UfoTwoWayQueue *queue,
                                                      gpointer data);
+void              ufo_two_way_queue_replace         (UfoTwoWayQueue *queue,
+                                                     gpointer old_data,
+                                                     gpointer new_data);
 guint             ufo_two_way_queue_get_capacity    (UfoTwoWayQueue *queue);
+guint             ufo_two_way_queue_get_high_water_mark
+                                                    (UfoTwoWayQueue *queue);
+guint             ufo_two_way_queue_get_num_queued  (UfoTwoWayQueue *queue);
 GList           * ufo_two_way_queue_get_inserted    (UfoTwoWayQueue *queue);
 
 G_END_DECLS
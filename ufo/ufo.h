@@ -24,6 +24,7 @@
 
 #include <ufo/ufo-basic-ops.h>
 #include <ufo/ufo-buffer.h>
+#include <ufo/ufo-buffer-pool.h>
 #include <ufo/ufo-copyable-iface.h>
 #include <ufo/ufo-copy-task.h>
 #include <ufo/ufo-cpu-node.h>
@@ -38,6 +39,7 @@
 #include <ufo/ufo-node.h>
 #include <ufo/ufo-output-task.h>
 #include <ufo/ufo-plugin-manager.h>
+#include <ufo/ufo-pool-scheduler.h>
 #include <ufo/ufo-processor.h>
 #include <ufo/ufo-profiler.h>
 #include <ufo/ufo-resources.h>
@@ -45,6 +47,7 @@
 #include <ufo/ufo-task-graph.h>
 #include <ufo/ufo-task-iface.h>
 #include <ufo/ufo-task-node.h>
+#include <ufo/ufo-trace.h>
 #include <ufo/ufo-transform-iface.h>
 #include <ufo/ufo-two-way-queue.h>
 